@@ -18,6 +18,7 @@
 #include <chrono>
 #include <cmath> // cbrt
 #include <random>
+#include <string>
 
 template <class NO>
 int main_( Teuchos::CommandLineProcessor &clp, int argc, char *argv[] )
@@ -30,6 +31,7 @@ int main_( Teuchos::CommandLineProcessor &clp, int argc, char *argv[] )
     int n_neighbors = 10;
     bool perform_knn_search = true;
     bool perform_radius_search = true;
+    std::string curve = "morton";
 
     clp.setOption( "values", &n_values, "number of indexable values (source)" );
     clp.setOption( "queries", &n_queries, "number of queries (target)" );
@@ -41,6 +43,9 @@ int main_( Teuchos::CommandLineProcessor &clp, int argc, char *argv[] )
     clp.setOption( "perform-radius-search", "do-not-perform-radius-search",
                    &perform_radius_search,
                    "whether or not to perform radius search" );
+    clp.setOption( "curve", &curve,
+                   "space-filling curve used to sort the objects "
+                   "(morton | hilbert)" );
 
     clp.recogniseAllOptions( true );
     switch ( clp.parse( argc, argv ) )
@@ -54,6 +59,14 @@ int main_( Teuchos::CommandLineProcessor &clp, int argc, char *argv[] )
         break;
     }
 
+    DataTransferKit::SpaceFillingCurve space_filling_curve;
+    if ( curve == "morton" )
+        space_filling_curve = DataTransferKit::SpaceFillingCurve::Morton;
+    else if ( curve == "hilbert" )
+        space_filling_curve = DataTransferKit::SpaceFillingCurve::Hilbert;
+    else
+        throw std::runtime_error( "Unrecognized space-filling curve" );
+
     Kokkos::View<DataTransferKit::Point *, DeviceType> random_points(
         "random_points" );
     {
@@ -99,9 +112,12 @@ int main_( Teuchos::CommandLineProcessor &clp, int argc, char *argv[] )
     std::ostream &os = std::cout;
 
     auto start = std::chrono::high_resolution_clock::now();
-    DataTransferKit::BVH<DeviceType> bvh( bounding_boxes );
+    DataTransferKit::BVH<DeviceType> bvh(
+        bounding_boxes, DataTransferKit::BVHConstruction::Karras,
+        space_filling_curve );
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed_seconds = end - start;
+    os << "curve " << curve << "\n";
     os << "construction " << elapsed_seconds.count() << "\n";
 
     if ( perform_knn_search )
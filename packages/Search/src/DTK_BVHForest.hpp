@@ -0,0 +1,397 @@
+/****************************************************************************
+ * Copyright (c) 2012-2018 by the DataTransferKit authors                   *
+ * All rights reserved.                                                     *
+ *                                                                          *
+ * This file is part of the DataTransferKit library. DataTransferKit is     *
+ * distributed under a BSD 3-clause license. For the licensing terms see    *
+ * the LICENSE file in the top-level directory.                             *
+ *                                                                          *
+ * SPDX-License-Identifier: BSD-3-Clause                                    *
+ ****************************************************************************/
+
+#ifndef DTK_BVH_FOREST_HPP
+#define DTK_BVH_FOREST_HPP
+
+#include "DTK_ConfigDefs.hpp"
+
+#include <DTK_Box.hpp>
+#include <DTK_DBC.hpp>
+#include <DTK_DetailsTreeConstruction.hpp>
+#include <DTK_DetailsTreeTraversal.hpp>
+#include <DTK_DetailsUtils.hpp> // iota, exclusivePrefixSum, lastElement
+#include <DTK_Future.hpp>
+#include <DTK_KokkosHelpers.hpp> // min
+#include <DTK_LinearBVH.hpp>
+
+#include <Kokkos_Core.hpp>
+
+#include <type_traits>
+
+namespace DataTransferKit
+{
+
+/** \brief Collection of bounding volume hierarchies built together
+ *
+ *  The objects of all the trees are passed in a single segmented array: the
+ *  objects of tree \c t are <code>bounding_volumes(j)</code> for
+ *  <code>offsets(t) <= j < offsets(t+1)</code>.  Trees may be empty.  Every
+ *  stage of the construction is performed for all the trees in the same
+ *  kernel launch, which matters when there are many small trees (e.g. one per
+ *  block or per topology) and building them one by one would be dominated by
+ *  the launch and synchronization overhead.
+ *
+ *  The trees are built with the \c Karras algorithm.  The space-filling curve
+ *  codes are computed relative to the bounding box of all the objects so a
+ *  tree that only covers a small fraction of the scene gets coarser codes.
+ *
+ *  Each query targets a single tree, given by its index in \c tree_ids, so
+ *  that one batch addresses all the trees.  The indices returned are
+ *  positions in \c bounding_volumes, not within the tree.
+ */
+template <typename DeviceType, typename BoundingVolume = Box>
+class BoundingVolumeHierarchyForest
+{
+  public:
+    using ExecutionSpace = typename DeviceType::execution_space;
+    using TreeType = BoundingVolumeHierarchy<DeviceType, BoundingVolume>;
+
+    BoundingVolumeHierarchyForest() = default; // build an empty forest
+
+    BoundingVolumeHierarchyForest(
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Kokkos::View<int const *, DeviceType> offsets,
+        SpaceFillingCurve curve = SpaceFillingCurve::Morton )
+        : BoundingVolumeHierarchyForest( ExecutionSpace{}, bounding_volumes,
+                                         offsets, curve )
+    {
+        Kokkos::fence();
+    }
+
+    /** Builds the trees with the construction stages enqueued on the
+     *  execution space instance \c space.  Same as the constructor of
+     *  BoundingVolumeHierarchy, it returns once the objects have been sorted
+     *  while the last stages may still be running.
+     */
+    BoundingVolumeHierarchyForest(
+        ExecutionSpace const &space,
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Kokkos::View<int const *, DeviceType> offsets,
+        SpaceFillingCurve curve = SpaceFillingCurve::Morton );
+
+    /** Performs <code>queries(i)</code> against tree <code>tree_ids(i)</code>.
+     *  Results are returned the same way as BoundingVolumeHierarchy::query()
+     *  does.
+     */
+    template <typename Query>
+    void query( Kokkos::View<Query *, DeviceType> queries,
+                Kokkos::View<int *, DeviceType> tree_ids,
+                Kokkos::View<int *, DeviceType> &indices,
+                Kokkos::View<int *, DeviceType> &offset ) const
+    {
+        query( ExecutionSpace{}, queries, tree_ids, indices, offset ).wait();
+    }
+    template <typename Query>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::NearestPredicateTag>::value,
+        void>::type
+    query( Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> tree_ids,
+           Kokkos::View<int *, DeviceType> &indices,
+           Kokkos::View<int *, DeviceType> &offset,
+           Kokkos::View<double *, DeviceType> &distances ) const
+    {
+        query( ExecutionSpace{}, queries, tree_ids, indices, offset,
+               distances )
+            .wait();
+    }
+
+    /** Asynchronous versions of query().  They never fence the execution
+     *  space instance \c space except to read the number of results.
+     */
+    template <typename Query>
+    Future<ExecutionSpace>
+    query( ExecutionSpace const &space,
+           Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> tree_ids,
+           Kokkos::View<int *, DeviceType> &indices,
+           Kokkos::View<int *, DeviceType> &offset ) const;
+    template <typename Query>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::NearestPredicateTag>::value,
+        Future<ExecutionSpace>>::type
+    query( ExecutionSpace const &space,
+           Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> tree_ids,
+           Kokkos::View<int *, DeviceType> &indices,
+           Kokkos::View<int *, DeviceType> &offset,
+           Kokkos::View<double *, DeviceType> &distances ) const;
+
+    /** Returns tree \c t.  It shares the nodes of the forest and may only be
+     *  used while the forest is alive.  Since the offsets of the trees live
+     *  in the memory space of \c DeviceType, it is meant to be called from
+     *  within a kernel.
+     */
+    KOKKOS_INLINE_FUNCTION
+    TreeType tree( int t ) const
+    {
+        int const first = _offsets( t );
+        int const n = _offsets( t + 1 ) - first;
+        return TreeType(
+            Kokkos::View<Node *, DeviceType>( _leaf_nodes.data() + first, n ),
+            Kokkos::View<Node *, DeviceType>( _internal_nodes.data() + first,
+                                              n > 0 ? n - 1 : 0 ),
+            Kokkos::View<int *, DeviceType>( _indices.data() + first, n ) );
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    int numberOfTrees() const
+    {
+        return _offsets.extent_int( 0 ) > 0 ? _offsets.extent_int( 0 ) - 1
+                                            : 0;
+    }
+
+    // total number of objects in the forest
+    using SizeType = typename Kokkos::View<int *, DeviceType>::size_type;
+    KOKKOS_INLINE_FUNCTION
+    SizeType size() const { return _leaf_nodes.extent( 0 ); }
+
+    KOKKOS_INLINE_FUNCTION
+    bool empty() const { return size() == 0; }
+
+  private:
+    using Node = TreeNode<BoundingVolume>;
+
+    Kokkos::View<int *, DeviceType> _offsets;
+    Kokkos::View<Node *, DeviceType> _leaf_nodes;
+    // The internal nodes of tree t start at position offsets(t), as its
+    // leaves do.  The slot that follows them is unused.
+    Kokkos::View<Node *, DeviceType> _internal_nodes;
+    Kokkos::View<int *, DeviceType> _indices;
+};
+
+template <typename DeviceType, typename BoundingVolume = Box>
+using BVHForest = BoundingVolumeHierarchyForest<DeviceType, BoundingVolume>;
+
+namespace Details
+{
+template <typename DeviceType, typename BoundingVolume, typename Query>
+void forestQueryDispatch(
+    typename DeviceType::execution_space const &space,
+    BoundingVolumeHierarchyForest<DeviceType, BoundingVolume> const forest,
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> tree_ids,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset, SpatialPredicateTag )
+{
+    using ExecutionSpace = typename DeviceType::execution_space;
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+
+    DTK_REQUIRE( tree_ids.extent( 0 ) == queries.extent( 0 ) );
+    int const n_queries = queries.extent( 0 );
+
+    offset = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( offset.label() ),
+        n_queries + 1 );
+    Kokkos::deep_copy( space, offset, 0 );
+
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "first_pass_at_the_search_in_the_forest" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int i ) {
+            offset( i ) = Traversal::query( forest.tree( tree_ids( i ) ),
+                                            queries( i ), []( int ) {} );
+        } );
+
+    exclusivePrefixSum( space, offset );
+    int const n_results = lastElement( space, offset );
+
+    indices = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        n_results );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "second_pass_in_the_forest" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int i ) {
+            int count = 0;
+            Traversal::query( forest.tree( tree_ids( i ) ), queries( i ),
+                              [indices, offset, i, &count]( int index ) {
+                                  indices( offset( i ) + count++ ) = index;
+                              } );
+        } );
+}
+
+template <typename DeviceType, typename BoundingVolume, typename Query>
+void forestQueryDispatch(
+    typename DeviceType::execution_space const &space,
+    BoundingVolumeHierarchyForest<DeviceType, BoundingVolume> const forest,
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> tree_ids,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset, NearestPredicateTag,
+    Kokkos::View<double *, DeviceType> *distances_ptr = nullptr )
+{
+    using ExecutionSpace = typename DeviceType::execution_space;
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+
+    DTK_REQUIRE( tree_ids.extent( 0 ) == queries.extent( 0 ) );
+    int const n_queries = queries.extent( 0 );
+
+    // Reserve room for k neighbors or as many as there are objects in the
+    // tree if fewer.
+    offset = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( offset.label() ),
+        n_queries + 1 );
+    Kokkos::deep_copy( space, offset, 0 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "scan_queries_for_numbers_of_nearest_neighbors" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int i ) {
+            offset( i ) = KokkosHelpers::min(
+                queries( i )._k,
+                static_cast<int>( forest.tree( tree_ids( i ) ).size() ) );
+        } );
+    exclusivePrefixSum( space, offset );
+    int const n_results = lastElement( space, offset );
+
+    indices = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        n_results );
+    Kokkos::View<double *, DeviceType> distances(
+        Kokkos::ViewAllocateWithoutInitializing(
+            distances_ptr ? distances_ptr->label() : "distances" ),
+        n_results );
+    Kokkos::View<int *, DeviceType> counts(
+        Kokkos::ViewAllocateWithoutInitializing( "counts" ), n_queries + 1 );
+    Kokkos::deep_copy( space, counts, 0 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "perform_nearest_queries_in_the_forest" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int i ) {
+            int count = 0;
+            Traversal::query(
+                forest.tree( tree_ids( i ) ), queries( i ),
+                [indices, offset, distances, i, &count]( int index,
+                                                         double distance ) {
+                    indices( offset( i ) + count ) = index;
+                    distances( offset( i ) + count ) = distance;
+                    count++;
+                } );
+            counts( i ) = count;
+        } );
+
+    // Queries bounded by a radius may find fewer neighbors than there is room
+    // for.  Compact the results in that case.
+    exclusivePrefixSum( space, counts );
+    if ( lastElement( space, counts ) < n_results )
+    {
+        Kokkos::View<int *, DeviceType> permute(
+            Kokkos::ViewAllocateWithoutInitializing( "permute" ), n_results );
+        iota( space, permute );
+        gatherResults( space, offset, counts, permute, indices, distances );
+        offset = counts;
+    }
+    if ( distances_ptr )
+        *distances_ptr = distances;
+}
+} // namespace Details
+
+template <typename DeviceType, typename BoundingVolume>
+BoundingVolumeHierarchyForest<DeviceType, BoundingVolume>::
+    BoundingVolumeHierarchyForest(
+        ExecutionSpace const &space,
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Kokkos::View<int const *, DeviceType> offsets, SpaceFillingCurve curve )
+    : _offsets( Kokkos::ViewAllocateWithoutInitializing( "offsets" ),
+                offsets.extent( 0 ) )
+    , _leaf_nodes( Kokkos::ViewAllocateWithoutInitializing( "leaf_nodes" ),
+                   bounding_volumes.extent( 0 ) )
+    , _internal_nodes(
+          Kokkos::ViewAllocateWithoutInitializing( "internal_nodes" ),
+          bounding_volumes.extent( 0 ) )
+    , _indices( Kokkos::ViewAllocateWithoutInitializing( "sorted_indices" ),
+                bounding_volumes.extent( 0 ) )
+{
+    using TreeConstruction =
+        Details::TreeConstruction<DeviceType, BoundingVolume>;
+
+    DTK_REQUIRE( offsets.extent( 0 ) > 0 );
+    Kokkos::deep_copy( space, _offsets, offsets );
+    DTK_REQUIRE( lastElement( space, _offsets ) ==
+                 static_cast<int>( bounding_volumes.extent( 0 ) ) );
+
+    if ( empty() )
+    {
+        return;
+    }
+
+    Details::initializeNodes( space, _leaf_nodes );
+    Details::initializeNodes( space, _internal_nodes );
+
+    int const n = bounding_volumes.extent( 0 );
+
+    Box scene_bounding_box;
+    TreeConstruction::calculateBoundingBoxOfTheScene( space, bounding_volumes,
+                                                      scene_bounding_box );
+
+    Kokkos::View<unsigned int *, DeviceType> morton_indices(
+        Kokkos::ViewAllocateWithoutInitializing( "morton" ), n );
+    TreeConstruction::assignMortonCodes(
+        space, bounding_volumes, morton_indices, scene_bounding_box, curve );
+
+    // sort the objects of each tree along the space-filling curve
+    iota( space, _indices );
+    TreeConstruction::sortObjects( space, morton_indices, offsets, _indices );
+
+    TreeConstruction::generateHierarchy( space, morton_indices, offsets,
+                                         _leaf_nodes, _internal_nodes );
+
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "set_bounding_volumes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        SetBoundingVolumesFunctor<DeviceType, BoundingVolume>(
+            _leaf_nodes, _indices, bounding_volumes ) );
+
+    // The walk toward the root stops at the root of each tree.
+    TreeConstruction::calculateBoundingVolumes( space, _leaf_nodes,
+                                                _internal_nodes );
+
+    TreeConstruction::sortInternalNodesDepthFirst( space, _leaf_nodes,
+                                                   _internal_nodes );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query>
+Future<typename DeviceType::execution_space>
+BoundingVolumeHierarchyForest<DeviceType, BoundingVolume>::query(
+    ExecutionSpace const &space, Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> tree_ids,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset ) const
+{
+    using Tag = typename Query::Tag;
+    Details::forestQueryDispatch( space, *this, queries, tree_ids, indices,
+                                  offset, Tag{} );
+    return Future<ExecutionSpace>( space );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::NearestPredicateTag>::value,
+    Future<typename DeviceType::execution_space>>::type
+BoundingVolumeHierarchyForest<DeviceType, BoundingVolume>::query(
+    ExecutionSpace const &space, Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> tree_ids,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset,
+    Kokkos::View<double *, DeviceType> &distances ) const
+{
+    using Tag = typename Query::Tag;
+    Details::forestQueryDispatch( space, *this, queries, tree_ids, indices,
+                                  offset, Tag{}, &distances );
+    return Future<ExecutionSpace>( space );
+}
+
+} // namespace DataTransferKit
+
+#endif
@@ -26,18 +26,92 @@
 namespace DataTransferKit
 {
 
+/** Part taken by a process in a DistributedSearchTree whose objects and
+ *  queries live on different groups of processes.  \c Source processes hold
+ *  objects, \c Target processes issue queries, and \c SourceAndTarget ones
+ *  do both.
+ */
+enum class ProcessRole
+{
+    Source,
+    Target,
+    SourceAndTarget
+};
+
 /** \brief Distributed search tree
  *
  *  \note size() and empty() must be called as collectives over all processes
  *  in the communicator passed to the constructor.
+ *
+ *  The tree keeps the communication plans of its last queries.  A query
+ *  that sends to the same ranks as a previous one on every process, e.g.
+ *  with targets that moved little, reuses the plan and avoids the
+ *  all-to-all exchange needed to create it.  Copies of the tree share the
+ *  plans.
  */
 template <typename DeviceType>
 class DistributedSearchTree
 {
   public:
+    /** Each process contributes to the top tree the boxes of the nodes at
+     *  depth \c top_tree_depth of its local tree, i.e. up to
+     *  2^top_tree_depth boxes.  By default, the depth is 0 and the box is
+     *  the one around all its objects.  With a larger depth, queries are
+     *  only forwarded to the processes owning objects near them even if the
+     *  local domains are non-convex or fragmented, at the price of a larger
+     *  top tree.  \c top_tree_depth must not exceed 8 since the top tree is
+     *  replicated on every process.
+     *
+     *  If \c ranks_per_node is not one, the processes are grouped in nodes.
+     *  With 0, a node is made of the processes that share the memory of a
+     *  compute node, as reported by \c MPI_Comm_split_type, or of a single
+     *  process if MPI does not support it.  A value greater than one
+     *  overrides this and groups \c ranks_per_node consecutive ranks
+     *  instead.  The top tree then holds the boxes of the nodes instead of
+     *  the processes and the boxes of the processes are only known within
+     *  their node.  A query is first sent to one process of each node found
+     *  in the top tree, which forwards it to the processes of its node that
+     *  may satisfy it.  This divides the size of the top tree and the number
+     *  of processes queries are sent to by the number of processes per node
+     *  at the cost of a second hop within the nodes.
+     */
+    DistributedSearchTree(
+        Teuchos::RCP<Teuchos::Comm<int> const> comm,
+        Kokkos::View<Box const *, DeviceType> bounding_boxes,
+        int top_tree_depth = 0, int ranks_per_node = 1 );
+
+    /** Redistributes the objects before building the tree so that each
+     *  process holds about the same number of them, forming a contiguous
+     *  segment of the space-filling curve \c curve through all the objects.
+     *  The queries still report the objects by the process and the index
+     *  they were passed in with.
+     *
+     *  \note allNearest() is not available for such a tree since the local
+     *  objects are not the ones that were passed in.
+     */
+    DistributedSearchTree(
+        Teuchos::RCP<Teuchos::Comm<int> const> comm,
+        Kokkos::View<Box const *, DeviceType> bounding_boxes,
+        SpaceFillingCurve curve, int top_tree_depth = 0,
+        int ranks_per_node = 1 );
+
+    /** Builds the tree over groups of processes of \c comm that may be
+     *  disjoint, e.g. the union of the processes of two coupled codes.  Only
+     *  the processes that are sources hold a local tree and take part in
+     *  gathering the top tree, which is only built on the processes that are
+     *  targets.  Target processes pass an empty view of boxes.  Processes
+     *  that are not targets take part in the queries, which are collective,
+     *  with empty views of predicates.  The ranks returned by the queries are
+     *  ranks in \c comm.
+     *
+     *  \note bounds() returns an invalid box on processes that are not
+     *  targets.  allNearest() requires every process to be both a source and
+     *  a target.
+     */
     DistributedSearchTree(
         Teuchos::RCP<Teuchos::Comm<int> const> comm,
-        Kokkos::View<Box const *, DeviceType> bounding_boxes );
+        Kokkos::View<Box const *, DeviceType> bounding_boxes,
+        ProcessRole role, int top_tree_depth = 0 );
 
     /** Returns the smallest axis-aligned box able to contain all the objects
      *  stored in the tree or an invalid box if the tree is empty.
@@ -53,6 +127,16 @@ class DistributedSearchTree
      */
     inline bool empty() const { return size() == 0; }
 
+    /** Lets the distances found on other processes be sent back in single
+     *  precision, which saves 4 bytes per result communicated by the
+     *  queries that return distances.  These distances then have a relative
+     *  error of about 1e-7.  Off by default.
+     */
+    void allowSinglePrecisionDistances( bool allow = true )
+    {
+        _single_precision_distances = allow;
+    }
+
     /** \brief Finds object satisfying the passed predicates (e.g. nearest to
      *  some point or overlaping with some box)
      *
@@ -76,13 +160,16 @@ class DistributedSearchTree
      *  may be spatial predicates or nearest predicates.
      *  \param[out] indices Object local indices that satisfy the predicates.
      *  \param[out] offset Array of predicate offsets for one-dimensional
-     *  storage.
+     *  storage.  For spatial predicates, its value type may be a 64-bit
+     *  integer type (e.g. \c long \c long) when the number of results on
+     *  the calling process may exceed 2^31 - 1.  Nearest predicates require
+     *  \c int offsets.
      *  \param[out] ranks Process ranks that own objects.
      */
-    template <typename Query>
+    template <typename Query, typename Offset>
     void query( Kokkos::View<Query *, DeviceType> queries,
                 Kokkos::View<int *, DeviceType> &indices,
-                Kokkos::View<int *, DeviceType> &offset,
+                Kokkos::View<Offset *, DeviceType> &offset,
                 Kokkos::View<int *, DeviceType> &ranks ) const;
 
     template <typename Query>
@@ -95,24 +182,169 @@ class DistributedSearchTree
            Kokkos::View<int *, DeviceType> &ranks,
            Kokkos::View<double *, DeviceType> &distances ) const;
 
+    /** Spatial queries that also return the distances from the centroid of
+     *  the geometry of each predicate to the objects found.  If \c
+     *  sort_by_distance is true, the results of each query are sorted by
+     *  ascending distance.  If \c max_results is non-negative, only the \c
+     *  max_results closest objects across all processes are kept, which
+     *  implies sorting.  The truncation is applied on each process before
+     *  communicating the results back.
+     */
+    template <typename Query, typename Offset>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        void>::type
+    query( Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> &indices,
+           Kokkos::View<Offset *, DeviceType> &offset,
+           Kokkos::View<int *, DeviceType> &ranks,
+           Kokkos::View<double *, DeviceType> &distances,
+           bool sort_by_distance = false, int max_results = -1 ) const;
+
+    /** \brief Spatial queries processed in chunks to bound the memory used
+     *  by their results
+     *
+     *  The queries are taken in windows of at most \c max_window_size
+     *  queries (and at least one), which bounds the memory used to count
+     *  their results independently of the number of results per chunk.  The
+     *  number of objects that satisfy each predicate of a window across all
+     *  processes is obtained as with count() and the
+     *  window is split into consecutive ranges with at most \c
+     *  max_chunk_size results each (a query with more results forms a range
+     *  of its own).  The ranges are searched one after the other before the
+     *  next window is counted.  The queries of a range are forwarded while
+     *  the queries of the previous range received from other processes are
+     *  performed, so that only two ranges are in memory at a time.  For each
+     *  range, <code>callback( first, indices, offset, ranks )</code> is
+     *  called on the host.  The results of query <code>first + q</code> are
+     *  then <code>indices(j)</code> on processes <code>ranks(j)</code> for
+     *  <code>offset(q) <= j < offset(q+1)</code>.  The views are only valid
+     *  during the call.
+     *
+     *  \note All processes go through as many windows, and as many ranges
+     *  per window, as the process with the most of them.  The callback is
+     *  only called for non-empty ranges.
+     */
+    template <typename Query, typename Callback>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        void>::type
+    chunkedQuery( Kokkos::View<Query *, DeviceType> queries,
+                  std::size_t max_chunk_size, std::size_t max_window_size,
+                  Callback const &callback ) const;
+
+    /** \brief Counts the objects that satisfy the passed spatial predicates
+     *
+     *  Queries are forwarded to the processes that may own matching objects
+     *  the same way query() does.  Only the number of objects found is sent
+     *  back, and only for the forwarded queries that found any, so that no
+     *  index or rank is communicated.
+     *
+     *  \param[in] queries Collection of spatial predicates.
+     *  \param[out] counts Number of objects across all processes that satisfy
+     *  each predicate.
+     */
+    template <typename Query>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        void>::type
+    count( Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> &counts ) const;
+
+    /** \brief Indicates whether any object satisfies each of the passed
+     *  spatial predicates
+     *
+     *  The search stops at the first object found on each process the query
+     *  was forwarded to.  Only the identifiers of the queries that found an
+     *  object are sent back.
+     *
+     *  \param[in] queries Collection of spatial predicates.
+     *  \param[out] hits Whether some object on any process satisfies each
+     *  predicate.
+     */
+    template <typename Query>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        void>::type
+    any( Kokkos::View<Query *, DeviceType> queries,
+         Kokkos::View<bool *, DeviceType> &hits ) const;
+
+    /** \brief All k nearest neighbors self query
+     *
+     *  Finds for each local object the \c k objects across all processes
+     *  that are closest to the centroid of its bounding box.  The neighbors
+     *  are searched in the local tree first.  The object is then only sent to
+     *  the other processes whose bounding box lies within the distance to the
+     *  k-th local neighbor, i.e. the search only reaches across the halo
+     *  around the local domain.
+     *
+     *  \param[in] k Number of neighbors queried for.
+     *  \param[out] indices Local indices of the neighbors on the processes
+     *  that own them.
+     *  \param[out] offset Neighbors of local object \c i are stored in
+     *  <code>[offset(i), offset(i+1))</code>.
+     *  \param[out] ranks Processes that own the neighbors.
+     *  \param[out] distances Distances to the neighbors, in ascending order.
+     *  \param[in] exclude_self Whether the object itself is omitted.
+     */
+    void allNearest( int k, Kokkos::View<int *, DeviceType> &indices,
+                     Kokkos::View<int *, DeviceType> &offset,
+                     Kokkos::View<int *, DeviceType> &ranks,
+                     Kokkos::View<double *, DeviceType> &distances,
+                     bool exclude_self = true ) const;
+
   private:
+    void buildTopTree( int top_tree_depth, int ranks_per_node );
+    void buildTopTreeFromSources( int top_tree_depth );
+
     friend struct Details::DistributedSearchTreeImpl<DeviceType>;
     Teuchos::RCP<Teuchos::Comm<int> const> _comm;
+    // Communication plans of the previous queries.  The pointee is modified
+    // by the queries even though they are const.
+    Teuchos::RCP<Details::DistributorCache> _distributor_cache;
     BVH<DeviceType> _top_tree;    // replicated
+    // Rank owning each box of the top tree, or index of the node if the
+    // processes are grouped in nodes.
+    Kokkos::View<int *, DeviceType> _top_tree_ranks;
+    // If the processes are grouped in nodes, the node tree is replicated
+    // within the node and holds the boxes of its processes, owned by the
+    // ranks _node_tree_ranks in the node communicator.  The ranks in the
+    // communicator of the processes of node i are _processes_of_nodes(j) for
+    // j in [_processes_of_nodes_offset(i), _processes_of_nodes_offset(i+1)),
+    // and _node_processes holds the ones of the local node.
+    bool _grouped_in_nodes;
+    Teuchos::RCP<Teuchos::Comm<int> const> _node_comm;
+    Teuchos::RCP<Details::DistributorCache> _node_distributor_cache;
+    BVH<DeviceType> _node_tree;
+    Kokkos::View<int *, DeviceType> _node_tree_ranks;
+    Kokkos::View<int *, DeviceType> _processes_of_nodes;
+    Kokkos::View<int *, DeviceType> _processes_of_nodes_offset;
+    Kokkos::View<int *, DeviceType> _node_processes;
     BVH<DeviceType> _bottom_tree; // local
     SizeType _top_tree_size;
+    // Number of objects owned by each rank or node of the top tree.
     Kokkos::View<SizeType *, DeviceType> _bottom_tree_sizes;
+    // Process and index each local object was passed in with when the tree
+    // was repartitioned.
+    bool _repartitioned;
+    Kokkos::View<int *, DeviceType> _original_ranks;
+    Kokkos::View<int *, DeviceType> _original_indices;
+    bool _single_precision_distances;
+    ProcessRole _role;
 };
 
 template <typename DeviceType>
-template <typename Query>
+template <typename Query, typename Offset>
 void DistributedSearchTree<DeviceType>::query(
     Kokkos::View<Query *, DeviceType> queries,
     Kokkos::View<int *, DeviceType> &indices,
-    Kokkos::View<int *, DeviceType> &offset,
+    Kokkos::View<Offset *, DeviceType> &offset,
     Kokkos::View<int *, DeviceType> &ranks ) const
 {
     using Tag = typename Query::Tag;
+    static_assert( std::is_same<Tag, Details::SpatialPredicateTag>::value ||
+                       std::is_same<Offset, int>::value,
+                   "Nearest queries only support int offsets" );
     Details::DistributedSearchTreeImpl<DeviceType>::queryDispatch(
         *this, queries, indices, offset, ranks, Tag{} );
 }
@@ -134,6 +366,64 @@ DistributedSearchTree<DeviceType>::query(
         *this, queries, indices, offset, ranks, Tag{}, &distances );
 }
 
+template <typename DeviceType>
+template <typename Query, typename Offset>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    void>::type
+DistributedSearchTree<DeviceType>::query(
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<Offset *, DeviceType> &offset,
+    Kokkos::View<int *, DeviceType> &ranks,
+    Kokkos::View<double *, DeviceType> &distances, bool sort_by_distance,
+    int max_results ) const
+{
+    using Tag = typename Query::Tag;
+    Details::DistributedSearchTreeImpl<DeviceType>::queryDispatch(
+        *this, queries, indices, offset, ranks, Tag{}, &distances,
+        sort_by_distance, max_results );
+}
+
+template <typename DeviceType>
+template <typename Query, typename Callback>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    void>::type
+DistributedSearchTree<DeviceType>::chunkedQuery(
+    Kokkos::View<Query *, DeviceType> queries, std::size_t max_chunk_size,
+    std::size_t max_window_size, Callback const &callback ) const
+{
+    Details::DistributedSearchTreeImpl<DeviceType>::chunkedQueryDispatch(
+        *this, queries, max_chunk_size, max_window_size, callback );
+}
+
+template <typename DeviceType>
+template <typename Query>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    void>::type
+DistributedSearchTree<DeviceType>::count(
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &counts ) const
+{
+    Details::DistributedSearchTreeImpl<DeviceType>::countDispatch(
+        *this, queries, counts );
+}
+
+template <typename DeviceType>
+template <typename Query>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    void>::type
+DistributedSearchTree<DeviceType>::any(
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<bool *, DeviceType> &hits ) const
+{
+    Details::DistributedSearchTreeImpl<DeviceType>::anyDispatch(
+        *this, queries, hits );
+}
+
 } // namespace DataTransferKit
 
 #endif
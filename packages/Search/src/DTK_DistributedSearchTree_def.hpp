@@ -13,52 +13,388 @@
 #define DTK_DISTRIBUTED_SEARCH_TREE_DEF_HPP
 
 #include <DTK_Box.hpp>
+#include <DTK_DetailsTeuchosSerializationTraits.hpp>
 #include <DTK_DetailsUtils.hpp> // accumulate
 
 #include <Teuchos_Array.hpp>
 #include <Teuchos_CommHelpers.hpp>
+#ifdef HAVE_MPI
+#include <Teuchos_DefaultMpiComm.hpp>
+#endif
+
+#include <numeric> // accumulate, partial_sum
+#include <string>
 
 namespace DataTransferKit
 {
+namespace Details
+{
+// Gathers on all the processes in comm the boxes of the nodes at depth \c
+// depth of their trees, along with the rank in comm of the process that owns
+// each box.  The boxes of a process are contiguous.
+template <typename DeviceType>
+void gatherBoundingBoxes( Teuchos::Comm<int> const &comm,
+                          BVH<DeviceType> const &tree, int depth,
+                          Teuchos::Array<Box> &boxes,
+                          Teuchos::Array<int> &owners )
+{
+    using ExecutionSpace = typename DeviceType::execution_space;
+    int const comm_size = comm.getSize();
+
+    // Each of the 2^depth paths from the root gets at most one box.  Count
+    // them first so that only the boxes that exist are allocated and
+    // communicated.
+    int const n_paths = 1 << depth;
+    auto const local_tree = tree;
+    Kokkos::View<int *, DeviceType> offset(
+        Kokkos::ViewAllocateWithoutInitializing( "offset" ), n_paths + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_bounding_boxes_at_top_tree_depth" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_paths + 1 ),
+        KOKKOS_LAMBDA( int path ) {
+            Box box;
+            offset( path ) =
+                ( path < n_paths &&
+                  boundingVolumeAtDepth( local_tree, depth, path, box ) )
+                    ? 1
+                    : 0;
+        } );
+    exclusivePrefixSum( offset );
+    int const n_local_boxes = lastElement( offset );
+    Kokkos::View<Box *, DeviceType> local_boxes(
+        Kokkos::ViewAllocateWithoutInitializing( "local_bounding_boxes" ),
+        n_local_boxes );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "bounding_boxes_at_top_tree_depth" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_paths ),
+        KOKKOS_LAMBDA( int path ) {
+            if ( offset( path + 1 ) > offset( path ) )
+                boundingVolumeAtDepth( local_tree, depth, path,
+                                       local_boxes( offset( path ) ) );
+        } );
+    Kokkos::fence();
+
+    // FIXME: I am not sure how to do the MPI allgather with Teuchos for data
+    // living on the device so I copied to the host.
+    auto local_boxes_host = Kokkos::create_mirror_view( local_boxes );
+    Kokkos::deep_copy( local_boxes_host, local_boxes );
+
+    Teuchos::Array<int> counts( comm_size );
+    Teuchos::gatherAll( comm, 1, &n_local_boxes, comm_size,
+                        counts.getRawPtr() );
+    Teuchos::Array<int> displs( comm_size );
+    int n_total_boxes = 0;
+    owners.clear();
+    for ( int i = 0; i < comm_size; ++i )
+    {
+        displs[i] = n_total_boxes;
+        n_total_boxes += counts[i];
+        owners.insert( owners.end(), counts[i], i );
+    }
+
+    // Teuchos only has a rooted variable-count gather so the boxes are
+    // gathered on the first process and broadcast from there.
+    boxes.resize( n_total_boxes );
+    Teuchos::gatherv( local_boxes_host.data(), n_local_boxes,
+                      boxes.getRawPtr(), counts.getRawPtr(),
+                      displs.getRawPtr(), 0, comm );
+    Teuchos::broadcast( comm, 0, n_total_boxes, boxes.getRawPtr() );
+}
+
+// Splits comm in nodes.  Unless a number of consecutive ranks per node is
+// given, the processes of a node are the ones that share memory if the MPI
+// implementation can tell, and each process is its own node otherwise.  The
+// processes keep their relative order within their node.
+inline Teuchos::RCP<Teuchos::Comm<int> const>
+splitInNodes( Teuchos::Comm<int> const &comm, int ranks_per_node )
+{
+    int const comm_rank = comm.getRank();
+    if ( ranks_per_node > 1 )
+        return comm.split( comm_rank / ranks_per_node, comm_rank );
+#if defined( HAVE_MPI ) && MPI_VERSION >= 3
+    auto const *mpi_comm = dynamic_cast<Teuchos::MpiComm<int> const *>( &comm );
+    if ( mpi_comm != nullptr )
+    {
+        MPI_Comm node_comm;
+        MPI_Comm_split_type( ( *mpi_comm->getRawMpiComm() )(),
+                             MPI_COMM_TYPE_SHARED, comm_rank, MPI_INFO_NULL,
+                             &node_comm );
+        return Teuchos::rcp( new Teuchos::MpiComm<int>(
+            Teuchos::opaqueWrapper( node_comm, MPI_Comm_free ) ) );
+    }
+#endif
+    return comm.split( comm_rank, 0 );
+}
+
+template <typename DeviceType, typename T>
+Kokkos::View<T *, DeviceType> copyToView( Teuchos::Array<T> const &array,
+                                          std::string const &label )
+{
+    int const n = array.size();
+    Kokkos::View<T *, DeviceType> view( label, n );
+    auto view_host = Kokkos::create_mirror_view( view );
+    for ( int i = 0; i < n; ++i )
+        view_host( i ) = array[i];
+    Kokkos::deep_copy( view, view_host );
+    return view;
+}
+} // namespace Details
+
+template <typename DeviceType>
+DistributedSearchTree<DeviceType>::DistributedSearchTree(
+    Teuchos::RCP<Teuchos::Comm<int> const> comm,
+    Kokkos::View<Box const *, DeviceType> bounding_boxes, int top_tree_depth,
+    int ranks_per_node )
+    : _comm( comm )
+    , _distributor_cache(
+          Teuchos::rcp( new Details::DistributorCache( comm ) ) )
+    , _grouped_in_nodes( ranks_per_node != 1 )
+    , _bottom_tree( bounding_boxes )
+    , _repartitioned( false )
+    , _single_precision_distances( false )
+    , _role( ProcessRole::SourceAndTarget )
+{
+    buildTopTree( top_tree_depth, ranks_per_node );
+}
+
+template <typename DeviceType>
+DistributedSearchTree<DeviceType>::DistributedSearchTree(
+    Teuchos::RCP<Teuchos::Comm<int> const> comm,
+    Kokkos::View<Box const *, DeviceType> bounding_boxes,
+    SpaceFillingCurve curve, int top_tree_depth, int ranks_per_node )
+    : _comm( comm )
+    , _distributor_cache(
+          Teuchos::rcp( new Details::DistributorCache( comm ) ) )
+    , _grouped_in_nodes( ranks_per_node != 1 )
+    , _repartitioned( true )
+    , _single_precision_distances( false )
+    , _role( ProcessRole::SourceAndTarget )
+{
+    Kokkos::View<Box *, DeviceType> boxes( bounding_boxes.label() );
+    Details::DistributedSearchTreeImpl<DeviceType>::partitionAlongCurve(
+        *_distributor_cache, bounding_boxes, curve, boxes, _original_ranks,
+        _original_indices );
+    _bottom_tree = BVH<DeviceType>( boxes );
+    buildTopTree( top_tree_depth, ranks_per_node );
+}
 
 template <typename DeviceType>
 DistributedSearchTree<DeviceType>::DistributedSearchTree(
     Teuchos::RCP<Teuchos::Comm<int> const> comm,
-    Kokkos::View<Box const *, DeviceType> bounding_boxes )
+    Kokkos::View<Box const *, DeviceType> bounding_boxes, ProcessRole role,
+    int top_tree_depth )
     : _comm( comm )
+    , _distributor_cache(
+          Teuchos::rcp( new Details::DistributorCache( comm ) ) )
+    , _grouped_in_nodes( false )
     , _bottom_tree( bounding_boxes )
+    , _repartitioned( false )
+    , _single_precision_distances( false )
+    , _role( role )
 {
+    DTK_REQUIRE( role != ProcessRole::Target ||
+                 bounding_boxes.extent( 0 ) == 0 );
+    buildTopTreeFromSources( top_tree_depth );
+}
+
+template <typename DeviceType>
+void DistributedSearchTree<DeviceType>::buildTopTree( int top_tree_depth,
+                                                      int ranks_per_node )
+{
+    DTK_REQUIRE( top_tree_depth >= 0 && top_tree_depth <= 8 );
+    DTK_REQUIRE( ranks_per_node >= 0 );
+
     int const comm_rank = _comm->getRank();
     int const comm_size = _comm->getSize();
+    SizeType const bottom_tree_size = _bottom_tree.size();
 
-    Kokkos::View<Box *, DeviceType> boxes( "rank_bounding_boxes", comm_size );
-    // FIXME: I am not sure how to do the MPI allgather with Teuchos for data
-    // living on the device so I copied to the host.
-    auto boxes_host = Kokkos::create_mirror_view( boxes );
-    boxes_host( comm_rank ) = _bottom_tree.bounds();
+    Teuchos::Array<Box> boxes;
+    Teuchos::Array<int> owners;
+    Teuchos::Array<SizeType> sizes;
+    if ( !_grouped_in_nodes )
+    {
+        Details::gatherBoundingBoxes<DeviceType>(
+            *_comm, _bottom_tree, top_tree_depth, boxes, owners );
+        sizes.resize( comm_size );
+        Teuchos::gatherAll( *_comm, 1, &bottom_tree_size, comm_size,
+                            sizes.getRawPtr() );
+    }
+    else
+    {
+        // The boxes of the processes in a node make up the node tree, which
+        // is replicated on these processes.  Only the first process of each
+        // node takes part in the gather of the boxes of the node trees
+        // across nodes.  It then broadcasts them within its node.
+        _node_comm = Details::splitInNodes( *_comm, ranks_per_node );
+        _node_distributor_cache =
+            Teuchos::rcp( new Details::DistributorCache( _node_comm ) );
+        int const node_rank = _node_comm->getRank();
+        int const node_size = _node_comm->getSize();
 
-    Teuchos::Array<double> bounds( 6 * comm_size );
-    Teuchos::gatherAll( *_comm, 6,
-                        reinterpret_cast<double *>( &boxes_host( comm_rank ) ),
-                        6 * comm_size, bounds.getRawPtr() );
-    for ( int i = 0; i < comm_size; ++i )
-        boxes_host( i ) = reinterpret_cast<Box const &>( bounds[6 * i] );
-    Kokkos::deep_copy( boxes, boxes_host );
+        Details::gatherBoundingBoxes<DeviceType>(
+            *_node_comm, _bottom_tree, top_tree_depth, boxes, owners );
+        _node_tree = BVH<DeviceType>(
+            Details::copyToView<DeviceType>( boxes, "node_boxes" ) );
+        _node_tree_ranks =
+            Details::copyToView<DeviceType>( owners, "node_tree_ranks" );
+        Teuchos::Array<SizeType> node_sizes( node_size );
+        Teuchos::gatherAll( *_node_comm, 1, &bottom_tree_size, node_size,
+                            node_sizes.getRawPtr() );
+        SizeType const node_tree_size = std::accumulate(
+            node_sizes.begin(), node_sizes.end(), SizeType( 0 ) );
 
-    _top_tree = BVH<DeviceType>( boxes );
+        // The ranks of the first processes of the nodes in leaders_comm are
+        // the indices of the nodes.
+        auto const leaders_comm = _comm->split( node_rank, comm_rank );
+        int n_boxes = 0;
+        int n_nodes = 0;
+        if ( node_rank == 0 )
+        {
+            n_nodes = leaders_comm->getSize();
+            Details::gatherBoundingBoxes<DeviceType>(
+                *leaders_comm, _node_tree, top_tree_depth, boxes, owners );
+            n_boxes = boxes.size();
+            sizes.resize( n_nodes );
+            Teuchos::gatherAll( *leaders_comm, 1, &node_tree_size, n_nodes,
+                                sizes.getRawPtr() );
+        }
+        Teuchos::broadcast( *_node_comm, 0, 1, &n_boxes );
+        Teuchos::broadcast( *_node_comm, 0, 1, &n_nodes );
+        boxes.resize( n_boxes );
+        owners.resize( n_boxes );
+        sizes.resize( n_nodes );
+        Teuchos::broadcast( *_node_comm, 0, n_boxes, boxes.getRawPtr() );
+        Teuchos::broadcast( *_node_comm, 0, n_boxes, owners.getRawPtr() );
+        Teuchos::broadcast( *_node_comm, 0, n_nodes, sizes.getRawPtr() );
 
-    _bottom_tree_sizes = Kokkos::View<SizeType *, DeviceType>(
-        "leave_count_in_local_trees", comm_size );
-    auto bottom_tree_sizes_host =
-        Kokkos::create_mirror_view( _bottom_tree_sizes );
-    auto const bottom_tree_size = _bottom_tree.size();
-    Teuchos::gatherAll( *comm, 1, &bottom_tree_size, comm_size,
-                        bottom_tree_sizes_host.data() );
-    Kokkos::deep_copy( _bottom_tree_sizes, bottom_tree_sizes_host );
+        // The nodes need not be made of consecutive ranks so the queries are
+        // forwarded to them through the list of the ranks in comm of their
+        // processes, ordered by rank in the node.
+        int node_index = ( node_rank == 0 ) ? leaders_comm->getRank() : 0;
+        Teuchos::broadcast( *_node_comm, 0, 1, &node_index );
+        Teuchos::Array<int> node_indices( comm_size );
+        Teuchos::gatherAll( *_comm, 1, &node_index, comm_size,
+                            node_indices.getRawPtr() );
+        Teuchos::Array<int> processes_offset( n_nodes + 1, 0 );
+        for ( int node : node_indices )
+            ++processes_offset[node + 1];
+        std::partial_sum( processes_offset.begin(), processes_offset.end(),
+                          processes_offset.begin() );
+        Teuchos::Array<int> processes( comm_size );
+        Teuchos::Array<int> next( processes_offset.begin(),
+                                  processes_offset.end() - 1 );
+        for ( int rank = 0; rank < comm_size; ++rank )
+            processes[next[node_indices[rank]]++] = rank;
+        _processes_of_nodes =
+            Details::copyToView<DeviceType>( processes, "processes_of_nodes" );
+        _processes_of_nodes_offset = Details::copyToView<DeviceType>(
+            processes_offset, "processes_of_nodes_offset" );
+        _node_processes = Details::copyToView<DeviceType>(
+            Teuchos::Array<int>(
+                processes.begin() + processes_offset[node_index],
+                processes.begin() + processes_offset[node_index + 1] ),
+            "node_processes" );
+    }
 
+    _top_tree = BVH<DeviceType>(
+        Details::copyToView<DeviceType>( boxes, "rank_bounding_boxes" ) );
+    _top_tree_ranks =
+        Details::copyToView<DeviceType>( owners, "top_tree_ranks" );
+    _bottom_tree_sizes = Details::copyToView<DeviceType>(
+        sizes, "leave_count_in_local_trees" );
     _top_tree_size = accumulate( _bottom_tree_sizes, 0 );
 }
 
+template <typename DeviceType>
+void DistributedSearchTree<DeviceType>::buildTopTreeFromSources(
+    int top_tree_depth )
+{
+    DTK_REQUIRE( top_tree_depth >= 0 && top_tree_depth <= 8 );
+
+    int const comm_rank = _comm->getRank();
+    int const comm_size = _comm->getSize();
+    bool const is_source = ( _role != ProcessRole::Target );
+    bool const is_target = ( _role != ProcessRole::Source );
+    SizeType const bottom_tree_size = _bottom_tree.size();
+    Teuchos::reduceAll( *_comm, Teuchos::REDUCE_SUM, bottom_tree_size,
+                        Teuchos::ptrFromRef( _top_tree_size ) );
+
+    // The sources gather their boxes among themselves.  The first source
+    // then broadcasts them to the targets.
+    int first_source = comm_size;
+    Teuchos::reduceAll( *_comm, Teuchos::REDUCE_MIN,
+                        is_source ? comm_rank : comm_size,
+                        Teuchos::ptrFromRef( first_source ) );
+    Teuchos::Array<Box> boxes;
+    Teuchos::Array<int> owners;
+    Teuchos::Array<int> source_ranks;
+    Teuchos::Array<SizeType> source_sizes;
+    auto const sources_comm = _comm->split( is_source ? 0 : 1, comm_rank );
+    if ( is_source )
+    {
+        int const n_sources = sources_comm->getSize();
+        Details::gatherBoundingBoxes<DeviceType>(
+            *sources_comm, _bottom_tree, top_tree_depth, boxes, owners );
+        source_ranks.resize( n_sources );
+        Teuchos::gatherAll( *sources_comm, 1, &comm_rank, n_sources,
+                            source_ranks.getRawPtr() );
+        source_sizes.resize( n_sources );
+        Teuchos::gatherAll( *sources_comm, 1, &bottom_tree_size, n_sources,
+                            source_sizes.getRawPtr() );
+    }
+
+    bool const receives_top_tree = is_target || comm_rank == first_source;
+    auto const targets_comm =
+        _comm->split( receives_top_tree ? 0 : 1,
+                      ( comm_rank == first_source ) ? 0 : comm_rank + 1 );
+    if ( receives_top_tree && first_source < comm_size )
+    {
+        int n_boxes = boxes.size();
+        int n_sources = source_ranks.size();
+        Teuchos::broadcast( *targets_comm, 0, 1, &n_boxes );
+        Teuchos::broadcast( *targets_comm, 0, 1, &n_sources );
+        boxes.resize( n_boxes );
+        owners.resize( n_boxes );
+        source_ranks.resize( n_sources );
+        source_sizes.resize( n_sources );
+        Teuchos::broadcast( *targets_comm, 0, n_boxes, boxes.getRawPtr() );
+        Teuchos::broadcast( *targets_comm, 0, n_boxes, owners.getRawPtr() );
+        Teuchos::broadcast( *targets_comm, 0, n_sources,
+                            source_ranks.getRawPtr() );
+        Teuchos::broadcast( *targets_comm, 0, n_sources,
+                            source_sizes.getRawPtr() );
+    }
+    if ( !is_target )
+        return;
+
+    // The owners are ranks in sources_comm and the queries are forwarded to
+    // ranks in comm.
+    Teuchos::Array<SizeType> sizes( comm_size, 0 );
+    for ( int i = 0; i < source_ranks.size(); ++i )
+        sizes[source_ranks[i]] = source_sizes[i];
+    for ( auto &owner : owners )
+        owner = source_ranks[owner];
+
+    _top_tree = BVH<DeviceType>(
+        Details::copyToView<DeviceType>( boxes, "rank_bounding_boxes" ) );
+    _top_tree_ranks =
+        Details::copyToView<DeviceType>( owners, "top_tree_ranks" );
+    _bottom_tree_sizes = Details::copyToView<DeviceType>(
+        sizes, "leave_count_in_local_trees" );
+}
+
+template <typename DeviceType>
+void DistributedSearchTree<DeviceType>::allNearest(
+    int k, Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset,
+    Kokkos::View<int *, DeviceType> &ranks,
+    Kokkos::View<double *, DeviceType> &distances, bool exclude_self ) const
+{
+    DTK_INSIST( _role == ProcessRole::SourceAndTarget );
+    Details::DistributedSearchTreeImpl<DeviceType>::allNearestDispatch(
+        *this, k, indices, offset, ranks, distances, exclude_self );
+}
+
 } // namespace DataTransferKit
 
 // Explicit instantiation macro
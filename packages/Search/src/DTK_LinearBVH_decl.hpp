@@ -17,48 +17,279 @@
 #include <DTK_Box.hpp>
 #include <DTK_DetailsAlgorithms.hpp>
 #include <DTK_DetailsNode.hpp>
+#include <DTK_DetailsTreeConstruction.hpp> // SpaceFillingCurve
 #include <DTK_DetailsTreeTraversal.hpp>
 #include <DTK_DetailsUtils.hpp>
+#include <DTK_Future.hpp>
+#include <DTK_KDOP.hpp>
+#include <DTK_KokkosHelpers.hpp> // min
 #include <DTK_Predicates.hpp>
+#include <DTK_Sphere.hpp>
 
 #include <Kokkos_ArithTraits.hpp>
 #include <Kokkos_Array.hpp>
+#include <Kokkos_Sort.hpp>
 #include <Kokkos_View.hpp>
 
+#include <cstddef> // size_t
+
 namespace DataTransferKit
 {
 
-template <typename DeviceType>
+/** \brief Algorithms available to build a bounding volume hierarchy
+ *
+ *  \c Karras sorts the objects along a space-filling curve (Z-order by
+ *  default, see \c SpaceFillingCurve) and generates all the internal nodes
+ *  concurrently.  It is the fastest to
+ *  build.  \c BinnedSAH splits the objects top-down using the surface area
+ *  heuristic.  It takes longer to build but yields trees that visit fewer
+ *  nodes when queried, in particular when objects are unevenly distributed.
+ *  It is worth considering when the tree is queried many times.
+ */
+enum class BVHConstruction
+{
+    Karras,
+    BinnedSAH
+};
+
+/** \brief Ways to map the queries onto the threads of the execution space
+ *
+ *  \c PerQuery traverses the tree independently for each query, one thread
+ *  per query.  \c Packet traverses the tree once for small packets of
+ *  consecutive queries: a node is visited if any query in the packet needs it
+ *  and the packet is tested against it in a tight loop.  It pays off when
+ *  consecutive queries are close to each other (e.g. the quadrature points of
+ *  a cell or queries sorted along a space-filling curve, see
+ *  computeSpaceFillingCurvePermutation()).  Packets are only used on host
+ *  execution spaces and the queries are traversed one by one otherwise.
+ *  \c Team assigns a team of threads to each spatial query.  The top levels
+ *  of the tree are expanded by the whole team and the subtrees below a depth
+ *  cutoff are searched concurrently by its threads, so that queries with many
+ *  more results than the others do not hold back the entire batch.  The
+ *  queries are scheduled dynamically.  Nearest queries are traversed one by
+ *  one, also with dynamic scheduling.
+ */
+enum class QueryTraversal
+{
+    PerQuery,
+    Packet,
+    Team
+};
+
+template <typename DeviceType, typename BoundingVolume>
+class BoundingVolumeHierarchyForest;
+
+/** \brief Bounding volume hierarchy
+ *
+ *  The type of bounding volume used for the leaves and the internal nodes is a
+ *  template parameter.  Axis-aligned boxes are the default.  Tighter volumes
+ *  such as spheres or k-DOPs (see \c KDOP) reduce the number of false
+ *  positive candidates returned by spatial queries for thin or rotated
+ *  objects, at the price of more expensive intersection tests.
+ *
+ *  \note The predicates are evaluated exactly for boxes and spheres.  For
+ *  \c KDOP<k> they are conservative: spatial queries may return objects
+ *  whose k-DOP does not actually satisfy the predicate (the intersection
+ *  tests only use the k-DOP directions as separating axes), and the
+ *  distances computed by nearest queries are lower bounds of the distances
+ *  to the k-DOPs (the largest distance to any of their slabs), which are
+ *  also what the nearest neighbors are ranked by.  The results are exact
+ *  when the k-DOPs reduce to points.
+ */
+template <typename DeviceType, typename BoundingVolume = Box>
 class BoundingVolumeHierarchy
 {
   public:
     using TreeType = BoundingVolumeHierarchy;
+    using BoundingVolumeType = BoundingVolume;
+
+    using ExecutionSpace = typename DeviceType::execution_space;
 
     BoundingVolumeHierarchy() = default; // build an empty tree
+    /** The space-filling curve \c curve used to order the objects is only
+     *  relevant to the \c Karras construction.
+     */
+    BoundingVolumeHierarchy(
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        BVHConstruction construction = BVHConstruction::Karras,
+        SpaceFillingCurve curve = SpaceFillingCurve::Morton );
+
+    /** Builds the tree with the construction stages enqueued on the execution
+     *  space instance \c space.  The constructor returns once the objects
+     *  have been sorted (this requires a value on the host) while the last
+     *  stages may still be running.  The tree may be queried on the same
+     *  instance right away, otherwise call <code>space.fence()</code>.
+     */
     BoundingVolumeHierarchy(
-        Kokkos::View<Box const *, DeviceType> bounding_boxes );
+        ExecutionSpace const &space,
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        BVHConstruction construction = BVHConstruction::Karras,
+        SpaceFillingCurve curve = SpaceFillingCurve::Morton );
 
     // Views are passed by reference here because internally Kokkos::realloc()
-    // is called.
-    template <typename Query>
+    // is called.  The value type of offset is the type of the running total
+    // of results.  A 64-bit integer type (e.g. long long) is required when
+    // the total number of results may exceed 2^31 - 1.
+    template <typename Query, typename Offset>
     void query( Kokkos::View<Query *, DeviceType> queries,
                 Kokkos::View<int *, DeviceType> &indices,
-                Kokkos::View<int *, DeviceType> &offset ) const;
-    template <typename Query>
+                Kokkos::View<Offset *, DeviceType> &offset,
+                QueryTraversal traversal = QueryTraversal::PerQuery ) const;
+    template <typename Query, typename Offset>
     typename std::enable_if<
         std::is_same<typename Query::Tag, Details::NearestPredicateTag>::value,
         void>::type
     query( Kokkos::View<Query *, DeviceType> queries,
            Kokkos::View<int *, DeviceType> &indices,
-           Kokkos::View<int *, DeviceType> &offset,
+           Kokkos::View<Offset *, DeviceType> &offset,
            Kokkos::View<double *, DeviceType> &distances ) const;
 
+    /** Spatial queries that also return for each result the distance from
+     *  the centroid of the geometry of the predicate (e.g. the center of the
+     *  sphere for \c Within) to the bounding volume of the object.
+     *
+     *  If \c sort_by_distance is true, the results of each query are sorted
+     *  by ascending distance.  If \c max_results is non-negative, only the
+     *  \c max_results closest objects are kept for each query, which implies
+     *  sorting them.
+     */
+    template <typename Query, typename Offset>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        void>::type
+    query( Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> &indices,
+           Kokkos::View<Offset *, DeviceType> &offset,
+           Kokkos::View<double *, DeviceType> &distances,
+           bool sort_by_distance = false, int max_results = -1 ) const;
+
+    /** Asynchronous versions of the queries.  The search is enqueued on the
+     *  execution space instance \c space and the instance is only fenced when
+     *  the host needs to know the number of results to allocate the output
+     *  views.  The returned handle must be waited on before reading the
+     *  results, unless they are consumed by work enqueued on the same
+     *  instance.
+     */
+    template <typename Query, typename Offset>
+    Future<ExecutionSpace>
+    query( ExecutionSpace const &space,
+           Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> &indices,
+           Kokkos::View<Offset *, DeviceType> &offset,
+           QueryTraversal traversal = QueryTraversal::PerQuery ) const;
+    template <typename Query, typename Offset>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::NearestPredicateTag>::value,
+        Future<ExecutionSpace>>::type
+    query( ExecutionSpace const &space,
+           Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> &indices,
+           Kokkos::View<Offset *, DeviceType> &offset,
+           Kokkos::View<double *, DeviceType> &distances ) const;
+    template <typename Query, typename Offset>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        Future<ExecutionSpace>>::type
+    query( ExecutionSpace const &space,
+           Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> &indices,
+           Kokkos::View<Offset *, DeviceType> &offset,
+           Kokkos::View<double *, DeviceType> &distances,
+           bool sort_by_distance = false, int max_results = -1 ) const;
+
+    /** Counts the objects that satisfy each of the spatial predicates in
+     *  \c queries without storing their indices.  On output, \c counts
+     *  holds one entry per query.  The tree is traversed once whereas query()
+     *  needs a second pass to fill the indices.
+     */
+    template <typename Query>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        void>::type
+    count( Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> &counts ) const;
+
+    /** Indicates for each of the spatial predicates in \c queries whether
+     *  any object satisfies it.  The traversal for a given query stops as
+     *  soon as such an object is found.
+     */
+    template <typename Query>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        void>::type
+    any( Kokkos::View<Query *, DeviceType> queries,
+         Kokkos::View<bool *, DeviceType> &hits ) const;
+
+    /** Asynchronous versions of count() and any().  They never fence the
+     *  execution space instance \c space.
+     */
+    template <typename Query>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        Future<ExecutionSpace>>::type
+    count( ExecutionSpace const &space,
+           Kokkos::View<Query *, DeviceType> queries,
+           Kokkos::View<int *, DeviceType> &counts ) const;
+    template <typename Query>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        Future<ExecutionSpace>>::type
+    any( ExecutionSpace const &space, Kokkos::View<Query *, DeviceType> queries,
+         Kokkos::View<bool *, DeviceType> &hits ) const;
+
+    /** Spatial queries whose results are handed over in chunks, for outputs
+     *  that would not fit in memory at once.  The objects that satisfy each
+     *  predicate are counted in a first pass over all queries.  The queries
+     *  are then split into consecutive ranges with at most \c
+     *  max_chunk_size results each (a query with more results forms a chunk
+     *  of its own).  For each range, the second pass fills the indices and
+     *  <code>callback( first, indices, offset )</code> is called on the host.
+     *  On entry to the callback, the results of query <code>first + q</code>
+     *  are <code>indices(j)</code> for <code>offset(q) <= j <
+     *  offset(q+1)</code>.  The views are only valid during the call, and
+     *  only one chunk is allocated at a time.
+     */
+    template <typename Query, typename Callback>
+    typename std::enable_if<
+        std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+        void>::type
+    chunkedQuery( Kokkos::View<Query *, DeviceType> queries,
+                  std::size_t max_chunk_size,
+                  Callback const &callback ) const;
+
+    /** All k nearest neighbors self query.  Finds for each object of the
+     *  tree the \c k objects closest to the centroid of its bounding volume.
+     *  The object itself is not counted as a neighbor unless \c exclude_self
+     *  is false.  The neighbors of object \c i are stored in \c indices(j)
+     *  for <code>offset(i) <= j < offset(i+1)</code>, sorted by ascending
+     *  \c distances(j).  Every object has the same number of neighbors, \c k
+     *  or fewer if the tree is too small.
+     *
+     *  The search for each object starts from its own leaf and walks up the
+     *  tree, which is much cheaper than a nearest query from the root when
+     *  the neighbors are close.
+     */
+    void allNearest( int k, Kokkos::View<int *, DeviceType> &indices,
+                     Kokkos::View<int *, DeviceType> &offset,
+                     Kokkos::View<double *, DeviceType> &distances,
+                     bool exclude_self = true ) const;
+    Future<ExecutionSpace>
+    allNearest( ExecutionSpace const &space, int k,
+                Kokkos::View<int *, DeviceType> &indices,
+                Kokkos::View<int *, DeviceType> &offset,
+                Kokkos::View<double *, DeviceType> &distances,
+                bool exclude_self = true ) const;
+
+    /** Returns the bounding volume of the root node or a default-constructed
+     *  bounding volume if the tree is empty.
+     */
     KOKKOS_INLINE_FUNCTION
-    Box bounds() const
+    BoundingVolume bounds() const
     {
         if ( empty() )
-            return Box();
-        return ( size() > 1 ? _internal_nodes : _leaf_nodes )[0].bounding_box;
+            return BoundingVolume();
+        return ( size() > 1 ? _internal_nodes : _leaf_nodes )[0]
+            .bounding_volume;
     }
 
     using SizeType = typename Kokkos::View<int *, DeviceType>::size_type;
@@ -69,61 +300,334 @@ class BoundingVolumeHierarchy
     bool empty() const { return size() == 0; }
 
   private:
-    friend struct Details::TreeTraversal<DeviceType>;
+    friend struct Details::TreeTraversal<DeviceType, BoundingVolume>;
+    friend class BoundingVolumeHierarchyForest<DeviceType, BoundingVolume>;
+
+    using Node = TreeNode<BoundingVolume>;
+
+    // Tree that shares the nodes of a forest.
+    KOKKOS_INLINE_FUNCTION
+    BoundingVolumeHierarchy( Kokkos::View<Node *, DeviceType> leaf_nodes,
+                             Kokkos::View<Node *, DeviceType> internal_nodes,
+                             Kokkos::View<int *, DeviceType> indices )
+        : _leaf_nodes( leaf_nodes )
+        , _internal_nodes( internal_nodes )
+        , _indices( indices )
+    {
+    }
 
     Kokkos::View<Node *, DeviceType> _leaf_nodes;
     Kokkos::View<Node *, DeviceType> _internal_nodes;
     /**
-     * Array of indices that sort the boxes used to construct the hierarchy.
+     * Array of indices that sort the volumes used to construct the hierarchy.
      * The leaf nodes are ordered so we need these to identify objects that
      * meet a predicate.
      */
     Kokkos::View<int *, DeviceType> _indices;
 };
 
-template <typename DeviceType>
-using BVH = typename BoundingVolumeHierarchy<DeviceType>::TreeType;
+template <typename DeviceType, typename BoundingVolume = Box>
+using BVH =
+    typename BoundingVolumeHierarchy<DeviceType, BoundingVolume>::TreeType;
 
-template <typename DeviceType, typename Query>
+namespace Details
+{
+template <typename ExecutionSpace, typename DeviceType, typename Offset,
+          typename Index>
+void gatherResults( ExecutionSpace const &, Kokkos::View<Offset *, DeviceType>,
+                    Kokkos::View<Offset *, DeviceType>,
+                    Kokkos::View<Index *, DeviceType> )
+{
+    // do nothing
+}
+
+// Copies the first new_offset(q+1)-new_offset(q) results of each query q in
+// the order given by permute.
+template <typename ExecutionSpace, typename DeviceType, typename Offset,
+          typename Index, typename View, typename... OtherViews>
+void gatherResults( ExecutionSpace const &space,
+                    Kokkos::View<Offset *, DeviceType> offset,
+                    Kokkos::View<Offset *, DeviceType> new_offset,
+                    Kokkos::View<Index *, DeviceType> permute, View &view,
+                    OtherViews &... other_views )
+{
+    int const n_queries = offset.extent_int( 0 ) - 1;
+    View new_view( Kokkos::ViewAllocateWithoutInitializing( view.label() ),
+                   lastElement( space, new_offset ) );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "gather_results" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            for ( Offset i = 0; i < new_offset( q + 1 ) - new_offset( q ); ++i )
+                new_view( new_offset( q ) + i ) =
+                    view( permute( offset( q ) + i ) );
+        } );
+    view = new_view;
+    gatherResults( space, offset, new_offset, permute, other_views... );
+}
+
+// Bins the results of all the queries for Kokkos::BinSort so that they end up
+// ordered by query and, within a query, by ascending distance.  The results of
+// query q get as many bins as there are results, spread uniformly between the
+// smallest and the largest distance of the query, so that a query with many
+// more results than the others is sorted as much in parallel as the rest.
+template <typename DeviceType, typename Offset>
+struct ResultsBinOp
+{
+    Kokkos::View<Offset *, DeviceType> _offset;
+    Kokkos::View<int *, DeviceType> _query_ids;
+    Kokkos::View<double *, DeviceType> _min_distances;
+    Kokkos::View<double *, DeviceType> _max_distances;
+    Offset _n_results;
+    int _n_bins;
+
+    KOKKOS_INLINE_FUNCTION
+    int max_bins() const { return _n_bins; }
+
+    template <typename ViewType, typename iType>
+    KOKKOS_INLINE_FUNCTION int bin( ViewType &distances,
+                                    iType const &i ) const
+    {
+        int const q = _query_ids( i );
+        Offset const n = _offset( q + 1 ) - _offset( q );
+        double const range = _max_distances( q ) - _min_distances( q );
+        Offset const local_bin =
+            ( range > 0. )
+                ? KokkosHelpers::min(
+                      static_cast<Offset>(
+                          ( distances( i ) - _min_distances( q ) ) / range *
+                          n ),
+                      n - 1 )
+                : 0;
+        // There are fewer bins than results if the latter do not fit in int.
+        return static_cast<int>( static_cast<double>( _offset( q ) +
+                                                      local_bin ) /
+                                 _n_results * _n_bins );
+    }
+
+    template <typename ViewType, typename iType1, typename iType2>
+    KOKKOS_INLINE_FUNCTION bool operator()( ViewType &distances,
+                                            iType1 &i, iType2 &j ) const
+    {
+        return _query_ids( i ) < _query_ids( j ) ||
+               ( _query_ids( i ) == _query_ids( j ) &&
+                 distances( i ) < distances( j ) );
+    }
+};
+
+/** Sorts the results of each query by ascending distance.  If \p max_results
+ *  is non-negative, only the \p max_results closest ones are kept.  The other
+ *  views hold additional data attached to the results (e.g. the indices) and
+ *  are reordered the same way.  All the results are sorted at once with
+ *  Kokkos::BinSort, see \c ResultsBinOp.
+ */
+template <typename ExecutionSpace, typename DeviceType, typename Offset,
+          typename... OtherViews>
+void sortResultsByDistance( ExecutionSpace const &space,
+                            Kokkos::View<Offset *, DeviceType> &offset,
+                            Kokkos::View<double *, DeviceType> &distances,
+                            int max_results, OtherViews &... other_views )
+{
+    int const n_queries = offset.extent_int( 0 ) - 1;
+    Offset const n_results = distances.extent( 0 );
+
+    using TeamPolicy = Kokkos::TeamPolicy<ExecutionSpace>;
+    Kokkos::View<int *, DeviceType> query_ids(
+        Kokkos::ViewAllocateWithoutInitializing( "query_ids" ), n_results );
+    Kokkos::View<double *, DeviceType> min_distances(
+        Kokkos::ViewAllocateWithoutInitializing( "min_distances" ),
+        n_queries );
+    Kokkos::View<double *, DeviceType> max_distances(
+        Kokkos::ViewAllocateWithoutInitializing( "max_distances" ),
+        n_queries );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "compute_distance_range_per_query" ),
+        TeamPolicy( space, n_queries, Kokkos::AUTO ),
+        KOKKOS_LAMBDA( typename TeamPolicy::member_type const &team ) {
+            int const q = team.league_rank();
+            Kokkos::Experimental::MinMaxScalar<double> range;
+            Kokkos::parallel_reduce(
+                Kokkos::TeamThreadRange( team, offset( q ),
+                                         offset( q + 1 ) ),
+                [&]( Offset i,
+                     Kokkos::Experimental::MinMaxScalar<double> &partial ) {
+                    query_ids( i ) = q;
+                    partial.min_val =
+                        KokkosHelpers::min( partial.min_val, distances( i ) );
+                    partial.max_val =
+                        KokkosHelpers::max( partial.max_val, distances( i ) );
+                },
+                Kokkos::Experimental::MinMax<double>( range ) );
+            Kokkos::single( Kokkos::PerTeam( team ), [&]() {
+                min_distances( q ) = range.min_val;
+                max_distances( q ) = range.max_val;
+            } );
+        } );
+
+    Kokkos::View<Offset *, DeviceType> permute(
+        Kokkos::ViewAllocateWithoutInitializing( "permute" ), n_results );
+    iota( space, permute );
+    if ( n_results > 0 )
+    {
+        // NOTE: Kokkos::BinSort does not take an execution space instance and
+        // runs on the default one.
+        space.fence();
+        ResultsBinOp<DeviceType, Offset> const bin_op = {
+            offset,
+            query_ids,
+            min_distances,
+            max_distances,
+            n_results,
+            static_cast<int>( KokkosHelpers::min(
+                n_results, Offset( Kokkos::ArithTraits<int>::max() ) ) )};
+        Kokkos::BinSort<Kokkos::View<double *, DeviceType>,
+                        ResultsBinOp<DeviceType, Offset>, DeviceType,
+                        std::size_t>
+            bin_sort( distances, bin_op, true );
+        bin_sort.create_permute_vector();
+        bin_sort.sort( permute );
+        ExecutionSpace().fence();
+    }
+
+    Kokkos::View<Offset *, DeviceType> new_offset = offset;
+    if ( max_results >= 0 )
+    {
+        new_offset = Kokkos::View<Offset *, DeviceType>(
+            Kokkos::ViewAllocateWithoutInitializing( offset.label() ),
+            n_queries + 1 );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "truncate_results" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries + 1 ),
+            KOKKOS_LAMBDA( int q ) {
+                new_offset( q ) =
+                    ( q < n_queries )
+                        ? KokkosHelpers::min( offset( q + 1 ) - offset( q ),
+                                              Offset( max_results ) )
+                        : 0;
+            } );
+        exclusivePrefixSum( space, new_offset );
+    }
+
+    gatherResults( space, offset, new_offset, permute, distances,
+                   other_views... );
+    offset = new_offset;
+}
+
+// Packet traversal is only worth it on CPUs.
+template <typename ExecutionSpace>
+bool usePackets( QueryTraversal traversal )
+{
+    return traversal == QueryTraversal::Packet &&
+           Kokkos::Impl::SpaceAccessibility<ExecutionSpace,
+                                            Kokkos::HostSpace>::accessible;
+}
+
+// Loops over the queries with one thread per query.  In Team mode, the
+// queries are scheduled dynamically since their cost may vary widely.
+template <typename ExecutionSpace, typename Functor>
+void parallelForQueries( std::string const &label, ExecutionSpace const &space,
+                         int n_queries, QueryTraversal traversal,
+                         Functor const &functor )
+{
+    if ( traversal == QueryTraversal::Team )
+        Kokkos::parallel_for(
+            label,
+            Kokkos::RangePolicy<ExecutionSpace,
+                                Kokkos::Schedule<Kokkos::Dynamic>>(
+                space, 0, n_queries ),
+            functor );
+    else
+        Kokkos::parallel_for(
+            label, Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+            functor );
+}
+} // namespace Details
+
+// NOTE: The query dispatch functions below enqueue all their work on the
+// execution space instance that is passed as first argument.  They do not
+// fence, except implicitly through lastElement() when the number of results
+// must be known on the host.
+template <typename DeviceType, typename BoundingVolume, typename Query,
+          typename Offset>
 void queryDispatch(
-    BoundingVolumeHierarchy<DeviceType> const bvh,
+    typename DeviceType::execution_space const &space,
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const bvh,
     Kokkos::View<Query *, DeviceType> queries,
     Kokkos::View<int *, DeviceType> &indices,
-    Kokkos::View<int *, DeviceType> &offset, Details::NearestPredicateTag,
+    Kokkos::View<Offset *, DeviceType> &offset, Details::NearestPredicateTag,
+    QueryTraversal traversal,
     Kokkos::View<double *, DeviceType> *distances_ptr = nullptr )
 {
     using ExecutionSpace = typename DeviceType::execution_space;
+    using Traversal = Details::TreeTraversal<DeviceType, BoundingVolume>;
 
     int const n_queries = queries.extent( 0 );
+    bool const use_packets = Details::usePackets<ExecutionSpace>( traversal );
 
-    Kokkos::realloc( offset, n_queries + 1 );
-    Kokkos::deep_copy( offset, 0 );
+    offset = Kokkos::View<Offset *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( offset.label() ),
+        n_queries + 1 );
+    Kokkos::deep_copy( space, offset, 0 );
 
     Kokkos::parallel_for(
         DTK_MARK_REGION( "scan_queries_for_numbers_of_nearest_neighbors" ),
-        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
         KOKKOS_LAMBDA( int i ) { offset( i ) = queries( i )._k; } );
-    Kokkos::fence();
 
-    exclusivePrefixSum( offset );
-    int const n_results = lastElement( offset );
+    exclusivePrefixSum( space, offset );
+    Offset const n_results = lastElement( space, offset );
 
-    Kokkos::realloc( indices, n_results );
+    indices = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        n_results );
     int const invalid_index = -1;
-    Kokkos::deep_copy( indices, invalid_index );
-    if ( distances_ptr )
+    Kokkos::deep_copy( space, indices, invalid_index );
+    if ( use_packets )
+    {
+        // The candidates of each query are kept directly in the output views.
+        Kokkos::View<double *, DeviceType> distances(
+            Kokkos::ViewAllocateWithoutInitializing(
+                distances_ptr ? distances_ptr->label() : "distances" ),
+            n_results );
+        if ( distances_ptr )
+            *distances_ptr = distances;
+        int const packet_size = Traversal::packet_size;
+        int const n_packets = ( n_queries + packet_size - 1 ) / packet_size;
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "perform_nearest_queries_with_packets" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_packets ),
+            KOKKOS_LAMBDA( int p ) {
+                int const first = p * packet_size;
+                int const n =
+                    KokkosHelpers::min( packet_size, n_queries - first );
+                int *packet_indices[Traversal::packet_size];
+                double *packet_distances[Traversal::packet_size];
+                int counts[Traversal::packet_size];
+                for ( int j = 0; j < n; ++j )
+                {
+                    packet_indices[j] = indices.data() + offset( first + j );
+                    packet_distances[j] =
+                        distances.data() + offset( first + j );
+                }
+                Details::nearestPacketQuery( bvh, queries.data() + first, n,
+                                             packet_indices, packet_distances,
+                                             counts );
+            } );
+    }
+    else if ( distances_ptr )
     {
         Kokkos::View<double *, DeviceType> &distances = *distances_ptr;
-        Kokkos::realloc( distances, n_results );
+        distances = Kokkos::View<double *, DeviceType>(
+            Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+            n_results );
         double const invalid_distance = -Kokkos::ArithTraits<double>::max();
-        Kokkos::deep_copy( distances, invalid_distance );
+        Kokkos::deep_copy( space, distances, invalid_distance );
 
-        Kokkos::parallel_for(
+        Details::parallelForQueries(
             DTK_MARK_REGION( "perform_nearest_queries_and_return_distances" ),
-            Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
-            KOKKOS_LAMBDA( int i ) {
+            space, n_queries, traversal, KOKKOS_LAMBDA( int i ) {
                 int count = 0;
-                Details::TreeTraversal<DeviceType>::query(
+                Traversal::query(
                     bvh, queries( i ),
                     [indices, offset, distances, i, &count]( int index,
                                                              double distance ) {
@@ -132,178 +636,522 @@ void queryDispatch(
                         count++;
                     } );
             } );
-        Kokkos::fence();
     }
     else
     {
-        Kokkos::parallel_for(
-            DTK_MARK_REGION( "perform_nearest_queries" ),
-            Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
-            KOKKOS_LAMBDA( int i ) {
+        Details::parallelForQueries(
+            DTK_MARK_REGION( "perform_nearest_queries" ), space, n_queries,
+            traversal, KOKKOS_LAMBDA( int i ) {
                 int count = 0;
-                Details::TreeTraversal<DeviceType>::query(
+                Traversal::query(
                     bvh, queries( i ),
                     [indices, offset, i, &count]( int index, double ) {
                         indices( offset( i ) + count++ ) = index;
                     } );
             } );
-        Kokkos::fence();
     }
     // Find out if they are any invalid entries in the indices (i.e. at least
     // one query asked for more neighbors that they are leaves in the tree) and
     // eliminate them if necessary.
-    auto tmp_offset = Kokkos::create_mirror( DeviceType(), offset );
-    Kokkos::deep_copy( tmp_offset, 0 );
-    Kokkos::parallel_for( DTK_MARK_REGION( "count_invalid_indices" ),
-                          Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
-                          KOKKOS_LAMBDA( int q ) {
-                              for ( int i = offset( q ); i < offset( q + 1 );
-                                    ++i )
-                                  if ( indices( i ) == invalid_index )
-                                  {
-                                      tmp_offset( q ) = offset( q + 1 ) - i;
-                                      break;
-                                  }
-                          } );
-    Kokkos::fence();
-    exclusivePrefixSum( tmp_offset );
-    int const n_invalid_indices = lastElement( tmp_offset );
+    Kokkos::View<Offset *, DeviceType> tmp_offset(
+        Kokkos::ViewAllocateWithoutInitializing( offset.label() ),
+        n_queries + 1 );
+    Kokkos::deep_copy( space, tmp_offset, 0 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_invalid_indices" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            for ( Offset i = offset( q ); i < offset( q + 1 ); ++i )
+                if ( indices( i ) == invalid_index )
+                {
+                    tmp_offset( q ) = offset( q + 1 ) - i;
+                    break;
+                }
+        } );
+    exclusivePrefixSum( space, tmp_offset );
+    Offset const n_invalid_indices = lastElement( space, tmp_offset );
     if ( n_invalid_indices > 0 )
     {
         Kokkos::parallel_for(
             DTK_MARK_REGION( "subtract_invalid_entries_from_offset" ),
-            Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries + 1 ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries + 1 ),
             KOKKOS_LAMBDA( int q ) {
                 tmp_offset( q ) = offset( q ) - tmp_offset( q );
             } );
-        Kokkos::fence();
 
-        int const n_valid_indices = n_results - n_invalid_indices;
-        Kokkos::View<int *, DeviceType> tmp_indices( indices.label(),
-                                                     n_valid_indices );
+        Offset const n_valid_indices = n_results - n_invalid_indices;
+        Kokkos::View<int *, DeviceType> tmp_indices(
+            Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+            n_valid_indices );
 
         Kokkos::parallel_for(
             DTK_MARK_REGION( "copy_valid_indices" ),
-            Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
             KOKKOS_LAMBDA( int q ) {
-                for ( int i = 0; i < tmp_offset( q + 1 ) - tmp_offset( q );
+                for ( Offset i = 0; i < tmp_offset( q + 1 ) - tmp_offset( q );
                       ++i )
                 {
                     tmp_indices( tmp_offset( q ) + i ) =
                         indices( offset( q ) + i );
                 }
             } );
-        Kokkos::fence();
         indices = tmp_indices;
         if ( distances_ptr )
         {
             Kokkos::View<double *, DeviceType> &distances = *distances_ptr;
-            Kokkos::View<double *, DeviceType> tmp_distances( distances.label(),
-                                                              n_valid_indices );
+            Kokkos::View<double *, DeviceType> tmp_distances(
+                Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+                n_valid_indices );
             Kokkos::parallel_for(
                 DTK_MARK_REGION( "copy_valid_distances" ),
-                Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+                Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
                 KOKKOS_LAMBDA( int q ) {
-                    for ( int i = 0; i < tmp_offset( q + 1 ) - tmp_offset( q );
-                          ++i )
+                    for ( Offset i = 0;
+                          i < tmp_offset( q + 1 ) - tmp_offset( q ); ++i )
                     {
                         tmp_distances( tmp_offset( q ) + i ) =
                             distances( offset( q ) + i );
                     }
                 } );
-            Kokkos::fence();
             distances = tmp_distances;
         }
         offset = tmp_offset;
     }
 }
 
-template <typename DeviceType, typename Query>
-void queryDispatch( BoundingVolumeHierarchy<DeviceType> const bvh,
-                    Kokkos::View<Query *, DeviceType> queries,
-                    Kokkos::View<int *, DeviceType> &indices,
-                    Kokkos::View<int *, DeviceType> &offset,
-                    Details::SpatialPredicateTag )
+template <typename DeviceType, typename BoundingVolume, typename Query,
+          typename Offset>
+void queryDispatch(
+    typename DeviceType::execution_space const &space,
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const bvh,
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<Offset *, DeviceType> &offset, Details::SpatialPredicateTag,
+    QueryTraversal traversal,
+    Kokkos::View<double *, DeviceType> *distances_ptr = nullptr,
+    bool sort_by_distance = false, int max_results = -1 )
 {
     using ExecutionSpace = typename DeviceType::execution_space;
+    using Traversal = Details::TreeTraversal<DeviceType, BoundingVolume>;
 
     int const n_queries = queries.extent( 0 );
+    // Results with distances are computed one query at a time.
+    bool const use_packets =
+        !distances_ptr && Details::usePackets<ExecutionSpace>( traversal );
+    int const packet_size = Traversal::packet_size;
+    int const n_packets = ( n_queries + packet_size - 1 ) / packet_size;
+    bool const use_teams =
+        !distances_ptr && traversal == QueryTraversal::Team;
+    using Node = typename Traversal::Node;
+    using TeamPolicy =
+        Kokkos::TeamPolicy<ExecutionSpace, Kokkos::Schedule<Kokkos::Dynamic>>;
+    using TeamMember = typename TeamPolicy::member_type;
+    int constexpr frontier_size = 1 << Traversal::frontier_depth;
+    Kokkos::View<int **, DeviceType> subtree_counts( "subtree_counts" );
 
     // Initialize view
     // [ 0 0 0 .... 0 0 ]
     //                ^
     //                N
-    Kokkos::realloc( offset, n_queries + 1 );
-    Kokkos::deep_copy( offset, 0 );
+    offset = Kokkos::View<Offset *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( offset.label() ),
+        n_queries + 1 );
+    Kokkos::deep_copy( space, offset, 0 );
 
     // Say we found exactly two object for each query:
     // [ 2 2 2 .... 2 0 ]
     //   ^            ^
     //   0th          Nth element in the view
-    Kokkos::parallel_for(
-        DTK_MARK_REGION(
-            "first_pass_at_the_search_count_the_number_of_indices" ),
-        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
-        KOKKOS_LAMBDA( int i ) {
-            offset( i ) = Details::TreeTraversal<DeviceType>::query(
-                bvh, queries( i ), []( int ) {} );
-        } );
-    Kokkos::fence();
+    if ( use_packets )
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "first_pass_at_the_search_with_packets" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_packets ),
+            KOKKOS_LAMBDA( int p ) {
+                int const first = p * packet_size;
+                Details::spatialPacketQuery(
+                    bvh, queries.data() + first,
+                    KokkosHelpers::min( packet_size, n_queries - first ),
+                    [offset, first]( int j, int ) { offset( first + j )++; } );
+            } );
+    else if ( use_teams )
+    {
+        // The number of results below each subtree of the frontier is kept
+        // for the second pass.
+        subtree_counts = Kokkos::View<int **, DeviceType>(
+            Kokkos::ViewAllocateWithoutInitializing( "subtree_counts" ),
+            n_queries, frontier_size );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "first_pass_at_the_search_with_teams" ),
+            TeamPolicy( space, n_queries, Kokkos::AUTO ),
+            KOKKOS_LAMBDA( TeamMember const &team ) {
+                int const i = team.league_rank();
+                Node const *frontier[frontier_size];
+                int const n_frontier =
+                    Details::spatialFrontier( bvh, queries( i ), frontier );
+                int count = 0;
+                Kokkos::parallel_reduce(
+                    Kokkos::TeamThreadRange( team, n_frontier ),
+                    [&]( int f, int &partial_count ) {
+                        int const subtree_count = Details::spatialTraversal(
+                            bvh, frontier[f], queries( i ),
+                            []( Node const * ) {} );
+                        subtree_counts( i, f ) = subtree_count;
+                        partial_count += subtree_count;
+                    },
+                    count );
+                Kokkos::single( Kokkos::PerTeam( team ),
+                                [&]() { offset( i ) = count; } );
+            } );
+    }
+    else
+        Kokkos::parallel_for(
+            DTK_MARK_REGION(
+                "first_pass_at_the_search_count_the_number_of_indices" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+            KOKKOS_LAMBDA( int i ) {
+                offset( i ) =
+                    Traversal::query( bvh, queries( i ), []( int ) {} );
+            } );
 
     // Then we would get:
     // [ 0 2 4 .... 2N-2 2N ]
     //                    ^
     //                    N
-    exclusivePrefixSum( offset );
+    exclusivePrefixSum( space, offset );
 
     // Let us extract the last element in the view which is the total count of
     // objects which where found to meet the query predicates:
     //
     // [ 2N ]
-    int const n_results = lastElement( offset );
+    Offset const n_results = lastElement( space, offset );
     // We allocate the memory and fill
     //
     // [ A0 A1 B0 B1 C0 C1 ... X0 X1 ]
     //   ^     ^     ^         ^     ^
     //   0     2     4         2N-2  2N
-    Kokkos::realloc( indices, n_results );
-    Kokkos::parallel_for( DTK_MARK_REGION( "second_pass" ),
-                          Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
-                          KOKKOS_LAMBDA( int i ) {
-                              int count = 0;
-                              Details::TreeTraversal<DeviceType>::query(
-                                  bvh, queries( i ),
-                                  [indices, offset, i, &count]( int index ) {
-                                      indices( offset( i ) + count++ ) = index;
-                                  } );
-                          } );
-    Kokkos::fence();
+    indices = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        n_results );
+    if ( distances_ptr )
+    {
+        Kokkos::View<double *, DeviceType> &distances = *distances_ptr;
+        distances = Kokkos::View<double *, DeviceType>(
+            Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+            n_results );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "second_pass_and_return_distances" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+            KOKKOS_LAMBDA( int i ) {
+                int count = 0;
+                Details::spatialQueryWithDistances(
+                    bvh, queries( i ),
+                    [indices, offset, distances, i, &count]( int index,
+                                                             double distance ) {
+                        indices( offset( i ) + count ) = index;
+                        distances( offset( i ) + count ) = distance;
+                        count++;
+                    } );
+            } );
+        if ( sort_by_distance || max_results >= 0 )
+            Details::sortResultsByDistance( space, offset, distances,
+                                            max_results, indices );
+        return;
+    }
+    if ( use_packets )
+    {
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "second_pass_with_packets" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_packets ),
+            KOKKOS_LAMBDA( int p ) {
+                int const first = p * packet_size;
+                int count[Traversal::packet_size] = {};
+                Details::spatialPacketQuery(
+                    bvh, queries.data() + first,
+                    KokkosHelpers::min( packet_size, n_queries - first ),
+                    [indices, offset, first, &count]( int j, int index ) {
+                        indices( offset( first + j ) + count[j]++ ) = index;
+                    } );
+            } );
+        return;
+    }
+    if ( use_teams )
+    {
+        // The subtrees of the frontier are searched twice, first to count
+        // the results below each of them and then to store them.  The scan
+        // only goes over the counts of the first pass.
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "second_pass_with_teams" ),
+            TeamPolicy( space, n_queries, Kokkos::AUTO ),
+            KOKKOS_LAMBDA( TeamMember const &team ) {
+                int const i = team.league_rank();
+                Node const *frontier[frontier_size];
+                int const n_frontier =
+                    Details::spatialFrontier( bvh, queries( i ), frontier );
+                Kokkos::parallel_scan(
+                    Kokkos::TeamThreadRange( team, n_frontier ),
+                    [&]( int f, int &partial_count, bool final ) {
+                        if ( final )
+                        {
+                            Offset const first = offset( i ) + partial_count;
+                            int count = 0;
+                            Details::spatialTraversal(
+                                bvh, frontier[f], queries( i ),
+                                [&]( Node const *leaf ) {
+                                    indices( first + count++ ) =
+                                        Traversal::getIndex( bvh, leaf );
+                                } );
+                        }
+                        partial_count += subtree_counts( i, f );
+                    } );
+            } );
+        return;
+    }
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "second_pass" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int i ) {
+            int count = 0;
+            Traversal::query( bvh, queries( i ),
+                              [indices, offset, i, &count]( int index ) {
+                                  indices( offset( i ) + count++ ) = index;
+                              } );
+        } );
 }
 
-template <typename DeviceType>
-template <typename Query>
-void BoundingVolumeHierarchy<DeviceType>::query(
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query, typename Offset>
+void BoundingVolumeHierarchy<DeviceType, BoundingVolume>::query(
     Kokkos::View<Query *, DeviceType> queries,
     Kokkos::View<int *, DeviceType> &indices,
-    Kokkos::View<int *, DeviceType> &offset ) const
+    Kokkos::View<Offset *, DeviceType> &offset, QueryTraversal traversal ) const
 {
-    using Tag = typename Query::Tag;
-    queryDispatch( *this, queries, indices, offset, Tag{} );
+    query( ExecutionSpace{}, queries, indices, offset, traversal ).wait();
 }
 
-template <typename DeviceType>
-template <typename Query>
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query, typename Offset>
 typename std::enable_if<
     std::is_same<typename Query::Tag, Details::NearestPredicateTag>::value,
     void>::type
-BoundingVolumeHierarchy<DeviceType>::query(
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::query(
     Kokkos::View<Query *, DeviceType> queries,
     Kokkos::View<int *, DeviceType> &indices,
-    Kokkos::View<int *, DeviceType> &offset,
+    Kokkos::View<Offset *, DeviceType> &offset,
     Kokkos::View<double *, DeviceType> &distances ) const
+{
+    query( ExecutionSpace{}, queries, indices, offset, distances ).wait();
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query, typename Offset>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    void>::type
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::query(
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<Offset *, DeviceType> &offset,
+    Kokkos::View<double *, DeviceType> &distances, bool sort_by_distance,
+    int max_results ) const
+{
+    query( ExecutionSpace{}, queries, indices, offset, distances,
+           sort_by_distance, max_results )
+        .wait();
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query, typename Offset>
+Future<typename DeviceType::execution_space>
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::query(
+    ExecutionSpace const &space, Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<Offset *, DeviceType> &offset, QueryTraversal traversal ) const
 {
     using Tag = typename Query::Tag;
-    queryDispatch( *this, queries, indices, offset, Tag{}, &distances );
+    queryDispatch( space, *this, queries, indices, offset, Tag{}, traversal );
+    return Future<ExecutionSpace>( space );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query, typename Offset>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::NearestPredicateTag>::value,
+    Future<typename DeviceType::execution_space>>::type
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::query(
+    ExecutionSpace const &space, Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<Offset *, DeviceType> &offset,
+    Kokkos::View<double *, DeviceType> &distances ) const
+{
+    using Tag = typename Query::Tag;
+    queryDispatch( space, *this, queries, indices, offset, Tag{},
+                   QueryTraversal::PerQuery, &distances );
+    return Future<ExecutionSpace>( space );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query, typename Offset>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    Future<typename DeviceType::execution_space>>::type
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::query(
+    ExecutionSpace const &space, Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<Offset *, DeviceType> &offset,
+    Kokkos::View<double *, DeviceType> &distances, bool sort_by_distance,
+    int max_results ) const
+{
+    using Tag = typename Query::Tag;
+    queryDispatch( space, *this, queries, indices, offset, Tag{},
+                   QueryTraversal::PerQuery, &distances, sort_by_distance,
+                   max_results );
+    return Future<ExecutionSpace>( space );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    void>::type
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::count(
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &counts ) const
+{
+    count( ExecutionSpace{}, queries, counts ).wait();
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    void>::type
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::any(
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<bool *, DeviceType> &hits ) const
+{
+    any( ExecutionSpace{}, queries, hits ).wait();
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    Future<typename DeviceType::execution_space>>::type
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::count(
+    ExecutionSpace const &space, Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &counts ) const
+{
+    using Traversal = Details::TreeTraversal<DeviceType, BoundingVolume>;
+
+    int const n_queries = queries.extent( 0 );
+    counts = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( counts.label() ),
+        n_queries );
+    auto const bvh = *this;
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_objects_that_meet_the_predicates" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int i ) {
+            counts( i ) = Traversal::query( bvh, queries( i ), []( int ) {} );
+        } );
+    return Future<ExecutionSpace>( space );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query, typename Callback>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    void>::type
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::chunkedQuery(
+    Kokkos::View<Query *, DeviceType> queries, std::size_t max_chunk_size,
+    Callback const &callback ) const
+{
+    using Traversal = Details::TreeTraversal<DeviceType, BoundingVolume>;
+
+    int const n_queries = queries.extent( 0 );
+    ExecutionSpace space;
+
+    // First pass, counts are accumulated in 64-bit offsets since the total
+    // number of results is typically what does not fit.
+    Kokkos::View<int *, DeviceType> counts( "counts" );
+    count( space, queries, counts );
+    Kokkos::View<long long *, DeviceType> offset(
+        Kokkos::ViewAllocateWithoutInitializing( "offset" ), n_queries + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "copy_counts" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries + 1 ),
+        KOKKOS_LAMBDA( int q ) {
+            offset( q ) = ( q < n_queries ) ? counts( q ) : 0;
+        } );
+    exclusivePrefixSum( space, offset );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( space, offset_host, offset );
+    space.fence();
+
+    auto const bvh = *this;
+    int first = 0;
+    while ( first < n_queries )
+    {
+        int last = first + 1;
+        while ( last < n_queries &&
+                static_cast<std::size_t>( offset_host( last + 1 ) -
+                                          offset_host( first ) ) <=
+                    max_chunk_size )
+            ++last;
+        long long const n_chunk_results =
+            offset_host( last ) - offset_host( first );
+        DTK_REQUIRE( n_chunk_results <= Kokkos::ArithTraits<int>::max() );
+
+        // Second pass for the queries of the chunk.
+        Kokkos::View<int *, DeviceType> chunk_offset(
+            Kokkos::ViewAllocateWithoutInitializing( "offset" ),
+            last - first + 1 );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "set_chunk_offset" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, last - first + 1 ),
+            KOKKOS_LAMBDA( int q ) {
+                chunk_offset( q ) = offset( first + q ) - offset( first );
+            } );
+        Kokkos::View<int *, DeviceType> indices(
+            Kokkos::ViewAllocateWithoutInitializing( "indices" ),
+            n_chunk_results );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "second_pass_for_chunk" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, last - first ),
+            KOKKOS_LAMBDA( int q ) {
+                int count = 0;
+                Traversal::query(
+                    bvh, queries( first + q ),
+                    [indices, chunk_offset, q, &count]( int index ) {
+                        indices( chunk_offset( q ) + count++ ) = index;
+                    } );
+            } );
+        space.fence();
+        callback( first, indices, chunk_offset );
+        first = last;
+    }
+}
+
+template <typename DeviceType, typename BoundingVolume>
+template <typename Query>
+typename std::enable_if<
+    std::is_same<typename Query::Tag, Details::SpatialPredicateTag>::value,
+    Future<typename DeviceType::execution_space>>::type
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::any(
+    ExecutionSpace const &space, Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<bool *, DeviceType> &hits ) const
+{
+    int const n_queries = queries.extent( 0 );
+    hits = Kokkos::View<bool *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( hits.label() ), n_queries );
+    auto const bvh = *this;
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "find_any_object_that_meets_the_predicates" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_queries ),
+        KOKKOS_LAMBDA( int i ) {
+            hits( i ) = Details::spatialQueryAny( bvh, queries( i ) );
+        } );
+    return Future<ExecutionSpace>( space );
 }
 
 } // namespace DataTransferKit
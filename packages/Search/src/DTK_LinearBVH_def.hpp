@@ -22,95 +22,210 @@
 
 namespace DataTransferKit
 {
-template <typename DeviceType>
-class SetBoundingBoxesFunctor
+template <typename DeviceType, typename BoundingVolume>
+class SetBoundingVolumesFunctor
 {
   public:
     using ExecutionSpace = typename DeviceType::execution_space;
+    using Node = TreeNode<BoundingVolume>;
 
-    SetBoundingBoxesFunctor(
+    SetBoundingVolumesFunctor(
         Kokkos::View<Node *, DeviceType> leaf_nodes,
         Kokkos::View<int *, DeviceType> indices,
-        Kokkos::View<Box const *, DeviceType> bounding_boxes )
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes )
         : _leaf_nodes( leaf_nodes )
         , _indices( indices )
-        , _bounding_boxes( bounding_boxes )
+        , _bounding_volumes( bounding_volumes )
     {
     }
 
     KOKKOS_INLINE_FUNCTION
     void operator()( int const i ) const
     {
-        _leaf_nodes[i].bounding_box = _bounding_boxes[_indices[i]];
+        _leaf_nodes[i].bounding_volume = _bounding_volumes[_indices[i]];
     }
 
   private:
     Kokkos::View<Node *, DeviceType> _leaf_nodes;
     Kokkos::View<int *, DeviceType> _indices;
-    Kokkos::View<Box const *, DeviceType> _bounding_boxes;
+    Kokkos::View<BoundingVolume const *, DeviceType> _bounding_volumes;
 };
 
-template <typename DeviceType>
-BoundingVolumeHierarchy<DeviceType>::BoundingVolumeHierarchy(
-    Kokkos::View<Box const *, DeviceType> bounding_boxes )
-    : _leaf_nodes( "leaf_nodes", bounding_boxes.extent( 0 ) )
-    , _internal_nodes( "internal_nodes", bounding_boxes.extent( 0 ) > 0
-                                             ? bounding_boxes.extent( 0 ) - 1
-                                             : 0 )
-    , _indices( "sorted_indices", bounding_boxes.extent( 0 ) )
+namespace Details
 {
-    using ExecutionSpace = typename DeviceType::execution_space;
+// Default-construct the nodes on the execution space instance rather than
+// relying on the View constructor that initializes memory on the default
+// instance.
+template <typename ExecutionSpace, typename Node, typename DeviceType>
+void initializeNodes( ExecutionSpace const &space,
+                      Kokkos::View<Node *, DeviceType> nodes )
+{
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "initialize_nodes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, nodes.extent( 0 ) ),
+        KOKKOS_LAMBDA( int i ) { nodes( i ) = Node(); } );
+}
+} // namespace Details
+
+template <typename DeviceType, typename BoundingVolume>
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::BoundingVolumeHierarchy(
+    Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+    BVHConstruction construction, SpaceFillingCurve curve )
+    : BoundingVolumeHierarchy( ExecutionSpace{}, bounding_volumes,
+                               construction, curve )
+{
+    Kokkos::fence();
+}
+
+template <typename DeviceType, typename BoundingVolume>
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::BoundingVolumeHierarchy(
+    ExecutionSpace const &space,
+    Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+    BVHConstruction construction, SpaceFillingCurve curve )
+    : _leaf_nodes( Kokkos::ViewAllocateWithoutInitializing( "leaf_nodes" ),
+                   bounding_volumes.extent( 0 ) )
+    , _internal_nodes(
+          Kokkos::ViewAllocateWithoutInitializing( "internal_nodes" ),
+          bounding_volumes.extent( 0 ) > 0 ? bounding_volumes.extent( 0 ) - 1
+                                           : 0 )
+    , _indices( Kokkos::ViewAllocateWithoutInitializing( "sorted_indices" ),
+                bounding_volumes.extent( 0 ) )
+{
+    using TreeConstruction =
+        Details::TreeConstruction<DeviceType, BoundingVolume>;
 
     if ( empty() )
     {
         return;
     }
 
+    Details::initializeNodes( space, _leaf_nodes );
+    Details::initializeNodes( space, _internal_nodes );
+
     if ( size() == 1 )
     {
-        iota( _indices );
-        Kokkos::parallel_for( DTK_MARK_REGION( "set_bounding_boxes" ),
-                              Kokkos::RangePolicy<ExecutionSpace>( 0, 1 ),
-                              SetBoundingBoxesFunctor<DeviceType>(
-                                  _leaf_nodes, _indices, bounding_boxes ) );
-        Kokkos::fence();
+        iota( space, _indices );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "set_bounding_volumes" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, 1 ),
+            SetBoundingVolumesFunctor<DeviceType, BoundingVolume>(
+                _leaf_nodes, _indices, bounding_volumes ) );
         return;
     }
 
-    // determine the bounding box of the scene
-    Details::TreeConstruction<DeviceType>::calculateBoundingBoxOfTheScene(
-        bounding_boxes, _internal_nodes[0].bounding_box );
-
-    // calculate morton code of all objects
-    int const n = bounding_boxes.extent( 0 );
-    Kokkos::View<unsigned int *, DeviceType> morton_indices( "morton", n );
-    Details::TreeConstruction<DeviceType>::assignMortonCodes(
-        bounding_boxes, morton_indices, _internal_nodes[0].bounding_box );
-
-    // sort them along the Z-order space-filling curve
-    iota( _indices );
-    Details::TreeConstruction<DeviceType>::sortObjects( morton_indices,
-                                                        _indices );
-
-    // generate bounding volume hierarchy
-    Kokkos::parallel_for( DTK_MARK_REGION( "set_bounding_boxes" ),
-                          Kokkos::RangePolicy<ExecutionSpace>( 0, n ),
-                          SetBoundingBoxesFunctor<DeviceType>(
-                              _leaf_nodes, _indices, bounding_boxes ) );
-    Kokkos::fence();
-    Details::TreeConstruction<DeviceType>::generateHierarchy(
-        morton_indices, _leaf_nodes, _internal_nodes );
+    int const n = bounding_volumes.extent( 0 );
+    if ( construction == BVHConstruction::BinnedSAH )
+    {
+        // split the objects top-down and sort them in the process
+        TreeConstruction::generateHierarchyBinnedSAH(
+            space, bounding_volumes, _indices, _leaf_nodes, _internal_nodes );
+    }
+    else
+    {
+        // determine the bounding box of the scene
+        Box scene_bounding_box;
+        TreeConstruction::calculateBoundingBoxOfTheScene(
+            space, bounding_volumes, scene_bounding_box );
+
+        // calculate morton code of all objects
+        Kokkos::View<unsigned int *, DeviceType> morton_indices(
+            Kokkos::ViewAllocateWithoutInitializing( "morton" ), n );
+        TreeConstruction::assignMortonCodes( space, bounding_volumes,
+                                             morton_indices,
+                                             scene_bounding_box, curve );
+
+        // sort them along the space-filling curve
+        iota( space, _indices );
+        TreeConstruction::sortObjects( space, morton_indices, _indices );
+
+        // generate bounding volume hierarchy
+        TreeConstruction::generateHierarchy( space, morton_indices,
+                                             _leaf_nodes, _internal_nodes );
+    }
 
-    // calculate bounding box for each internal node by walking the hierarchy
-    // toward the root
-    Details::TreeConstruction<DeviceType>::calculateBoundingBoxes(
-        _leaf_nodes, _internal_nodes );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "set_bounding_volumes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        SetBoundingVolumesFunctor<DeviceType, BoundingVolume>(
+            _leaf_nodes, _indices, bounding_volumes ) );
+
+    // calculate bounding volume for each internal node by walking the
+    // hierarchy toward the root
+    TreeConstruction::calculateBoundingVolumes( space, _leaf_nodes,
+                                                _internal_nodes );
+
+    // lay out the internal nodes in the order the traversal visits them
+    TreeConstruction::sortInternalNodesDepthFirst( space, _leaf_nodes,
+                                                   _internal_nodes );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+void BoundingVolumeHierarchy<DeviceType, BoundingVolume>::allNearest(
+    int k, Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset,
+    Kokkos::View<double *, DeviceType> &distances, bool exclude_self ) const
+{
+    allNearest( ExecutionSpace{}, k, indices, offset, distances, exclude_self )
+        .wait();
+}
+
+template <typename DeviceType, typename BoundingVolume>
+Future<typename DeviceType::execution_space>
+BoundingVolumeHierarchy<DeviceType, BoundingVolume>::allNearest(
+    ExecutionSpace const &space, int k,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset,
+    Kokkos::View<double *, DeviceType> &distances, bool exclude_self ) const
+{
+    using Traversal = Details::TreeTraversal<DeviceType, BoundingVolume>;
+
+    int const n = size();
+    // same number of neighbors for all objects
+    int const n_neighbors = KokkosHelpers::max(
+        KokkosHelpers::min( k, exclude_self ? n - 1 : n ), 0 );
+
+    offset = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( offset.label() ), n + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "set_offset_of_all_nearest_neighbors" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n + 1 ),
+        KOKKOS_LAMBDA( int i ) { offset( i ) = i * n_neighbors; } );
+
+    indices = Kokkos::View<int *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        n * n_neighbors );
+    distances = Kokkos::View<double *, DeviceType>(
+        Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+        n * n_neighbors );
+
+    // The queries are processed in the order of the leaves so that
+    // consecutive threads search the same region of the tree.
+    auto const bvh = *this;
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "perform_all_nearest_queries" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        KOKKOS_LAMBDA( int position ) {
+            auto const leaf = Traversal::getLeaf( bvh, position );
+            int const i = Traversal::getIndex( bvh, leaf );
+            Details::allNearestQuery( bvh, leaf, n_neighbors, exclude_self,
+                                      indices.data() + offset( i ),
+                                      distances.data() + offset( i ) );
+        } );
+    return Future<ExecutionSpace>( space );
 }
 
 } // namespace DataTransferKit
 
 // Explicit instantiation macro
 #define DTK_LINEAR_BVH_INSTANT( NODE )                                         \
-    template class BoundingVolumeHierarchy<typename NODE::device_type>;
+    template class BoundingVolumeHierarchy<typename NODE::device_type, Box>;   \
+    template class BoundingVolumeHierarchy<typename NODE::device_type,         \
+                                           Sphere>;                            \
+    template class BoundingVolumeHierarchy<typename NODE::device_type,         \
+                                           KDOP<14>>;                          \
+    template class BoundingVolumeHierarchy<typename NODE::device_type,         \
+                                           KDOP<18>>;                          \
+    template class BoundingVolumeHierarchy<typename NODE::device_type,         \
+                                           KDOP<26>>;
 
 #endif
@@ -0,0 +1,241 @@
+/****************************************************************************
+ * Copyright (c) 2012-2018 by the DataTransferKit authors                   *
+ * All rights reserved.                                                     *
+ *                                                                          *
+ * This file is part of the DataTransferKit library. DataTransferKit is     *
+ * distributed under a BSD 3-clause license. For the licensing terms see    *
+ * the LICENSE file in the top-level directory.                             *
+ *                                                                          *
+ * SPDX-License-Identifier: BSD-3-Clause                                    *
+ ****************************************************************************/
+
+#ifndef DTK_SPACE_FILLING_CURVE_HPP
+#define DTK_SPACE_FILLING_CURVE_HPP
+
+#include "DTK_ConfigDefs.hpp"
+
+#include <DTK_Box.hpp>
+#include <DTK_DBC.hpp>
+#include <DTK_DetailsAlgorithms.hpp> // expand
+#include <DTK_DetailsTreeConstruction.hpp>
+#include <DTK_DetailsUtils.hpp> // iota
+
+#include <Kokkos_Core.hpp>
+
+#include <type_traits>
+
+namespace DataTransferKit
+{
+namespace Details
+{
+// Boxes are used as they are.
+template <typename ExecutionSpace, typename DeviceType>
+Kokkos::View<Box const *, DeviceType>
+boundingBoxes( ExecutionSpace const &,
+               Kokkos::View<Box const *, DeviceType> boxes )
+{
+    return boxes;
+}
+
+// Any other geometry (points, spheres, k-DOPs) is enclosed in an axis-aligned
+// box first since the scene bounding box and the codes are computed from
+// boxes.
+template <typename ExecutionSpace, typename DeviceType, typename Geometry>
+Kokkos::View<Box const *, DeviceType>
+boundingBoxes( ExecutionSpace const &space,
+               Kokkos::View<Geometry const *, DeviceType> geometries )
+{
+    int const n = geometries.extent( 0 );
+    Kokkos::View<Box *, DeviceType> boxes(
+        Kokkos::ViewAllocateWithoutInitializing( "bounding_boxes" ), n );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "compute_bounding_boxes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        KOKKOS_LAMBDA( int i ) {
+            Box box;
+            expand( box, geometries( i ) );
+            boxes( i ) = box;
+        } );
+    return boxes;
+}
+} // namespace Details
+
+/** \brief Computes the permutation that orders objects along a space-filling
+ *  curve.
+ *
+ *  This is the ordering the bounding volume hierarchy uses for its leaves
+ *  (Z-order unless another \p curve is requested).  The codes are computed
+ *  from the centroid of the axis-aligned bounding box of each object,
+ *  expressed relative to the bounding box of the scene.
+ *  \p geometries may hold points, boxes, spheres or k-DOPs.
+ *
+ *  On output, <tt>permutation(i)</tt> is the index in \p geometries of the
+ *  object at position \c i along the curve.  Use applyPermutation() to
+ *  reorder the objects and any data attached to them, and
+ *  applyInversePermutation() to bring results back in the original order.
+ *
+ *  The work is enqueued on \p space.  The reduction into the scene bounding
+ *  box and the sort of the codes wait for the instance.
+ */
+template <typename ExecutionSpace, typename Geometry, typename... P>
+typename std::enable_if<
+    Kokkos::Impl::is_execution_space<ExecutionSpace>::value,
+    Kokkos::View<int *, typename Kokkos::View<Geometry *, P...>::device_type>>::
+    type
+    computeSpaceFillingCurvePermutation(
+        ExecutionSpace const &space,
+        Kokkos::View<Geometry *, P...> const &geometries,
+        SpaceFillingCurve curve = SpaceFillingCurve::Morton )
+{
+    using DeviceType = typename Kokkos::View<Geometry *, P...>::device_type;
+    using TreeConstruction = Details::TreeConstruction<DeviceType, Box>;
+    using ValueType = typename std::remove_const<Geometry>::type;
+
+    int const n = geometries.extent( 0 );
+    Kokkos::View<int *, DeviceType> permutation(
+        Kokkos::ViewAllocateWithoutInitializing( "permutation" ), n );
+    iota( space, permutation );
+    if ( n < 2 )
+        return permutation;
+
+    auto const boxes = Details::boundingBoxes(
+        space, Kokkos::View<ValueType const *, DeviceType>( geometries ) );
+
+    Box scene_bounding_box;
+    TreeConstruction::calculateBoundingBoxOfTheScene( space, boxes,
+                                                      scene_bounding_box );
+
+    Kokkos::View<unsigned int *, DeviceType> morton_codes(
+        Kokkos::ViewAllocateWithoutInitializing( "morton" ), n );
+    TreeConstruction::assignMortonCodes( space, boxes, morton_codes,
+                                         scene_bounding_box, curve );
+
+    TreeConstruction::sortObjects( space, morton_codes, permutation );
+
+    return permutation;
+}
+
+/** \brief Computes the permutation that orders objects along a space-filling
+ *  curve.
+ *
+ *  Calls \c computeSpaceFillingCurvePermutation(space, geometries, curve) on
+ *  a default instance of the execution space of \p geometries and waits for
+ *  it to complete.
+ */
+template <typename Geometry, typename... P>
+Kokkos::View<int *, typename Kokkos::View<Geometry *, P...>::device_type>
+computeSpaceFillingCurvePermutation(
+    Kokkos::View<Geometry *, P...> const &geometries,
+    SpaceFillingCurve curve = SpaceFillingCurve::Morton )
+{
+    using ExecutionSpace =
+        typename Kokkos::View<Geometry *, P...>::execution_space;
+    auto const permutation = computeSpaceFillingCurvePermutation(
+        ExecutionSpace{}, geometries, curve );
+    Kokkos::fence();
+    return permutation;
+}
+
+/** \brief Reorders the entries of a view according to a permutation.
+ *
+ *  On output, <tt>v(i, j)</tt> holds what used to be
+ *  <tt>v(permutation(i), j)</tt>.  Rank-1 and rank-2 views are supported;
+ *  rows of rank-2 views are moved as a whole.  The view is modified in place
+ *  so that other views that share its allocation see the new order.
+ *
+ *  \pre \p permutation and \p v have the same extent along the first
+ *  dimension and \p permutation is a permutation of [0, n).
+ */
+template <typename ExecutionSpace, typename PermutationView, typename T,
+          typename... P>
+typename std::enable_if<
+    Kokkos::Impl::is_execution_space<ExecutionSpace>::value>::type
+applyPermutation( ExecutionSpace const &space,
+                  PermutationView const &permutation,
+                  Kokkos::View<T, P...> const &v )
+{
+    using ViewType = Kokkos::View<T, P...>;
+    static_assert( ViewType::rank <= 2,
+                   "applyPermutation() requires rank-1 or rank-2 views" );
+    DTK_REQUIRE( permutation.extent( 0 ) == v.extent( 0 ) );
+    int const n = v.extent( 0 );
+    int const m = v.extent( 1 );
+    typename ViewType::non_const_type tmp(
+        Kokkos::ViewAllocateWithoutInitializing( v.label() ), n, m );
+    Kokkos::deep_copy( space, tmp, v );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "apply_permutation" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        KOKKOS_LAMBDA( int i ) {
+            for ( int j = 0; j < m; ++j )
+                v( i, j ) = tmp( permutation( i ), j );
+        } );
+}
+
+/** \brief Reorders the entries of a view according to a permutation.
+ *
+ *  Calls \c applyPermutation(space, permutation, v) on a default instance of
+ *  the execution space of \p v and waits for it to complete.
+ */
+template <typename PermutationView, typename T, typename... P>
+void applyPermutation( PermutationView const &permutation,
+                       Kokkos::View<T, P...> const &v )
+{
+    using ExecutionSpace = typename Kokkos::View<T, P...>::execution_space;
+    applyPermutation( ExecutionSpace{}, permutation, v );
+    Kokkos::fence();
+}
+
+/** \brief Undoes the reordering of applyPermutation().
+ *
+ *  On output, <tt>v(permutation(i), j)</tt> holds what used to be
+ *  <tt>v(i, j)</tt>.  This is the operation to use to scatter results that
+ *  were computed in the order of the curve back to the original order.
+ *
+ *  \pre \p permutation and \p v have the same extent along the first
+ *  dimension and \p permutation is a permutation of [0, n).
+ */
+template <typename ExecutionSpace, typename PermutationView, typename T,
+          typename... P>
+typename std::enable_if<
+    Kokkos::Impl::is_execution_space<ExecutionSpace>::value>::type
+applyInversePermutation( ExecutionSpace const &space,
+                         PermutationView const &permutation,
+                         Kokkos::View<T, P...> const &v )
+{
+    using ViewType = Kokkos::View<T, P...>;
+    static_assert(
+        ViewType::rank <= 2,
+        "applyInversePermutation() requires rank-1 or rank-2 views" );
+    DTK_REQUIRE( permutation.extent( 0 ) == v.extent( 0 ) );
+    int const n = v.extent( 0 );
+    int const m = v.extent( 1 );
+    typename ViewType::non_const_type tmp(
+        Kokkos::ViewAllocateWithoutInitializing( v.label() ), n, m );
+    Kokkos::deep_copy( space, tmp, v );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "apply_inverse_permutation" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        KOKKOS_LAMBDA( int i ) {
+            for ( int j = 0; j < m; ++j )
+                v( permutation( i ), j ) = tmp( i, j );
+        } );
+}
+
+/** \brief Undoes the reordering of applyPermutation().
+ *
+ *  Calls \c applyInversePermutation(space, permutation, v) on a default
+ *  instance of the execution space of \p v and waits for it to complete.
+ */
+template <typename PermutationView, typename T, typename... P>
+void applyInversePermutation( PermutationView const &permutation,
+                              Kokkos::View<T, P...> const &v )
+{
+    using ExecutionSpace = typename Kokkos::View<T, P...>::execution_space;
+    applyInversePermutation( ExecutionSpace{}, permutation, v );
+    Kokkos::fence();
+}
+
+} // namespace DataTransferKit
+
+#endif
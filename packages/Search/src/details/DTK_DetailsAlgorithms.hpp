@@ -12,6 +12,7 @@
 #define DTK_DETAILS_ALGORITHMS_HPP
 
 #include <DTK_Box.hpp>
+#include <DTK_KDOP.hpp>
 #include <DTK_KokkosHelpers.hpp> // isFinite, min, max
 #include <DTK_Point.hpp>
 #include <DTK_Sphere.hpp>
@@ -45,6 +46,16 @@ bool equals( Sphere const &l, Sphere const &r )
     return equals( l.centroid(), r.centroid() ) && l.radius() == r.radius();
 }
 
+template <int k>
+KOKKOS_INLINE_FUNCTION bool equals( KDOP<k> const &l, KDOP<k> const &r )
+{
+    for ( int i = 0; i < KDOP<k>::n_directions; ++i )
+        if ( l.minValue( i ) != r.minValue( i ) ||
+             l.maxValue( i ) != r.maxValue( i ) )
+            return false;
+    return true;
+}
+
 KOKKOS_INLINE_FUNCTION
 bool isValid( Point const &p )
 {
@@ -69,6 +80,17 @@ bool isValid( Sphere const &s )
            ( s.radius() >= 0. );
 }
 
+template <int k>
+KOKKOS_INLINE_FUNCTION bool isValid( KDOP<k> const &kdop )
+{
+    using KokkosHelpers::isFinite;
+    for ( int i = 0; i < KDOP<k>::n_directions; ++i )
+        if ( !isFinite( kdop.minValue( i ) ) ||
+             !isFinite( kdop.maxValue( i ) ) )
+            return false;
+    return true;
+}
+
 // distance point-point
 KOKKOS_INLINE_FUNCTION
 double distance( Point const &a, Point const &b )
@@ -107,6 +129,40 @@ double distance( Point const &point, Sphere const &sphere )
         distance( point, sphere.centroid() ) - sphere.radius(), 0. );
 }
 
+// distance point-kdop
+// NOTE: Computing the exact distance to a polytope is expensive.  This returns
+// a lower bound: the largest of the distance to the axis-aligned slabs and of
+// the distances to each of the diagonal slabs.  It is exact if the k-DOP
+// reduces to a single point and it is zero if and only if the point is inside
+// the k-DOP.  Nearest queries on k-DOP trees report and rank by this bound
+// (see BoundingVolumeHierarchy).
+template <int k>
+KOKKOS_INLINE_FUNCTION double distance( Point const &point,
+                                        KDOP<k> const &kdop )
+{
+    using KokkosHelpers::max;
+    Box box;
+    for ( int d = 0; d < 3; ++d )
+    {
+        box.minCorner()[d] = kdop.minValue( d );
+        box.maxCorner()[d] = kdop.maxValue( d );
+    }
+    double distance_to_slabs = distance( point, box );
+    for ( int i = 3; i < KDOP<k>::n_directions; ++i )
+    {
+        int n[3];
+        KDOP<k>::direction( i, n );
+        double const norm =
+            std::sqrt( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] );
+        double const projected_point = KDOP<k>::project( i, point );
+        double const outside =
+            max( kdop.minValue( i ) - projected_point,
+                 max( projected_point - kdop.maxValue( i ), 0. ) );
+        distance_to_slabs = max( distance_to_slabs, outside / norm );
+    }
+    return distance_to_slabs;
+}
+
 // expand an axis-aligned bounding box to include a point
 KOKKOS_INLINE_FUNCTION
 void expand( Box &box, Point const &point )
@@ -125,8 +181,8 @@ void expand( Box &box, Point const &point )
 // Kokkos::parallel_reduce() in which case the arguments must be declared
 // volatile.
 template <typename BOX,
-          typename = std::enable_if<std::is_same<
-              typename std::remove_volatile<BOX>::type, Box>::value>>
+          typename = typename std::enable_if<std::is_same<
+              typename std::remove_volatile<BOX>::type, Box>::value>::type>
 KOKKOS_INLINE_FUNCTION void expand( BOX &box, BOX const &other )
 {
     for ( int d = 0; d < 3; ++d )
@@ -151,6 +207,126 @@ void expand( Box &box, Sphere const &sphere )
     }
 }
 
+// expand an axis-aligned bounding box to include a kdop
+template <int k>
+KOKKOS_INLINE_FUNCTION void expand( Box &box, KDOP<k> const &kdop )
+{
+    // the first three directions of a k-DOP are the coordinate axes
+    for ( int d = 0; d < 3; ++d )
+    {
+        box.minCorner()[d] =
+            KokkosHelpers::min( box.minCorner()[d], kdop.minValue( d ) );
+        box.maxCorner()[d] =
+            KokkosHelpers::max( box.maxCorner()[d], kdop.maxValue( d ) );
+    }
+}
+
+// expand a sphere to include another sphere (smallest enclosing sphere)
+KOKKOS_INLINE_FUNCTION
+void expand( Sphere &sphere, Sphere const &other )
+{
+    double const d = distance( sphere.centroid(), other.centroid() );
+    if ( d + other.radius() <= sphere.radius() )
+        return;
+    if ( d + sphere.radius() <= other.radius() )
+    {
+        sphere = other;
+        return;
+    }
+    double const radius = 0.5 * ( d + sphere.radius() + other.radius() );
+    double const ratio = ( radius - sphere.radius() ) / d;
+    Point centroid;
+    for ( int i = 0; i < 3; ++i )
+        centroid[i] =
+            sphere.centroid()[i] +
+            ratio * ( other.centroid()[i] - sphere.centroid()[i] );
+    // guard against round-off so that both spheres are indeed enclosed
+    using KokkosHelpers::max;
+    sphere = Sphere(
+        centroid,
+        max( radius,
+             max( distance( centroid, sphere.centroid() ) + sphere.radius(),
+                  distance( centroid, other.centroid() ) + other.radius() ) ) );
+}
+
+// expand a sphere to include a point
+KOKKOS_INLINE_FUNCTION
+void expand( Sphere &sphere, Point const &point )
+{
+    expand( sphere, Sphere( point, 0. ) );
+}
+
+// expand a sphere to include an axis-aligned bounding box
+KOKKOS_INLINE_FUNCTION
+void expand( Sphere &sphere, Box const &box )
+{
+    Point c;
+    for ( int d = 0; d < 3; ++d )
+        c[d] = 0.5 * ( box.minCorner()[d] + box.maxCorner()[d] );
+    expand( sphere, Sphere( c, distance( c, box.minCorner() ) ) );
+}
+
+// expand a kdop to include a point
+template <int k>
+KOKKOS_INLINE_FUNCTION void expand( KDOP<k> &kdop, Point const &point )
+{
+    using KokkosHelpers::max;
+    using KokkosHelpers::min;
+    for ( int i = 0; i < KDOP<k>::n_directions; ++i )
+    {
+        double const projected_point = KDOP<k>::project( i, point );
+        kdop.minValue( i ) = min( kdop.minValue( i ), projected_point );
+        kdop.maxValue( i ) = max( kdop.maxValue( i ), projected_point );
+    }
+}
+
+// expand a kdop to include another kdop
+template <int k>
+KOKKOS_INLINE_FUNCTION void expand( KDOP<k> &kdop, KDOP<k> const &other )
+{
+    using KokkosHelpers::max;
+    using KokkosHelpers::min;
+    for ( int i = 0; i < KDOP<k>::n_directions; ++i )
+    {
+        kdop.minValue( i ) = min( kdop.minValue( i ), other.minValue( i ) );
+        kdop.maxValue( i ) = max( kdop.maxValue( i ), other.maxValue( i ) );
+    }
+}
+
+// expand a kdop to include an axis-aligned bounding box
+template <int k>
+KOKKOS_INLINE_FUNCTION void expand( KDOP<k> &kdop, Box const &box )
+{
+    // the extremal projections of a box are attained at its corners
+    for ( int i = 0; i < 8; ++i )
+    {
+        Point corner;
+        for ( int d = 0; d < 3; ++d )
+            corner[d] = ( i & ( 1 << d ) ) ? box.maxCorner()[d]
+                                           : box.minCorner()[d];
+        expand( kdop, corner );
+    }
+}
+
+// expand a kdop to include a sphere
+template <int k>
+KOKKOS_INLINE_FUNCTION void expand( KDOP<k> &kdop, Sphere const &sphere )
+{
+    using KokkosHelpers::max;
+    using KokkosHelpers::min;
+    for ( int i = 0; i < KDOP<k>::n_directions; ++i )
+    {
+        int n[3];
+        KDOP<k>::direction( i, n );
+        double const r = sphere.radius() *
+                         std::sqrt( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] );
+        double const projected_centroid =
+            KDOP<k>::project( i, sphere.centroid() );
+        kdop.minValue( i ) = min( kdop.minValue( i ), projected_centroid - r );
+        kdop.maxValue( i ) = max( kdop.maxValue( i ), projected_centroid + r );
+    }
+}
+
 // check if two axis-aligned bounding boxes intersect
 KOKKOS_INLINE_FUNCTION
 bool intersects( Box const &box, Box const &other )
@@ -169,6 +345,45 @@ bool intersects( Sphere const &sphere, Box const &box )
     return distance( sphere.centroid(), box ) <= sphere.radius();
 }
 
+// check if two spheres intersect
+KOKKOS_INLINE_FUNCTION
+bool intersects( Sphere const &sphere, Sphere const &other )
+{
+    return distance( sphere.centroid(), other.centroid() ) <=
+           sphere.radius() + other.radius();
+}
+
+// check if an axis-aligned bounding box intersects with a sphere
+KOKKOS_INLINE_FUNCTION
+bool intersects( Box const &box, Sphere const &sphere )
+{
+    return intersects( sphere, box );
+}
+
+// check if an axis-aligned bounding box intersects with a kdop
+// NOTE: Only the k-DOP directions are tested as separating axes so the test is
+// conservative, i.e. it may return true for some disjoint pairs but never
+// returns false for intersecting ones.
+template <int k>
+KOKKOS_INLINE_FUNCTION bool intersects( Box const &box, KDOP<k> const &kdop )
+{
+    KDOP<k> box_kdop;
+    expand( box_kdop, box );
+    for ( int i = 0; i < KDOP<k>::n_directions; ++i )
+        if ( box_kdop.minValue( i ) > kdop.maxValue( i ) ||
+             box_kdop.maxValue( i ) < kdop.minValue( i ) )
+            return false;
+    return true;
+}
+
+// check if a sphere intersects with a kdop (conservative, see distance)
+template <int k>
+KOKKOS_INLINE_FUNCTION bool intersects( Sphere const &sphere,
+                                        KDOP<k> const &kdop )
+{
+    return distance( sphere.centroid(), kdop ) <= sphere.radius();
+}
+
 // calculate the centroid of a box
 KOKKOS_INLINE_FUNCTION
 void centroid( Box const &box, Point &c )
@@ -177,6 +392,18 @@ void centroid( Box const &box, Point &c )
         c[d] = 0.5 * ( box.minCorner()[d] + box.maxCorner()[d] );
 }
 
+// calculate the centroid of a sphere
+KOKKOS_INLINE_FUNCTION
+void centroid( Sphere const &sphere, Point &c ) { c = sphere.centroid(); }
+
+// calculate the centroid of a kdop (centroid of its axis-aligned slabs)
+template <int k>
+KOKKOS_INLINE_FUNCTION void centroid( KDOP<k> const &kdop, Point &c )
+{
+    for ( int d = 0; d < 3; ++d )
+        c[d] = 0.5 * ( kdop.minValue( d ) + kdop.maxValue( d ) );
+}
+
 } // namespace Details
 } // namespace DataTransferKit
 
@@ -11,6 +11,7 @@
 #ifndef DTK_DETAILS_DISTRIBUTED_SEARCH_TREE_IMPL_HPP
 #define DTK_DETAILS_DISTRIBUTED_SEARCH_TREE_IMPL_HPP
 
+#include <DTK_DetailsDistributorCache.hpp>
 #include <DTK_DetailsPriorityQueue.hpp>
 #include <DTK_DetailsTeuchosSerializationTraits.hpp>
 #include <DTK_DetailsUtils.hpp>
@@ -19,9 +20,15 @@
 
 #include <Kokkos_Atomic.hpp>
 #include <Kokkos_Sort.hpp>
+#include <Teuchos_ArrayRCP.hpp>
 #include <Tpetra_Distributor.hpp>
 
-#include <numeric> // accumulate
+#include <algorithm> // is_sorted, lower_bound
+#include <cstring>   // memcpy
+#include <limits>
+#include <numeric>   // accumulate
+#include <tuple>
+#include <vector>
 
 namespace DataTransferKit
 {
@@ -38,13 +45,15 @@ struct DistributedSearchTreeImpl
     using ExecutionSpace = typename DeviceType::execution_space;
 
     // spatial queries
-    template <typename Query>
-    static void queryDispatch( DistributedSearchTree<DeviceType> const &tree,
-                               Kokkos::View<Query *, DeviceType> queries,
-                               Kokkos::View<int *, DeviceType> &indices,
-                               Kokkos::View<int *, DeviceType> &offset,
-                               Kokkos::View<int *, DeviceType> &ranks,
-                               Details::SpatialPredicateTag );
+    template <typename Query, typename Offset>
+    static void queryDispatch(
+        DistributedSearchTree<DeviceType> const &tree,
+        Kokkos::View<Query *, DeviceType> queries,
+        Kokkos::View<int *, DeviceType> &indices,
+        Kokkos::View<Offset *, DeviceType> &offset,
+        Kokkos::View<int *, DeviceType> &ranks, Details::SpatialPredicateTag,
+        Kokkos::View<double *, DeviceType> *distances_ptr = nullptr,
+        bool sort_by_distance = false, int max_results = -1 );
 
     // nearest neighbors queries
     template <typename Query>
@@ -56,51 +65,217 @@ struct DistributedSearchTreeImpl
         Kokkos::View<int *, DeviceType> &ranks, Details::NearestPredicateTag,
         Kokkos::View<double *, DeviceType> *distances_ptr = nullptr );
 
+    // spatial queries processed in windows of at most max_window_size
+    // queries, split in chunks of at most max_chunk_size results
+    template <typename Query, typename Callback>
+    static void
+    chunkedQueryDispatch( DistributedSearchTree<DeviceType> const &tree,
+                          Kokkos::View<Query *, DeviceType> queries,
+                          std::size_t max_chunk_size,
+                          std::size_t max_window_size,
+                          Callback const &callback );
+
+    // count-only spatial queries
+    template <typename Query>
+    static void countDispatch( DistributedSearchTree<DeviceType> const &tree,
+                               Kokkos::View<Query *, DeviceType> queries,
+                               Kokkos::View<int *, DeviceType> &counts );
+
+    // any-hit spatial queries
+    template <typename Query>
+    static void anyDispatch( DistributedSearchTree<DeviceType> const &tree,
+                             Kokkos::View<Query *, DeviceType> queries,
+                             Kokkos::View<bool *, DeviceType> &hits );
+
+    // all k nearest neighbors self query
+    static void
+    allNearestDispatch( DistributedSearchTree<DeviceType> const &tree, int k,
+                        Kokkos::View<int *, DeviceType> &indices,
+                        Kokkos::View<int *, DeviceType> &offset,
+                        Kokkos::View<int *, DeviceType> &ranks,
+                        Kokkos::View<double *, DeviceType> &distances,
+                        bool exclude_self );
+
+    // Finds the ranks owning boxes of the top tree that meet the queries.
+    // Each rank is listed once per query, where its first box was found.
+    template <typename Query>
+    static void queryTopTree( DistributedSearchTree<DeviceType> const &tree,
+                              Kokkos::View<Query *, DeviceType> queries,
+                              Kokkos::View<int *, DeviceType> &indices,
+                              Kokkos::View<int *, DeviceType> &offset );
+
+    // Same as above for a tree whose box i is owned by owner_ranks(i).
+    template <typename Query>
+    static void queryOwners( BVH<DeviceType> const &bvh,
+                             Kokkos::View<int *, DeviceType> owner_ranks,
+                             Kokkos::View<Query *, DeviceType> queries,
+                             Kokkos::View<int *, DeviceType> &indices,
+                             Kokkos::View<int *, DeviceType> &offset );
+
     template <typename Query>
     static void deviseStrategy( Kokkos::View<Query *, DeviceType> queries,
                                 DistributedSearchTree<DeviceType> const &tree,
                                 Kokkos::View<int *, DeviceType> &indices,
-                                Kokkos::View<int *, DeviceType> &offset,
-                                Kokkos::View<double *, DeviceType> & );
+                                Kokkos::View<int *, DeviceType> &offset );
 
+    // On entry, indices and offset hold the ranks visited in the 1st pass.
+    // On exit, they hold the ranks that were not visited yet and may have
+    // neighbors closer than the ones found so far.
     template <typename Query>
     static void
     reassessStrategy( Kokkos::View<Query *, DeviceType> queries,
                       DistributedSearchTree<DeviceType> const &tree,
+                      Kokkos::View<int *, DeviceType> results_offset,
+                      Kokkos::View<double *, DeviceType> distances,
                       Kokkos::View<int *, DeviceType> &indices,
                       Kokkos::View<int *, DeviceType> &offset,
-                      Kokkos::View<double *, DeviceType> &distances );
-
-    template <typename Query>
-    static void forwardQueries( Teuchos::RCP<Teuchos::Comm<int> const> comm,
+                      Kokkos::View<Query *, DeviceType> &bounded_queries );
+
+    // Sends the queries to the ranks indices(offset(q)), ...,
+    // indices(offset(q+1)-1).  The queries destined to the local process do
+    // not go through the network.  They are passed to local_work() while the
+    // other ones are in flight and their ids are returned in local_ids.
+    template <typename Query, typename LocalWork>
+    static void forwardQueries( DistributorCache &distributor_cache,
+                                Kokkos::View<Query *, DeviceType> queries,
+                                Kokkos::View<int *, DeviceType> indices,
+                                Kokkos::View<int *, DeviceType> offset,
+                                Kokkos::View<Query *, DeviceType> &fwd_queries,
+                                Kokkos::View<int *, DeviceType> &fwd_ids,
+                                Kokkos::View<int *, DeviceType> &fwd_ranks,
+                                Kokkos::View<int *, DeviceType> &local_ids,
+                                LocalWork const &local_work );
+
+    // Same as above if the processes of the tree are not grouped in nodes.
+    // Otherwise, indices hold the nodes to send the queries to.  Each query
+    // is first sent to one process of the node, which forwards it within the
+    // node to the processes that may satisfy it.  There is no local query
+    // and local_work() is passed an empty view.  If skip_origin is true, the
+    // queries are not forwarded back to the process they come from.
+    template <typename Query, typename LocalWork>
+    static void forwardQueries( DistributedSearchTree<DeviceType> const &tree,
                                 Kokkos::View<Query *, DeviceType> queries,
                                 Kokkos::View<int *, DeviceType> indices,
                                 Kokkos::View<int *, DeviceType> offset,
                                 Kokkos::View<Query *, DeviceType> &fwd_queries,
                                 Kokkos::View<int *, DeviceType> &fwd_ids,
-                                Kokkos::View<int *, DeviceType> &fwd_ranks );
+                                Kokkos::View<int *, DeviceType> &fwd_ranks,
+                                Kokkos::View<int *, DeviceType> &local_ids,
+                                LocalWork const &local_work,
+                                bool skip_origin = false );
+
+    // Predicates used to search the node tree for the processes that may
+    // satisfy the queries.  Nearest predicates are turned into spatial ones
+    // within their radius.
+    template <typename Query>
+    static Kokkos::View<Query *, DeviceType>
+    nodeTreeQueries( Kokkos::View<Query *, DeviceType> queries,
+                     SpatialPredicateTag )
+    {
+        return queries;
+    }
 
+    template <typename Query>
+    static Kokkos::View<Within *, DeviceType>
+    nodeTreeQueries( Kokkos::View<Query *, DeviceType> queries,
+                     NearestPredicateTag );
+
+    // Redistributes the objects so that each process holds a contiguous
+    // segment of the space-filling curve through all of them, with about as
+    // many objects as the other processes.  Returns the process and the
+    // index each object was passed in with.
+    static void
+    partitionAlongCurve( DistributorCache &distributor_cache,
+                         Kokkos::View<Box const *, DeviceType> boxes,
+                         SpaceFillingCurve curve,
+                         Kokkos::View<Box *, DeviceType> &new_boxes,
+                         Kokkos::View<int *, DeviceType> &original_ranks,
+                         Kokkos::View<int *, DeviceType> &original_indices );
+
+    // Replaces the indices of objects in the local tree by the indices they
+    // were passed to the constructor with and returns the processes that
+    // passed them.
+    static void
+    mapToOriginalOwners( DistributedSearchTree<DeviceType> const &tree,
+                         Kokkos::View<int *, DeviceType> indices,
+                         Kokkos::View<int *, DeviceType> &owner_ranks );
+
+    // The objects indices(i) are owned by the processes owner_ranks(i).
+    // Unless the tree was repartitioned, the owners are the processes that
+    // send the results and owner_ranks is not sent.  The distances are sent
+    // as float if the tree allows it.
+    template <typename Offset>
     static void communicateResultsBack(
-        Teuchos::RCP<Teuchos::Comm<int> const> comm,
+        DistributedSearchTree<DeviceType> const &tree,
         Kokkos::View<int *, DeviceType> &indices,
-        Kokkos::View<int *, DeviceType> offset,
+        Kokkos::View<int *, DeviceType> owner_ranks,
+        Kokkos::View<Offset *, DeviceType> offset,
         Kokkos::View<int *, DeviceType> &ranks,
         Kokkos::View<int *, DeviceType> &ids,
         Kokkos::View<double *, DeviceType> *distances_ptr = nullptr );
 
+    // Appends the results of the queries that were performed locally to the
+    // ones received from the other processes.  The results of query
+    // local_ids(j) are local_indices(local_offset(j)), ...,
+    // local_indices(local_offset(j+1)-1), owned by the processes
+    // local_owner_ranks(local_offset(j)), ...
+    template <typename Offset>
+    static void
+    mergeLocalResults( Kokkos::View<int *, DeviceType> local_ids,
+                       Kokkos::View<int *, DeviceType> local_indices,
+                       Kokkos::View<int *, DeviceType> local_owner_ranks,
+                       Kokkos::View<Offset *, DeviceType> local_offset,
+                       Kokkos::View<double *, DeviceType> local_distances,
+                       Kokkos::View<int *, DeviceType> &indices,
+                       Kokkos::View<int *, DeviceType> &ranks,
+                       Kokkos::View<int *, DeviceType> &ids,
+                       Kokkos::View<double *, DeviceType> *distances_ptr );
+
+    static void
+    communicateCountsBack( DistributorCache &distributor_cache,
+                           Kokkos::View<int *, DeviceType> ranks,
+                           Kokkos::View<int *, DeviceType> &ids,
+                           Kokkos::View<int *, DeviceType> &counts,
+                           bool send_counts = true );
+
     template <typename Query>
     static void filterResults( Kokkos::View<Query *, DeviceType> queries,
-                               Kokkos::View<double *, DeviceType> distances,
+                               Kokkos::View<double *, DeviceType> &distances,
                                Kokkos::View<int *, DeviceType> &indices,
                                Kokkos::View<int *, DeviceType> &offset,
                                Kokkos::View<int *, DeviceType> &ranks );
 
+    // Sends the results held in the tuples together with the distances, as
+    // float if the tree allows it.
+    template <typename... ExportViews, typename... ImportViews>
+    static void sendResultsAcrossNetwork(
+        DistributedSearchTree<DeviceType> const &tree,
+        Tpetra::Distributor &distributor,
+        Kokkos::View<std::size_t *, DeviceType> permute,
+        std::tuple<ExportViews...> exports, std::tuple<ImportViews...> imports,
+        Kokkos::View<double *, DeviceType> *distances_ptr );
+
+    // Returns the cached plan for sending entry i of the exports to process
+    // export_ranks(i).  The plan expects the exports grouped by destination
+    // and permute(i) is the position of entry i once they are.
+    static Tpetra::Distributor &
+    getDistributor( DistributorCache &distributor_cache,
+                    Kokkos::View<int *, DeviceType> export_ranks,
+                    Kokkos::View<std::size_t *, DeviceType> &permute );
+
+    // Returns the process each entry received with the distributor comes
+    // from.  The imports are laid out by process in the order given by
+    // getProcsFrom().
+    static Kokkos::View<int *, DeviceType>
+    importSources( Tpetra::Distributor const &distributor );
+
     template <typename View, typename... OtherViews>
     static void sortResults( View keys, OtherViews... other_views );
 
+    template <typename Offset>
     static void countResults( int n_queries,
                               Kokkos::View<int *, DeviceType> query_ids,
-                              Kokkos::View<int *, DeviceType> &offset );
+                              Kokkos::View<Offset *, DeviceType> &offset );
 
     // NOTE: Would love to pass the distributor as a const reference but
     // unfortunately the methods for executing the communication plan (e.g.
@@ -110,6 +285,184 @@ struct DistributedSearchTreeImpl
     static typename std::enable_if<Kokkos::is_view<View>::value>::type
     sendAcrossNetwork( Tpetra::Distributor &distributor, View exports,
                        typename View::non_const_type imports );
+
+    // Same as above but calls work() while the messages are in flight.
+    // work() must not access the imports.
+    template <typename View, typename Work>
+    static typename std::enable_if<Kokkos::is_view<View>::value>::type
+    sendAcrossNetwork( Tpetra::Distributor &distributor, View exports,
+                       typename View::non_const_type imports,
+                       Work const &work );
+
+    // Sends several rank-1 views with the same communication plan.  They go
+    // in a single message per process instead of one message per view: the
+    // entries with the same index in all the views are packed together in a
+    // buffer of bytes.  A single view in host memory is sent without staging.
+    // Use std::tie() to build the tuples.
+    template <typename... ExportViews, typename... ImportViews>
+    static void sendAcrossNetwork( Tpetra::Distributor &distributor,
+                                   std::tuple<ExportViews...> exports,
+                                   std::tuple<ImportViews...> imports );
+
+    template <typename... ExportViews, typename... ImportViews,
+              typename Work>
+    static void sendAcrossNetwork( Tpetra::Distributor &distributor,
+                                   std::tuple<ExportViews...> exports,
+                                   std::tuple<ImportViews...> imports,
+                                   Work const &work );
+
+    // Same as above for a plan returned by getDistributor().  Entry i of the
+    // exports is packed at position permute(i) of the buffer.
+    template <typename... ExportViews, typename... ImportViews>
+    static void
+    sendAcrossNetwork( Tpetra::Distributor &distributor,
+                       Kokkos::View<std::size_t *, DeviceType> permute,
+                       std::tuple<ExportViews...> exports,
+                       std::tuple<ImportViews...> imports );
+
+    template <typename... ExportViews, typename... ImportViews,
+              typename Work>
+    static void
+    sendAcrossNetwork( Tpetra::Distributor &distributor,
+                       Kokkos::View<std::size_t *, DeviceType> permute,
+                       std::tuple<ExportViews...> exports,
+                       std::tuple<ImportViews...> imports, Work const &work );
+};
+
+// Copies the entries of the I-th to (N-1)-th views of a tuple to or from a
+// buffer holding one packet of bytes per entry.  Each entry is copied with a
+// single memcpy() since it is not aligned in the buffer.  Entry i is packed
+// in the packet permute(i), or i if permute is empty.
+template <typename DeviceType, std::size_t I, std::size_t N>
+struct PackViews
+{
+    using ExecutionSpace = typename DeviceType::execution_space;
+    using Buffer = Kokkos::View<char **, Kokkos::LayoutRight, DeviceType>;
+
+    template <typename Tuple>
+    static std::size_t packetSize()
+    {
+        using View = typename std::decay<
+            typename std::tuple_element<I, Tuple>::type>::type;
+        return sizeof( typename View::non_const_value_type ) +
+               PackViews<DeviceType, I + 1, N>::template packetSize<Tuple>();
+    }
+
+    template <typename Tuple>
+    static void pack( Tuple const &views,
+                      Kokkos::View<std::size_t *, DeviceType> permute,
+                      Buffer buffer, std::size_t shift )
+    {
+        auto const view = std::get<I>( views );
+        bool const permuted = ( permute.extent( 0 ) > 0 );
+        using ValueType =
+            typename std::decay<decltype( view )>::type::non_const_value_type;
+        std::size_t const n = view.extent( 0 );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "pack_view" ),
+            Kokkos::RangePolicy<ExecutionSpace,
+                                Kokkos::IndexType<std::size_t>>( 0, n ),
+            KOKKOS_LAMBDA( std::size_t i ) {
+                std::size_t const packet = permuted ? permute( i ) : i;
+                memcpy( &buffer( packet, shift ), &view( i ),
+                        sizeof( ValueType ) );
+            } );
+        PackViews<DeviceType, I + 1, N>::pack( views, permute, buffer,
+                                               shift + sizeof( ValueType ) );
+    }
+
+    template <typename Tuple>
+    static void unpack( Buffer buffer, std::size_t shift, Tuple const &views )
+    {
+        auto const view = std::get<I>( views );
+        using ValueType =
+            typename std::decay<decltype( view )>::type::non_const_value_type;
+        std::size_t const n = view.extent( 0 );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "unpack_view" ),
+            Kokkos::RangePolicy<ExecutionSpace,
+                                Kokkos::IndexType<std::size_t>>( 0, n ),
+            KOKKOS_LAMBDA( std::size_t i ) {
+                memcpy( &view( i ), &buffer( i, shift ), sizeof( ValueType ) );
+            } );
+        PackViews<DeviceType, I + 1, N>::unpack(
+            buffer, shift + sizeof( ValueType ), views );
+    }
+};
+
+template <typename DeviceType, std::size_t N>
+struct PackViews<DeviceType, N, N>
+{
+    using Buffer = Kokkos::View<char **, Kokkos::LayoutRight, DeviceType>;
+
+    template <typename Tuple>
+    static std::size_t packetSize()
+    {
+        return 0;
+    }
+
+    template <typename Tuple>
+    static void pack( Tuple const &, Kokkos::View<std::size_t *, DeviceType>,
+                      Buffer, std::size_t )
+    {
+    }
+
+    template <typename Tuple>
+    static void unpack( Buffer, std::size_t, Tuple const & )
+    {
+    }
+};
+
+// Sends the I-th to (N-1)-th views of the tuples one after the other with the
+// same plan, without packing them.  work() is called while the first view is
+// in flight.  Entry i of an export view goes to position permute(i), or i if
+// permute is empty.
+template <typename DeviceType, std::size_t I, std::size_t N>
+struct SendViews
+{
+    using ExecutionSpace = typename DeviceType::execution_space;
+
+    template <typename ExportTuple, typename ImportTuple, typename Work>
+    static void send( Tpetra::Distributor &distributor,
+                      Kokkos::View<std::size_t *, DeviceType> permute,
+                      ExportTuple const &exports, ImportTuple const &imports,
+                      Work const &work )
+    {
+        using View = typename std::decay<
+            typename std::tuple_element<I, ExportTuple>::type>::type;
+        View export_view = std::get<I>( exports );
+        std::size_t const n = permute.extent( 0 );
+        if ( n > 0 )
+        {
+            typename View::non_const_type grouped_view(
+                Kokkos::ViewAllocateWithoutInitializing( export_view.label() ),
+                n );
+            Kokkos::parallel_for(
+                DTK_MARK_REGION( "group_exports_by_destination" ),
+                Kokkos::RangePolicy<ExecutionSpace,
+                                    Kokkos::IndexType<std::size_t>>( 0, n ),
+                KOKKOS_LAMBDA( std::size_t i ) {
+                    grouped_view( permute( i ) ) = export_view( i );
+                } );
+            Kokkos::fence();
+            export_view = grouped_view;
+        }
+        DistributedSearchTreeImpl<DeviceType>::sendAcrossNetwork(
+            distributor, export_view, std::get<I>( imports ), work );
+        SendViews<DeviceType, I + 1, N>::send( distributor, permute, exports,
+                                               imports, []() {} );
+    }
+};
+
+template <typename DeviceType, std::size_t N>
+struct SendViews<DeviceType, N, N>
+{
+    template <typename ExportTuple, typename ImportTuple, typename Work>
+    static void send( Tpetra::Distributor &,
+                      Kokkos::View<std::size_t *, DeviceType>,
+                      ExportTuple const &, ImportTuple const &, Work const & )
+    {
+    }
 };
 
 template <typename View>
@@ -159,6 +512,16 @@ typename std::enable_if<Kokkos::is_view<View>::value>::type
 DistributedSearchTreeImpl<DeviceType>::sendAcrossNetwork(
     Tpetra::Distributor &distributor, View exports,
     typename View::non_const_type imports )
+{
+    sendAcrossNetwork( distributor, exports, imports, []() {} );
+}
+
+template <typename DeviceType>
+template <typename View, typename Work>
+typename std::enable_if<Kokkos::is_view<View>::value>::type
+DistributedSearchTreeImpl<DeviceType>::sendAcrossNetwork(
+    Tpetra::Distributor &distributor, View exports,
+    typename View::non_const_type imports, Work const &work )
 {
     DTK_REQUIRE( ( exports.dimension_0() ==
                    std::accumulate( std::begin( distributor.getLengthsTo() ),
@@ -181,19 +544,179 @@ DistributedSearchTreeImpl<DeviceType>::sendAcrossNetwork(
                              exports.dimension_5() * exports.dimension_6() *
                              exports.dimension_7();
 
+    // The mirrors are the views themselves when they are accessible from
+    // the host and contiguous.  The distributor then reads the exports and
+    // writes the imports in place and no copy is made.
     auto exports_host = create_layout_right_mirror_view( exports );
-    Kokkos::deep_copy( exports_host, exports );
+    if ( exports_host.data() != exports.data() )
+        Kokkos::deep_copy( exports_host, exports );
 
     auto imports_host = create_layout_right_mirror_view( imports );
 
-    distributor.doPostsAndWaits(
-        Teuchos::ArrayView<typename View::const_value_type>(
-            exports_host.data(), exports_host.size() ),
+    // The buffers are not owned by the array RCPs.  They outlive the
+    // communication since doWaits() is called before returning.
+    distributor.doPosts(
+        Teuchos::ArrayRCP<typename View::const_value_type>(
+            exports_host.data(), 0, exports_host.size(), false ),
         num_packets,
-        Teuchos::ArrayView<typename View::non_const_value_type>(
-            imports_host.data(), imports_host.size() ) );
+        Teuchos::ArrayRCP<typename View::non_const_value_type>(
+            imports_host.data(), 0, imports_host.size(), false ) );
+    work();
+    distributor.doWaits();
+
+    if ( imports_host.data() != imports.data() )
+        Kokkos::deep_copy( imports, imports_host );
+}
+
+template <typename DeviceType>
+template <typename... ExportViews, typename... ImportViews>
+void DistributedSearchTreeImpl<DeviceType>::sendAcrossNetwork(
+    Tpetra::Distributor &distributor, std::tuple<ExportViews...> exports,
+    std::tuple<ImportViews...> imports )
+{
+    sendAcrossNetwork( distributor, exports, imports, []() {} );
+}
+
+template <typename DeviceType>
+template <typename... ExportViews, typename... ImportViews, typename Work>
+void DistributedSearchTreeImpl<DeviceType>::sendAcrossNetwork(
+    Tpetra::Distributor &distributor, std::tuple<ExportViews...> exports,
+    std::tuple<ImportViews...> imports, Work const &work )
+{
+    sendAcrossNetwork( distributor, Kokkos::View<std::size_t *, DeviceType>(),
+                       exports, imports, work );
+}
+
+template <typename DeviceType>
+template <typename... ExportViews, typename... ImportViews>
+void DistributedSearchTreeImpl<DeviceType>::sendAcrossNetwork(
+    Tpetra::Distributor &distributor,
+    Kokkos::View<std::size_t *, DeviceType> permute,
+    std::tuple<ExportViews...> exports, std::tuple<ImportViews...> imports )
+{
+    sendAcrossNetwork( distributor, permute, exports, imports, []() {} );
+}
+
+template <typename DeviceType>
+template <typename... ExportViews, typename... ImportViews, typename Work>
+void DistributedSearchTreeImpl<DeviceType>::sendAcrossNetwork(
+    Tpetra::Distributor &distributor,
+    Kokkos::View<std::size_t *, DeviceType> permute,
+    std::tuple<ExportViews...> exports, std::tuple<ImportViews...> imports,
+    Work const &work )
+{
+    static_assert( sizeof...( ExportViews ) == sizeof...( ImportViews ),
+                   "There must be as many import views as export views" );
+    std::size_t constexpr n_views = sizeof...( ExportViews );
+
+    // The distributor reads and writes host memory in place, so there is no
+    // need to stage a single view through a buffer.  Several views are packed
+    // so that each process receives one message rather than one per view.
+    using MemorySpace = typename DeviceType::memory_space;
+    if ( n_views == 1 &&
+         std::is_same<MemorySpace,
+                      typename Kokkos::View<int *, DeviceType>::traits::
+                          host_mirror_space::memory_space>::value )
+    {
+        SendViews<DeviceType, 0, n_views>::send( distributor, permute, exports,
+                                                 imports, work );
+        return;
+    }
+
+    using Pack = PackViews<DeviceType, 0, n_views>;
+    using Buffer = typename Pack::Buffer;
+
+    std::size_t const packet_size =
+        Pack::template packetSize<std::tuple<ExportViews...>>();
+    DTK_REQUIRE( packet_size ==
+                 Pack::template packetSize<std::tuple<ImportViews...>>() );
+
+    Buffer export_buffer( Kokkos::ViewAllocateWithoutInitializing( "exports" ),
+                          std::get<0>( exports ).extent( 0 ), packet_size );
+    Pack::pack( exports, permute, export_buffer, 0 );
+    Kokkos::fence();
+
+    Buffer import_buffer( Kokkos::ViewAllocateWithoutInitializing( "imports" ),
+                          std::get<0>( imports ).extent( 0 ), packet_size );
+    sendAcrossNetwork( distributor, export_buffer, import_buffer, work );
+
+    Pack::unpack( import_buffer, 0, imports );
+    Kokkos::fence();
+}
+
+// Returns true if the box indices(j) is the first one of its rank among the
+// boxes indices(offset(q)), ..., indices(j) found for query q.
+template <typename DeviceType>
+KOKKOS_INLINE_FUNCTION bool
+isFirstBoxOfRank( Kokkos::View<int *, DeviceType> const &top_tree_ranks,
+                  Kokkos::View<int *, DeviceType> const &indices,
+                  Kokkos::View<int *, DeviceType> const &offset, int q, int j )
+{
+    int const rank = top_tree_ranks( indices( j ) );
+    for ( int i = offset( q ); i < j; ++i )
+        if ( top_tree_ranks( indices( i ) ) == rank )
+            return false;
+    return true;
+}
+
+template <typename DeviceType>
+template <typename Query>
+void DistributedSearchTreeImpl<DeviceType>::queryTopTree(
+    DistributedSearchTree<DeviceType> const &tree,
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset )
+{
+    queryOwners( tree._top_tree, tree._top_tree_ranks, queries, indices,
+                 offset );
+}
+
+template <typename DeviceType>
+template <typename Query>
+void DistributedSearchTreeImpl<DeviceType>::queryOwners(
+    BVH<DeviceType> const &bvh, Kokkos::View<int *, DeviceType> owner_ranks,
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset )
+{
+    bvh.query( queries, indices, offset );
+
+    // Several boxes of the same rank may meet a query.  Only keep the first
+    // one so that the query is forwarded once to that rank.  This preserves
+    // the order of the ranks for nearest queries.
+    // NOTE: the search for duplicates is quadratic in the number of boxes
+    // found for a query but that number is small in practice.
+    auto const n_queries = queries.extent( 0 );
+    Kokkos::View<int *, DeviceType> new_offset( offset.label(), n_queries + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_distinct_ranks" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            new_offset( q ) = 0;
+            for ( int j = offset( q ); j < offset( q + 1 ); ++j )
+                if ( isFirstBoxOfRank( owner_ranks, indices, offset, q, j ) )
+                    ++new_offset( q );
+        } );
+    Kokkos::fence();
+
+    exclusivePrefixSum( new_offset );
+
+    Kokkos::View<int *, DeviceType> new_indices( indices.label(),
+                                                 lastElement( new_offset ) );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "distinct_ranks" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            int count = 0;
+            for ( int j = offset( q ); j < offset( q + 1 ); ++j )
+                if ( isFirstBoxOfRank( owner_ranks, indices, offset, q, j ) )
+                    new_indices( new_offset( q ) + count++ ) =
+                        owner_ranks( indices( j ) );
+        } );
+    Kokkos::fence();
 
-    Kokkos::deep_copy( imports, imports_host );
+    offset = new_offset;
+    indices = new_indices;
 }
 
 template <typename DeviceType>
@@ -202,14 +725,14 @@ void DistributedSearchTreeImpl<DeviceType>::deviseStrategy(
     Kokkos::View<Query *, DeviceType> queries,
     DistributedSearchTree<DeviceType> const &tree,
     Kokkos::View<int *, DeviceType> &indices,
-    Kokkos::View<int *, DeviceType> &offset,
-    Kokkos::View<double *, DeviceType> & )
+    Kokkos::View<int *, DeviceType> &offset )
 {
-    auto const &top_tree = tree._top_tree;
     auto const &bottom_tree_sizes = tree._bottom_tree_sizes;
 
-    // Find the k nearest local trees.
-    top_tree.query( queries, indices, offset );
+    // Find the local trees that own the k nearest boxes of the top tree.  Each
+    // box contains at least one leaf so these trees have k leaves or more
+    // altogether, unless there are fewer in total.
+    queryTopTree( tree, queries, indices, offset );
 
     // Accumulate total leave count in the local trees until it reaches k which
     // is the number of neighbors queried for.  Stop if local trees get
@@ -255,16 +778,30 @@ void DistributedSearchTreeImpl<DeviceType>::deviseStrategy(
     indices = new_indices;
 }
 
+// Returns true if rank is in the list of ranks indices(offset(q)), ...,
+// indices(offset(q+1)-1).
+template <typename DeviceType>
+KOKKOS_INLINE_FUNCTION bool
+isVisitedRank( Kokkos::View<int *, DeviceType> const &indices,
+               Kokkos::View<int *, DeviceType> const &offset, int q, int rank )
+{
+    for ( int i = offset( q ); i < offset( q + 1 ); ++i )
+        if ( indices( i ) == rank )
+            return true;
+    return false;
+}
+
 template <typename DeviceType>
 template <typename Query>
 void DistributedSearchTreeImpl<DeviceType>::reassessStrategy(
     Kokkos::View<Query *, DeviceType> queries,
     DistributedSearchTree<DeviceType> const &tree,
+    Kokkos::View<int *, DeviceType> results_offset,
+    Kokkos::View<double *, DeviceType> distances,
     Kokkos::View<int *, DeviceType> &indices,
     Kokkos::View<int *, DeviceType> &offset,
-    Kokkos::View<double *, DeviceType> &distances )
+    Kokkos::View<Query *, DeviceType> &bounded_queries )
 {
-    auto const &top_tree = tree._top_tree;
     auto const n_queries = queries.extent( 0 );
 
     // Determine distance to the farthest neighbor found so far.
@@ -272,31 +809,87 @@ void DistributedSearchTreeImpl<DeviceType>::reassessStrategy(
                                                            n_queries );
     Kokkos::deep_copy( farthest_distances, 0. );
     // NOTE: in principle distances( j ) are arranged in ascending order for
-    // offset( i ) <= j < offset( i + 1 ) so max() is not necessary.
-    Kokkos::parallel_for( DTK_MARK_REGION( "most_distant_neighbor_so_far" ),
-                          Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
-                          KOKKOS_LAMBDA( int i ) {
-                              for ( int j = offset( i ); j < offset( i + 1 );
-                                    ++j )
-                                  farthest_distances( i ) = KokkosHelpers::max(
-                                      farthest_distances( i ), distances( j ) );
-                          } );
+    // results_offset( i ) <= j < results_offset( i + 1 ) so max() is not
+    // necessary.
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "most_distant_neighbor_so_far" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int i ) {
+            for ( int j = results_offset( i ); j < results_offset( i + 1 );
+                  ++j )
+                farthest_distances( i ) = KokkosHelpers::max(
+                    farthest_distances( i ), distances( j ) );
+        } );
     Kokkos::fence();
 
-    // Identify what ranks may have leaves that are within that distance.
+    // Identify what ranks may have leaves that are within that distance.  For
+    // approximate searches, it is sufficient to look for neighbors that would
+    // be closer than that distance divided by (1+epsilon).  If the search is
+    // bounded by a radius, fewer than k neighbors may have been found while
+    // some rank within the radius was not searched.  Look for all ranks within
+    // the radius in that case.  The queries forwarded to these ranks are
+    // bounded by the same distance so that only neighbors that may improve
+    // the current results are sent back.
+    double const unbounded = Kokkos::ArithTraits<double>::max();
     Kokkos::View<Within *, DeviceType> within_queries( "queries", n_queries );
+    Kokkos::realloc( bounded_queries, n_queries );
     Kokkos::parallel_for(
         DTK_MARK_REGION( "bottom_trees_within_that_distance" ),
         Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
         KOKKOS_LAMBDA( int i ) {
-            within_queries( i ) =
-                within( queries( i )._geometry, farthest_distances( i ) );
+            auto const &query = queries( i );
+            bool const missing_neighbors =
+                ( results_offset( i + 1 ) - results_offset( i ) < query._k );
+            double const bound =
+                farthest_distances( i ) / ( 1. + query._epsilon );
+            double const radius =
+                ( missing_neighbors && query._radius < unbounded )
+                    ? query._radius
+                    : bound;
+            within_queries( i ) = within( query._geometry, radius );
+            bounded_queries( i ) =
+                Query( query._geometry, query._k, query._epsilon,
+                       missing_neighbors ? query._radius : bound );
+        } );
+    Kokkos::fence();
+
+    // The ranks visited in the 1st pass already sent back their nearest
+    // neighbors.  Only forward queries to the other ones.
+    auto const visited_ranks = indices;
+    auto const visited_offset = offset;
+    queryTopTree( tree, within_queries, indices, offset );
+
+    Kokkos::View<int *, DeviceType> new_offset( offset.label(), n_queries + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_ranks_not_visited_yet" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            new_offset( q ) = 0;
+            for ( int j = offset( q ); j < offset( q + 1 ); ++j )
+                if ( !isVisitedRank( visited_ranks, visited_offset, q,
+                                     indices( j ) ) )
+                    ++new_offset( q );
+        } );
+    Kokkos::fence();
+
+    exclusivePrefixSum( new_offset );
+
+    Kokkos::View<int *, DeviceType> new_indices( indices.label(),
+                                                 lastElement( new_offset ) );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "ranks_not_visited_yet" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            int count = 0;
+            for ( int j = offset( q ); j < offset( q + 1 ); ++j )
+                if ( !isVisitedRank( visited_ranks, visited_offset, q,
+                                     indices( j ) ) )
+                    new_indices( new_offset( q ) + count++ ) = indices( j );
         } );
     Kokkos::fence();
 
-    top_tree.query( within_queries, indices, offset );
-    // NOTE: in principle, we could perform within queries on the bottom_tree
-    // rather than nearest queries.
+    offset = new_offset;
+    indices = new_indices;
 }
 
 template <typename DeviceType>
@@ -310,7 +903,6 @@ void DistributedSearchTreeImpl<DeviceType>::queryDispatch(
     Kokkos::View<double *, DeviceType> *distances_ptr )
 {
     auto const &bottom_tree = tree._bottom_tree;
-    auto comm = tree._comm;
 
     Kokkos::View<double *, DeviceType> distances( "distances" );
     if ( distances_ptr )
@@ -319,112 +911,516 @@ void DistributedSearchTreeImpl<DeviceType>::queryDispatch(
     // "Strategy" is used to determine what ranks to forward queries to.  In
     // the 1st pass, the queries are sent to as many ranks as necessary to
     // guarantee that all k neighbors queried for are found.  In the 2nd pass,
-    // queries are sent again to all ranks that may have a neighbor closer to
-    // the farthest neighbor identified in the 1st pass.
-    //
-    // The current implementation discards the results after the 1st pass and
-    // recompute everything instead of just searching for potential better
-    // neighbors and updating the list.
-
-    // NOTE: compiler would not deduce __range for the braced-init-list but I
-    // got it to work with the static_cast to function pointers.
-    using Strategy = void ( * )( Kokkos::View<Query *, DeviceType>,
-                                 DistributedSearchTree<DeviceType> const &,
-                                 Kokkos::View<int *, DeviceType> &,
-                                 Kokkos::View<int *, DeviceType> &,
-                                 Kokkos::View<double *, DeviceType> & );
-    for ( auto implementStrategy :
-          {static_cast<Strategy>(
-               DistributedSearchTreeImpl<DeviceType>::deviseStrategy ),
-           static_cast<Strategy>(
-               DistributedSearchTreeImpl<DeviceType>::reassessStrategy )} )
-    {
-        implementStrategy( queries, tree, indices, offset, distances );
+    // queries bounded by the distance to the farthest neighbor identified in
+    // the 1st pass are sent to the ranks that were not visited yet and may
+    // have closer neighbors.  Their results are merged with the ones from the
+    // 1st pass.
+    // In both passes, the queries destined to the local process are
+    // performed while the other ones are forwarded.
+    int const n_queries = queries.extent_int( 0 );
+    Kokkos::View<int *, DeviceType> ids( "query_ids" );
+    Kokkos::View<Query *, DeviceType> fwd_queries( "fwd_queries" );
+    Kokkos::View<int *, DeviceType> owner_ranks( ranks.label() );
+    Kokkos::View<int *, DeviceType> local_ids( "local_query_ids" );
+    Kokkos::View<int *, DeviceType> local_indices( indices.label() );
+    Kokkos::View<int *, DeviceType> local_owner_ranks( ranks.label() );
+    Kokkos::View<int *, DeviceType> local_offset( offset.label() );
+    Kokkos::View<double *, DeviceType> local_distances( distances.label() );
+    auto const queryLocally = [&]( Kokkos::View<Query *, DeviceType> local ) {
+        bottom_tree.query( local, local_indices, local_offset,
+                           local_distances );
+        mapToOriginalOwners( tree, local_indices, local_owner_ranks );
+    };
 
-        ////////////////////////////////////////////////////////////////////////////
-        // Forward queries
-        ////////////////////////////////////////////////////////////////////////////
-        Kokkos::View<int *, DeviceType> ids( "query_ids" );
-        Kokkos::View<Query *, DeviceType> fwd_queries( "fwd_queries" );
-        forwardQueries( comm, queries, indices, offset, fwd_queries, ids,
-                        ranks );
-        ////////////////////////////////////////////////////////////////////////////
-
-        ////////////////////////////////////////////////////////////////////////////
-        // Perform queries that have been received
-        ////////////////////////////////////////////////////////////////////////////
-        bottom_tree.query( fwd_queries, indices, offset, distances );
-        ////////////////////////////////////////////////////////////////////////////
-
-        ////////////////////////////////////////////////////////////////////////////
-        // Communicate results back
-        ////////////////////////////////////////////////////////////////////////////
-        communicateResultsBack( comm, indices, offset, ranks, ids, &distances );
-        ////////////////////////////////////////////////////////////////////////////
-
-        ////////////////////////////////////////////////////////////////////////////
-        // Merge results
-        ////////////////////////////////////////////////////////////////////////////
-        int const n_queries = queries.extent_int( 0 );
-        countResults( n_queries, ids, offset );
-        sortResults( ids, indices, ranks, distances );
-        filterResults( queries, distances, indices, offset, ranks );
-        ////////////////////////////////////////////////////////////////////////////
-    }
+    ////////////////////////////////////////////////////////////////////////////
+    // 1st pass
+    ////////////////////////////////////////////////////////////////////////////
+    deviseStrategy( queries, tree, indices, offset );
+    auto visited_ranks = indices;
+    auto visited_offset = offset;
+
+    forwardQueries( tree, queries, indices, offset, fwd_queries, ids, ranks,
+                    local_ids, queryLocally );
+    bottom_tree.query( fwd_queries, indices, offset, distances );
+    mapToOriginalOwners( tree, indices, owner_ranks );
+    communicateResultsBack( tree, indices, owner_ranks, offset, ranks, ids,
+                            &distances );
+    mergeLocalResults( local_ids, local_indices, local_owner_ranks,
+                       local_offset, local_distances, indices, ranks, ids,
+                       &distances );
+    countResults( n_queries, ids, offset );
+    sortResults( ids, indices, ranks, distances );
+    filterResults( queries, distances, indices, offset, ranks );
+    ////////////////////////////////////////////////////////////////////////////
+
+    ////////////////////////////////////////////////////////////////////////////
+    // 2nd pass
+    ////////////////////////////////////////////////////////////////////////////
+    Kokkos::View<Query *, DeviceType> bounded_queries( "bounded_queries" );
+    reassessStrategy( queries, tree, offset, distances, visited_ranks,
+                      visited_offset, bounded_queries );
+
+    Kokkos::View<int *, DeviceType> new_indices( indices.label() );
+    Kokkos::View<int *, DeviceType> new_offset( offset.label() );
+    Kokkos::View<int *, DeviceType> new_ranks( ranks.label() );
+    Kokkos::View<double *, DeviceType> new_distances( distances.label() );
+    forwardQueries( tree, bounded_queries, visited_ranks, visited_offset,
+                    fwd_queries, ids, new_ranks, local_ids, queryLocally );
+    bottom_tree.query( fwd_queries, new_indices, new_offset, new_distances );
+    mapToOriginalOwners( tree, new_indices, owner_ranks );
+    communicateResultsBack( tree, new_indices, owner_ranks, new_offset,
+                            new_ranks, ids, &new_distances );
+    mergeLocalResults( local_ids, local_indices, local_owner_ranks,
+                       local_offset, local_distances, new_indices, new_ranks,
+                       ids, &new_distances );
+    countResults( n_queries, ids, new_offset );
+    sortResults( ids, new_indices, new_ranks, new_distances );
+    ////////////////////////////////////////////////////////////////////////////
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Merge results
+    ////////////////////////////////////////////////////////////////////////////
+    Kokkos::View<int *, DeviceType> merged_offset( offset.label(),
+                                                   n_queries + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_neighbors_from_both_passes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            merged_offset( q ) = offset( q + 1 ) - offset( q ) +
+                                 new_offset( q + 1 ) - new_offset( q );
+        } );
+    Kokkos::fence();
+    exclusivePrefixSum( merged_offset );
+
+    int const n_results = lastElement( merged_offset );
+    Kokkos::View<int *, DeviceType> merged_indices(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        n_results );
+    Kokkos::View<int *, DeviceType> merged_ranks(
+        Kokkos::ViewAllocateWithoutInitializing( ranks.label() ), n_results );
+    Kokkos::View<double *, DeviceType> merged_distances(
+        Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+        n_results );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "merge_neighbors_from_both_passes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            int count = merged_offset( q );
+            for ( int j = offset( q ); j < offset( q + 1 ); ++j )
+            {
+                merged_indices( count ) = indices( j );
+                merged_ranks( count ) = ranks( j );
+                merged_distances( count++ ) = distances( j );
+            }
+            for ( int j = new_offset( q ); j < new_offset( q + 1 ); ++j )
+            {
+                merged_indices( count ) = new_indices( j );
+                merged_ranks( count ) = new_ranks( j );
+                merged_distances( count++ ) = new_distances( j );
+            }
+        } );
+    Kokkos::fence();
+
+    offset = merged_offset;
+    indices = merged_indices;
+    ranks = merged_ranks;
+    distances = merged_distances;
+    filterResults( queries, distances, indices, offset, ranks );
+    ////////////////////////////////////////////////////////////////////////////
+
+    if ( distances_ptr )
+        *distances_ptr = distances;
 }
 
 template <typename DeviceType>
-template <typename Query>
+template <typename Query, typename Offset>
 void DistributedSearchTreeImpl<DeviceType>::queryDispatch(
     DistributedSearchTree<DeviceType> const &tree,
     Kokkos::View<Query *, DeviceType> queries,
     Kokkos::View<int *, DeviceType> &indices,
-    Kokkos::View<int *, DeviceType> &offset,
-    Kokkos::View<int *, DeviceType> &ranks, Details::SpatialPredicateTag )
+    Kokkos::View<Offset *, DeviceType> &offset,
+    Kokkos::View<int *, DeviceType> &ranks, Details::SpatialPredicateTag,
+    Kokkos::View<double *, DeviceType> *distances_ptr, bool sort_by_distance,
+    int max_results )
 {
-    auto const &top_tree = tree._top_tree;
     auto const &bottom_tree = tree._bottom_tree;
-    auto comm = tree._comm;
 
     ////////////////////////////////////////////////////////////////////////////
     ////////////////////////////////////////////////////////////////////////////
-    top_tree.query( queries, indices, offset );
+    // There are at most as many candidate processes as queries times
+    // processes so the offsets into the top tree results fit in an int.
+    Kokkos::View<int *, DeviceType> top_offset( offset.label() );
+    queryTopTree( tree, queries, indices, top_offset );
     ////////////////////////////////////////////////////////////////////////////
 
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    if ( distances_ptr )
+        distances = *distances_ptr;
+
+    // Performs the same search for the queries received from other processes
+    // and for the local ones.
+    auto const queryBottomTree =
+        [&]( Kokkos::View<Query *, DeviceType> bottom_queries,
+             Kokkos::View<int *, DeviceType> &bottom_indices,
+             Kokkos::View<int *, DeviceType> &bottom_owner_ranks,
+             Kokkos::View<Offset *, DeviceType> &bottom_offset,
+             Kokkos::View<double *, DeviceType> &bottom_distances ) {
+            if ( !distances_ptr )
+            {
+                bottom_tree.query( bottom_queries, bottom_indices,
+                                   bottom_offset );
+            }
+            else
+            {
+                // Truncate locally so that at most max_results results per
+                // query are sent back from each process.
+                bottom_tree.query( bottom_queries, bottom_indices,
+                                   bottom_offset, bottom_distances, false,
+                                   max_results );
+            }
+            mapToOriginalOwners( tree, bottom_indices, bottom_owner_ranks );
+        };
+
     ////////////////////////////////////////////////////////////////////////////
-    // Forward queries
+    // Forward queries and perform the local ones in the meantime
     ////////////////////////////////////////////////////////////////////////////
     Kokkos::View<int *, DeviceType> ids( "query_ids" );
     Kokkos::View<Query *, DeviceType> fwd_queries( "fwd_queries" );
-    forwardQueries( comm, queries, indices, offset, fwd_queries, ids, ranks );
+    Kokkos::View<int *, DeviceType> local_ids( "local_query_ids" );
+    Kokkos::View<int *, DeviceType> local_indices( indices.label() );
+    Kokkos::View<int *, DeviceType> local_owner_ranks( ranks.label() );
+    Kokkos::View<Offset *, DeviceType> local_offset( offset.label() );
+    Kokkos::View<double *, DeviceType> local_distances( distances.label() );
+    forwardQueries(
+        tree, queries, indices, top_offset, fwd_queries, ids, ranks, local_ids,
+        [&]( Kokkos::View<Query *, DeviceType> local ) {
+            queryBottomTree( local, local_indices, local_owner_ranks,
+                             local_offset, local_distances );
+        } );
     ////////////////////////////////////////////////////////////////////////////
 
     ////////////////////////////////////////////////////////////////////////////
     // Perform queries that have been received
     ////////////////////////////////////////////////////////////////////////////
-    bottom_tree.query( fwd_queries, indices, offset );
+    Kokkos::View<int *, DeviceType> owner_ranks( ranks.label() );
+    queryBottomTree( fwd_queries, indices, owner_ranks, offset, distances );
     ////////////////////////////////////////////////////////////////////////////
 
     ////////////////////////////////////////////////////////////////////////////
     // Communicate results back
     ////////////////////////////////////////////////////////////////////////////
-    communicateResultsBack( comm, indices, offset, ranks, ids );
+    auto *results_distances_ptr = distances_ptr ? &distances : nullptr;
+    communicateResultsBack( tree, indices, owner_ranks, offset, ranks, ids,
+                            results_distances_ptr );
     ////////////////////////////////////////////////////////////////////////////
 
     ////////////////////////////////////////////////////////////////////////////
     // Merge results
     ////////////////////////////////////////////////////////////////////////////
+    mergeLocalResults( local_ids, local_indices, local_owner_ranks,
+                       local_offset, local_distances, indices, ranks, ids,
+                       results_distances_ptr );
     int const n_queries = queries.extent_int( 0 );
     countResults( n_queries, ids, offset );
-    sortResults( ids, indices, ranks );
+    if ( !distances_ptr )
+    {
+        sortResults( ids, indices, ranks );
+        return;
+    }
+    sortResults( ids, indices, ranks, distances );
+    if ( sort_by_distance || max_results >= 0 )
+        sortResultsByDistance( ExecutionSpace{}, offset, distances,
+                               max_results, indices, ranks );
+    *distances_ptr = distances;
     ////////////////////////////////////////////////////////////////////////////
 }
 
-// FIXME: for some reason Kokkos::BinSort::sort() was not const.
-// If https://github.com/kokkos/kokkos/pull/1310 makes it into master in
-// Trilinos, we might want to pass bin_sort by const reference.
-template <typename BinSort>
-void applyPermutations( BinSort & )
+template <typename DeviceType>
+template <typename Query, typename Callback>
+void DistributedSearchTreeImpl<DeviceType>::chunkedQueryDispatch(
+    DistributedSearchTree<DeviceType> const &tree,
+    Kokkos::View<Query *, DeviceType> queries, std::size_t max_chunk_size,
+    std::size_t max_window_size, Callback const &callback )
+{
+    auto const &bottom_tree = tree._bottom_tree;
+    int const n_queries = queries.extent_int( 0 );
+
+    // The queries are counted in windows of at most max_window_size queries
+    // so that counting never forwards the whole batch at once.  Each window
+    // is then split into chunks and searched before the next one is counted.
+    int const window_size = static_cast<int>( std::max<std::size_t>(
+        1, std::min<std::size_t>( max_window_size,
+                                  Kokkos::ArithTraits<int>::max() ) ) );
+    int const n_local_windows = n_queries / window_size +
+                                ( n_queries % window_size > 0 ? 1 : 0 );
+    int n_windows = 0;
+    Teuchos::reduceAll( *tree._comm, Teuchos::REDUCE_MAX, n_local_windows,
+                        Teuchos::ptrFromRef( n_windows ) );
+    for ( int w = 0; w < n_windows; ++w )
+    {
+        int const window_first =
+            ( w < n_local_windows ) ? w * window_size : n_queries;
+        int const n_window_queries =
+            std::min( n_queries - window_first, window_size );
+
+        ////////////////////////////////////////////////////////////////////////
+        // Split the window into chunks
+        ////////////////////////////////////////////////////////////////////////
+        Kokkos::View<Query *, DeviceType> window_queries(
+            Kokkos::ViewAllocateWithoutInitializing( queries.label() ),
+            n_window_queries );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "copy_window_queries" ),
+            Kokkos::RangePolicy<ExecutionSpace>( 0, n_window_queries ),
+            KOKKOS_LAMBDA( int q ) {
+                window_queries( q ) = queries( window_first + q );
+            } );
+        Kokkos::fence();
+
+        // The counts are accumulated in 64-bit offsets since the total number
+        // of results is typically what does not fit.
+        Kokkos::View<int *, DeviceType> counts( "counts" );
+        countDispatch( tree, window_queries, counts );
+        Kokkos::View<long long *, DeviceType> count_offset(
+            Kokkos::ViewAllocateWithoutInitializing( "offset" ),
+            n_window_queries + 1 );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "copy_counts" ),
+            Kokkos::RangePolicy<ExecutionSpace>( 0, n_window_queries + 1 ),
+            KOKKOS_LAMBDA( int q ) {
+                count_offset( q ) = ( q < n_window_queries ) ? counts( q ) : 0;
+            } );
+        Kokkos::fence();
+        exclusivePrefixSum( count_offset );
+        auto count_offset_host = Kokkos::create_mirror_view( count_offset );
+        Kokkos::deep_copy( count_offset_host, count_offset );
+
+        // Chunk c holds the queries chunks[c], ..., chunks[c+1]-1 of the
+        // window.
+        std::vector<int> chunks( 1, 0 );
+        while ( chunks.back() < n_window_queries )
+        {
+            int const first = chunks.back();
+            int last = first + 1;
+            while ( last < n_window_queries &&
+                    static_cast<std::size_t>( count_offset_host( last + 1 ) -
+                                              count_offset_host( first ) ) <=
+                        max_chunk_size )
+                ++last;
+            DTK_REQUIRE( count_offset_host( last ) -
+                             count_offset_host( first ) <=
+                         Kokkos::ArithTraits<int>::max() );
+            chunks.push_back( last );
+        }
+        int const n_local_chunks = chunks.size() - 1;
+        int n_chunks = 0;
+        Teuchos::reduceAll( *tree._comm, Teuchos::REDUCE_MAX, n_local_chunks,
+                            Teuchos::ptrFromRef( n_chunks ) );
+        ////////////////////////////////////////////////////////////////////////
+
+        ////////////////////////////////////////////////////////////////////////
+        // Search the chunks
+        ////////////////////////////////////////////////////////////////////////
+        // Chunk c is forwarded while the queries of chunk c-1 received from
+        // other processes are performed.  The results of chunk c-1 are then
+        // sent back.
+        Kokkos::View<Query *, DeviceType> fwd_queries( "fwd_queries" );
+        Kokkos::View<int *, DeviceType> ids( "query_ids" );
+        Kokkos::View<int *, DeviceType> ranks( "ranks" );
+        Kokkos::View<int *, DeviceType> local_ids( "local_query_ids" );
+        Kokkos::View<int *, DeviceType> local_indices( "indices" );
+        Kokkos::View<int *, DeviceType> local_owner_ranks( "ranks" );
+        Kokkos::View<int *, DeviceType> local_offset( "offset" );
+        Kokkos::View<int *, DeviceType> indices( "indices" );
+        Kokkos::View<int *, DeviceType> offset( "offset" );
+        Kokkos::View<int *, DeviceType> owner_ranks( "ranks" );
+        auto const queryReceived = [&]() {
+            bottom_tree.query( fwd_queries, indices, offset );
+            mapToOriginalOwners( tree, indices, owner_ranks );
+        };
+        for ( int c = 0; c <= n_chunks; ++c )
+        {
+            Kokkos::View<Query *, DeviceType> next_fwd_queries(
+                "fwd_queries" );
+            Kokkos::View<int *, DeviceType> next_ids( "query_ids" );
+            Kokkos::View<int *, DeviceType> next_ranks( "ranks" );
+            Kokkos::View<int *, DeviceType> next_local_ids(
+                "local_query_ids" );
+            Kokkos::View<int *, DeviceType> next_local_indices( "indices" );
+            Kokkos::View<int *, DeviceType> next_local_owner_ranks( "ranks" );
+            Kokkos::View<int *, DeviceType> next_local_offset( "offset" );
+            if ( c < n_chunks )
+            {
+                int const first = chunks[std::min( c, n_local_chunks )];
+                int const n_chunk_queries =
+                    chunks[std::min( c + 1, n_local_chunks )] - first;
+                Kokkos::View<Query *, DeviceType> chunk_queries(
+                    Kokkos::ViewAllocateWithoutInitializing(
+                        queries.label() ),
+                    n_chunk_queries );
+                Kokkos::parallel_for(
+                    DTK_MARK_REGION( "copy_chunk_queries" ),
+                    Kokkos::RangePolicy<ExecutionSpace>( 0, n_chunk_queries ),
+                    KOKKOS_LAMBDA( int q ) {
+                        chunk_queries( q ) = window_queries( first + q );
+                    } );
+                Kokkos::fence();
+
+                Kokkos::View<int *, DeviceType> top_indices( "indices" );
+                Kokkos::View<int *, DeviceType> top_offset( "offset" );
+                queryTopTree( tree, chunk_queries, top_indices, top_offset );
+                forwardQueries(
+                    tree, chunk_queries, top_indices, top_offset,
+                    next_fwd_queries, next_ids, next_ranks, next_local_ids,
+                    [&]( Kokkos::View<Query *, DeviceType> local ) {
+                        bottom_tree.query( local, next_local_indices,
+                                           next_local_offset );
+                        mapToOriginalOwners( tree, next_local_indices,
+                                             next_local_owner_ranks );
+                        if ( c > 0 )
+                            queryReceived();
+                    } );
+            }
+            else
+                queryReceived();
+
+            if ( c > 0 )
+            {
+                int const first = chunks[std::min( c - 1, n_local_chunks )];
+                int const n_chunk_queries =
+                    chunks[std::min( c, n_local_chunks )] - first;
+                communicateResultsBack( tree, indices, owner_ranks, offset,
+                                        ranks, ids );
+                mergeLocalResults( local_ids, local_indices,
+                                   local_owner_ranks, local_offset,
+                                   Kokkos::View<double *, DeviceType>(),
+                                   indices, ranks, ids, nullptr );
+                countResults( n_chunk_queries, ids, offset );
+                sortResults( ids, indices, ranks );
+                if ( n_chunk_queries > 0 )
+                    callback( window_first + first, indices, offset, ranks );
+            }
+
+            fwd_queries = next_fwd_queries;
+            ids = next_ids;
+            ranks = next_ranks;
+            local_ids = next_local_ids;
+            local_indices = next_local_indices;
+            local_owner_ranks = next_local_owner_ranks;
+            local_offset = next_local_offset;
+        }
+        ////////////////////////////////////////////////////////////////////////
+    }
+}
+
+template <typename DeviceType>
+template <typename Query>
+void DistributedSearchTreeImpl<DeviceType>::countDispatch(
+    DistributedSearchTree<DeviceType> const &tree,
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> &counts )
+{
+    auto const &bottom_tree = tree._bottom_tree;
+    auto &distributor_cache = *tree._distributor_cache;
+
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    queryTopTree( tree, queries, indices, offset );
+
+    Kokkos::View<int *, DeviceType> ids( "query_ids" );
+    Kokkos::View<int *, DeviceType> ranks( "ranks" );
+    Kokkos::View<Query *, DeviceType> fwd_queries( "fwd_queries" );
+    Kokkos::View<int *, DeviceType> local_ids( "local_query_ids" );
+    Kokkos::View<int *, DeviceType> local_counts( "local_counts" );
+    forwardQueries( tree, queries, indices, offset, fwd_queries, ids, ranks,
+                    local_ids, [&]( Kokkos::View<Query *, DeviceType> local ) {
+                        bottom_tree.count( local, local_counts );
+                    } );
+
+    Kokkos::View<int *, DeviceType> fwd_counts( "counts" );
+    bottom_tree.count( fwd_queries, fwd_counts );
+
+    communicateCountsBack( distributor_cache, ranks, ids, fwd_counts );
+
+    int const n_queries = queries.extent_int( 0 );
+    Kokkos::realloc( counts, n_queries );
+    Kokkos::deep_copy( counts, 0 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "accumulate_counts" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, ids.extent( 0 ) ),
+        KOKKOS_LAMBDA( int i ) {
+            Kokkos::atomic_add( &counts( ids( i ) ), fwd_counts( i ) );
+        } );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "accumulate_local_counts" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, local_ids.extent( 0 ) ),
+        KOKKOS_LAMBDA( int j ) {
+            Kokkos::atomic_add( &counts( local_ids( j ) ), local_counts( j ) );
+        } );
+    Kokkos::fence();
+}
+
+template <typename DeviceType>
+template <typename Query>
+void DistributedSearchTreeImpl<DeviceType>::anyDispatch(
+    DistributedSearchTree<DeviceType> const &tree,
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<bool *, DeviceType> &hits )
+{
+    auto const &bottom_tree = tree._bottom_tree;
+    auto &distributor_cache = *tree._distributor_cache;
+
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    queryTopTree( tree, queries, indices, offset );
+
+    Kokkos::View<int *, DeviceType> ids( "query_ids" );
+    Kokkos::View<int *, DeviceType> ranks( "ranks" );
+    Kokkos::View<Query *, DeviceType> fwd_queries( "fwd_queries" );
+    Kokkos::View<int *, DeviceType> local_ids( "local_query_ids" );
+    Kokkos::View<bool *, DeviceType> local_hits( "local_hits" );
+    forwardQueries( tree, queries, indices, offset, fwd_queries, ids, ranks,
+                    local_ids, [&]( Kokkos::View<Query *, DeviceType> local ) {
+                        bottom_tree.any( local, local_hits );
+                    } );
+
+    Kokkos::View<bool *, DeviceType> fwd_hits( "hits" );
+    bottom_tree.any( fwd_queries, fwd_hits );
+
+    int const n_fwd_queries = fwd_queries.extent_int( 0 );
+    Kokkos::View<int *, DeviceType> fwd_counts(
+        Kokkos::ViewAllocateWithoutInitializing( "counts" ), n_fwd_queries );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "convert_hits_to_counts" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_fwd_queries ),
+        KOKKOS_LAMBDA( int q ) { fwd_counts( q ) = fwd_hits( q ) ? 1 : 0; } );
+    Kokkos::fence();
+
+    // Only the ids of the queries that hit are needed.
+    communicateCountsBack( distributor_cache, ranks, ids, fwd_counts, false );
+
+    int const n_queries = queries.extent_int( 0 );
+    Kokkos::realloc( hits, n_queries );
+    Kokkos::deep_copy( hits, false );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "merge_hits" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, ids.extent( 0 ) ),
+        KOKKOS_LAMBDA( int i ) { hits( ids( i ) ) = true; } );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "merge_local_hits" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, local_ids.extent( 0 ) ),
+        KOKKOS_LAMBDA( int j ) {
+            if ( local_hits( j ) )
+                hits( local_ids( j ) ) = true;
+        } );
+    Kokkos::fence();
+}
+
+// FIXME: for some reason Kokkos::BinSort::sort() was not const.
+// If https://github.com/kokkos/kokkos/pull/1310 makes it into master in
+// Trilinos, we might want to pass bin_sort by const reference.
+template <typename BinSort>
+void applyPermutations( BinSort & )
 {
     // do nothing
 }
@@ -444,7 +1440,7 @@ template <typename View, typename... OtherViews>
 void DistributedSearchTreeImpl<DeviceType>::sortResults(
     View keys, OtherViews... other_views )
 {
-    auto const n = keys.extent( 0 );
+    std::size_t const n = keys.extent( 0 );
     // If they were no queries, min_val and max_val values won't change after
     // the parallel reduce (they are initialized to +infty and -infty
     // respectively) and the sort will hang.
@@ -456,30 +1452,211 @@ void DistributedSearchTreeImpl<DeviceType>::sortResults(
 
     Kokkos::Experimental::MinMaxScalar<Value> result;
     Kokkos::Experimental::MinMax<Value> reducer( result );
-    parallel_reduce( Kokkos::RangePolicy<ExecutionSpace>( 0, n ),
-                     Kokkos::Impl::min_max_functor<View>( keys ), reducer );
+    parallel_reduce(
+        Kokkos::RangePolicy<ExecutionSpace, Kokkos::IndexType<std::size_t>>(
+            0, n ),
+        Kokkos::Impl::min_max_functor<View>( keys ), reducer );
     if ( result.min_val == result.max_val )
         return;
-    Kokkos::BinSort<View, Comp> bin_sort(
-        keys, Comp( n / 2, result.min_val, result.max_val ), true );
+    // The permutation is indexed with std::size_t rather than the default
+    // size type of the memory space that is 32-bit on some devices.
+    int const n_bins = std::min<std::size_t>(
+        n / 2, std::numeric_limits<int>::max() );
+    Kokkos::BinSort<View, Comp, DeviceType, std::size_t> bin_sort(
+        keys, Comp( n_bins, result.min_val, result.max_val ), true );
     bin_sort.create_permute_vector();
     applyPermutations( bin_sort, other_views... );
     Kokkos::fence();
 }
 
 template <typename DeviceType>
+void DistributedSearchTreeImpl<DeviceType>::allNearestDispatch(
+    DistributedSearchTree<DeviceType> const &tree, int k,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &offset,
+    Kokkos::View<int *, DeviceType> &ranks,
+    Kokkos::View<double *, DeviceType> &distances, bool exclude_self )
+{
+    using Traversal = TreeTraversal<DeviceType, Box>;
+
+    // The local objects are not the ones passed to the constructor if the
+    // tree was repartitioned.
+    DTK_INSIST( !tree._repartitioned );
+
+    auto const &bottom_tree = tree._bottom_tree;
+    int const comm_rank = tree._comm->getRank();
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Search the local objects
+    ////////////////////////////////////////////////////////////////////////////
+    Kokkos::View<int *, DeviceType> local_indices( indices.label() );
+    Kokkos::View<int *, DeviceType> local_offset( offset.label() );
+    Kokkos::View<double *, DeviceType> local_distances( distances.label() );
+    bottom_tree.allNearest( k, local_indices, local_offset, local_distances,
+                            exclude_self );
+    ////////////////////////////////////////////////////////////////////////////
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Determine the halo
+    ////////////////////////////////////////////////////////////////////////////
+    // Only the objects of other processes that are closer than the k-th
+    // local neighbor may improve the result.  The radius is unbounded if
+    // fewer than k neighbors were found locally.
+    int const n_objects = bottom_tree.size();
+    double const unbounded = Kokkos::ArithTraits<double>::max();
+    Kokkos::View<Nearest<Point> *, DeviceType> queries(
+        Kokkos::ViewAllocateWithoutInitializing( "queries" ), n_objects );
+    Kokkos::View<Within *, DeviceType> halo_queries(
+        Kokkos::ViewAllocateWithoutInitializing( "halo_queries" ), n_objects );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "radius_of_the_halo" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_objects ),
+        KOKKOS_LAMBDA( int position ) {
+            auto const leaf = Traversal::getLeaf( bottom_tree, position );
+            int const i = Traversal::getIndex( bottom_tree, leaf );
+            Point center;
+            centroid( leaf->bounding_volume, center );
+            double const radius =
+                ( local_offset( i + 1 ) - local_offset( i ) < k )
+                    ? unbounded
+                    : local_distances( local_offset( i + 1 ) - 1 );
+            queries( i ) = nearestWithin( center, k, radius );
+            halo_queries( i ) = within( center, radius );
+        } );
+    Kokkos::fence();
+
+    // Drop the local process from the candidates.  If the processes are
+    // grouped in nodes, the candidates are nodes and the local process is
+    // skipped when the queries are forwarded within the node instead.
+    int const self = tree._grouped_in_nodes ? -1 : comm_rank;
+    queryTopTree( tree, halo_queries, indices, offset );
+    Kokkos::View<int *, DeviceType> halo_offset( offset.label(),
+                                                 n_objects + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_other_ranks_in_the_halo" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_objects ),
+        KOKKOS_LAMBDA( int i ) {
+            for ( int j = offset( i ); j < offset( i + 1 ); ++j )
+                if ( indices( j ) != self )
+                    ++halo_offset( i );
+        } );
+    Kokkos::fence();
+    exclusivePrefixSum( halo_offset );
+    Kokkos::View<int *, DeviceType> halo_indices(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        lastElement( halo_offset ) );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "other_ranks_in_the_halo" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_objects ),
+        KOKKOS_LAMBDA( int i ) {
+            int count = 0;
+            for ( int j = offset( i ); j < offset( i + 1 ); ++j )
+                if ( indices( j ) != self )
+                    halo_indices( halo_offset( i ) + count++ ) = indices( j );
+        } );
+    Kokkos::fence();
+    ////////////////////////////////////////////////////////////////////////////
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Forward queries
+    ////////////////////////////////////////////////////////////////////////////
+    // The local process is not in the halo so there is no local query.
+    Kokkos::View<int *, DeviceType> ids( "query_ids" );
+    Kokkos::View<Nearest<Point> *, DeviceType> fwd_queries( "fwd_queries" );
+    Kokkos::View<int *, DeviceType> local_ids( "local_query_ids" );
+    forwardQueries( tree, queries, halo_indices, halo_offset, fwd_queries, ids,
+                    ranks, local_ids,
+                    []( Kokkos::View<Nearest<Point> *, DeviceType> ) {},
+                    true );
+    ////////////////////////////////////////////////////////////////////////////
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Perform queries that have been received
+    ////////////////////////////////////////////////////////////////////////////
+    bottom_tree.query( fwd_queries, indices, offset, distances );
+    Kokkos::View<int *, DeviceType> owner_ranks( ranks.label() );
+    mapToOriginalOwners( tree, indices, owner_ranks );
+    ////////////////////////////////////////////////////////////////////////////
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Communicate results back
+    ////////////////////////////////////////////////////////////////////////////
+    communicateResultsBack( tree, indices, owner_ranks, offset, ranks, ids,
+                            &distances );
+    ////////////////////////////////////////////////////////////////////////////
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Merge results
+    ////////////////////////////////////////////////////////////////////////////
+    countResults( n_objects, ids, offset );
+    sortResults( ids, indices, ranks, distances );
+
+    Kokkos::View<int *, DeviceType> new_offset( offset.label(),
+                                                n_objects + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_local_and_remote_neighbors" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_objects ),
+        KOKKOS_LAMBDA( int i ) {
+            new_offset( i ) = local_offset( i + 1 ) - local_offset( i ) +
+                              offset( i + 1 ) - offset( i );
+        } );
+    Kokkos::fence();
+    exclusivePrefixSum( new_offset );
+
+    int const n_results = lastElement( new_offset );
+    Kokkos::View<int *, DeviceType> new_indices(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        n_results );
+    Kokkos::View<int *, DeviceType> new_ranks(
+        Kokkos::ViewAllocateWithoutInitializing( ranks.label() ), n_results );
+    Kokkos::View<double *, DeviceType> new_distances(
+        Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+        n_results );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "merge_local_and_remote_neighbors" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_objects ),
+        KOKKOS_LAMBDA( int i ) {
+            int count = new_offset( i );
+            for ( int j = local_offset( i ); j < local_offset( i + 1 ); ++j )
+            {
+                new_indices( count ) = local_indices( j );
+                new_ranks( count ) = comm_rank;
+                new_distances( count++ ) = local_distances( j );
+            }
+            for ( int j = offset( i ); j < offset( i + 1 ); ++j )
+            {
+                new_indices( count ) = indices( j );
+                new_ranks( count ) = ranks( j );
+                new_distances( count++ ) = distances( j );
+            }
+        } );
+    Kokkos::fence();
+
+    offset = new_offset;
+    indices = new_indices;
+    ranks = new_ranks;
+    distances = new_distances;
+    sortResultsByDistance( ExecutionSpace{}, offset, distances, k, indices,
+                           ranks );
+    ////////////////////////////////////////////////////////////////////////////
+}
+
+template <typename DeviceType>
+template <typename Offset>
 void DistributedSearchTreeImpl<DeviceType>::countResults(
     int n_queries, Kokkos::View<int *, DeviceType> query_ids,
-    Kokkos::View<int *, DeviceType> &offset )
+    Kokkos::View<Offset *, DeviceType> &offset )
 {
-    int const nnz = query_ids.extent( 0 );
+    Offset const nnz = query_ids.extent( 0 );
 
     Kokkos::realloc( offset, n_queries + 1 );
     Kokkos::deep_copy( offset, 0 );
 
     Kokkos::parallel_for(
         DTK_MARK_REGION( "count_results_per_query" ),
-        Kokkos::RangePolicy<ExecutionSpace>( 0, nnz ), KOKKOS_LAMBDA( int i ) {
+        Kokkos::RangePolicy<ExecutionSpace, Kokkos::IndexType<Offset>>(
+            0, nnz ),
+        KOKKOS_LAMBDA( Offset i ) {
             Kokkos::atomic_increment( &offset( query_ids( i ) ) );
         } );
     Kokkos::fence();
@@ -488,105 +1665,480 @@ void DistributedSearchTreeImpl<DeviceType>::countResults(
 }
 
 template <typename DeviceType>
-template <typename Query>
+template <typename Query, typename LocalWork>
 void DistributedSearchTreeImpl<DeviceType>::forwardQueries(
-    Teuchos::RCP<Teuchos::Comm<int> const> comm,
+    DistributorCache &distributor_cache,
     Kokkos::View<Query *, DeviceType> queries,
     Kokkos::View<int *, DeviceType> indices,
     Kokkos::View<int *, DeviceType> offset,
     Kokkos::View<Query *, DeviceType> &fwd_queries,
     Kokkos::View<int *, DeviceType> &fwd_ids,
-    Kokkos::View<int *, DeviceType> &fwd_ranks )
+    Kokkos::View<int *, DeviceType> &fwd_ranks,
+    Kokkos::View<int *, DeviceType> &local_ids, LocalWork const &local_work )
 {
-    int const comm_rank = comm->getRank();
-
-    Tpetra::Distributor distributor( comm );
+    int const comm_rank = distributor_cache.getComm()->getRank();
 
     int const n_queries = queries.extent( 0 );
-    int const n_exports = offset( n_queries );
-    int const n_imports = distributor.createFromSends(
-        Teuchos::ArrayView<int>( indices.data(), n_exports ) );
 
-    Kokkos::View<Query *, DeviceType> exports( queries.label(), n_exports );
-    Kokkos::parallel_for( DTK_MARK_REGION( "forward_queries_fill_buffer" ),
-                          Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
-                          KOKKOS_LAMBDA( int q ) {
-                              for ( int i = offset( q ); i < offset( q + 1 );
-                                    ++i )
-                              {
-                                  exports( i ) = queries( q );
-                              }
-                          } );
+    // Separate the queries destined to the local process from the other ones.
+    Kokkos::View<int *, DeviceType> export_offset( "export_offset",
+                                                   n_queries + 1 );
+    Kokkos::View<int *, DeviceType> local_offset( "local_offset",
+                                                  n_queries + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "forward_queries_count_local_and_remote" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            export_offset( q ) = 0;
+            local_offset( q ) = 0;
+            for ( int i = offset( q ); i < offset( q + 1 ); ++i )
+                if ( indices( i ) == comm_rank )
+                    ++local_offset( q );
+                else
+                    ++export_offset( q );
+        } );
     Kokkos::fence();
+    exclusivePrefixSum( export_offset );
+    exclusivePrefixSum( local_offset );
+    int const n_exports = lastElement( export_offset );
+    int const n_local = lastElement( local_offset );
 
-    Kokkos::View<int *, DeviceType> export_ranks( "export_ranks", n_exports );
-    Kokkos::deep_copy( export_ranks, comm_rank );
-
-    Kokkos::View<int *, DeviceType> import_ranks( "import_ranks", n_imports );
-    sendAcrossNetwork( distributor, export_ranks, import_ranks );
-
+    Kokkos::View<int *, DeviceType> destinations( "destinations", n_exports );
+    Kokkos::View<Query *, DeviceType> exports( queries.label(), n_exports );
     Kokkos::View<int *, DeviceType> export_ids( "export_ids", n_exports );
-    Kokkos::parallel_for( DTK_MARK_REGION( "forward_queries_fill_ids" ),
-                          Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
-                          KOKKOS_LAMBDA( int q ) {
-                              for ( int i = offset( q ); i < offset( q + 1 );
-                                    ++i )
-                              {
-                                  export_ids( i ) = q;
-                              }
-                          } );
+    Kokkos::View<Query *, DeviceType> local_queries( queries.label(),
+                                                     n_local );
+    Kokkos::realloc( local_ids, n_local );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "forward_queries_fill_buffer" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            int export_count = export_offset( q );
+            int local_count = local_offset( q );
+            for ( int i = offset( q ); i < offset( q + 1 ); ++i )
+                if ( indices( i ) == comm_rank )
+                {
+                    local_queries( local_count ) = queries( q );
+                    local_ids( local_count++ ) = q;
+                }
+                else
+                {
+                    destinations( export_count ) = indices( i );
+                    exports( export_count ) = queries( q );
+                    export_ids( export_count++ ) = q;
+                }
+        } );
     Kokkos::fence();
-    Kokkos::View<int *, DeviceType> import_ids( "import_ids", n_imports );
-    sendAcrossNetwork( distributor, export_ids, import_ids );
 
-    // Send queries across the network
+    Kokkos::View<std::size_t *, DeviceType> permute( "permute" );
+    Tpetra::Distributor &distributor =
+        getDistributor( distributor_cache, destinations, permute );
+    int const n_imports = distributor.getTotalReceiveLength();
+
+    // Send queries across the network and perform the local ones in the
+    // meantime.  The rank of the process the queries come from is not sent
+    // since the distributor tells it.
+    Kokkos::View<int *, DeviceType> import_ids( "import_ids", n_imports );
     Kokkos::View<Query *, DeviceType> imports( queries.label(), n_imports );
-    sendAcrossNetwork( distributor, exports, imports );
+    sendAcrossNetwork( distributor, permute, std::tie( export_ids, exports ),
+                       std::tie( import_ids, imports ),
+                       [&]() { local_work( local_queries ); } );
 
     fwd_queries = imports;
     fwd_ids = import_ids;
-    fwd_ranks = import_ranks;
+    fwd_ranks = importSources( distributor );
+}
+
+template <typename DeviceType>
+template <typename Query>
+Kokkos::View<Within *, DeviceType>
+DistributedSearchTreeImpl<DeviceType>::nodeTreeQueries(
+    Kokkos::View<Query *, DeviceType> queries, NearestPredicateTag )
+{
+    int const n_queries = queries.extent_int( 0 );
+    Kokkos::View<Within *, DeviceType> within_queries(
+        Kokkos::ViewAllocateWithoutInitializing( "queries" ), n_queries );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "node_tree_queries" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            within_queries( q ) =
+                within( queries( q )._geometry, queries( q )._radius );
+        } );
+    Kokkos::fence();
+    return within_queries;
+}
+
+template <typename DeviceType>
+template <typename Query, typename LocalWork>
+void DistributedSearchTreeImpl<DeviceType>::forwardQueries(
+    DistributedSearchTree<DeviceType> const &tree,
+    Kokkos::View<Query *, DeviceType> queries,
+    Kokkos::View<int *, DeviceType> indices,
+    Kokkos::View<int *, DeviceType> offset,
+    Kokkos::View<Query *, DeviceType> &fwd_queries,
+    Kokkos::View<int *, DeviceType> &fwd_ids,
+    Kokkos::View<int *, DeviceType> &fwd_ranks,
+    Kokkos::View<int *, DeviceType> &local_ids, LocalWork const &local_work,
+    bool skip_origin )
+{
+    if ( !tree._grouped_in_nodes )
+    {
+        forwardQueries( *tree._distributor_cache, queries, indices, offset,
+                        fwd_queries, fwd_ids, fwd_ranks, local_ids,
+                        local_work );
+        return;
+    }
+
+    int const node_rank = tree._node_comm->getRank();
+    auto const processes_of_nodes = tree._processes_of_nodes;
+    auto const processes_of_nodes_offset = tree._processes_of_nodes_offset;
+    auto const node_processes = tree._node_processes;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Send the queries to the nodes
+    ////////////////////////////////////////////////////////////////////////////
+    // The queries enter a node through the process with the same rank in the
+    // node as this one, or its last process, so that the work of forwarding
+    // them is spread over the processes of the node.
+    int const n_queries = queries.extent_int( 0 );
+    int const n_exports = lastElement( offset );
+    Kokkos::View<int *, DeviceType> destinations(
+        Kokkos::ViewAllocateWithoutInitializing( "destinations" ), n_exports );
+    Kokkos::View<Query *, DeviceType> exports(
+        Kokkos::ViewAllocateWithoutInitializing( queries.label() ), n_exports );
+    Kokkos::View<int *, DeviceType> export_ids(
+        Kokkos::ViewAllocateWithoutInitializing( "export_ids" ), n_exports );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "forward_queries_to_nodes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            for ( int i = offset( q ); i < offset( q + 1 ); ++i )
+            {
+                int const first = processes_of_nodes_offset( indices( i ) );
+                int const last =
+                    processes_of_nodes_offset( indices( i ) + 1 ) - 1;
+                destinations( i ) = processes_of_nodes(
+                    KokkosHelpers::min( first + node_rank, last ) );
+                exports( i ) = queries( q );
+                export_ids( i ) = q;
+            }
+        } );
+    Kokkos::fence();
+
+    Kokkos::View<std::size_t *, DeviceType> permute( "permute" );
+    Tpetra::Distributor &distributor =
+        getDistributor( *tree._distributor_cache, destinations, permute );
+    int const n_imports = distributor.getTotalReceiveLength();
+
+    Kokkos::View<int *, DeviceType> import_ids( "import_ids", n_imports );
+    Kokkos::View<Query *, DeviceType> imports( queries.label(), n_imports );
+    Kokkos::realloc( local_ids, 0 );
+    sendAcrossNetwork( distributor, permute, std::tie( export_ids, exports ),
+                       std::tie( import_ids, imports ), [&]() {
+                           local_work( Kokkos::View<Query *, DeviceType>(
+                               queries.label(), 0 ) );
+                       } );
+    auto const import_ranks = importSources( distributor );
+    ////////////////////////////////////////////////////////////////////////////
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Forward them within the node
+    ////////////////////////////////////////////////////////////////////////////
+    Kokkos::View<int *, DeviceType> node_indices( indices.label() );
+    Kokkos::View<int *, DeviceType> node_offset( offset.label() );
+    queryOwners( tree._node_tree, tree._node_tree_ranks,
+                 nodeTreeQueries( imports, typename Query::Tag{} ),
+                 node_indices, node_offset );
+
+    Kokkos::View<int *, DeviceType> node_export_offset( offset.label(),
+                                                        n_imports + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "count_processes_in_the_node" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_imports ),
+        KOKKOS_LAMBDA( int q ) {
+            node_export_offset( q ) = 0;
+            for ( int i = node_offset( q ); i < node_offset( q + 1 ); ++i )
+                if ( !skip_origin || node_processes( node_indices( i ) ) !=
+                                         import_ranks( q ) )
+                    ++node_export_offset( q );
+        } );
+    Kokkos::fence();
+    exclusivePrefixSum( node_export_offset );
+    int const n_node_exports = lastElement( node_export_offset );
+
+    Kokkos::View<int *, DeviceType> node_destinations(
+        Kokkos::ViewAllocateWithoutInitializing( "destinations" ),
+        n_node_exports );
+    Kokkos::View<Query *, DeviceType> node_exports(
+        Kokkos::ViewAllocateWithoutInitializing( queries.label() ),
+        n_node_exports );
+    Kokkos::View<int *, DeviceType> node_export_ids(
+        Kokkos::ViewAllocateWithoutInitializing( "export_ids" ),
+        n_node_exports );
+    Kokkos::View<int *, DeviceType> node_export_ranks(
+        Kokkos::ViewAllocateWithoutInitializing( "export_ranks" ),
+        n_node_exports );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "forward_queries_within_the_node" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_imports ),
+        KOKKOS_LAMBDA( int q ) {
+            int count = node_export_offset( q );
+            for ( int i = node_offset( q ); i < node_offset( q + 1 ); ++i )
+                if ( !skip_origin || node_processes( node_indices( i ) ) !=
+                                         import_ranks( q ) )
+                {
+                    node_destinations( count ) = node_indices( i );
+                    node_exports( count ) = imports( q );
+                    node_export_ids( count ) = import_ids( q );
+                    node_export_ranks( count++ ) = import_ranks( q );
+                }
+        } );
+    Kokkos::fence();
+
+    Tpetra::Distributor &node_distributor = getDistributor(
+        *tree._node_distributor_cache, node_destinations, permute );
+    int const n_node_imports = node_distributor.getTotalReceiveLength();
+
+    Kokkos::realloc( fwd_ranks, n_node_imports );
+    Kokkos::realloc( fwd_ids, n_node_imports );
+    Kokkos::realloc( fwd_queries, n_node_imports );
+    sendAcrossNetwork(
+        node_distributor, permute,
+        std::tie( node_export_ranks, node_export_ids, node_exports ),
+        std::tie( fwd_ranks, fwd_ids, fwd_queries ) );
+    ////////////////////////////////////////////////////////////////////////////
+}
+
+template <typename DeviceType>
+void DistributedSearchTreeImpl<DeviceType>::partitionAlongCurve(
+    DistributorCache &distributor_cache,
+    Kokkos::View<Box const *, DeviceType> boxes, SpaceFillingCurve curve,
+    Kokkos::View<Box *, DeviceType> &new_boxes,
+    Kokkos::View<int *, DeviceType> &original_ranks,
+    Kokkos::View<int *, DeviceType> &original_indices )
+{
+    using TreeConstruction = Details::TreeConstruction<DeviceType>;
+
+    auto const comm = distributor_cache.getComm();
+    int const comm_rank = comm->getRank();
+    int const comm_size = comm->getSize();
+    int const n = boxes.extent_int( 0 );
+
+    // The codes must be computed with respect to the same scene on all
+    // processes.
+    Box local_scene_bounding_box;
+    TreeConstruction::calculateBoundingBoxOfTheScene(
+        boxes, local_scene_bounding_box );
+    Box scene_bounding_box;
+    Teuchos::reduceAll( *comm, Teuchos::REDUCE_MIN, 3,
+                        &local_scene_bounding_box.minCorner()[0],
+                        &scene_bounding_box.minCorner()[0] );
+    Teuchos::reduceAll( *comm, Teuchos::REDUCE_MAX, 3,
+                        &local_scene_bounding_box.maxCorner()[0],
+                        &scene_bounding_box.maxCorner()[0] );
+
+    Kokkos::View<unsigned int *, DeviceType> codes(
+        Kokkos::ViewAllocateWithoutInitializing( "morton" ), n );
+    TreeConstruction::assignMortonCodes( boxes, codes, scene_bounding_box,
+                                         curve );
+    Kokkos::View<int *, DeviceType> permutation(
+        Kokkos::ViewAllocateWithoutInitializing( "permutation" ), n );
+    iota( permutation );
+    if ( n > 1 )
+        TreeConstruction::sortObjects( codes, permutation );
+
+    // Process r > 0 gets the objects from the first code c such that at least
+    // r * n_total / comm_size codes are smaller than c over all processes.
+    // The codes being 30 bits long, the splitters are found by bisection in
+    // at most 31 reductions.  Objects with the same code are never split.
+    // FIXME: the local codes are counted on the host.
+    auto codes_host = Kokkos::create_mirror_view( codes );
+    Kokkos::deep_copy( codes_host, codes );
+    long long const n_local = n;
+    long long n_total = 0;
+    Teuchos::reduceAll( *comm, Teuchos::REDUCE_SUM, n_local,
+                        Teuchos::ptrFromRef( n_total ) );
+    int const n_splitters = comm_size - 1;
+    std::vector<unsigned int> lower( n_splitters, 0 );
+    std::vector<unsigned int> upper( n_splitters, 1u << 30 );
+    std::vector<long long> local_counts( n_splitters );
+    std::vector<long long> global_counts( n_splitters );
+    while ( lower != upper )
+    {
+        for ( int r = 0; r < n_splitters; ++r )
+            local_counts[r] =
+                std::lower_bound( codes_host.data(), codes_host.data() + n,
+                                  lower[r] + ( upper[r] - lower[r] ) / 2 ) -
+                codes_host.data();
+        Teuchos::reduceAll( *comm, Teuchos::REDUCE_SUM, n_splitters,
+                            local_counts.data(), global_counts.data() );
+        for ( int r = 0; r < n_splitters; ++r )
+        {
+            if ( lower[r] == upper[r] )
+                continue;
+            unsigned int const middle = lower[r] + ( upper[r] - lower[r] ) / 2;
+            if ( global_counts[r] >= n_total * ( r + 1 ) / comm_size )
+                upper[r] = middle;
+            else
+                lower[r] = middle + 1;
+        }
+    }
+
+    Kokkos::View<unsigned int *, DeviceType> splitters(
+        Kokkos::ViewAllocateWithoutInitializing( "splitters" ), n_splitters );
+    auto splitters_host = Kokkos::create_mirror_view( splitters );
+    for ( int r = 0; r < n_splitters; ++r )
+        splitters_host( r ) = lower[r];
+    Kokkos::deep_copy( splitters, splitters_host );
+
+    Kokkos::View<int *, DeviceType> destinations(
+        Kokkos::ViewAllocateWithoutInitializing( "destinations" ), n );
+    Kokkos::View<Box *, DeviceType> export_boxes(
+        Kokkos::ViewAllocateWithoutInitializing( boxes.label() ), n );
+    Kokkos::View<int *, DeviceType> export_ranks(
+        Kokkos::ViewAllocateWithoutInitializing( "export_ranks" ), n );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "assign_curve_segments" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n ), KOKKOS_LAMBDA( int i ) {
+            // number of splitters that are not greater than the code
+            int first = 0;
+            int last = n_splitters;
+            while ( first < last )
+            {
+                int const middle = ( first + last ) / 2;
+                if ( splitters( middle ) <= codes( i ) )
+                    first = middle + 1;
+                else
+                    last = middle;
+            }
+            destinations( i ) = first;
+            export_boxes( i ) = boxes( permutation( i ) );
+            export_ranks( i ) = comm_rank;
+        } );
+    Kokkos::fence();
+
+    Kokkos::View<std::size_t *, DeviceType> permute( "permute" );
+    Tpetra::Distributor &distributor =
+        getDistributor( distributor_cache, destinations, permute );
+    int const n_imports = distributor.getTotalReceiveLength();
+
+    Kokkos::View<Box *, DeviceType> import_boxes( boxes.label(), n_imports );
+    Kokkos::View<int *, DeviceType> import_ranks( "original_ranks",
+                                                  n_imports );
+    Kokkos::View<int *, DeviceType> import_indices( "original_indices",
+                                                    n_imports );
+    sendAcrossNetwork(
+        distributor, permute,
+        std::tie( export_boxes, export_ranks, permutation ),
+        std::tie( import_boxes, import_ranks, import_indices ) );
+
+    new_boxes = import_boxes;
+    original_ranks = import_ranks;
+    original_indices = import_indices;
+}
+
+template <typename DeviceType>
+void DistributedSearchTreeImpl<DeviceType>::mapToOriginalOwners(
+    DistributedSearchTree<DeviceType> const &tree,
+    Kokkos::View<int *, DeviceType> indices,
+    Kokkos::View<int *, DeviceType> &owner_ranks )
+{
+    int const n = indices.extent_int( 0 );
+    Kokkos::realloc( owner_ranks, n );
+    if ( !tree._repartitioned )
+    {
+        Kokkos::deep_copy( owner_ranks, tree._comm->getRank() );
+        return;
+    }
+
+    auto const original_ranks = tree._original_ranks;
+    auto const original_indices = tree._original_indices;
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "map_to_original_owners" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n ), KOKKOS_LAMBDA( int i ) {
+            owner_ranks( i ) = original_ranks( indices( i ) );
+            indices( i ) = original_indices( indices( i ) );
+        } );
+    Kokkos::fence();
+}
+
+template <typename DeviceType>
+Tpetra::Distributor &DistributedSearchTreeImpl<DeviceType>::getDistributor(
+    DistributorCache &distributor_cache,
+    Kokkos::View<int *, DeviceType> export_ranks,
+    Kokkos::View<std::size_t *, DeviceType> &permute )
+{
+    // There is one export per result when the results are sent back, which
+    // may be more than fit in int.
+    std::size_t const n_exports = export_ranks.extent( 0 );
+    Kokkos::realloc( permute, n_exports );
+    Tpetra::Distributor &distributor = distributor_cache.getDistributor(
+        Teuchos::ArrayView<int const>( export_ranks.data(), n_exports ),
+        Teuchos::ArrayView<std::size_t>( permute.data(), n_exports ) );
+    // An empty permutation spares the copy when the exports are already
+    // grouped by destination.
+    if ( std::is_sorted( export_ranks.data(),
+                         export_ranks.data() + n_exports ) )
+        Kokkos::realloc( permute, 0 );
+    return distributor;
 }
 
 template <typename DeviceType>
+Kokkos::View<int *, DeviceType>
+DistributedSearchTreeImpl<DeviceType>::importSources(
+    Tpetra::Distributor const &distributor )
+{
+    auto const procs_from = distributor.getProcsFrom();
+    auto const lengths_from = distributor.getLengthsFrom();
+    Kokkos::View<int *, DeviceType> sources(
+        Kokkos::ViewAllocateWithoutInitializing( "sources" ),
+        distributor.getTotalReceiveLength() );
+    auto sources_host = Kokkos::create_mirror_view( sources );
+    std::size_t i = 0;
+    for ( int k = 0; k < procs_from.size(); ++k )
+        for ( std::size_t j = 0; j < lengths_from[k]; ++j )
+            sources_host( i++ ) = procs_from[k];
+    Kokkos::deep_copy( sources, sources_host );
+    return sources;
+}
+
+template <typename DeviceType>
+template <typename Offset>
 void DistributedSearchTreeImpl<DeviceType>::communicateResultsBack(
-    Teuchos::RCP<Teuchos::Comm<int> const> comm,
+    DistributedSearchTree<DeviceType> const &tree,
     Kokkos::View<int *, DeviceType> &indices,
-    Kokkos::View<int *, DeviceType> offset,
+    Kokkos::View<int *, DeviceType> owner_ranks,
+    Kokkos::View<Offset *, DeviceType> offset,
     Kokkos::View<int *, DeviceType> &ranks,
     Kokkos::View<int *, DeviceType> &ids,
     Kokkos::View<double *, DeviceType> *distances_ptr )
 {
-    int const comm_rank = comm->getRank();
-
     int const n_fwd_queries = offset.extent_int( 0 ) - 1;
-    int const n_exports = offset( n_fwd_queries );
+    Offset const n_exports = lastElement( offset );
     Kokkos::View<int *, DeviceType> export_ranks( ranks.label(), n_exports );
     Kokkos::parallel_for(
         DTK_MARK_REGION( "setup_communication_plan" ),
         Kokkos::RangePolicy<ExecutionSpace>( 0, n_fwd_queries ),
         KOKKOS_LAMBDA( int q ) {
-            for ( int i = offset( q ); i < offset( q + 1 ); ++i )
+            for ( Offset i = offset( q ); i < offset( q + 1 ); ++i )
             {
                 export_ranks( i ) = ranks( q );
             }
         } );
     Kokkos::fence();
 
-    Tpetra::Distributor distributor( comm );
-    int const n_imports = distributor.createFromSends(
-        Teuchos::ArrayView<int>( export_ranks.data(), n_exports ) );
-
-    // export_ranks already has adequate size since it was used as a buffer to
-    // make the new communication plan.
-    Kokkos::deep_copy( export_ranks, comm_rank );
+    Kokkos::View<std::size_t *, DeviceType> permute( "permute" );
+    Tpetra::Distributor &distributor =
+        getDistributor( *tree._distributor_cache, export_ranks, permute );
+    auto const n_imports = distributor.getTotalReceiveLength();
 
     Kokkos::View<int *, DeviceType> export_ids( ids.label(), n_exports );
     Kokkos::parallel_for(
         DTK_MARK_REGION( "fill_buffer" ),
         Kokkos::RangePolicy<ExecutionSpace>( 0, n_fwd_queries ),
         KOKKOS_LAMBDA( int q ) {
-            for ( int i = offset( q ); i < offset( q + 1 ); ++i )
+            for ( Offset i = offset( q ); i < offset( q + 1 ); ++i )
             {
                 export_ids( i ) = ids( q );
             }
@@ -598,30 +2150,218 @@ void DistributedSearchTreeImpl<DeviceType>::communicateResultsBack(
                                                     n_imports );
     Kokkos::View<int *, DeviceType> import_ranks( ranks.label(), n_imports );
     Kokkos::View<int *, DeviceType> import_ids( ids.label(), n_imports );
-    sendAcrossNetwork( distributor, export_indices, import_indices );
-    sendAcrossNetwork( distributor, export_ranks, import_ranks );
-    sendAcrossNetwork( distributor, export_ids, import_ids );
+    if ( tree._repartitioned )
+    {
+        // export_ranks already has adequate size since it was used as a
+        // buffer to make the new communication plan.
+        Kokkos::deep_copy( export_ranks, owner_ranks );
+        sendResultsAcrossNetwork(
+            tree, distributor, permute,
+            std::tie( export_indices, export_ranks, export_ids ),
+            std::tie( import_indices, import_ranks, import_ids ),
+            distances_ptr );
+    }
+    else
+    {
+        sendResultsAcrossNetwork(
+            tree, distributor, permute, std::tie( export_indices, export_ids ),
+            std::tie( import_indices, import_ids ), distances_ptr );
+        import_ranks = importSources( distributor );
+    }
 
     ids = import_ids;
     ranks = import_ranks;
     indices = import_indices;
+}
+
+template <typename DeviceType>
+template <typename... ExportViews, typename... ImportViews>
+void DistributedSearchTreeImpl<DeviceType>::sendResultsAcrossNetwork(
+    DistributedSearchTree<DeviceType> const &tree,
+    Tpetra::Distributor &distributor,
+    Kokkos::View<std::size_t *, DeviceType> permute,
+    std::tuple<ExportViews...> exports, std::tuple<ImportViews...> imports,
+    Kokkos::View<double *, DeviceType> *distances_ptr )
+{
+    if ( !distances_ptr )
+    {
+        sendAcrossNetwork( distributor, permute, exports, imports );
+        return;
+    }
+
+    Kokkos::View<double *, DeviceType> &distances = *distances_ptr;
+    std::size_t const n_exports = distances.extent( 0 );
+    std::size_t const n_imports = distributor.getTotalReceiveLength();
+    Kokkos::View<double *, DeviceType> import_distances( distances.label(),
+                                                         n_imports );
+    if ( tree._single_precision_distances )
+    {
+        Kokkos::View<float *, DeviceType> export_floats(
+            Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+            n_exports );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "convert_distances_to_float" ),
+            Kokkos::RangePolicy<ExecutionSpace,
+                                Kokkos::IndexType<std::size_t>>( 0, n_exports ),
+            KOKKOS_LAMBDA( std::size_t i ) {
+                export_floats( i ) = distances( i );
+            } );
+        Kokkos::fence();
+        Kokkos::View<float *, DeviceType> import_floats(
+            Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+            n_imports );
+        sendAcrossNetwork(
+            distributor, permute,
+            std::tuple_cat( exports, std::tie( export_floats ) ),
+            std::tuple_cat( imports, std::tie( import_floats ) ) );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "convert_distances_to_double" ),
+            Kokkos::RangePolicy<ExecutionSpace,
+                                Kokkos::IndexType<std::size_t>>( 0, n_imports ),
+            KOKKOS_LAMBDA( std::size_t i ) {
+                import_distances( i ) = import_floats( i );
+            } );
+        Kokkos::fence();
+    }
+    else
+        sendAcrossNetwork(
+            distributor, permute,
+            std::tuple_cat( exports, std::tie( distances ) ),
+            std::tuple_cat( imports, std::tie( import_distances ) ) );
+    distances = import_distances;
+}
+
+// Forwarded queries that did not find anything are not sent back.  On output,
+// ids (and counts unless send_counts is false) only hold the entries that
+// were received.
+template <typename DeviceType>
+template <typename Offset>
+void DistributedSearchTreeImpl<DeviceType>::mergeLocalResults(
+    Kokkos::View<int *, DeviceType> local_ids,
+    Kokkos::View<int *, DeviceType> local_indices,
+    Kokkos::View<int *, DeviceType> local_owner_ranks,
+    Kokkos::View<Offset *, DeviceType> local_offset,
+    Kokkos::View<double *, DeviceType> local_distances,
+    Kokkos::View<int *, DeviceType> &indices,
+    Kokkos::View<int *, DeviceType> &ranks,
+    Kokkos::View<int *, DeviceType> &ids,
+    Kokkos::View<double *, DeviceType> *distances_ptr )
+{
+    int const n_local_queries = local_ids.extent_int( 0 );
+    Offset const n_remote_results = indices.extent( 0 );
+    Offset const n_results = n_remote_results + lastElement( local_offset );
+
+    Kokkos::View<int *, DeviceType> new_indices(
+        Kokkos::ViewAllocateWithoutInitializing( indices.label() ),
+        n_results );
+    Kokkos::View<int *, DeviceType> new_ranks(
+        Kokkos::ViewAllocateWithoutInitializing( ranks.label() ), n_results );
+    Kokkos::View<int *, DeviceType> new_ids(
+        Kokkos::ViewAllocateWithoutInitializing( ids.label() ), n_results );
+    Kokkos::View<double *, DeviceType> distances;
+    Kokkos::View<double *, DeviceType> new_distances;
+    if ( distances_ptr )
+    {
+        distances = *distances_ptr;
+        new_distances = Kokkos::View<double *, DeviceType>(
+            Kokkos::ViewAllocateWithoutInitializing( distances.label() ),
+            n_results );
+    }
+    bool const with_distances = ( distances_ptr != nullptr );
 
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "copy_remote_results" ),
+        Kokkos::RangePolicy<ExecutionSpace, Kokkos::IndexType<Offset>>(
+            0, n_remote_results ),
+        KOKKOS_LAMBDA( Offset i ) {
+            new_indices( i ) = indices( i );
+            new_ranks( i ) = ranks( i );
+            new_ids( i ) = ids( i );
+            if ( with_distances )
+                new_distances( i ) = distances( i );
+        } );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "append_local_results" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_local_queries ),
+        KOKKOS_LAMBDA( int j ) {
+            for ( Offset i = local_offset( j ); i < local_offset( j + 1 ); ++i )
+            {
+                new_indices( n_remote_results + i ) = local_indices( i );
+                new_ranks( n_remote_results + i ) = local_owner_ranks( i );
+                new_ids( n_remote_results + i ) = local_ids( j );
+                if ( with_distances )
+                    new_distances( n_remote_results + i ) =
+                        local_distances( i );
+            }
+        } );
+    Kokkos::fence();
+
+    indices = new_indices;
+    ranks = new_ranks;
+    ids = new_ids;
     if ( distances_ptr )
+        *distances_ptr = new_distances;
+}
+
+template <typename DeviceType>
+void DistributedSearchTreeImpl<DeviceType>::communicateCountsBack(
+    DistributorCache &distributor_cache,
+    Kokkos::View<int *, DeviceType> ranks, Kokkos::View<int *, DeviceType> &ids,
+    Kokkos::View<int *, DeviceType> &counts, bool send_counts )
+{
+    int const n_fwd_queries = ids.extent_int( 0 );
+    Kokkos::View<int *, DeviceType> offset( "offset", n_fwd_queries + 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "flag_queries_with_results" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_fwd_queries ),
+        KOKKOS_LAMBDA( int q ) { offset( q ) = ( counts( q ) > 0 ) ? 1 : 0; } );
+    Kokkos::fence();
+    exclusivePrefixSum( offset );
+    int const n_exports = lastElement( offset );
+
+    Kokkos::View<int *, DeviceType> export_ranks( ranks.label(), n_exports );
+    Kokkos::View<int *, DeviceType> export_ids( ids.label(), n_exports );
+    Kokkos::View<int *, DeviceType> export_counts( counts.label(),
+                                                   n_exports );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "fill_buffer" ),
+        Kokkos::RangePolicy<ExecutionSpace>( 0, n_fwd_queries ),
+        KOKKOS_LAMBDA( int q ) {
+            if ( offset( q + 1 ) > offset( q ) )
+            {
+                export_ranks( offset( q ) ) = ranks( q );
+                export_ids( offset( q ) ) = ids( q );
+                export_counts( offset( q ) ) = counts( q );
+            }
+        } );
+    Kokkos::fence();
+
+    Kokkos::View<std::size_t *, DeviceType> permute( "permute" );
+    Tpetra::Distributor &distributor =
+        getDistributor( distributor_cache, export_ranks, permute );
+    int const n_imports = distributor.getTotalReceiveLength();
+
+    Kokkos::View<int *, DeviceType> import_ids( ids.label(), n_imports );
+    if ( send_counts )
     {
-        Kokkos::View<double *, DeviceType> &distances = *distances_ptr;
-        Kokkos::View<double *, DeviceType> export_distances = distances;
-        Kokkos::View<double *, DeviceType> import_distances( distances.label(),
-                                                             n_imports );
-        sendAcrossNetwork( distributor, export_distances, import_distances );
-        distances = import_distances;
+        Kokkos::View<int *, DeviceType> import_counts( counts.label(),
+                                                       n_imports );
+        sendAcrossNetwork( distributor, permute,
+                           std::tie( export_ids, export_counts ),
+                           std::tie( import_ids, import_counts ) );
+        counts = import_counts;
     }
+    else
+        sendAcrossNetwork( distributor, permute, std::tie( export_ids ),
+                           std::tie( import_ids ) );
+    ids = import_ids;
 }
 
 template <typename DeviceType>
 template <typename Query>
 void DistributedSearchTreeImpl<DeviceType>::filterResults(
     Kokkos::View<Query *, DeviceType> queries,
-    Kokkos::View<double *, DeviceType> distances,
+    Kokkos::View<double *, DeviceType> &distances,
     Kokkos::View<int *, DeviceType> &indices,
     Kokkos::View<int *, DeviceType> &offset,
     Kokkos::View<int *, DeviceType> &ranks )
@@ -647,6 +2387,8 @@ void DistributedSearchTreeImpl<DeviceType>::filterResults(
                                                  n_truncated_results );
     Kokkos::View<int *, DeviceType> new_ranks( ranks.label(),
                                                n_truncated_results );
+    Kokkos::View<double *, DeviceType> new_distances( distances.label(),
+                                                      n_truncated_results );
 
     using PairIndexDistance = Kokkos::pair<Kokkos::Array<int, 2>, double>;
     struct CompareDistance
@@ -675,6 +2417,7 @@ void DistributedSearchTreeImpl<DeviceType>::filterResults(
             {
                 new_indices( new_offset( q ) + count ) = queue.top().first[0];
                 new_ranks( new_offset( q ) + count ) = queue.top().first[1];
+                new_distances( new_offset( q ) + count ) = queue.top().second;
                 queue.pop();
                 ++count;
             }
@@ -682,6 +2425,7 @@ void DistributedSearchTreeImpl<DeviceType>::filterResults(
     Kokkos::fence();
     indices = new_indices;
     ranks = new_ranks;
+    distances = new_distances;
     offset = new_offset;
 }
 
@@ -0,0 +1,171 @@
+/****************************************************************************
+ * Copyright (c) 2012-2018 by the DataTransferKit authors                   *
+ * All rights reserved.                                                     *
+ *                                                                          *
+ * This file is part of the DataTransferKit library. DataTransferKit is     *
+ * distributed under a BSD 3-clause license. For the licensing terms see    *
+ * the LICENSE file in the top-level directory.                             *
+ *                                                                          *
+ * SPDX-License-Identifier: BSD-3-Clause                                    *
+ ****************************************************************************/
+#ifndef DTK_DETAILS_DISTRIBUTOR_CACHE_HPP
+#define DTK_DETAILS_DISTRIBUTOR_CACHE_HPP
+
+#include <DTK_DBC.hpp>
+
+#include <Teuchos_ArrayView.hpp>
+#include <Teuchos_Comm.hpp>
+#include <Teuchos_CommHelpers.hpp>
+#include <Teuchos_ParameterList.hpp>
+#include <Teuchos_RCP.hpp>
+#include <Tpetra_Distributor.hpp>
+
+#include <algorithm> // min, stable_sort
+#include <cstddef>   // size_t
+#include <numeric>   // iota
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace DataTransferKit
+{
+namespace Details
+{
+
+/** Keeps the communication plans built by the last few calls to
+ *  getDistributor().  Creating a plan with \c createFromSends() requires an
+ *  all-to-all exchange for every process to learn who sends to it and how
+ *  much.  The plans are built for exports grouped by destination in
+ *  ascending rank order, so that a plan only depends on how many entries go
+ *  to each process.  When all processes send the same number of entries to
+ *  the same processes as when a cached plan was made, that plan is returned
+ *  instead, which only costs a reduction to agree on it.
+ *
+ *  All the methods are collective over the communicator.  The plans are
+ *  replaced in a round-robin fashion, which is identical on all processes.
+ *  After a streak of misses, the lookups back off so that patterns that
+ *  never repeat do not pay the reduction on top of creating their plans.
+ *
+ *  The plans post their sends with MPI_Isend instead of the blocking
+ *  MPI_Send that Tpetra uses by default, so that the work done between
+ *  \c doPosts() and \c doWaits() overlaps with the whole exchange rather
+ *  than only with the receives.
+ */
+class DistributorCache
+{
+  public:
+    DistributorCache( Teuchos::RCP<Teuchos::Comm<int> const> comm,
+                      int capacity = 4 )
+        : _comm( comm )
+        , _capacity( capacity )
+        , _next( 0 )
+        , _hits( 0 )
+        , _misses( 0 )
+        , _skips( 0 )
+    {
+        DTK_REQUIRE( capacity > 0 );
+    }
+
+    /** Returns a plan for sending entry \c i of the exports to process \c
+     *  export_ranks[i].  The plan expects the exports grouped by
+     *  destination: entry \c i must be at position \c permute[i] of the
+     *  send buffer.  The entries going to the same process keep their
+     *  relative order.  The number of entries this process will receive is
+     *  given by \c getTotalReceiveLength().  The reference is valid until the
+     *  next call.
+     */
+    Tpetra::Distributor &
+    getDistributor( Teuchos::ArrayView<int const> export_ranks,
+                    Teuchos::ArrayView<std::size_t> permute )
+    {
+        DTK_REQUIRE( permute.size() == export_ranks.size() );
+        std::size_t const n_exports = export_ranks.size();
+        std::vector<std::size_t> order( n_exports );
+        std::iota( order.begin(), order.end(), 0 );
+        std::stable_sort( order.begin(), order.end(),
+                          [export_ranks]( std::size_t i, std::size_t j ) {
+                              return export_ranks[i] < export_ranks[j];
+                          } );
+        Key key;
+        std::vector<int> grouped_ranks( n_exports );
+        for ( std::size_t k = 0; k < n_exports; ++k )
+        {
+            int const rank = export_ranks[order[k]];
+            permute[order[k]] = k;
+            grouped_ranks[k] = rank;
+            if ( key.empty() || key.back().first != rank )
+                key.emplace_back( rank, 0 );
+            ++key.back().second;
+        }
+
+        int const n_entries = _entries.size();
+        if ( n_entries > 0 && _skips > 0 )
+            --_skips;
+        else if ( n_entries > 0 )
+        {
+            std::vector<int> local_match( n_entries );
+            for ( int e = 0; e < n_entries; ++e )
+                local_match[e] = ( _entries[e].key == key );
+            std::vector<int> global_match( n_entries );
+            Teuchos::reduceAll( *_comm, Teuchos::REDUCE_MIN, n_entries,
+                                local_match.data(), global_match.data() );
+            for ( int e = 0; e < n_entries; ++e )
+                if ( global_match[e] )
+                {
+                    ++_hits;
+                    _misses = 0;
+                    return *_entries[e].distributor;
+                }
+            // Skip 1, 2, 4, ..., up to 32 lookups once the last capacity
+            // ones all missed.
+            if ( ++_misses >= _capacity )
+                _skips = 1 << std::min( _misses - _capacity, 5 );
+        }
+
+        Entry entry;
+        entry.key = std::move( key );
+        entry.distributor = Teuchos::rcp( new Tpetra::Distributor( _comm ) );
+        auto parameters = Teuchos::parameterList();
+        parameters->set( "Send type", std::string( "Isend" ) );
+        entry.distributor->setParameterList( parameters );
+        entry.distributor->createFromSends( Teuchos::ArrayView<int const>(
+            grouped_ranks.data(), n_exports ) );
+        if ( n_entries < _capacity )
+        {
+            _entries.push_back( entry );
+            return *_entries.back().distributor;
+        }
+        _entries[_next] = entry;
+        Tpetra::Distributor &distributor = *_entries[_next].distributor;
+        _next = ( _next + 1 ) % _capacity;
+        return distributor;
+    }
+
+    /** Number of plans that were reused rather than created.
+     */
+    int hits() const { return _hits; }
+
+    Teuchos::RCP<Teuchos::Comm<int> const> getComm() const { return _comm; }
+
+  private:
+    // The processes the exports go to in ascending order and how many
+    // entries go to each of them.
+    using Key = std::vector<std::pair<int, std::size_t>>;
+    struct Entry
+    {
+        Key key;
+        Teuchos::RCP<Tpetra::Distributor> distributor;
+    };
+    Teuchos::RCP<Teuchos::Comm<int> const> _comm;
+    int _capacity;
+    int _next;
+    int _hits;
+    int _misses;
+    int _skips;
+    std::vector<Entry> _entries;
+};
+
+} // namespace Details
+} // namespace DataTransferKit
+
+#endif
@@ -17,15 +17,18 @@
 
 namespace DataTransferKit
 {
-struct Node
+template <typename BoundingVolume>
+struct TreeNode
 {
     KOKKOS_INLINE_FUNCTION
-    Node() = default;
+    TreeNode() = default;
 
-    Node *parent = nullptr;
-    Kokkos::pair<Node *, Node *> children = {nullptr, nullptr};
-    Box bounding_box;
+    TreeNode *parent = nullptr;
+    Kokkos::pair<TreeNode *, TreeNode *> children = {nullptr, nullptr};
+    BoundingVolume bounding_volume;
 };
+
+using Node = TreeNode<Box>;
 } // namespace DataTransferKit
 
 #endif
@@ -12,6 +12,7 @@
 #define DTK_DETAILS_TEUCHOS_SERIALIZATION_TRAITS_HPP
 
 #include <DTK_Box.hpp>
+#include <DTK_KDOP.hpp>
 #include <DTK_Point.hpp>
 #include <DTK_Predicates.hpp>
 #include <DTK_Sphere.hpp>
@@ -39,6 +40,12 @@ class SerializationTraits<Ordinal, DataTransferKit::Sphere>
 {
 };
 
+template <typename Ordinal, int k>
+class SerializationTraits<Ordinal, DataTransferKit::KDOP<k>>
+    : public DirectSerializationTraits<Ordinal, DataTransferKit::KDOP<k>>
+{
+};
+
 template <typename Ordinal, typename Geometry>
 class SerializationTraits<Ordinal, DataTransferKit::Nearest<Geometry>>
     : public DirectSerializationTraits<Ordinal,
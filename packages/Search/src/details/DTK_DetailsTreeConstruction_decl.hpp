@@ -24,42 +24,190 @@
 
 namespace DataTransferKit
 {
+/** \brief Space-filling curves available to order the objects
+ *
+ *  \c Morton (Z-order) interleaves the bits of the coordinates.  It is the
+ *  cheapest to compute but jumps across the domain at power-of-two
+ *  boundaries.  \c Hilbert only ever moves to a neighboring cell which keeps
+ *  consecutive objects closer to each other, at the price of a few more
+ *  operations per code.
+ */
+enum class SpaceFillingCurve
+{
+    Morton,
+    Hilbert
+};
+
 namespace Details
 {
 /**
  * This structure contains all the functions used to build the BVH. All the
  * functions are static.
+ *
+ * The bounding volume type is used for the leaves and the internal nodes.  It
+ * must provide expand() overloads with itself and with Box as well as
+ * centroid().  The bounding box of the scene that is used to compute the
+ * Morton codes is always an axis-aligned box.
  */
-template <typename DeviceType>
+template <typename DeviceType, typename BoundingVolume = Box>
 struct TreeConstruction
 {
   public:
     using ExecutionSpace = typename DeviceType::execution_space;
+    using Node = TreeNode<BoundingVolume>;
+
+    // The overloads that take an execution space instance enqueue their work
+    // on it and do not fence, except where the host needs a value (the
+    // reduction into the scene bounding box and the bin sort).  The other
+    // overloads run on the default instance and fence before returning.
 
     static void calculateBoundingBoxOfTheScene(
-        Kokkos::View<Box const *, DeviceType> bounding_boxes,
+        ExecutionSpace const &space,
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
         Box &scene_bounding_box );
 
+    static void calculateBoundingBoxOfTheScene(
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Box &scene_bounding_box )
+    {
+        calculateBoundingBoxOfTheScene( ExecutionSpace{}, bounding_volumes,
+                                        scene_bounding_box );
+        Kokkos::fence();
+    }
+
     // to assign the Morton code for a given object, we use the centroid point
-    // of its bounding box, and express it relative to the bounding box of the
-    // scene.
+    // of its bounding volume, and express it relative to the bounding box of
+    // the scene.  The codes may be computed along the Hilbert curve instead.
+    // Both are 30-bit keys whose leading bits identify the octant the object
+    // falls into so the rest of the construction is oblivious to the curve.
+    static void assignMortonCodes(
+        ExecutionSpace const &space,
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Kokkos::View<unsigned int *, DeviceType> morton_codes,
+        Box const &scene_bounding_box,
+        SpaceFillingCurve curve = SpaceFillingCurve::Morton );
+
+    static void assignMortonCodes(
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Kokkos::View<unsigned int *, DeviceType> morton_codes,
+        Box const &scene_bounding_box,
+        SpaceFillingCurve curve = SpaceFillingCurve::Morton )
+    {
+        assignMortonCodes( ExecutionSpace{}, bounding_volumes, morton_codes,
+                           scene_bounding_box, curve );
+        Kokkos::fence();
+    }
+
     static void
-    assignMortonCodes( Kokkos::View<Box const *, DeviceType> bounding_boxes,
-                       Kokkos::View<unsigned int *, DeviceType> morton_codes,
-                       Box const &scene_bounding_box );
+    sortObjects( ExecutionSpace const &space,
+                 Kokkos::View<unsigned int *, DeviceType> morton_codes,
+                 Kokkos::View<int *, DeviceType> object_ids );
 
     static void
     sortObjects( Kokkos::View<unsigned int *, DeviceType> morton_codes,
+                 Kokkos::View<int *, DeviceType> object_ids )
+    {
+        sortObjects( ExecutionSpace{}, morton_codes, object_ids );
+        Kokkos::fence();
+    }
+
+    // Segmented versions of sortObjects() and generateHierarchy() that build
+    // a forest of independent trees at once.  The objects of tree t are
+    // [offsets(t), offsets(t+1)).  They are only sorted among themselves and
+    // the internal nodes of tree t are stored starting at the same position
+    // offsets(t) as its leaves, its root first.  The slot that follows its
+    // last internal node is left unused.
+    static void
+    sortObjects( ExecutionSpace const &space,
+                 Kokkos::View<unsigned int *, DeviceType> morton_codes,
+                 Kokkos::View<int const *, DeviceType> offsets,
                  Kokkos::View<int *, DeviceType> object_ids );
 
+    static void generateHierarchy(
+        ExecutionSpace const &space,
+        Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes,
+        Kokkos::View<int const *, DeviceType> offsets,
+        Kokkos::View<Node *, DeviceType> leaf_nodes,
+        Kokkos::View<Node *, DeviceType> internal_nodes );
+
+    static Node *generateHierarchy(
+        ExecutionSpace const &space,
+        Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes,
+        Kokkos::View<Node *, DeviceType> leaf_nodes,
+        Kokkos::View<Node *, DeviceType> internal_nodes );
+
     static Node *generateHierarchy(
         Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes,
         Kokkos::View<Node *, DeviceType> leaf_nodes,
+        Kokkos::View<Node *, DeviceType> internal_nodes )
+    {
+        Node *root = generateHierarchy( ExecutionSpace{}, sorted_morton_codes,
+                                        leaf_nodes, internal_nodes );
+        Kokkos::fence();
+        return root;
+    }
+
+    // Top-down alternative to the three stages above.  Objects are
+    // recursively partitioned with the surface area heuristic (SAH) evaluated
+    // over a fixed number of bins along each axis.  All the nodes of a given
+    // level of the tree are split concurrently.  On output, \p object_ids
+    // holds the order of the objects in the leaves and the internal nodes are
+    // linked the same way as with generateHierarchy() (root first, node index
+    // at one end of the range of leaves it covers) so that the traversal
+    // algorithms are oblivious to how the tree was built.
+    static Node *generateHierarchyBinnedSAH(
+        ExecutionSpace const &space,
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Kokkos::View<int *, DeviceType> object_ids,
+        Kokkos::View<Node *, DeviceType> leaf_nodes,
         Kokkos::View<Node *, DeviceType> internal_nodes );
 
+    static Node *generateHierarchyBinnedSAH(
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Kokkos::View<int *, DeviceType> object_ids,
+        Kokkos::View<Node *, DeviceType> leaf_nodes,
+        Kokkos::View<Node *, DeviceType> internal_nodes )
+    {
+        Node *root = generateHierarchyBinnedSAH(
+            ExecutionSpace{}, bounding_volumes, object_ids, leaf_nodes,
+            internal_nodes );
+        Kokkos::fence();
+        return root;
+    }
+
     static void
-    calculateBoundingBoxes( Kokkos::View<Node *, DeviceType> leaf_nodes,
-                            Kokkos::View<Node *, DeviceType> internal_nodes );
+    calculateBoundingVolumes( ExecutionSpace const &space,
+                              Kokkos::View<Node *, DeviceType> leaf_nodes,
+                              Kokkos::View<Node *, DeviceType> internal_nodes );
+
+    static void
+    calculateBoundingVolumes( Kokkos::View<Node *, DeviceType> leaf_nodes,
+                              Kokkos::View<Node *, DeviceType> internal_nodes )
+    {
+        calculateBoundingVolumes( ExecutionSpace{}, leaf_nodes,
+                                  internal_nodes );
+        Kokkos::fence();
+    }
+
+    // Stores the internal nodes in depth-first order.  The root stays first,
+    // the left child of an internal node (unless it is a leaf) is stored
+    // right after its parent, and the nodes of any subtree are contiguous so
+    // that top-down traversals touch memory that is close together.  The
+    // internal nodes are moved to a new allocation and the parent pointers of
+    // the leaves are updated accordingly.
+    static void sortInternalNodesDepthFirst(
+        ExecutionSpace const &space,
+        Kokkos::View<Node *, DeviceType> leaf_nodes,
+        Kokkos::View<Node *, DeviceType> &internal_nodes );
+
+    static void sortInternalNodesDepthFirst(
+        Kokkos::View<Node *, DeviceType> leaf_nodes,
+        Kokkos::View<Node *, DeviceType> &internal_nodes )
+    {
+        sortInternalNodesDepthFirst( ExecutionSpace{}, leaf_nodes,
+                                     internal_nodes );
+        Kokkos::fence();
+    }
 
     KOKKOS_INLINE_FUNCTION
     static int
@@ -118,6 +266,74 @@ struct TreeConstruction
         return xx * 4 + yy * 2 + zz;
     }
 
+    // Calculates a 30-bit Hilbert code for the given 3D point located within
+    // the unit cube [0,1].  The coordinates are discretized the same way as
+    // in morton3D() and transformed with Skilling's algorithm ("Programming
+    // the Hilbert curve", AIP Conf. Proc. 707, 2004) so that interleaving
+    // their bits yields the index along the curve.
+    KOKKOS_INLINE_FUNCTION
+    static unsigned int hilbert3D( double x, double y, double z )
+    {
+        using KokkosHelpers::max;
+        using KokkosHelpers::min;
+
+        x = min( max( x * 1024.0, 0.0 ), 1023.0 );
+        y = min( max( y * 1024.0, 0.0 ), 1023.0 );
+        z = min( max( z * 1024.0, 0.0 ), 1023.0 );
+        unsigned int X[3] = {(unsigned int)x, (unsigned int)y,
+                             (unsigned int)z};
+
+        // inverse undo excess work
+        for ( unsigned int q = 1u << 9; q > 1; q >>= 1 )
+        {
+            unsigned int const p = q - 1;
+            for ( int i = 0; i < 3; ++i )
+            {
+                if ( X[i] & q )
+                {
+                    X[0] ^= p; // invert
+                }
+                else
+                {
+                    unsigned int const t = ( X[0] ^ X[i] ) & p; // exchange
+                    X[0] ^= t;
+                    X[i] ^= t;
+                }
+            }
+        }
+
+        // Gray encode
+        X[1] ^= X[0];
+        X[2] ^= X[1];
+        unsigned int t = 0;
+        for ( unsigned int q = 1u << 9; q > 1; q >>= 1 )
+            if ( X[2] & q )
+                t ^= q - 1;
+        for ( int i = 0; i < 3; ++i )
+            X[i] ^= t;
+
+        return expandBits( X[0] ) * 4 + expandBits( X[1] ) * 2 +
+               expandBits( X[2] );
+    }
+
+    // Returns the tree t that object i belongs to, i.e. the last t such that
+    // offsets(t) <= i, so that empty trees are skipped.
+    KOKKOS_INLINE_FUNCTION
+    static int findTree( Kokkos::View<int const *, DeviceType> offsets, int i )
+    {
+        int first = 0;
+        int last = offsets.extent_int( 0 ) - 1;
+        while ( last - first > 1 )
+        {
+            int const middle = ( first + last ) / 2;
+            if ( offsets( middle ) <= i )
+                first = middle;
+            else
+                last = middle;
+        }
+        return first;
+    }
+
     KOKKOS_FUNCTION
     static int
     findSplit( Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes,
@@ -14,12 +14,15 @@
 
 #include "DTK_ConfigDefs.hpp"
 
+#include <DTK_DBC.hpp>
 #include <DTK_DetailsAlgorithms.hpp>
+#include <DTK_DetailsUtils.hpp>   // iota, lastElement
 #include <DTK_KokkosHelpers.hpp> // sgn, min, max
 
 #include <Kokkos_Atomic.hpp>
 #include <Kokkos_Sort.hpp>
 
+#include <algorithm> // swap
 #include <cassert>
 
 namespace DataTransferKit
@@ -27,13 +30,13 @@ namespace DataTransferKit
 namespace Details
 {
 
-template <typename DeviceType>
+template <typename DeviceType, typename BoundingVolume>
 class CalculateBoundingBoxOfTheSceneFunctor
 {
   public:
     CalculateBoundingBoxOfTheSceneFunctor(
-        Kokkos::View<Box const *, DeviceType> bounding_boxes )
-        : _bounding_boxes( bounding_boxes )
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes )
+        : _bounding_volumes( bounding_volumes )
     {
     }
 
@@ -43,7 +46,7 @@ class CalculateBoundingBoxOfTheSceneFunctor
     KOKKOS_INLINE_FUNCTION
     void operator()( int const i, Box &box ) const
     {
-        expand( box, _bounding_boxes( i ) );
+        expand( box, _bounding_volumes( i ) );
     }
 
     KOKKOS_INLINE_FUNCTION
@@ -53,20 +56,21 @@ class CalculateBoundingBoxOfTheSceneFunctor
     }
 
   private:
-    Kokkos::View<Box const *, DeviceType> _bounding_boxes;
+    Kokkos::View<BoundingVolume const *, DeviceType> _bounding_volumes;
 };
 
-template <typename DeviceType>
+template <typename DeviceType, typename BoundingVolume>
 class AssignMortonCodesFunctor
 {
   public:
     AssignMortonCodesFunctor(
-        Kokkos::View<Box const *, DeviceType> bounding_boxes,
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
         Kokkos::View<unsigned int *, DeviceType> morton_codes,
-        Box const &scene_bounding_box )
-        : _bounding_boxes( bounding_boxes )
+        Box const &scene_bounding_box, SpaceFillingCurve curve )
+        : _bounding_volumes( bounding_volumes )
         , _morton_codes( morton_codes )
         , _scene_bounding_box( scene_bounding_box )
+        , _curve( curve )
     {
     }
 
@@ -75,7 +79,7 @@ class AssignMortonCodesFunctor
     {
         Point xyz;
         double a, b;
-        centroid( _bounding_boxes[i], xyz );
+        centroid( _bounding_volumes[i], xyz );
         // scale coordinates with respect to bounding box of the scene
         for ( int d = 0; d < 3; ++d )
         {
@@ -84,19 +88,27 @@ class AssignMortonCodesFunctor
             xyz[d] = ( a != b ? ( xyz[d] - a ) / ( b - a ) : 0 );
         }
         _morton_codes[i] =
-            TreeConstruction<DeviceType>::morton3D( xyz[0], xyz[1], xyz[2] );
+            _curve == SpaceFillingCurve::Hilbert
+                ? TreeConstruction<DeviceType>::hilbert3D( xyz[0], xyz[1],
+                                                           xyz[2] )
+                : TreeConstruction<DeviceType>::morton3D( xyz[0], xyz[1],
+                                                          xyz[2] );
     }
 
   private:
-    Kokkos::View<Box const *, DeviceType> _bounding_boxes;
+    Kokkos::View<BoundingVolume const *, DeviceType> _bounding_volumes;
     Kokkos::View<unsigned int *, DeviceType> _morton_codes;
-    Box const &_scene_bounding_box;
+    // NOTE: stored by value so that the functor can be copied to the device
+    Box _scene_bounding_box;
+    SpaceFillingCurve _curve;
 };
 
-template <typename DeviceType>
+template <typename DeviceType, typename BoundingVolume>
 class GenerateHierarchyFunctor
 {
   public:
+    using Node = TreeNode<BoundingVolume>;
+
     GenerateHierarchyFunctor(
         Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes,
         Kokkos::View<Node *, DeviceType> leaf_nodes,
@@ -156,27 +168,98 @@ class GenerateHierarchyFunctor
     Kokkos::View<Node *, DeviceType> _internal_nodes;
 };
 
-template <typename DeviceType>
-class CalculateBoundingBoxesFunctor
+// Same as GenerateHierarchyFunctor for each tree of a forest.  The codes of
+// tree t are handed to determineRange() and findSplit() on their own so that
+// its range never extends into a neighboring tree.
+template <typename DeviceType, typename BoundingVolume>
+class GenerateSegmentedHierarchyFunctor
 {
   public:
-    CalculateBoundingBoxesFunctor( Kokkos::View<Node *, DeviceType> leaf_nodes,
-                                   Node *root )
+    using Node = TreeNode<BoundingVolume>;
+
+    GenerateSegmentedHierarchyFunctor(
+        Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes,
+        Kokkos::View<int const *, DeviceType> offsets,
+        Kokkos::View<Node *, DeviceType> leaf_nodes,
+        Kokkos::View<Node *, DeviceType> internal_nodes )
+        : _sorted_morton_codes( sorted_morton_codes )
+        , _offsets( offsets )
+        , _leaf_nodes( leaf_nodes )
+        , _internal_nodes( internal_nodes )
+    {
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    void operator()( int const i ) const
+    {
+        int const t = TreeConstruction<DeviceType>::findTree( _offsets, i );
+        int const offset = _offsets( t );
+        int const n = _offsets( t + 1 ) - offset;
+        if ( i - offset >= n - 1 )
+            return;
+
+        Kokkos::View<unsigned int *, DeviceType> morton_codes(
+            _sorted_morton_codes.data() + offset, n );
+        auto range = TreeConstruction<DeviceType>::determineRange(
+            morton_codes, i - offset );
+        int first = range.first;
+        int last = range.second;
+        int split = TreeConstruction<DeviceType>::findSplit( morton_codes,
+                                                              first, last );
+
+        Node *childA;
+        if ( split == first )
+            childA = &_leaf_nodes[offset + split];
+        else
+            childA = &_internal_nodes[offset + split];
+
+        Node *childB;
+        if ( split + 1 == last )
+            childB = &_leaf_nodes[offset + split + 1];
+        else
+            childB = &_internal_nodes[offset + split + 1];
+
+        _internal_nodes[i].children.first = childA;
+        _internal_nodes[i].children.second = childB;
+        childA->parent = &_internal_nodes[i];
+        childB->parent = &_internal_nodes[i];
+    }
+
+  private:
+    Kokkos::View<unsigned int *, DeviceType> _sorted_morton_codes;
+    Kokkos::View<int const *, DeviceType> _offsets;
+    Kokkos::View<Node *, DeviceType> _leaf_nodes;
+    Kokkos::View<Node *, DeviceType> _internal_nodes;
+};
+
+template <typename DeviceType, typename BoundingVolume>
+class CalculateBoundingVolumesFunctor
+{
+  public:
+    using Node = TreeNode<BoundingVolume>;
+
+    using ExecutionSpace = typename DeviceType::execution_space;
+
+    CalculateBoundingVolumesFunctor(
+        ExecutionSpace const &space,
+        Kokkos::View<Node *, DeviceType> leaf_nodes, Node *root )
         : _leaf_nodes( leaf_nodes )
         , _root( root )
-        , _flags( "flags", leaf_nodes.extent( 0 ) - 1 )
+        , _flags( Kokkos::ViewAllocateWithoutInitializing( "flags" ),
+                  leaf_nodes.extent( 0 ) - 1 )
     {
         // Initialize flags to zero
-        Kokkos::deep_copy( _flags, 0 );
+        Kokkos::deep_copy( space, _flags, 0 );
     }
 
     KOKKOS_INLINE_FUNCTION
     void operator()( int const i ) const
     {
         Node *node = _leaf_nodes( i ).parent;
-        // Walk toward the root but do not actually process it because its
-        // bounding box has already been computed (bounding box of the scene)
-        while ( node != _root )
+        // Walk toward the root.  Unlike axis-aligned boxes, general bounding
+        // volumes of the root cannot be deduced from the bounding box of the
+        // scene so the root is processed as well.
+        while ( node != nullptr )
         {
             // Use an atomic flag per internal node to terminate the first
             // thread that enters it, while letting the second one through.
@@ -185,12 +268,14 @@ class CalculateBoundingBoxesFunctor
             if ( Kokkos::atomic_compare_exchange_strong(
                      &_flags( node - _root ), 0, 1 ) )
                 break;
-            for ( Node *child : {node->children.first, node->children.second} )
-                expand( node->bounding_box, child->bounding_box );
+            // Overwrite rather than expand the default-constructed volume
+            // since not every bounding volume has a neutral element (e.g. a
+            // sphere).
+            node->bounding_volume = node->children.first->bounding_volume;
+            expand( node->bounding_volume,
+                    node->children.second->bounding_volume );
             node = node->parent;
         }
-        // NOTE: could check that bounding box of the root node is indeed the
-        // union of the two children.
     }
 
   private:
@@ -201,66 +286,489 @@ class CalculateBoundingBoxesFunctor
     Kokkos::View<int *, DeviceType> _flags;
 };
 
-template <typename DeviceType>
-void TreeConstruction<DeviceType>::calculateBoundingBoxOfTheScene(
-    Kokkos::View<Box const *, DeviceType> bounding_boxes,
-    Box &scene_bounding_box )
+// In depth-first (pre-order) order, the left child of an internal node comes
+// right after it and its right child comes after the whole left subtree.
+// Since the leaves are sorted in order and a subtree with m leaves has m - 1
+// internal nodes, the position of a node is the index of the first leaf it
+// covers plus the number of times the path from the root goes left to reach
+// it.  Both are obtained by walking the tree so that every node is processed
+// independently.
+template <typename DeviceType, typename BoundingVolume>
+class ComputeDepthFirstPositionsFunctor
+{
+  public:
+    using Node = TreeNode<BoundingVolume>;
+
+    ComputeDepthFirstPositionsFunctor(
+        Kokkos::View<Node *, DeviceType> leaf_nodes,
+        Kokkos::View<Node *, DeviceType> internal_nodes,
+        Kokkos::View<int *, DeviceType> positions )
+        : _leaf_nodes( leaf_nodes )
+        , _internal_nodes( internal_nodes )
+        , _positions( positions )
+    {
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    void operator()( int const i ) const
+    {
+        Node const *node = &_internal_nodes( i );
+        // The slots left unused between the trees of a forest stay in place.
+        if ( node->children.first == nullptr )
+        {
+            _positions( i ) = i;
+            return;
+        }
+        Node const *leftmost = node;
+        while ( leftmost->children.first != nullptr )
+            leftmost = leftmost->children.first;
+        int position = leftmost - _leaf_nodes.data();
+        for ( Node const *parent = node->parent; parent != nullptr;
+              node = parent, parent = parent->parent )
+            if ( parent->children.first == node )
+                ++position;
+        _positions( i ) = position;
+    }
+
+  private:
+    Kokkos::View<Node *, DeviceType> _leaf_nodes;
+    Kokkos::View<Node *, DeviceType> _internal_nodes;
+    Kokkos::View<int *, DeviceType> _positions;
+};
+
+template <typename DeviceType, typename BoundingVolume>
+class MoveInternalNodesFunctor
+{
+  public:
+    using Node = TreeNode<BoundingVolume>;
+
+    MoveInternalNodesFunctor(
+        Kokkos::View<Node *, DeviceType> internal_nodes,
+        Kokkos::View<Node *, DeviceType> sorted_internal_nodes,
+        Kokkos::View<int *, DeviceType> positions )
+        : _internal_nodes( internal_nodes )
+        , _sorted_internal_nodes( sorted_internal_nodes )
+        , _positions( positions )
+    {
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    void operator()( int const i ) const
+    {
+        Node const &node = _internal_nodes( i );
+        Node &sorted_node = _sorted_internal_nodes( _positions( i ) );
+        if ( node.children.first == nullptr )
+        {
+            sorted_node = node;
+            return;
+        }
+        sorted_node.bounding_volume = node.bounding_volume;
+        sorted_node.parent = ( node.parent != nullptr )
+                                 ? newAddress( node.parent )
+                                 : nullptr;
+        sorted_node.children.first = newAddress( node.children.first );
+        sorted_node.children.second = newAddress( node.children.second );
+        // A leaf has a single parent so no other thread updates it.
+        if ( isLeaf( sorted_node.children.first ) )
+            sorted_node.children.first->parent = &sorted_node;
+        if ( isLeaf( sorted_node.children.second ) )
+            sorted_node.children.second->parent = &sorted_node;
+    }
+
+  private:
+    KOKKOS_INLINE_FUNCTION
+    static bool isLeaf( Node const *node )
+    {
+        return node->children.first == nullptr;
+    }
+
+    // Leaves do not move.
+    KOKKOS_INLINE_FUNCTION
+    Node *newAddress( Node *node ) const
+    {
+        if ( isLeaf( node ) )
+            return node;
+        return &_sorted_internal_nodes(
+            _positions( node - _internal_nodes.data() ) );
+    }
+
+    Kokkos::View<Node *, DeviceType> _internal_nodes;
+    Kokkos::View<Node *, DeviceType> _sorted_internal_nodes;
+    Kokkos::View<int *, DeviceType> _positions;
+};
+
+// Range of leaves [first, last] that still needs to be split, index of the
+// internal node that covers it, and depth of that node.
+struct BinnedSAHTask
+{
+    int first;
+    int last;
+    int node;
+    int depth;
+};
+
+template <typename DeviceType, typename BoundingVolume>
+class BinnedSAHSplitFunctor
+{
+  public:
+    using Node = TreeNode<BoundingVolume>;
+
+    static constexpr int n_bins = 16;
+
+    BinnedSAHSplitFunctor( Kokkos::View<Box const *, DeviceType> boxes,
+                           Kokkos::View<Point const *, DeviceType> centroids,
+                           Kokkos::View<int *, DeviceType> object_ids,
+                           Kokkos::View<Node *, DeviceType> leaf_nodes,
+                           Kokkos::View<Node *, DeviceType> internal_nodes,
+                           Kokkos::View<BinnedSAHTask *, DeviceType> tasks,
+                           Kokkos::View<BinnedSAHTask *, DeviceType> new_tasks,
+                           Kokkos::View<int *, DeviceType> n_new_tasks,
+                           int max_depth )
+        : _boxes( boxes )
+        , _centroids( centroids )
+        , _object_ids( object_ids )
+        , _leaf_nodes( leaf_nodes )
+        , _internal_nodes( internal_nodes )
+        , _tasks( tasks )
+        , _new_tasks( new_tasks )
+        , _n_new_tasks( n_new_tasks )
+        , _max_depth( max_depth )
+    {
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    static int ceilLog2( int n )
+    {
+        int k = 0;
+        while ( ( 1 << k ) < n )
+            ++k;
+        return k;
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    static double surfaceArea( Box const &box )
+    {
+        double extent[3];
+        for ( int d = 0; d < 3; ++d )
+        {
+            extent[d] = box.maxCorner()[d] - box.minCorner()[d];
+            if ( extent[d] < 0. )
+                return 0.;
+        }
+        return 2. * ( extent[0] * extent[1] + extent[1] * extent[2] +
+                      extent[2] * extent[0] );
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    static int bin( double x, double min, double scale )
+    {
+        int const b = static_cast<int>( ( x - min ) * scale );
+        return b < 0 ? 0 : ( b < n_bins ? b : n_bins - 1 );
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    void operator()( int const i ) const
+    {
+        int const first = _tasks( i ).first;
+        int const last = _tasks( i ).last;
+        int const depth = _tasks( i ).depth;
+        Node *node = &_internal_nodes( _tasks( i ).node );
+
+        // Bin the objects along each axis according to their centroids.
+        Box centroid_bounds;
+        for ( int j = first; j <= last; ++j )
+            expand( centroid_bounds, _centroids( _object_ids( j ) ) );
+        double scale[3];
+        for ( int d = 0; d < 3; ++d )
+        {
+            double const extent = centroid_bounds.maxCorner()[d] -
+                                  centroid_bounds.minCorner()[d];
+            scale[d] = extent > 0. ? n_bins / extent : 0.;
+        }
+        Box bin_boxes[3][n_bins];
+        int bin_counts[3][n_bins] = {};
+        for ( int j = first; j <= last; ++j )
+        {
+            int const id = _object_ids( j );
+            for ( int d = 0; d < 3; ++d )
+            {
+                int const b = bin( _centroids( id )[d],
+                                   centroid_bounds.minCorner()[d], scale[d] );
+                expand( bin_boxes[d][b], _boxes( id ) );
+                ++bin_counts[d][b];
+            }
+        }
+
+        // Sweep the bins to evaluate the cost of the n_bins-1 candidate
+        // planes along each axis and retain the cheapest.  The constant
+        // traversal cost and the normalization by the area of the parent are
+        // the same for all candidates and are omitted.
+        int best_axis = -1;
+        int best_plane = 0;
+        double best_cost = Kokkos::ArithTraits<double>::max();
+        for ( int d = 0; d < 3; ++d )
+        {
+            if ( scale[d] == 0. )
+                continue;
+            double right_costs[n_bins];
+            Box right_box;
+            int right_count = 0;
+            for ( int b = n_bins - 1; b > 0; --b )
+            {
+                expand( right_box, bin_boxes[d][b] );
+                right_count += bin_counts[d][b];
+                right_costs[b] = right_count * surfaceArea( right_box );
+            }
+            Box left_box;
+            int left_count = 0;
+            for ( int b = 1; b < n_bins; ++b )
+            {
+                expand( left_box, bin_boxes[d][b - 1] );
+                left_count += bin_counts[d][b - 1];
+                if ( left_count == 0 || left_count == last - first + 1 )
+                    continue;
+                double const cost =
+                    left_count * surfaceArea( left_box ) + right_costs[b];
+                if ( cost < best_cost )
+                {
+                    best_cost = cost;
+                    best_axis = d;
+                    best_plane = b;
+                }
+            }
+        }
+
+        // Partition the objects in place.
+        int split = -1;
+        if ( best_axis != -1 )
+        {
+            int left = first;
+            int right = last;
+            while ( left <= right )
+            {
+                int const id = _object_ids( left );
+                if ( bin( _centroids( id )[best_axis],
+                          centroid_bounds.minCorner()[best_axis],
+                          scale[best_axis] ) < best_plane )
+                {
+                    ++left;
+                }
+                else
+                {
+                    _object_ids( left ) = _object_ids( right );
+                    _object_ids( right ) = id;
+                    --right;
+                }
+            }
+            split = left - 1;
+        }
+
+        // Cut the range at the median object instead when all the centroids
+        // coincide, when the plane only peels off a single object, or when
+        // the deeper side could not be split at its median below the maximum
+        // depth.  Skewed inputs, e.g. exponentially spaced points, would
+        // otherwise give a tree about as deep as there are objects.
+        if ( split != -1 && last - first > 2 )
+        {
+            int const larger_side =
+                KokkosHelpers::max( split - first + 1, last - split );
+            if ( larger_side == last - first ||
+                 depth + 1 + ceilLog2( larger_side ) > _max_depth )
+                split = -1;
+        }
+        if ( split == -1 )
+        {
+            split = first + ( last - first ) / 2;
+            selectMedian( first, last, split, widestAxis( centroid_bounds ) );
+        }
+
+        // Same numbering as in GenerateHierarchyFunctor.
+        Node *childA;
+        if ( split == first )
+            childA = &_leaf_nodes( split );
+        else
+        {
+            childA = &_internal_nodes( split );
+            _new_tasks( Kokkos::atomic_fetch_add( &_n_new_tasks( 0 ), 1 ) ) = {
+                first, split, split, depth + 1};
+        }
+
+        Node *childB;
+        if ( split + 1 == last )
+            childB = &_leaf_nodes( split + 1 );
+        else
+        {
+            childB = &_internal_nodes( split + 1 );
+            _new_tasks( Kokkos::atomic_fetch_add( &_n_new_tasks( 0 ), 1 ) ) = {
+                split + 1, last, split + 1, depth + 1};
+        }
+
+        node->children.first = childA;
+        node->children.second = childB;
+        childA->parent = node;
+        childB->parent = node;
+    }
+
+  private:
+    KOKKOS_INLINE_FUNCTION
+    static int widestAxis( Box const &box )
+    {
+        int axis = 0;
+        for ( int d = 1; d < 3; ++d )
+            if ( box.maxCorner()[d] - box.minCorner()[d] >
+                 box.maxCorner()[axis] - box.minCorner()[axis] )
+                axis = d;
+        return axis;
+    }
+
+    // Reorders the objects in [first, last] so that the ones up to mid have
+    // centroids no greater along axis than the ones after it.
+    KOKKOS_INLINE_FUNCTION
+    void selectMedian( int first, int last, int mid, int axis ) const
+    {
+        while ( first < last )
+        {
+            double const pivot =
+                _centroids( _object_ids( first + ( last - first ) / 2 ) )[axis];
+            int i = first;
+            int j = last;
+            while ( i <= j )
+            {
+                while ( _centroids( _object_ids( i ) )[axis] < pivot )
+                    ++i;
+                while ( _centroids( _object_ids( j ) )[axis] > pivot )
+                    --j;
+                if ( i <= j )
+                {
+                    int const id = _object_ids( i );
+                    _object_ids( i++ ) = _object_ids( j );
+                    _object_ids( j-- ) = id;
+                }
+            }
+            if ( mid <= j )
+                last = j;
+            else if ( mid >= i )
+                first = i;
+            else
+                return;
+        }
+    }
+
+    Kokkos::View<Box const *, DeviceType> _boxes;
+    Kokkos::View<Point const *, DeviceType> _centroids;
+    Kokkos::View<int *, DeviceType> _object_ids;
+    Kokkos::View<Node *, DeviceType> _leaf_nodes;
+    Kokkos::View<Node *, DeviceType> _internal_nodes;
+    Kokkos::View<BinnedSAHTask *, DeviceType> _tasks;
+    Kokkos::View<BinnedSAHTask *, DeviceType> _new_tasks;
+    Kokkos::View<int *, DeviceType> _n_new_tasks;
+    int _max_depth;
+};
+
+template <typename DeviceType, typename BoundingVolume>
+void TreeConstruction<DeviceType, BoundingVolume>::
+    calculateBoundingBoxOfTheScene(
+        ExecutionSpace const &space,
+        Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+        Box &scene_bounding_box )
 {
-    auto const n = bounding_boxes.extent( 0 );
+    auto const n = bounding_volumes.extent( 0 );
     Kokkos::parallel_reduce(
         DTK_MARK_REGION( "calculate_bouding_of_the_scene" ),
-        Kokkos::RangePolicy<ExecutionSpace>( 0, n ),
-        CalculateBoundingBoxOfTheSceneFunctor<DeviceType>( bounding_boxes ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        CalculateBoundingBoxOfTheSceneFunctor<DeviceType, BoundingVolume>(
+            bounding_volumes ),
         scene_bounding_box );
-    Kokkos::fence();
 }
 
-template <typename DeviceType>
-void TreeConstruction<DeviceType>::assignMortonCodes(
-    Kokkos::View<Box const *, DeviceType> bounding_boxes,
+template <typename DeviceType, typename BoundingVolume>
+void TreeConstruction<DeviceType, BoundingVolume>::assignMortonCodes(
+    ExecutionSpace const &space,
+    Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
     Kokkos::View<unsigned int *, DeviceType> morton_codes,
-    Box const &scene_bounding_box )
+    Box const &scene_bounding_box, SpaceFillingCurve curve )
 {
     auto const n = morton_codes.extent( 0 );
     Kokkos::parallel_for(
         DTK_MARK_REGION( "assign_morton_codes" ),
-        Kokkos::RangePolicy<ExecutionSpace>( 0, n ),
-        AssignMortonCodesFunctor<DeviceType>( bounding_boxes, morton_codes,
-                                              scene_bounding_box ) );
-    Kokkos::fence();
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        AssignMortonCodesFunctor<DeviceType, BoundingVolume>(
+            bounding_volumes, morton_codes, scene_bounding_box, curve ) );
 }
 
-template <typename DeviceType>
-void TreeConstruction<DeviceType>::sortObjects(
-    Kokkos::View<unsigned int *, DeviceType> morton_codes,
-    Kokkos::View<int *, DeviceType> object_ids )
+// Sorts the keys and reorders the object ids accordingly.
+template <typename ExecutionSpace, typename Key, typename DeviceType>
+void binSort( ExecutionSpace const &space, Kokkos::View<Key *, DeviceType> keys,
+              Kokkos::View<int *, DeviceType> object_ids )
 {
-    int const n = morton_codes.extent( 0 );
+    int const n = keys.extent( 0 );
 
-    typedef Kokkos::BinOp1D<Kokkos::View<unsigned int *, DeviceType>> CompType;
+    typedef Kokkos::BinOp1D<Kokkos::View<Key *, DeviceType>> CompType;
 
-    Kokkos::Experimental::MinMaxScalar<unsigned int> result;
-    Kokkos::Experimental::MinMax<unsigned int> reducer( result );
+    Kokkos::Experimental::MinMaxScalar<Key> result;
+    Kokkos::Experimental::MinMax<Key> reducer( result );
+    // NOTE: the reduction into a host value waits for the work previously
+    // enqueued on the instance.
     parallel_reduce(
-        Kokkos::RangePolicy<ExecutionSpace>( 0, n ),
-        Kokkos::Impl::min_max_functor<Kokkos::View<unsigned int *, DeviceType>>(
-            morton_codes ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        Kokkos::Impl::min_max_functor<Kokkos::View<Key *, DeviceType>>( keys ),
         reducer );
     if ( result.min_val == result.max_val )
         return;
-    Kokkos::BinSort<Kokkos::View<unsigned int *, DeviceType>, CompType>
-        bin_sort( morton_codes,
-                  CompType( n / 2, result.min_val, result.max_val ), true );
+    // NOTE: Kokkos::BinSort does not take an execution space instance and runs
+    // on the default one.  Wait for it so that the sorted codes and indices
+    // are visible to the work enqueued next on the instance.
+    Kokkos::BinSort<Kokkos::View<Key *, DeviceType>, CompType> bin_sort(
+        keys, CompType( n / 2, result.min_val, result.max_val ), true );
     bin_sort.create_permute_vector();
-    bin_sort.sort( morton_codes );
+    bin_sort.sort( keys );
     // TODO: We might be able to just use `bin_sort.get_permute_vector()`
     // instead of initializing the indices with iota() and sorting the vector
     bin_sort.sort( object_ids );
-    Kokkos::fence();
+    ExecutionSpace().fence();
+}
+
+template <typename DeviceType, typename BoundingVolume>
+void TreeConstruction<DeviceType, BoundingVolume>::sortObjects(
+    ExecutionSpace const &space,
+    Kokkos::View<unsigned int *, DeviceType> morton_codes,
+    Kokkos::View<int *, DeviceType> object_ids )
+{
+    binSort( space, morton_codes, object_ids );
 }
 
-template <typename DeviceType>
-Node *TreeConstruction<DeviceType>::generateHierarchy(
+template <typename DeviceType, typename BoundingVolume>
+void TreeConstruction<DeviceType, BoundingVolume>::sortObjects(
+    ExecutionSpace const &space,
+    Kokkos::View<unsigned int *, DeviceType> morton_codes,
+    Kokkos::View<int const *, DeviceType> offsets,
+    Kokkos::View<int *, DeviceType> object_ids )
+{
+    // Prepend the tree index to the 30-bit codes so that the objects do not
+    // leave the range of their tree.
+    int const n = morton_codes.extent( 0 );
+    Kokkos::View<unsigned long long *, DeviceType> keys(
+        Kokkos::ViewAllocateWithoutInitializing( "keys" ), n );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "prepend_tree_indices" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        KOKKOS_LAMBDA( int i ) {
+            unsigned long long const t = findTree( offsets, i );
+            keys( i ) = ( t << 32 ) | morton_codes( i );
+        } );
+    binSort( space, keys, object_ids );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "strip_tree_indices" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        KOKKOS_LAMBDA( int i ) {
+            morton_codes( i ) = static_cast<unsigned int>( keys( i ) );
+        } );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+typename TreeConstruction<DeviceType, BoundingVolume>::Node *
+TreeConstruction<DeviceType, BoundingVolume>::generateHierarchy(
+    ExecutionSpace const &space,
     Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes,
     Kokkos::View<Node *, DeviceType> leaf_nodes,
     Kokkos::View<Node *, DeviceType> internal_nodes )
@@ -268,30 +776,138 @@ Node *TreeConstruction<DeviceType>::generateHierarchy(
     auto const n = sorted_morton_codes.extent( 0 );
     Kokkos::parallel_for(
         DTK_MARK_REGION( "generate_hierarchy" ),
-        Kokkos::RangePolicy<ExecutionSpace>( 0, n - 1 ),
-        GenerateHierarchyFunctor<DeviceType>( sorted_morton_codes, leaf_nodes,
-                                              internal_nodes ) );
-    Kokkos::fence();
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n - 1 ),
+        GenerateHierarchyFunctor<DeviceType, BoundingVolume>(
+            sorted_morton_codes, leaf_nodes, internal_nodes ) );
     // returns a pointer to the root node of the tree
     return internal_nodes.data();
 }
 
-template <typename DeviceType>
-void TreeConstruction<DeviceType>::calculateBoundingBoxes(
+template <typename DeviceType, typename BoundingVolume>
+void TreeConstruction<DeviceType, BoundingVolume>::generateHierarchy(
+    ExecutionSpace const &space,
+    Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes,
+    Kokkos::View<int const *, DeviceType> offsets,
     Kokkos::View<Node *, DeviceType> leaf_nodes,
     Kokkos::View<Node *, DeviceType> internal_nodes )
+{
+    auto const n = sorted_morton_codes.extent( 0 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "generate_segmented_hierarchy" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        GenerateSegmentedHierarchyFunctor<DeviceType, BoundingVolume>(
+            sorted_morton_codes, offsets, leaf_nodes, internal_nodes ) );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+typename TreeConstruction<DeviceType, BoundingVolume>::Node *
+TreeConstruction<DeviceType, BoundingVolume>::generateHierarchyBinnedSAH(
+    ExecutionSpace const &space,
+    Kokkos::View<BoundingVolume const *, DeviceType> bounding_volumes,
+    Kokkos::View<int *, DeviceType> object_ids,
+    Kokkos::View<Node *, DeviceType> leaf_nodes,
+    Kokkos::View<Node *, DeviceType> internal_nodes )
+{
+    int const n = bounding_volumes.extent( 0 );
+    DTK_REQUIRE( n > 1 );
+
+    // The heuristic is evaluated with axis-aligned boxes regardless of the
+    // type of bounding volume stored in the nodes.
+    Kokkos::View<Box *, DeviceType> boxes(
+        Kokkos::ViewAllocateWithoutInitializing( "boxes" ), n );
+    Kokkos::View<Point *, DeviceType> centroids(
+        Kokkos::ViewAllocateWithoutInitializing( "centroids" ), n );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "compute_boxes_and_centroids" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        KOKKOS_LAMBDA( int i ) {
+            Box box;
+            expand( box, bounding_volumes( i ) );
+            boxes( i ) = box;
+            centroid( bounding_volumes( i ), centroids( i ) );
+        } );
+    iota( space, object_ids );
+
+    // There are at most n/2 internal nodes on any given level.
+    Kokkos::View<BinnedSAHTask *, DeviceType> tasks(
+        Kokkos::ViewAllocateWithoutInitializing( "tasks" ), n / 2 + 1 );
+    Kokkos::View<BinnedSAHTask *, DeviceType> new_tasks(
+        Kokkos::ViewAllocateWithoutInitializing( "new_tasks" ), n / 2 + 1 );
+    Kokkos::View<int *, DeviceType> n_new_tasks(
+        Kokkos::ViewAllocateWithoutInitializing( "n_new_tasks" ), 1 );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "initialize_root_task" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, 1 ),
+        KOKKOS_LAMBDA( int i ) { tasks( i ) = {0, n - 1, 0, 0}; } );
+
+    // Split the tree level by level.  The number of nodes on the next level
+    // must be read back on the host before launching the next kernel.  The
+    // depth is bounded by twice that of a balanced tree, which keeps the
+    // number of levels logarithmic and the traversal stack from overflowing.
+    using Functor = BinnedSAHSplitFunctor<DeviceType, BoundingVolume>;
+    int const max_depth = 2 * Functor::ceilLog2( n );
+    int n_tasks = 1;
+    while ( n_tasks > 0 )
+    {
+        Kokkos::deep_copy( space, n_new_tasks, 0 );
+        Kokkos::parallel_for(
+            DTK_MARK_REGION( "binned_sah_split" ),
+            Kokkos::RangePolicy<ExecutionSpace>( space, 0, n_tasks ),
+            Functor( boxes, centroids, object_ids, leaf_nodes,
+                     internal_nodes, tasks, new_tasks, n_new_tasks,
+                     max_depth ) );
+        n_tasks = lastElement( space, n_new_tasks );
+        std::swap( tasks, new_tasks );
+    }
+    // returns a pointer to the root node of the tree
+    return internal_nodes.data();
+}
+
+template <typename DeviceType, typename BoundingVolume>
+void TreeConstruction<DeviceType, BoundingVolume>::calculateBoundingVolumes(
+    ExecutionSpace const &space, Kokkos::View<Node *, DeviceType> leaf_nodes,
+    Kokkos::View<Node *, DeviceType> internal_nodes )
 {
     auto const n = leaf_nodes.extent( 0 );
     Node *root = internal_nodes.data();
     Kokkos::parallel_for(
-        DTK_MARK_REGION( "calculate_bounding_boxes" ),
-        Kokkos::RangePolicy<ExecutionSpace>( 0, n ),
-        CalculateBoundingBoxesFunctor<DeviceType>( leaf_nodes, root ) );
-    Kokkos::fence();
+        DTK_MARK_REGION( "calculate_bounding_volumes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        CalculateBoundingVolumesFunctor<DeviceType, BoundingVolume>(
+            space, leaf_nodes, root ) );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+void TreeConstruction<DeviceType, BoundingVolume>::sortInternalNodesDepthFirst(
+    ExecutionSpace const &space, Kokkos::View<Node *, DeviceType> leaf_nodes,
+    Kokkos::View<Node *, DeviceType> &internal_nodes )
+{
+    int const n = internal_nodes.extent( 0 );
+    if ( n < 2 )
+        return;
+
+    Kokkos::View<int *, DeviceType> positions(
+        Kokkos::ViewAllocateWithoutInitializing( "positions" ), n );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "compute_depth_first_positions" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        ComputeDepthFirstPositionsFunctor<DeviceType, BoundingVolume>(
+            leaf_nodes, internal_nodes, positions ) );
+
+    Kokkos::View<Node *, DeviceType> sorted_internal_nodes(
+        Kokkos::ViewAllocateWithoutInitializing( internal_nodes.label() ),
+        n );
+    Kokkos::parallel_for(
+        DTK_MARK_REGION( "move_internal_nodes" ),
+        Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        MoveInternalNodesFunctor<DeviceType, BoundingVolume>(
+            internal_nodes, sorted_internal_nodes, positions ) );
+
+    internal_nodes = sorted_internal_nodes;
 }
 
-template <typename DeviceType>
-int TreeConstruction<DeviceType>::findSplit(
+template <typename DeviceType, typename BoundingVolume>
+int TreeConstruction<DeviceType, BoundingVolume>::findSplit(
     Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes, int first,
     int last )
 {
@@ -323,8 +939,9 @@ int TreeConstruction<DeviceType>::findSplit(
     return split;
 }
 
-template <typename DeviceType>
-Kokkos::pair<int, int> TreeConstruction<DeviceType>::determineRange(
+template <typename DeviceType, typename BoundingVolume>
+Kokkos::pair<int, int>
+TreeConstruction<DeviceType, BoundingVolume>::determineRange(
     Kokkos::View<unsigned int *, DeviceType> sorted_morton_codes, int i )
 {
     using KokkosHelpers::max;
@@ -366,7 +983,11 @@ Kokkos::pair<int, int> TreeConstruction<DeviceType>::determineRange(
 #define DTK_TREECONSTRUCTION_INSTANT( NODE )                                   \
     namespace Details                                                          \
     {                                                                          \
-    template struct TreeConstruction<typename NODE::device_type>;              \
+    template struct TreeConstruction<typename NODE::device_type, Box>;         \
+    template struct TreeConstruction<typename NODE::device_type, Sphere>;      \
+    template struct TreeConstruction<typename NODE::device_type, KDOP<14>>;    \
+    template struct TreeConstruction<typename NODE::device_type, KDOP<18>>;    \
+    template struct TreeConstruction<typename NODE::device_type, KDOP<26>>;    \
     }
 
 #endif
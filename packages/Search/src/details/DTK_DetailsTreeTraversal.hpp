@@ -17,26 +17,41 @@
 #include <DTK_DetailsNode.hpp>
 #include <DTK_DetailsPriorityQueue.hpp>
 #include <DTK_DetailsStack.hpp>
+#include <DTK_DetailsUtils.hpp> // sortByKey
+#include <DTK_KokkosHelpers.hpp> // min
 #include <DTK_Predicates.hpp>
 
+#include <Kokkos_ArithTraits.hpp>
+
 namespace DataTransferKit
 {
 
-template <typename DeviceType>
+template <typename DeviceType, typename BoundingVolume>
 class BoundingVolumeHierarchy;
 
 namespace Details
 {
-template <typename DeviceType>
+template <typename DeviceType, typename BoundingVolume = Box>
 struct TreeTraversal
 {
   public:
     using ExecutionSpace = typename DeviceType::execution_space;
+    using Node = TreeNode<BoundingVolume>;
+    using BVH = BoundingVolumeHierarchy<DeviceType, BoundingVolume>;
+
+    // Number of consecutive queries that are traversed together in packet
+    // mode.  At most 32 since the active queries are tracked with the bits of
+    // an unsigned int.
+    static constexpr int packet_size = 8;
+
+    // Depth below the root at which the traversal of a spatial query is split
+    // among the threads of a team.  There are at most 2^frontier_depth
+    // subtrees to distribute.
+    static constexpr int frontier_depth = 4;
 
     template <typename Predicate, typename Insert>
     KOKKOS_INLINE_FUNCTION static int
-    query( BoundingVolumeHierarchy<DeviceType> const &bvh,
-           Predicate const &pred, Insert const &insert )
+    query( BVH const &bvh, Predicate const &pred, Insert const &insert )
     {
         using Tag = typename Predicate::Tag;
         return queryDispatch( bvh, pred, insert, Tag{} );
@@ -56,17 +71,25 @@ struct TreeTraversal
      * Return the index of the leaf node.
      */
     KOKKOS_INLINE_FUNCTION
-    static int getIndex( BoundingVolumeHierarchy<DeviceType> const &bvh,
-                         Node const *leaf )
+    static int getIndex( BVH const &bvh, Node const *leaf )
     {
         return bvh._indices[leaf - bvh._leaf_nodes.data()];
     }
 
+    /**
+     * Return the leaf node at the given position in the order of the leaves.
+     */
+    KOKKOS_INLINE_FUNCTION
+    static Node const *getLeaf( BVH const &bvh, int position )
+    {
+        return bvh._leaf_nodes.data() + position;
+    }
+
     /**
      * Return the root node of the BVH.
      */
     KOKKOS_INLINE_FUNCTION
-    static Node const *getRoot( BoundingVolumeHierarchy<DeviceType> const &bvh )
+    static Node const *getRoot( BVH const &bvh )
     {
         if ( bvh.empty() )
             return nullptr;
@@ -78,73 +101,597 @@ struct TreeTraversal
 // There are two (related) families of search: one using a spatial predicate and
 // one using nearest neighbours query (see boost::geometry::queries
 // documentation).
-template <typename DeviceType, typename Predicate, typename Insert>
-KOKKOS_FUNCTION int
-spatialQuery( BoundingVolumeHierarchy<DeviceType> const &bvh,
-              Predicate const &predicate, Insert const &insert )
+//
+// The spatial search calls insert with the leaf nodes that meet the predicate.
+//
+// This overload searches the subtree rooted at node, which is assumed to meet
+// the predicate.
+template <typename DeviceType, typename BoundingVolume, typename Predicate,
+          typename Insert>
+KOKKOS_FUNCTION int spatialTraversal(
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &,
+    TreeNode<BoundingVolume> const *node, Predicate const &predicate,
+    Insert const &insert )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    Stack<Node const *> stack;
+
+    stack.push( node );
+    int count = 0;
+
+    while ( !stack.empty() )
+    {
+        Node const *node = stack.top();
+        stack.pop();
+
+        if ( Traversal::isLeaf( node ) )
+        {
+            insert( node );
+            count++;
+        }
+        else
+        {
+            for ( Node const *child :
+                  {node->children.first, node->children.second} )
+            {
+                if ( predicate( child ) )
+                {
+                    stack.push( child );
+                }
+            }
+        }
+    }
+    return count;
+}
+
+template <typename DeviceType, typename BoundingVolume, typename Predicate,
+          typename Insert>
+KOKKOS_FUNCTION int spatialTraversal(
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+    Predicate const &predicate, Insert const &insert )
 {
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
     if ( bvh.empty() )
         return 0;
 
     if ( bvh.size() == 1 )
     {
-        Node const *leaf = TreeTraversal<DeviceType>::getRoot( bvh );
+        Node const *leaf = Traversal::getRoot( bvh );
         if ( predicate( leaf ) )
         {
-            int const leaf_index =
-                TreeTraversal<DeviceType>::getIndex( bvh, leaf );
-            insert( leaf_index );
+            insert( leaf );
             return 1;
         }
         else
             return 0;
     }
 
+    return spatialTraversal( bvh, Traversal::getRoot( bvh ), predicate,
+                             insert );
+}
+
+// Collects the roots of the subtrees that a spatial query must search below
+// depth Traversal::frontier_depth, as well as the leaves above it, that meet
+// the predicate.  Searching all of them with spatialTraversal() is equivalent
+// to searching the whole tree so that they may be distributed among the
+// threads of a team.  frontier must have room for 2^frontier_depth nodes.
+// Returns the number of nodes collected.
+template <typename DeviceType, typename BoundingVolume, typename Predicate>
+KOKKOS_FUNCTION int spatialFrontier(
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+    Predicate const &predicate, TreeNode<BoundingVolume> const **frontier )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    if ( bvh.empty() )
+        return 0;
+
+    Node const *root = Traversal::getRoot( bvh );
+    if ( bvh.size() == 1 && !predicate( root ) )
+        return 0;
+
+    using PairNodePtrDepth = Kokkos::pair<Node const *, int>;
+    Stack<PairNodePtrDepth> stack;
+
+    stack.push( root, 0 );
+    int count = 0;
+
+    while ( !stack.empty() )
+    {
+        Node const *node = stack.top().first;
+        int const depth = stack.top().second;
+        stack.pop();
+
+        if ( Traversal::isLeaf( node ) ||
+             depth == Traversal::frontier_depth )
+        {
+            frontier[count++] = node;
+        }
+        else
+        {
+            for ( Node const *child :
+                  {node->children.first, node->children.second} )
+            {
+                if ( predicate( child ) )
+                {
+                    stack.push( child, depth + 1 );
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// Goes down from the root to the given depth, to the left child if the
+// corresponding bit of path is 0 (most significant first) and to the right
+// one otherwise, and gets the bounding volume of the node reached.  A path
+// that reaches a leaf above depth only gets it if all its remaining bits are
+// 0.  The nodes at depth, as well as the leaves above it, are thus found by
+// exactly one path in [0, 2^depth) each and every leaf of the tree is below
+// exactly one of them.  Returns false if the path gets no bounding volume.
+template <typename DeviceType, typename BoundingVolume>
+KOKKOS_FUNCTION bool boundingVolumeAtDepth(
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh, int depth,
+    int path, BoundingVolume &bounding_volume )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    if ( bvh.empty() )
+        return false;
+
+    Node const *node = Traversal::getRoot( bvh );
+    for ( int level = depth - 1; level >= 0; --level )
+    {
+        bool const right = ( path >> level ) & 1;
+        if ( Traversal::isLeaf( node ) )
+        {
+            if ( right )
+                return false;
+        }
+        else
+            node = right ? node->children.second : node->children.first;
+    }
+    bounding_volume = node->bounding_volume;
+    return true;
+}
+
+template <typename DeviceType, typename BoundingVolume, typename Predicate,
+          typename Insert>
+KOKKOS_FUNCTION int
+spatialQuery( BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+              Predicate const &predicate, Insert const &insert )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    return spatialTraversal( bvh, predicate,
+                             [&bvh, &insert]( Node const *leaf ) {
+                                 insert( Traversal::getIndex( bvh, leaf ) );
+                             } );
+}
+
+// Same as spatialQuery() but insert is also passed the distance from the
+// centroid of the geometry of the predicate to the bounding volume of the leaf.
+template <typename DeviceType, typename BoundingVolume, typename Predicate,
+          typename Insert>
+KOKKOS_FUNCTION int spatialQueryWithDistances(
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+    Predicate const &predicate, Insert const &insert )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    Point center;
+    centroid( predicate._geometry, center );
+    return spatialTraversal(
+        bvh, predicate, [&bvh, &insert, &center]( Node const *leaf ) {
+            insert( Traversal::getIndex( bvh, leaf ),
+                    distance( center, leaf->bounding_volume ) );
+        } );
+}
+
+// Same as spatialQuery() but stops at the first leaf that meets the predicate.
+// Returns whether such a leaf was found.
+template <typename DeviceType, typename BoundingVolume, typename Predicate>
+KOKKOS_FUNCTION bool
+spatialQueryAny( BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+                 Predicate const &predicate )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    if ( bvh.empty() )
+        return false;
+
+    if ( bvh.size() == 1 )
+        return predicate( Traversal::getRoot( bvh ) );
+
     Stack<Node const *> stack;
 
-    Node const *root = TreeTraversal<DeviceType>::getRoot( bvh );
+    Node const *root = Traversal::getRoot( bvh );
     stack.push( root );
-    int count = 0;
 
     while ( !stack.empty() )
     {
         Node const *node = stack.top();
         stack.pop();
 
-        if ( TreeTraversal<DeviceType>::isLeaf( node ) )
+        if ( Traversal::isLeaf( node ) )
+            return true;
+
+        for ( Node const *child :
+              {node->children.first, node->children.second} )
         {
-            insert( TreeTraversal<DeviceType>::getIndex( bvh, node ) );
-            count++;
+            if ( predicate( child ) )
+            {
+                stack.push( child );
+            }
+        }
+    }
+    return false;
+}
+
+// Packet traversal for spatial predicates.  The tree is traversed once for the
+// n consecutive predicates in the packet (n <= 32).  Each node on the stack
+// carries the mask of the predicates that need it and a node is visited if any
+// of them does.  All the predicates of the packet are evaluated against each
+// child without branching so that the loop may be vectorized.  Nodes are
+// visited in the same order as with spatialTraversal().
+//
+// insert is called with the position of the predicate in the packet and the
+// index of the leaf.
+template <typename DeviceType, typename BoundingVolume, typename Predicate,
+          typename Insert>
+KOKKOS_FUNCTION void spatialPacketQuery(
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+    Predicate const *predicates, int n, Insert const &insert )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    if ( bvh.empty() || n < 1 )
+        return;
+
+    Node const *root = Traversal::getRoot( bvh );
+
+    if ( bvh.size() == 1 )
+    {
+        int const index = Traversal::getIndex( bvh, root );
+        for ( int j = 0; j < n; ++j )
+            if ( predicates[j]( root ) )
+                insert( j, index );
+        return;
+    }
+
+    // Nodes that do not intersect the box around the geometries of all the
+    // predicates are discarded with a single test.
+    Box packet_box;
+    for ( int j = 0; j < n; ++j )
+        expand( packet_box, predicates[j]._geometry );
+
+    using PairNodePtrMask = Kokkos::pair<Node const *, unsigned int>;
+    Stack<PairNodePtrMask> stack;
+
+    stack.push( root, n < 32 ? ( 1u << n ) - 1 : ~0u );
+
+    while ( !stack.empty() )
+    {
+        Node const *node = stack.top().first;
+        unsigned int const mask = stack.top().second;
+        stack.pop();
+
+        if ( Traversal::isLeaf( node ) )
+        {
+            int const index = Traversal::getIndex( bvh, node );
+            for ( int j = 0; j < n; ++j )
+                if ( mask & ( 1u << j ) )
+                    insert( j, index );
         }
         else
         {
             for ( Node const *child :
                   {node->children.first, node->children.second} )
             {
-                if ( predicate( child ) )
+                if ( !intersects( packet_box, child->bounding_volume ) )
+                    continue;
+                unsigned int child_mask = 0;
+                for ( int j = 0; j < n; ++j )
+                    child_mask |=
+                        static_cast<unsigned int>( predicates[j]( child ) )
+                        << j;
+                child_mask &= mask;
+                if ( child_mask )
                 {
-                    stack.push( child );
+                    stack.push( child, child_mask );
                 }
             }
         }
     }
+}
+
+// Max-heap on the distances of the candidate neighbors of a query, used by
+// nearestPacketQuery() to keep the k closest leaves found so far.
+KOKKOS_INLINE_FUNCTION void pushCandidate( int *indices, double *distances,
+                                           int &size, int index,
+                                           double distance )
+{
+    int pos = size++;
+    while ( pos > 0 )
+    {
+        int const parent = ( pos - 1 ) / 2;
+        if ( distances[parent] >= distance )
+            break;
+        indices[pos] = indices[parent];
+        distances[pos] = distances[parent];
+        pos = parent;
+    }
+    indices[pos] = index;
+    distances[pos] = distance;
+}
+
+KOKKOS_INLINE_FUNCTION void replaceFarthestCandidate( int *indices,
+                                                      double *distances,
+                                                      int size, int index,
+                                                      double distance )
+{
+    int pos = 0;
+    while ( true )
+    {
+        int child = 2 * pos + 1;
+        if ( child >= size )
+            break;
+        if ( child + 1 < size && distances[child + 1] > distances[child] )
+            ++child;
+        if ( distances[child] <= distance )
+            break;
+        indices[pos] = indices[child];
+        distances[pos] = distances[child];
+        pos = child;
+    }
+    indices[pos] = index;
+    distances[pos] = distance;
+}
+
+// Packet traversal for nearest predicates.  The tree is traversed depth-first
+// once for the n consecutive predicates in the packet (n <= 32), the child
+// that is closest to the center of the packet first.  Each predicate keeps
+// the candidates found so far in a max-heap stored in indices[j] and
+// distances[j] which must have room for predicates[j]._k entries.  A node is
+// dropped for a given predicate when it is farther than its radius or, once k
+// candidates were found, when it cannot improve on the farthest one (scaled by
+// 1/(1+epsilon) in approximate mode).
+//
+// On output, counts[j] holds the number of neighbors found for predicate j
+// and the first counts[j] entries of indices[j] and distances[j] are sorted by
+// ascending distance.
+template <typename DeviceType, typename BoundingVolume, typename Predicate>
+KOKKOS_FUNCTION void nearestPacketQuery(
+    BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+    Predicate const *predicates, int n, int *const *indices,
+    double *const *distances, int *counts )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    for ( int j = 0; j < n; ++j )
+        counts[j] = 0;
+
+    if ( bvh.empty() || n < 1 )
+        return;
+
+    // Returns the mask of the predicates among the ones in mask for which the
+    // node might still hold one of the k nearest neighbors.  The predicates
+    // outside of mask are not evaluated, their candidates may be empty.
+    auto const filter = [predicates, n, counts, distances](
+                            Node const *node, unsigned int mask,
+                            double *node_distances ) {
+        unsigned int filtered_mask = 0;
+        for ( int j = 0; j < n; ++j )
+        {
+            if ( !( mask & ( 1u << j ) ) )
+                continue;
+            Predicate const &pred = predicates[j];
+            double const d = distance( pred._geometry, node->bounding_volume );
+            node_distances[j] = d;
+            bool const keep =
+                ( d <= pred._radius ) &&
+                ( counts[j] < pred._k ||
+                  d * ( 1. + pred._epsilon ) < distances[j][0] );
+            filtered_mask |= static_cast<unsigned int>( keep ) << j;
+        }
+        return filtered_mask;
+    };
+
+    unsigned int mask = 0;
+    for ( int j = 0; j < n; ++j )
+        if ( predicates[j]._k > 0 )
+            mask |= 1u << j;
+
+    Box packet_box;
+    for ( int j = 0; j < n; ++j )
+        expand( packet_box, predicates[j]._geometry );
+    Point packet_center;
+    centroid( packet_box, packet_center );
+
+    using PairNodePtrMask = Kokkos::pair<Node const *, unsigned int>;
+    Stack<PairNodePtrMask> stack;
+
+    stack.push( Traversal::getRoot( bvh ), mask );
+
+    double node_distances[32];
+    while ( !stack.empty() )
+    {
+        Node const *node = stack.top().first;
+        // the bounds may have shrunk since the node was pushed
+        unsigned int const node_mask =
+            filter( node, stack.top().second, node_distances );
+        stack.pop();
+
+        if ( !node_mask )
+            continue;
+
+        if ( Traversal::isLeaf( node ) )
+        {
+            int const index = Traversal::getIndex( bvh, node );
+            for ( int j = 0; j < n; ++j )
+            {
+                if ( !( node_mask & ( 1u << j ) ) )
+                    continue;
+                if ( counts[j] < predicates[j]._k )
+                    pushCandidate( indices[j], distances[j], counts[j], index,
+                                   node_distances[j] );
+                else
+                    replaceFarthestCandidate( indices[j], distances[j],
+                                              counts[j], index,
+                                              node_distances[j] );
+            }
+        }
+        else
+        {
+            // The children are checked against the bounds of each predicate
+            // when they are popped.  The one that is closest to the center of
+            // the packet goes on top of the stack.
+            Node const *left_child = node->children.first;
+            Node const *right_child = node->children.second;
+            bool const left_first =
+                distance( packet_center, left_child->bounding_volume ) <=
+                distance( packet_center, right_child->bounding_volume );
+            stack.push( left_first ? right_child : left_child, node_mask );
+            stack.push( left_first ? left_child : right_child, node_mask );
+        }
+    }
+
+    for ( int j = 0; j < n; ++j )
+        sortByKey( distances[j], indices[j], counts[j] );
+}
+
+// All k nearest neighbors self query for the object stored in leaf.  The
+// neighbors are searched around the centroid of the bounding volume of the
+// leaf.  Rather than descending from the root, the search starts at the leaf
+// and walks up toward the root.  The sibling of each node on the way is
+// searched depth-first, closest child first, and subtrees that are not closer
+// than the k-th candidate found so far are skipped.  Since the objects close
+// to a leaf are mostly found in the first few siblings, the bound is tight
+// early on and the siblings higher up are pruned with a single test.
+//
+// The leaf itself is a candidate unless exclude_self is true.  Candidates are
+// kept in a max-heap in indices and distances which must have room for k
+// entries.  Returns the number of neighbors found.  They are sorted by
+// ascending distance on output.
+template <typename DeviceType, typename BoundingVolume>
+KOKKOS_FUNCTION int
+allNearestQuery( BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+                 TreeNode<BoundingVolume> const *leaf, int k,
+                 bool exclude_self, int *indices, double *distances )
+{
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
+    if ( k < 1 )
+        return 0;
+
+    Point center;
+    centroid( leaf->bounding_volume, center );
+
+    int count = 0;
+    auto const insert = [&bvh, indices, distances, k, &count](
+                            Node const *node, double node_distance ) {
+        int const index = Traversal::getIndex( bvh, node );
+        if ( count < k )
+            pushCandidate( indices, distances, count, index, node_distance );
+        else
+            replaceFarthestCandidate( indices, distances, count, index,
+                                      node_distance );
+    };
+
+    if ( !exclude_self )
+        insert( leaf, distance( center, leaf->bounding_volume ) );
+
+    using PairNodePtrDistance = Kokkos::pair<Node const *, double>;
+    Stack<PairNodePtrDistance> stack;
+
+    for ( Node const *node = leaf, *parent = leaf->parent; parent != nullptr;
+          node = parent, parent = parent->parent )
+    {
+        Node const *sibling = ( parent->children.first == node )
+                                  ? parent->children.second
+                                  : parent->children.first;
+        stack.push( sibling, distance( center, sibling->bounding_volume ) );
+
+        while ( !stack.empty() )
+        {
+            Node const *current = stack.top().first;
+            double const current_distance = stack.top().second;
+            stack.pop();
+
+            // the bound may have shrunk since the node was pushed
+            if ( count == k && current_distance >= distances[0] )
+                continue;
+
+            if ( Traversal::isLeaf( current ) )
+            {
+                insert( current, current_distance );
+            }
+            else
+            {
+                Node const *left_child = current->children.first;
+                Node const *right_child = current->children.second;
+                double const left_distance =
+                    distance( center, left_child->bounding_volume );
+                double const right_distance =
+                    distance( center, right_child->bounding_volume );
+                // the closest child goes on top of the stack
+                bool const left_first = ( left_distance <= right_distance );
+                stack.push( left_first ? right_child : left_child,
+                            left_first ? right_distance : left_distance );
+                stack.push( left_first ? left_child : right_child,
+                            left_first ? left_distance : right_distance );
+            }
+        }
+    }
+
+    sortByKey( distances, indices, count );
     return count;
 }
 
 // query k nearest neighbours
-template <typename DeviceType, typename Distance, typename Insert>
+//
+// With a positive epsilon, the priority of the leaves is their distance
+// divided by (1+epsilon).  A leaf is thus reported as soon as no node left in
+// the queue is closer than that fraction of its distance, and nodes that are
+// farther than the current neighbor distance divided by (1+epsilon) are
+// never expanded.  This bounds the error on each neighbor distance by a
+// factor (1+epsilon).
+//
+// Nodes farther than radius are never pushed in the queue so that the search
+// may return fewer than k neighbors.
+template <typename DeviceType, typename BoundingVolume, typename Distance,
+          typename Insert>
 KOKKOS_FUNCTION int
-nearestQuery( BoundingVolumeHierarchy<DeviceType> const &bvh,
-              Distance const &distance, int k, Insert const &insert )
+nearestQuery( BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
+              Distance const &distance, int k, Insert const &insert,
+              double epsilon = 0.,
+              double radius = Kokkos::ArithTraits<double>::max() )
 {
+    using Traversal = TreeTraversal<DeviceType, BoundingVolume>;
+    using Node = typename Traversal::Node;
+
     if ( bvh.empty() || k < 1 )
         return 0;
 
     if ( bvh.size() == 1 )
     {
-        Node const *leaf = TreeTraversal<DeviceType>::getRoot( bvh );
-        int const leaf_index = TreeTraversal<DeviceType>::getIndex( bvh, leaf );
+        Node const *leaf = Traversal::getRoot( bvh );
         double const leaf_distance = distance( leaf );
+        if ( leaf_distance > radius )
+            return 0;
+        int const leaf_index = Traversal::getIndex( bvh, leaf );
         insert( leaf_index, leaf_distance );
         return 1;
     }
@@ -166,10 +713,12 @@ nearestQuery( BoundingVolumeHierarchy<DeviceType> const &bvh,
     // priority does not matter for the root since the node will be
     // processed directly and removed from the priority queue we don't even
     // bother computing the distance to it.
-    Node const *root = TreeTraversal<DeviceType>::getRoot( bvh );
+    Node const *root = Traversal::getRoot( bvh );
     queue.push( root, 0. );
     int count = 0;
 
+    double const leaf_priority_scaling = 1. / ( 1. + epsilon );
+
     while ( !queue.empty() && count < k )
     {
         // get the node that is on top of the priority list (i.e. is the
@@ -182,11 +731,13 @@ nearestQuery( BoundingVolumeHierarchy<DeviceType> const &bvh,
         // NOTE: not calling queue.pop() here so that it can be combined with
         // the next push in case the node is internal (thus sparing a bubble-up
         // operation)
-        if ( TreeTraversal<DeviceType>::isLeaf( node ) )
+        if ( Traversal::isLeaf( node ) )
         {
             queue.pop();
-            insert( TreeTraversal<DeviceType>::getIndex( bvh, node ),
-                    node_distance );
+            // the priority of the leaf differs from its actual distance in
+            // approximate mode
+            insert( Traversal::getIndex( bvh, node ),
+                    epsilon > 0. ? distance( node ) : node_distance );
             count++;
         }
         else
@@ -195,35 +746,61 @@ nearestQuery( BoundingVolumeHierarchy<DeviceType> const &bvh,
 
             auto const left_child = node->children.first;
             auto const right_child = node->children.second;
-            queue.pop_push( left_child, distance( left_child ) );
-            queue.push( right_child, distance( right_child ) );
+            double const left_distance = distance( left_child );
+            double const right_distance = distance( right_child );
+            bool const push_left = ( left_distance <= radius );
+            bool const push_right = ( right_distance <= radius );
+            double const left_priority =
+                Traversal::isLeaf( left_child )
+                    ? left_distance * leaf_priority_scaling
+                    : left_distance;
+            double const right_priority =
+                Traversal::isLeaf( right_child )
+                    ? right_distance * leaf_priority_scaling
+                    : right_distance;
+            if ( push_left && push_right )
+            {
+                queue.pop_push( left_child, left_priority );
+                queue.push( right_child, right_priority );
+            }
+            else if ( push_left )
+                queue.pop_push( left_child, left_priority );
+            else if ( push_right )
+                queue.pop_push( right_child, right_priority );
+            else
+                queue.pop();
         }
     }
     return count;
 }
 
-template <typename DeviceType, typename Predicate, typename Insert>
+template <typename DeviceType, typename BoundingVolume, typename Predicate,
+          typename Insert>
 KOKKOS_INLINE_FUNCTION int
-queryDispatch( BoundingVolumeHierarchy<DeviceType> const &bvh,
+queryDispatch( BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
                Predicate const &pred, Insert const &insert,
                SpatialPredicateTag )
 {
     return spatialQuery( bvh, pred, insert );
 }
 
-template <typename DeviceType, typename Predicate, typename Insert>
+template <typename DeviceType, typename BoundingVolume, typename Predicate,
+          typename Insert>
 KOKKOS_INLINE_FUNCTION int
-queryDispatch( BoundingVolumeHierarchy<DeviceType> const &bvh,
+queryDispatch( BoundingVolumeHierarchy<DeviceType, BoundingVolume> const &bvh,
                Predicate const &pred, Insert const &insert,
                NearestPredicateTag )
 {
+    using Node = TreeNode<BoundingVolume>;
     auto const geometry = pred._geometry;
     auto const k = pred._k;
+    auto const epsilon = pred._epsilon;
+    auto const radius = pred._radius;
     return nearestQuery( bvh,
                          [geometry]( Node const *node ) {
-                             return distance( geometry, node->bounding_box );
+                             return distance( geometry, node->bounding_volume );
                          },
-                         k, insert );
+                         k, insert, epsilon, radius );
 }
 
 } // namespace Details
@@ -24,12 +24,14 @@ namespace DataTransferKit
 namespace Details
 {
 // NOTE: This functor is used in exclusivePrefixSum( src, dst ).  We were
-// getting a compile error on CUDA when using a KOKKOS_LAMBDA.
-template <typename T, typename DeviceType>
+// getting a compile error on CUDA when using a KOKKOS_LAMBDA.  The sums are
+// accumulated in the value type of the output so that e.g. 32-bit counts may
+// be scanned into 64-bit offsets.
+template <typename T, typename DeviceType, typename U = T>
 class ExclusiveScanFunctor
 {
   public:
-    ExclusiveScanFunctor( Kokkos::View<T *, DeviceType> const &in,
+    ExclusiveScanFunctor( Kokkos::View<U const *, DeviceType> const &in,
                           Kokkos::View<T *, DeviceType> const &out )
         : _in( in )
         , _out( out )
@@ -45,25 +47,60 @@ class ExclusiveScanFunctor
     }
 
   private:
-    Kokkos::View<T *, DeviceType> _in;
+    Kokkos::View<U const *, DeviceType> _in;
     Kokkos::View<T *, DeviceType> _out;
 };
+
+// Sorts keys[0], ..., keys[n-1] in ascending order and applies the same
+// permutation to values.  This is a Shell sort meant to be called from a
+// single thread on the short sequences that are the results of one query.
+template <typename Key, typename Value>
+KOKKOS_INLINE_FUNCTION void sortByKey( Key *keys, Value *values, int n )
+{
+    int gap = 1;
+    while ( gap < n / 3 )
+        gap = 3 * gap + 1;
+    for ( ; gap > 0; gap /= 3 )
+        for ( int i = gap; i < n; ++i )
+        {
+            Key const key = keys[i];
+            Value const value = values[i];
+            int j = i;
+            for ( ; j >= gap && key < keys[j - gap]; j -= gap )
+            {
+                keys[j] = keys[j - gap];
+                values[j] = values[j - gap];
+            }
+            keys[j] = key;
+            values[j] = value;
+        }
+}
 } // namespace Details
 
 /** \brief Computes an exclusive scan.
  *
+ *  \param[in] space Execution space instance the scan is enqueued on
  *  \param[in] src Input view with range of elements to sum
  *  \param[out] dst Output view; may be equal to \p src
  *
  *  When \p dst is not provided or if \p src and \p dst are the same view, the
  *  scan is performed in-place.  "Exclusive" means that the i-th input element
- *  is not included in the i-th sum.
+ *  is not included in the i-th sum.  The sums are accumulated in the value
+ *  type of \p dst, which may be wider than that of \p src (e.g. 64-bit
+ *  offsets computed from 32-bit counts).
+ *
+ *  This overload does not fence, the result is available to subsequent work
+ *  enqueued on the same execution space instance.
  *
  *  \pre \p src and \p dst must be of rank 1 and have the same size.
  */
-template <typename ST, typename... SP, typename DT, typename... DP>
-void exclusivePrefixSum( Kokkos::View<ST, SP...> const &src,
-                         Kokkos::View<DT, DP...> const &dst )
+template <typename ExecutionSpace, typename ST, typename... SP, typename DT,
+          typename... DP>
+typename std::enable_if<
+    Kokkos::Impl::is_execution_space<ExecutionSpace>::value>::type
+exclusivePrefixSum( ExecutionSpace const &space,
+                    Kokkos::View<ST, SP...> const &src,
+                    Kokkos::View<DT, DP...> const &dst )
 {
     static_assert(
         std::is_same<typename Kokkos::ViewTraits<DT, DP...>::value_type,
@@ -77,15 +114,30 @@ void exclusivePrefixSum( Kokkos::View<ST, SP...> const &src,
                          unsigned( 1 ) ),
                    "exclusivePrefixSum requires Views of rank 1" );
 
-    using ExecutionSpace =
-        typename Kokkos::ViewTraits<DT, DP...>::execution_space;
     using ValueType = typename Kokkos::ViewTraits<DT, DP...>::value_type;
+    using SourceValueType =
+        typename Kokkos::ViewTraits<ST, SP...>::non_const_value_type;
 
     auto const n = src.extent( 0 );
     DTK_REQUIRE( n == dst.extent( 0 ) );
     Kokkos::parallel_scan(
-        "exclusive_scan", Kokkos::RangePolicy<ExecutionSpace>( 0, n ),
-        Details::ExclusiveScanFunctor<ValueType, ExecutionSpace>( src, dst ) );
+        "exclusive_scan", Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
+        Details::ExclusiveScanFunctor<ValueType, ExecutionSpace,
+                                      SourceValueType>( src, dst ) );
+}
+
+/** \brief Computes an exclusive scan.
+ *
+ *  Calls \c exclusivePrefixSum(space, src, dst) on a default instance of the
+ *  execution space of \p dst and fences.
+ */
+template <typename ST, typename... SP, typename DT, typename... DP>
+void exclusivePrefixSum( Kokkos::View<ST, SP...> const &src,
+                         Kokkos::View<DT, DP...> const &dst )
+{
+    using ExecutionSpace =
+        typename Kokkos::ViewTraits<DT, DP...>::execution_space;
+    exclusivePrefixSum( ExecutionSpace{}, src, dst );
     Kokkos::fence();
 }
 
@@ -101,17 +153,36 @@ inline void exclusivePrefixSum( Kokkos::View<T, P...> const &v )
     exclusivePrefixSum( v, v );
 }
 
+/** \brief In-place exclusive scan on an execution space instance.
+ *
+ *  Calls \c exclusivePrefixSum(space, v, v)
+ */
+template <typename ExecutionSpace, typename T, typename... P>
+inline typename std::enable_if<
+    Kokkos::Impl::is_execution_space<ExecutionSpace>::value>::type
+exclusivePrefixSum( ExecutionSpace const &space,
+                    Kokkos::View<T, P...> const &v )
+{
+    exclusivePrefixSum( space, v, v );
+}
+
 /** \brief Get a copy of the last element.
  *
  *  Returns a copy of the last element in the view on the host.  Note that it
  *  may require communication between host and device (e.g. if the view passed
  *  as an argument lives on the device).
  *
+ *  The copy is enqueued on \p space and only that instance is fenced, which
+ *  makes it a synchronization point for the work previously enqueued on it
+ *  but not for work running on other instances.
+ *
  *  \pre \c v is of rank 1 and not empty.
  */
-template <typename T, typename... P>
-typename Kokkos::ViewTraits<T, P...>::value_type
-lastElement( Kokkos::View<T, P...> const &v )
+template <typename ExecutionSpace, typename T, typename... P>
+typename std::enable_if<
+    Kokkos::Impl::is_execution_space<ExecutionSpace>::value,
+    typename Kokkos::ViewTraits<T, P...>::value_type>::type
+lastElement( ExecutionSpace const &space, Kokkos::View<T, P...> const &v )
 {
     static_assert(
         ( unsigned( Kokkos::ViewTraits<T, P...>::rank ) == unsigned( 1 ) ),
@@ -120,12 +191,30 @@ lastElement( Kokkos::View<T, P...> const &v )
     DTK_REQUIRE( n > 0 );
     auto v_subview = Kokkos::subview( v, n - 1 );
     auto v_host = Kokkos::create_mirror_view( v_subview );
-    Kokkos::deep_copy( v_host, v_subview );
+    Kokkos::deep_copy( space, v_host, v_subview );
+    space.fence();
     return v_host( 0 );
 }
 
+/** \brief Get a copy of the last element.
+ *
+ *  Calls \c lastElement(space, v) on a default instance of the execution
+ *  space of \p v.
+ *
+ *  \pre \c v is of rank 1 and not empty.
+ */
+template <typename T, typename... P>
+typename Kokkos::ViewTraits<T, P...>::value_type
+lastElement( Kokkos::View<T, P...> const &v )
+{
+    using ExecutionSpace =
+        typename Kokkos::ViewTraits<T, P...>::execution_space;
+    return lastElement( ExecutionSpace{}, v );
+}
+
 /** \brief Fills the view with a sequence of numbers
  *
+ *  \param[in] space Execution space instance the work is enqueued on
  *  \param[out] v Output view
  *  \param[in] value (optional) Initial value
  *
@@ -133,13 +222,15 @@ lastElement( Kokkos::View<T, P...> const &v )
  *  <code>v(i) = value + i</code> instead of repetitively evaluating
  *  <code>++value</code> which would be difficult to achieve in a performant
  *  manner while still guaranteeing the order of execution.
+ *
+ *  This overload does not fence.
  */
-template <typename T, typename... P>
-void iota( Kokkos::View<T, P...> const &v,
-           typename Kokkos::ViewTraits<T, P...>::value_type value = 0 )
+template <typename ExecutionSpace, typename T, typename... P>
+typename std::enable_if<
+    Kokkos::Impl::is_execution_space<ExecutionSpace>::value>::type
+iota( ExecutionSpace const &space, Kokkos::View<T, P...> const &v,
+      typename Kokkos::ViewTraits<T, P...>::value_type value = 0 )
 {
-    using ExecutionSpace =
-        typename Kokkos::ViewTraits<T, P...>::execution_space;
     using ValueType = typename Kokkos::ViewTraits<T, P...>::value_type;
     static_assert(
         ( unsigned( Kokkos::ViewTraits<T, P...>::rank ) == unsigned( 1 ) ),
@@ -152,8 +243,22 @@ void iota( Kokkos::View<T, P...> const &v,
         "iota requires a View with non-const value type" );
     auto const n = v.extent( 0 );
     Kokkos::parallel_for(
-        "iota", Kokkos::RangePolicy<ExecutionSpace>( 0, n ),
+        "iota", Kokkos::RangePolicy<ExecutionSpace>( space, 0, n ),
         KOKKOS_LAMBDA( int i ) { v( i ) = value + (ValueType)i; } );
+}
+
+/** \brief Fills the view with a sequence of numbers
+ *
+ *  Calls \c iota(space, v, value) on a default instance of the execution
+ *  space of \p v and fences.
+ */
+template <typename T, typename... P>
+void iota( Kokkos::View<T, P...> const &v,
+           typename Kokkos::ViewTraits<T, P...>::value_type value = 0 )
+{
+    using ExecutionSpace =
+        typename Kokkos::ViewTraits<T, P...>::execution_space;
+    iota( ExecutionSpace{}, v, value );
     Kokkos::fence();
 }
 
@@ -0,0 +1,49 @@
+/****************************************************************************
+ * Copyright (c) 2012-2018 by the DataTransferKit authors                   *
+ * All rights reserved.                                                     *
+ *                                                                          *
+ * This file is part of the DataTransferKit library. DataTransferKit is     *
+ * distributed under a BSD 3-clause license. For the licensing terms see    *
+ * the LICENSE file in the top-level directory.                             *
+ *                                                                          *
+ * SPDX-License-Identifier: BSD-3-Clause                                    *
+ ****************************************************************************/
+#ifndef DTK_FUTURE_HPP
+#define DTK_FUTURE_HPP
+
+namespace DataTransferKit
+{
+
+/** \brief Handle on work enqueued on an execution space instance.
+ *
+ *  Returned by the asynchronous overloads of the search functions.  The
+ *  output views are allocated and sized when the handle is returned but their
+ *  content is only meaningful after wait() has been called.  Work enqueued
+ *  afterwards on the same execution space instance is ordered after the
+ *  search, so a consumer that runs on that instance does not need to wait.
+ */
+template <typename ExecutionSpace>
+class Future
+{
+  public:
+    Future() = default;
+
+    explicit Future( ExecutionSpace const &space )
+        : _space( space )
+    {
+    }
+
+    /** Blocks until all the work enqueued on the execution space instance
+     *  completed.  Work running on other instances is not waited for.
+     */
+    void wait() const { _space.fence(); }
+
+    ExecutionSpace const &space() const { return _space; }
+
+  private:
+    ExecutionSpace _space;
+};
+
+} // namespace DataTransferKit
+
+#endif
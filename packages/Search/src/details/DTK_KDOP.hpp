@@ -0,0 +1,151 @@
+/****************************************************************************
+ * Copyright (c) 2012-2018 by the DataTransferKit authors                   *
+ * All rights reserved.                                                     *
+ *                                                                          *
+ * This file is part of the DataTransferKit library. DataTransferKit is     *
+ * distributed under a BSD 3-clause license. For the licensing terms see    *
+ * the LICENSE file in the top-level directory.                             *
+ *                                                                          *
+ * SPDX-License-Identifier: BSD-3-Clause                                    *
+ ****************************************************************************/
+#ifndef DTK_KDOP_HPP
+#define DTK_KDOP_HPP
+
+#include <DTK_Point.hpp>
+
+#include <Kokkos_ArithTraits.hpp>
+#include <Kokkos_Macros.hpp>
+
+namespace DataTransferKit
+{
+namespace Details
+{
+/**
+ * Fixed set of k/2 directions that define a discrete oriented polytope.  The
+ * first three directions are always the coordinate axes so that the
+ * axis-aligned bounding box of a k-DOP can be read directly off its first
+ * three slabs.  Directions are not normalized; their components are in
+ * {-1, 0, 1} which keeps projections exact and cheap.
+ */
+template <int k>
+struct KDOPDirections;
+
+// 14-DOP: coordinate axes and the four diagonals of the cube
+template <>
+struct KDOPDirections<14>
+{
+    KOKKOS_INLINE_FUNCTION
+    static void direction( int i, int n[3] )
+    {
+        // clang-format off
+        switch ( i )
+        {
+        case 0: n[0] = 1; n[1] = 0; n[2] = 0; return;
+        case 1: n[0] = 0; n[1] = 1; n[2] = 0; return;
+        case 2: n[0] = 0; n[1] = 0; n[2] = 1; return;
+        case 3: n[0] = 1; n[1] = 1; n[2] = 1; return;
+        case 4: n[0] = 1; n[1] = -1; n[2] = 1; return;
+        case 5: n[0] = 1; n[1] = 1; n[2] = -1; return;
+        default: n[0] = 1; n[1] = -1; n[2] = -1; return;
+        }
+        // clang-format on
+    }
+};
+
+// 18-DOP: coordinate axes and the six diagonals of the faces of the cube
+template <>
+struct KDOPDirections<18>
+{
+    KOKKOS_INLINE_FUNCTION
+    static void direction( int i, int n[3] )
+    {
+        // clang-format off
+        switch ( i )
+        {
+        case 0: n[0] = 1; n[1] = 0; n[2] = 0; return;
+        case 1: n[0] = 0; n[1] = 1; n[2] = 0; return;
+        case 2: n[0] = 0; n[1] = 0; n[2] = 1; return;
+        case 3: n[0] = 1; n[1] = 1; n[2] = 0; return;
+        case 4: n[0] = 1; n[1] = 0; n[2] = 1; return;
+        case 5: n[0] = 0; n[1] = 1; n[2] = 1; return;
+        case 6: n[0] = 1; n[1] = -1; n[2] = 0; return;
+        case 7: n[0] = 1; n[1] = 0; n[2] = -1; return;
+        default: n[0] = 0; n[1] = 1; n[2] = -1; return;
+        }
+        // clang-format on
+    }
+};
+
+// 26-DOP: union of the 14-DOP and 18-DOP directions
+template <>
+struct KDOPDirections<26>
+{
+    KOKKOS_INLINE_FUNCTION
+    static void direction( int i, int n[3] )
+    {
+        if ( i < 7 )
+            KDOPDirections<14>::direction( i, n );
+        else
+            KDOPDirections<18>::direction( i - 4, n );
+    }
+};
+} // namespace Details
+
+/**
+ * Discrete Oriented Polytope with k faces (k/2 pairs of parallel planes).  It
+ * stores for each direction the minimum and maximum value of the projection
+ * of the enclosed geometry onto that direction.  The default constructor
+ * initializes an "empty" polytope, the same way \c Box does.
+ */
+template <int k>
+struct KDOP
+{
+    static_assert( k == 14 || k == 18 || k == 26,
+                   "Only 14-, 18-, and 26-DOPs are supported" );
+
+    static constexpr int n_directions = k / 2;
+
+    KOKKOS_INLINE_FUNCTION
+    KDOP()
+    {
+        for ( int i = 0; i < n_directions; ++i )
+        {
+            _min_values[i] = Kokkos::ArithTraits<double>::max();
+            _max_values[i] = -Kokkos::ArithTraits<double>::max();
+        }
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    static void direction( int i, int n[3] )
+    {
+        Details::KDOPDirections<k>::direction( i, n );
+    }
+
+    // Project a point onto the i-th direction.
+    KOKKOS_INLINE_FUNCTION
+    static double project( int i, Point const &p )
+    {
+        int n[3];
+        direction( i, n );
+        return n[0] * p[0] + n[1] * p[1] + n[2] * p[2];
+    }
+
+    KOKKOS_INLINE_FUNCTION
+    double &minValue( int i ) { return _min_values[i]; }
+
+    KOKKOS_INLINE_FUNCTION
+    double const &minValue( int i ) const { return _min_values[i]; }
+
+    KOKKOS_INLINE_FUNCTION
+    double &maxValue( int i ) { return _max_values[i]; }
+
+    KOKKOS_INLINE_FUNCTION
+    double const &maxValue( int i ) const { return _max_values[i]; }
+
+    double _min_values[n_directions];
+    double _max_values[n_directions];
+};
+
+} // namespace DataTransferKit
+
+#endif
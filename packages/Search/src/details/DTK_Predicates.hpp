@@ -14,6 +14,8 @@
 #include <DTK_DetailsAlgorithms.hpp>
 #include <DTK_DetailsNode.hpp>
 
+#include <Kokkos_ArithTraits.hpp>
+
 namespace DataTransferKit
 {
 namespace Details
@@ -26,6 +28,21 @@ struct SpatialPredicateTag
 };
 } // namespace Details
 
+/**
+ * Predicate for the k nearest neighbors of a geometry.  A positive \c
+ * _epsilon requests an approximate search: the i-th neighbor returned is at
+ * most (1+epsilon) times farther than the exact i-th nearest neighbor.  In
+ * that case, neighbors are not necessarily returned in ascending order of
+ * distance.
+ *
+ * Neighbors farther than \c _radius are ignored so that fewer than k of them
+ * may be found.  The radius bounds the search from the start rather than
+ * filtering the results afterwards.
+ *
+ * The tolerance is stored in single precision: it fills the padding after
+ * \c _k so that forwarding the predicate to other processes costs 8 more
+ * bytes than the geometry and \c _k alone rather than 16.
+ */
 template <typename Geometry>
 struct Nearest
 {
@@ -35,14 +52,19 @@ struct Nearest
     Nearest() = default;
 
     KOKKOS_INLINE_FUNCTION
-    Nearest( Geometry const &geometry, int k )
+    Nearest( Geometry const &geometry, int k, double epsilon = 0.,
+             double radius = Kokkos::ArithTraits<double>::max() )
         : _geometry( geometry )
         , _k( k )
+        , _epsilon( static_cast<float>( epsilon ) )
+        , _radius( radius )
     {
     }
 
     Geometry _geometry;
     int _k = 0;
+    float _epsilon = 0.f;
+    double _radius = Kokkos::ArithTraits<double>::max();
 };
 
 template <typename Geometry>
@@ -57,10 +79,11 @@ struct Intersects
     {
     }
 
-    KOKKOS_INLINE_FUNCTION
-    bool operator()( Node const *node ) const
+    template <typename BoundingVolume>
+    KOKKOS_INLINE_FUNCTION bool
+    operator()( TreeNode<BoundingVolume> const *node ) const
     {
-        return Details::intersects( _geometry, node->bounding_box );
+        return Details::intersects( _geometry, node->bounding_volume );
     }
 
     Geometry _geometry;
@@ -70,10 +93,21 @@ using Within = Intersects<Sphere>;
 using Overlap = Intersects<Box>;
 
 template <typename Geometry>
-KOKKOS_INLINE_FUNCTION Nearest<Geometry> nearest( Geometry const &geometry,
-                                                  int k = 1 )
+KOKKOS_INLINE_FUNCTION Nearest<Geometry>
+nearest( Geometry const &geometry, int k = 1, double epsilon = 0. )
+{
+    return Nearest<Geometry>( geometry, k, epsilon );
+}
+
+/** Predicate for at most k neighbors of a geometry among the objects that are
+ *  within distance \p r of it.
+ */
+template <typename Geometry>
+KOKKOS_INLINE_FUNCTION Nearest<Geometry>
+nearestWithin( Geometry const &geometry, int k, double r,
+               double epsilon = 0. )
 {
-    return Nearest<Geometry>( geometry, k );
+    return Nearest<Geometry>( geometry, k, epsilon, r );
 }
 
 KOKKOS_INLINE_FUNCTION
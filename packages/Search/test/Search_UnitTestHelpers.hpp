@@ -22,6 +22,8 @@
 #include <Teuchos_LocalTestingHelpers.hpp>
 #include <Teuchos_RCP.hpp>
 
+#include <array>
+#include <tuple>
 #include <vector>
 
 // The `out` and `success` parameters come from the Teuchos unit testing macros
@@ -157,6 +159,30 @@ makeDistributedSearchTree( Teuchos::RCP<const Teuchos::Comm<int>> const &comm,
     return DataTransferKit::DistributedSearchTree<DeviceType>( comm, boxes );
 }
 
+// The cloud is the same on all processes, the i-th point lives on rank
+// i % comm_size.
+template <typename DeviceType>
+Kokkos::View<DataTransferKit::Box *, DeviceType>
+makeStridedBoxes( Teuchos::RCP<const Teuchos::Comm<int>> const &comm,
+                  std::vector<std::array<double, 3>> const &cloud )
+{
+    int const comm_rank = comm->getRank();
+    int const comm_size = comm->getSize();
+    int const n = cloud.size();
+    int const n_local = ( n - comm_rank + comm_size - 1 ) / comm_size;
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes",
+                                                            n_local );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n_local; ++i )
+    {
+        auto const &c = cloud[i * comm_size + comm_rank];
+        DataTransferKit::Point const p = {{c[0], c[1], c[2]}};
+        boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( boxes, boxes_host );
+    return boxes;
+}
+
 template <typename DeviceType>
 Kokkos::View<DataTransferKit::Overlap *, DeviceType>
 makeOverlapQueries( std::vector<DataTransferKit::Box> const &boxes )
@@ -174,7 +200,8 @@ makeOverlapQueries( std::vector<DataTransferKit::Box> const &boxes )
 template <typename DeviceType>
 Kokkos::View<DataTransferKit::Nearest<DataTransferKit::Point> *, DeviceType>
 makeNearestQueries(
-    std::vector<std::pair<DataTransferKit::Point, int>> const &points )
+    std::vector<std::pair<DataTransferKit::Point, int>> const &points,
+    double epsilon = 0. )
 {
     // NOTE: `points` is not a very descriptive name here. It stores both the
     // actual point and the number k of neighbors to query for.
@@ -183,8 +210,28 @@ makeNearestQueries(
         queries( "nearest_queries", n );
     auto queries_host = Kokkos::create_mirror_view( queries );
     for ( int i = 0; i < n; ++i )
-        queries_host( i ) =
-            DataTransferKit::nearest( points[i].first, points[i].second );
+        queries_host( i ) = DataTransferKit::nearest(
+            points[i].first, points[i].second, epsilon );
+    Kokkos::deep_copy( queries, queries_host );
+    return queries;
+}
+
+template <typename DeviceType>
+Kokkos::View<DataTransferKit::Nearest<DataTransferKit::Point> *, DeviceType>
+makeNearestWithinQueries(
+    std::vector<std::tuple<DataTransferKit::Point, int, double>> const
+        &points )
+{
+    // NOTE: `points` stores the actual point, the number k of neighbors to
+    // query for and the radius that bounds the search.
+    int const n = points.size();
+    Kokkos::View<DataTransferKit::Nearest<DataTransferKit::Point> *, DeviceType>
+        queries( "nearest_within_queries", n );
+    auto queries_host = Kokkos::create_mirror_view( queries );
+    for ( int i = 0; i < n; ++i )
+        queries_host( i ) = DataTransferKit::nearestWithin(
+            std::get<0>( points[i] ), std::get<1>( points[i] ),
+            std::get<2>( points[i] ) );
     Kokkos::deep_copy( queries, queries_host );
     return queries;
 }
@@ -0,0 +1,206 @@
+/****************************************************************************
+ * Copyright (c) 2012-2018 by the DataTransferKit authors                   *
+ * All rights reserved.                                                     *
+ *                                                                          *
+ * This file is part of the DataTransferKit library. DataTransferKit is     *
+ * distributed under a BSD 3-clause license. For the licensing terms see    *
+ * the LICENSE file in the top-level directory.                             *
+ *                                                                          *
+ * SPDX-License-Identifier: BSD-3-Clause                                    *
+ ****************************************************************************/
+
+#include <DTK_BVHForest.hpp>
+
+#include <Kokkos_Core.hpp>
+
+#include <Teuchos_UnitTestHarness.hpp>
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "Search_UnitTestHelpers.hpp"
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( BVHForest, empty_forest, DeviceType )
+{
+    DataTransferKit::BVHForest<DeviceType> default_forest;
+    TEST_ASSERT( default_forest.empty() );
+    TEST_EQUALITY( default_forest.numberOfTrees(), 0 );
+
+    // three trees without any object
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes", 0 );
+    Kokkos::View<int *, DeviceType> offsets( "offsets", 4 );
+    DataTransferKit::BVHForest<DeviceType> forest( boxes, offsets );
+    TEST_ASSERT( forest.empty() );
+    TEST_EQUALITY( forest.numberOfTrees(), 3 );
+
+    Kokkos::View<int *, DeviceType> tree_ids( "tree_ids", 2 );
+    auto tree_ids_host = Kokkos::create_mirror_view( tree_ids );
+    tree_ids_host( 0 ) = 0;
+    tree_ids_host( 1 ) = 2;
+    Kokkos::deep_copy( tree_ids, tree_ids_host );
+    DataTransferKit::Point const p = {{0., 0., 0.}};
+
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    forest.query( makeWithinQueries<DeviceType>( {{p, 1.}, {p, 2.}} ),
+                  tree_ids, indices, offset );
+    TEST_EQUALITY( indices.extent( 0 ), 0 );
+    TEST_EQUALITY( DataTransferKit::lastElement( offset ), 0 );
+
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    forest.query( makeNearestQueries<DeviceType>( {{p, 1}, {p, 2}} ), tree_ids,
+                  indices, offset, distances );
+    TEST_EQUALITY( indices.extent( 0 ), 0 );
+    TEST_EQUALITY( distances.extent( 0 ), 0 );
+    TEST_EQUALITY( DataTransferKit::lastElement( offset ), 0 );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( BVHForest, queries_per_tree, DeviceType )
+{
+    // Trees of various sizes, some of them empty or with a single object.
+    // All the trees span the same region so that the queries would find
+    // objects from other trees if the trees were mixed up.
+    std::vector<int> const sizes = {0, 1, 2, 37, 0, 300, 5};
+    int const n_trees = sizes.size();
+    std::vector<int> offsets_ref( n_trees + 1, 0 );
+    for ( int t = 0; t < n_trees; ++t )
+        offsets_ref[t + 1] = offsets_ref[t] + sizes[t];
+    int const n = offsets_ref.back();
+
+    std::mt19937 generator( 0 );
+    std::uniform_real_distribution<double> distribution( 0., 10. );
+    std::vector<DataTransferKit::Point> cloud( n );
+    for ( auto &p : cloud )
+        p = {{distribution( generator ), distribution( generator ),
+              distribution( generator )}};
+
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes", n );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n; ++i )
+        boxes_host( i ) = {cloud[i], cloud[i]};
+    Kokkos::deep_copy( boxes, boxes_host );
+    Kokkos::View<int *, DeviceType> offsets( "offsets", n_trees + 1 );
+    auto offsets_host = Kokkos::create_mirror_view( offsets );
+    for ( int t = 0; t <= n_trees; ++t )
+        offsets_host( t ) = offsets_ref[t];
+    Kokkos::deep_copy( offsets, offsets_host );
+
+    for ( auto curve : {DataTransferKit::SpaceFillingCurve::Morton,
+                        DataTransferKit::SpaceFillingCurve::Hilbert} )
+    {
+        DataTransferKit::BVHForest<DeviceType> forest( boxes, offsets, curve );
+        TEST_EQUALITY( forest.numberOfTrees(), n_trees );
+        TEST_EQUALITY( forest.size(), n );
+
+        // a few queries against every tree, in no particular order
+        int const n_queries = 10 * n_trees;
+        Kokkos::View<int *, DeviceType> tree_ids( "tree_ids", n_queries );
+        auto tree_ids_host = Kokkos::create_mirror_view( tree_ids );
+        std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+        std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+        std::vector<std::tuple<DataTransferKit::Point, int, double>>
+            nearest_within_points;
+        for ( int q = 0; q < n_queries; ++q )
+        {
+            tree_ids_host( q ) = ( 3 * q ) % n_trees;
+            DataTransferKit::Point const p = {{distribution( generator ),
+                                               distribution( generator ),
+                                               distribution( generator )}};
+            within_points.emplace_back( p, 0.5 * ( q % 7 ) );
+            nearest_points.emplace_back( p, 1 + q % 4 );
+            nearest_within_points.emplace_back( p, 1 + q % 4, 0.5 * ( q % 7 ) );
+        }
+        Kokkos::deep_copy( tree_ids, tree_ids_host );
+
+        Kokkos::View<int *, DeviceType> indices( "indices" );
+        Kokkos::View<int *, DeviceType> offset( "offset" );
+        forest.query( makeWithinQueries<DeviceType>( within_points ), tree_ids,
+                      indices, offset );
+        auto indices_host = Kokkos::create_mirror_view( indices );
+        Kokkos::deep_copy( indices_host, indices );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        for ( int q = 0; q < n_queries; ++q )
+        {
+            int const t = tree_ids_host( q );
+            std::vector<int> indices_ref;
+            for ( int i = offsets_ref[t]; i < offsets_ref[t + 1]; ++i )
+                if ( DataTransferKit::Details::distance(
+                         within_points[q].first, cloud[i] ) <=
+                     within_points[q].second )
+                    indices_ref.push_back( i );
+            TEST_COMPARE_ARRAYS( extractAndSort( indices_host,
+                                                 offset_host( q ),
+                                                 offset_host( q + 1 ) ),
+                                 indices_ref );
+        }
+
+        // with and without a radius
+        Kokkos::View<double *, DeviceType> distances( "distances" );
+        for ( bool bounded : {false, true} )
+        {
+            if ( bounded )
+                forest.query( makeNearestWithinQueries<DeviceType>(
+                                  nearest_within_points ),
+                              tree_ids, indices, offset, distances );
+            else
+                forest.query( makeNearestQueries<DeviceType>( nearest_points ),
+                              tree_ids, indices, offset, distances );
+            indices_host = Kokkos::create_mirror_view( indices );
+            Kokkos::deep_copy( indices_host, indices );
+            offset_host = Kokkos::create_mirror_view( offset );
+            Kokkos::deep_copy( offset_host, offset );
+            auto distances_host = Kokkos::create_mirror_view( distances );
+            Kokkos::deep_copy( distances_host, distances );
+            for ( int q = 0; q < n_queries; ++q )
+            {
+                int const t = tree_ids_host( q );
+                DataTransferKit::Point const &p = nearest_points[q].first;
+                std::vector<double> distances_ref;
+                for ( int i = offsets_ref[t]; i < offsets_ref[t + 1]; ++i )
+                {
+                    double const d =
+                        DataTransferKit::Details::distance( p, cloud[i] );
+                    double const r = std::get<2>( nearest_within_points[q] );
+                    if ( !bounded || d <= r )
+                        distances_ref.push_back( d );
+                }
+                std::sort( distances_ref.begin(), distances_ref.end() );
+                if ( (int)distances_ref.size() > nearest_points[q].second )
+                    distances_ref.resize( nearest_points[q].second );
+                TEST_COMPARE_FLOATING_ARRAYS(
+                    extractAndSort( distances_host, offset_host( q ),
+                                    offset_host( q + 1 ) ),
+                    distances_ref, 1e-14 );
+                for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+                {
+                    int const i = indices_host( j );
+                    TEST_ASSERT( offsets_ref[t] <= i &&
+                                 i < offsets_ref[t + 1] );
+                    TEST_FLOATING_EQUALITY(
+                        DataTransferKit::Details::distance( p, cloud[i] ),
+                        distances_host( j ), 1e-14 );
+                }
+            }
+        }
+    }
+}
+
+// Include the test macros.
+#include "DataTransferKitSearch_ETIHelperMacros.h"
+
+// Create the test group
+#define UNIT_TEST_GROUP( NODE )                                                \
+    using DeviceType##NODE = typename NODE::device_type;                       \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( BVHForest, empty_forest,             \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( BVHForest, queries_per_tree,         \
+                                          DeviceType##NODE )
+
+// Demangle the types
+DTK_ETI_MANGLING_TYPEDEFS()
+
+// Instantiate the tests
+DTK_INSTANTIATE_N( UNIT_TEST_GROUP )
@@ -92,6 +92,68 @@ TEUCHOS_UNIT_TEST( DetailsAlgorithms, intersects )
     DataTransferKit::Sphere sphere = {{{0., 0., 0.}}, 1.};
     TEST_ASSERT( dtk::intersects( sphere, {{{0., 0., 0.}}, {{1., 1., 1.}}} ) );
     TEST_ASSERT( !dtk::intersects( sphere, {{{1., 2., 3.}}, {{4., 5., 6.}}} ) );
+
+    using DataTransferKit::Box;
+    using DataTransferKit::Sphere;
+    // spheres as bounding volumes
+    TEST_ASSERT( dtk::intersects( sphere, Sphere{{{1., 1., 0.}}, 1.} ) );
+    TEST_ASSERT( dtk::intersects( sphere, Sphere{{{2., 0., 0.}}, 1.} ) );
+    TEST_ASSERT( !dtk::intersects( sphere, Sphere{{{2., 2., 0.}}, 1.} ) );
+    TEST_ASSERT(
+        dtk::intersects( Box{{{0., 0., 0.}}, {{1., 1., 1.}}}, sphere ) );
+    TEST_ASSERT(
+        !dtk::intersects( Box{{{1., 1., 1.}}, {{2., 2., 2.}}}, sphere ) );
+}
+
+TEUCHOS_UNIT_TEST( DetailsAlgorithms, kdop )
+{
+    using DataTransferKit::Box;
+    using DataTransferKit::KDOP;
+    using DataTransferKit::Point;
+    using DataTransferKit::Sphere;
+
+    // uninitialized k-DOP does not intersect anything
+    KDOP<14> kdop;
+    TEST_ASSERT( dtk::isValid( kdop ) );
+    TEST_ASSERT(
+        !dtk::intersects( Box{{{0., 0., 0.}}, {{1., 1., 1.}}}, kdop ) );
+
+    // the 14-DOP of the unit cube coincides with the cube
+    dtk::expand( kdop, Box{{{0., 0., 0.}}, {{1., 1., 1.}}} );
+    TEST_EQUALITY( dtk::distance( Point{{.5, .5, .5}}, kdop ), 0. );
+    TEST_EQUALITY( dtk::distance( Point{{2., .5, .5}}, kdop ), 1. );
+    Box box;
+    dtk::expand( box, kdop );
+    TEST_ASSERT( dtk::equals( box, {{{0., 0., 0.}}, {{1., 1., 1.}}} ) );
+    Point centroid;
+    dtk::centroid( kdop, centroid );
+    TEST_ASSERT( dtk::equals( centroid, {{.5, .5, .5}} ) );
+
+    // diagonals of the 18-DOP cut the edges of the bounding box of a triangle
+    KDOP<18> triangle;
+    for ( Point const &p : {Point{{0., 0., 0.}}, Point{{1., 0., 0.}},
+                            Point{{0., 1., 0.}}} )
+        dtk::expand( triangle, p );
+    // point (1,1,0) is inside the bounding box but outside of the 18-DOP
+    TEST_ASSERT(
+        !dtk::intersects( Box{{{1., 1., 0.}}, {{1., 1., 0.}}}, triangle ) );
+    TEST_ASSERT(
+        dtk::intersects( Box{{{.5, .5, 0.}}, {{1., 1., 0.}}}, triangle ) );
+    TEST_FLOATING_EQUALITY( dtk::distance( Point{{1., 1., 0.}}, triangle ),
+                            std::sqrt( 2. ) / 2., 1e-14 );
+    TEST_ASSERT( dtk::intersects( Sphere{{{1., 1., 0.}}, .75}, triangle ) );
+    TEST_ASSERT( !dtk::intersects( Sphere{{{1., 1., 0.}}, .5}, triangle ) );
+
+    // expand with another k-DOP and with a sphere
+    KDOP<18> other;
+    dtk::expand( other, Sphere{{{0., 0., 0.}}, 1.} );
+    TEST_EQUALITY( other.maxValue( 0 ), 1. );
+    TEST_EQUALITY( other.maxValue( 3 ), std::sqrt( 2. ) );
+    dtk::expand( other, triangle );
+    TEST_EQUALITY( other.maxValue( 0 ), 1. );
+    TEST_ASSERT( !dtk::equals( other, triangle ) );
+    dtk::expand( triangle, other );
+    TEST_ASSERT( dtk::equals( other, triangle ) );
 }
 
 TEUCHOS_UNIT_TEST( DetailsAlgorithms, equals )
@@ -141,6 +203,15 @@ TEUCHOS_UNIT_TEST( DetailsAlgorithms, expand )
     dtk::expand( box, {{{0., 0., 0.}}, 24.} );
     TEST_ASSERT(
         dtk::equals( box, {{{-24., -24., -24.}}, {{24., 24., 24.}}} ) );
+
+    // expand sphere with spheres
+    DataTransferKit::Sphere sphere = {{{0., 0., 0.}}, 1.};
+    dtk::expand( sphere, DataTransferKit::Sphere{{{.5, 0., 0.}}, .5} );
+    TEST_ASSERT( dtk::equals( sphere, {{{0., 0., 0.}}, 1.} ) );
+    dtk::expand( sphere, DataTransferKit::Sphere{{{3., 0., 0.}}, 1.} );
+    TEST_ASSERT( dtk::equals( sphere, {{{1.5, 0., 0.}}, 2.5} ) );
+    dtk::expand( sphere, DataTransferKit::Sphere{{{0., 0., 0.}}, 10.} );
+    TEST_ASSERT( dtk::equals( sphere, {{{0., 0., 0.}}, 10.} ) );
 }
 
 TEUCHOS_UNIT_TEST( DetailsAlgorithms, centroid )
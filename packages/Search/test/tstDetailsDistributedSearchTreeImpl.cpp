@@ -10,12 +10,14 @@
  ****************************************************************************/
 
 #include <DTK_DetailsDistributedSearchTreeImpl.hpp>
+#include <DTK_DistributedSearchTree.hpp>
 
 #include <Teuchos_DefaultComm.hpp>
 #include <Teuchos_UnitTestHarness.hpp>
 #include <Tpetra_Distributor.hpp>
 
-#include <algorithm> // fill
+#include <algorithm> // fill, is_sorted, max, min, sort
+#include <numeric>   // iota
 #include <set>
 #include <vector>
 
@@ -67,7 +69,7 @@ TEUCHOS_UNIT_TEST( DetailsTeuchosSerializationTraits, predicates )
     int const comm_size = comm->getSize();
 
     Point p = {{(double)comm_rank, (double)comm_rank, (double)comm_rank}};
-    auto nearest_query = nearest( p, comm_size );
+    auto nearest_query = nearest( p, comm_size, .5 * comm_rank );
     std::vector<decltype( nearest_query )> all_nearest_queries( comm_size );
     Teuchos::gatherAll( *comm, 1, &nearest_query, comm_size,
                         all_nearest_queries.data() );
@@ -76,6 +78,7 @@ TEUCHOS_UNIT_TEST( DetailsTeuchosSerializationTraits, predicates )
         TEST_ASSERT( equals( all_nearest_queries[i]._geometry,
                              {{(double)i, (double)i, (double)i}} ) );
         TEST_EQUALITY( all_nearest_queries[i]._k, comm_size );
+        TEST_EQUALITY( all_nearest_queries[i]._epsilon, .5 * i );
     }
 
     Box b = {{{0., 0., 0.}}, p};
@@ -320,6 +323,358 @@ TEUCHOS_UNIT_TEST( DetailsDistributedSearchTreeImpl,
     checkViewWasNotAllocated( y, y_h, success, out );
 }
 
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsDistributedSearchTreeImpl,
+                                   send_packed_views, DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = comm->getRank();
+    int const comm_size = comm->getSize();
+
+    // every process sends comm_rank + 1 entries to the next one
+    int const n_exports = comm_rank + 1;
+    std::vector<int> destinations( n_exports, ( comm_rank + 1 ) % comm_size );
+    Tpetra::Distributor distributor( comm );
+    int const n_imports = distributor.createFromSends(
+        Teuchos::ArrayView<int>( destinations.data(), n_exports ) );
+    int const source = ( comm_rank + comm_size - 1 ) % comm_size;
+    TEST_EQUALITY( n_imports, source + 1 );
+
+    // views of different value types, sizes, and alignments
+    Kokkos::View<int *, DeviceType> export_ints( "export_ints", n_exports );
+    Kokkos::View<double *, DeviceType> export_doubles( "export_doubles",
+                                                       n_exports );
+    Kokkos::View<bool *, DeviceType> export_flags( "export_flags", n_exports );
+    Kokkos::View<DataTransferKit::Point *, DeviceType> export_points(
+        "export_points", n_exports );
+    auto export_ints_host = Kokkos::create_mirror_view( export_ints );
+    auto export_doubles_host = Kokkos::create_mirror_view( export_doubles );
+    auto export_flags_host = Kokkos::create_mirror_view( export_flags );
+    auto export_points_host = Kokkos::create_mirror_view( export_points );
+    for ( int i = 0; i < n_exports; ++i )
+    {
+        export_ints_host( i ) = 10 * comm_rank + i;
+        export_doubles_host( i ) = 0.5 * comm_rank - i;
+        export_flags_host( i ) = ( i % 3 == 0 );
+        export_points_host( i ) = {{(double)comm_rank, (double)i, -1.}};
+    }
+    Kokkos::deep_copy( export_ints, export_ints_host );
+    Kokkos::deep_copy( export_doubles, export_doubles_host );
+    Kokkos::deep_copy( export_flags, export_flags_host );
+    Kokkos::deep_copy( export_points, export_points_host );
+
+    Kokkos::View<int *, DeviceType> import_ints( "import_ints", n_imports );
+    Kokkos::View<double *, DeviceType> import_doubles( "import_doubles",
+                                                       n_imports );
+    Kokkos::View<bool *, DeviceType> import_flags( "import_flags", n_imports );
+    Kokkos::View<DataTransferKit::Point *, DeviceType> import_points(
+        "import_points", n_imports );
+    DataTransferKit::Details::DistributedSearchTreeImpl<DeviceType>::
+        sendAcrossNetwork( distributor,
+                           std::tie( export_flags, export_ints,
+                                     export_doubles, export_points ),
+                           std::tie( import_flags, import_ints,
+                                     import_doubles, import_points ) );
+
+    auto import_ints_host = Kokkos::create_mirror_view( import_ints );
+    auto import_doubles_host = Kokkos::create_mirror_view( import_doubles );
+    auto import_flags_host = Kokkos::create_mirror_view( import_flags );
+    auto import_points_host = Kokkos::create_mirror_view( import_points );
+    Kokkos::deep_copy( import_ints_host, import_ints );
+    Kokkos::deep_copy( import_doubles_host, import_doubles );
+    Kokkos::deep_copy( import_flags_host, import_flags );
+    Kokkos::deep_copy( import_points_host, import_points );
+    for ( int i = 0; i < n_imports; ++i )
+    {
+        TEST_EQUALITY( import_ints_host( i ), 10 * source + i );
+        TEST_EQUALITY( import_doubles_host( i ), 0.5 * source - i );
+        TEST_EQUALITY( import_flags_host( i ), ( i % 3 == 0 ) );
+        TEST_ASSERT( DataTransferKit::Details::equals(
+            import_points_host( i ), {{(double)source, (double)i, -1.}} ) );
+    }
+}
+
+TEUCHOS_UNIT_TEST( DetailsDistributedSearchTreeImpl, distributor_cache )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = comm->getRank();
+    int const comm_size = comm->getSize();
+
+    // process i sends i+1 entries to the next process and one to itself
+    std::vector<int> ranks_next( comm_rank + 1, ( comm_rank + 1 ) % comm_size );
+    ranks_next.push_back( comm_rank );
+    std::vector<int> ranks_self( 3, comm_rank );
+    std::vector<int> ranks_none;
+
+    DataTransferKit::Details::DistributorCache cache( comm, 2 );
+    auto checkReceiveLength = [&]( std::vector<int> const &ranks,
+                                   std::size_t n_imports_ref ) {
+        std::vector<std::size_t> permute( ranks.size() );
+        auto &distributor = cache.getDistributor(
+            Teuchos::ArrayView<int const>( ranks.data(), ranks.size() ),
+            Teuchos::ArrayView<std::size_t>( permute.data(), permute.size() ) );
+        TEST_EQUALITY( distributor.getTotalReceiveLength(), n_imports_ref );
+        // the exports are grouped by destination in ascending rank order
+        std::vector<int> grouped_ranks( ranks.size() );
+        for ( std::size_t i = 0; i < ranks.size(); ++i )
+            grouped_ranks[permute[i]] = ranks[i];
+        TEST_ASSERT( std::is_sorted( grouped_ranks.begin(),
+                                     grouped_ranks.end() ) );
+    };
+    int const previous_rank = ( comm_rank + comm_size - 1 ) % comm_size;
+    std::size_t const n_imports_next = previous_rank + 2;
+
+    checkReceiveLength( ranks_next, n_imports_next );
+    TEST_EQUALITY( cache.hits(), 0 );
+    checkReceiveLength( ranks_next, n_imports_next );
+    TEST_EQUALITY( cache.hits(), 1 );
+    checkReceiveLength( ranks_self, 3 );
+    TEST_EQUALITY( cache.hits(), 1 );
+    checkReceiveLength( ranks_next, n_imports_next );
+    checkReceiveLength( ranks_self, 3 );
+    TEST_EQUALITY( cache.hits(), 3 );
+    // the plan for ranks_next is the oldest one and gets replaced
+    checkReceiveLength( ranks_none, 0 );
+    TEST_EQUALITY( cache.hits(), 3 );
+    checkReceiveLength( ranks_self, 3 );
+    checkReceiveLength( ranks_none, 0 );
+    TEST_EQUALITY( cache.hits(), 5 );
+    checkReceiveLength( ranks_next, n_imports_next );
+    TEST_EQUALITY( cache.hits(), 5 );
+    // the order of the exports does not matter
+    std::vector<int> ranks_next_reversed( ranks_next.rbegin(),
+                                          ranks_next.rend() );
+    checkReceiveLength( ranks_next_reversed, n_imports_next );
+    TEST_EQUALITY( cache.hits(), 6 );
+
+    // a plan is only reused if the ranks match on all processes
+    if ( comm_rank == 0 )
+        checkReceiveLength( ranks_self, 3 );
+    else
+        checkReceiveLength( ranks_none, 0 );
+    TEST_EQUALITY( cache.hits(), 6 );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsDistributedSearchTreeImpl,
+                                   reassess_strategy, DeviceType )
+{
+    using DataTransferKit::Box;
+    using DataTransferKit::Nearest;
+    using DataTransferKit::Point;
+
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = comm->getRank();
+    int const comm_size = comm->getSize();
+
+    // Each process owns a single point (comm_rank, 0, 0).
+    Kokkos::View<Box *, DeviceType> boxes( "boxes", 1 );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    Point const p = {{(double)comm_rank, 0., 0.}};
+    boxes_host( 0 ) = {p, p};
+    Kokkos::deep_copy( boxes, boxes_host );
+    DataTransferKit::DistributedSearchTree<DeviceType> tree( comm, boxes );
+
+    // Two queries for the nearest neighbor of the local point.  The 1st pass
+    // visited this process for the first query and found the neighbor at
+    // distance 0.  It visited no process for the second one and found a
+    // neighbor at distance 1.5.
+    Kokkos::View<Nearest<Point> *, DeviceType> queries( "queries", 2 );
+    auto queries_host = Kokkos::create_mirror_view( queries );
+    queries_host( 0 ) = DataTransferKit::nearest( p, 1 );
+    queries_host( 1 ) = DataTransferKit::nearest( p, 1 );
+    Kokkos::deep_copy( queries, queries_host );
+
+    Kokkos::View<int *, DeviceType> results_offset( "results_offset", 3 );
+    Kokkos::View<double *, DeviceType> distances( "distances", 2 );
+    auto results_offset_host = Kokkos::create_mirror_view( results_offset );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    results_offset_host( 0 ) = 0;
+    results_offset_host( 1 ) = 1;
+    results_offset_host( 2 ) = 2;
+    distances_host( 0 ) = 0.;
+    distances_host( 1 ) = 1.5;
+    Kokkos::deep_copy( results_offset, results_offset_host );
+    Kokkos::deep_copy( distances, distances_host );
+
+    Kokkos::View<int *, DeviceType> indices( "indices", 1 );
+    Kokkos::View<int *, DeviceType> offset( "offset", 3 );
+    auto indices_host = Kokkos::create_mirror_view( indices );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    indices_host( 0 ) = comm_rank;
+    offset_host( 0 ) = 0;
+    offset_host( 1 ) = 1;
+    offset_host( 2 ) = 1;
+    Kokkos::deep_copy( indices, indices_host );
+    Kokkos::deep_copy( offset, offset_host );
+
+    Kokkos::View<Nearest<Point> *, DeviceType> bounded_queries(
+        "bounded_queries" );
+    DataTransferKit::Details::DistributedSearchTreeImpl<DeviceType>::
+        reassessStrategy( queries, tree, results_offset, distances, indices,
+                          offset, bounded_queries );
+
+    // Nothing is forwarded again for the first query.  The second query is
+    // forwarded to the neighboring processes and to this one, since none of
+    // them was visited.
+    std::vector<int> ranks_ref;
+    for ( int r = std::max( 0, comm_rank - 1 );
+          r <= std::min( comm_size - 1, comm_rank + 1 ); ++r )
+        ranks_ref.push_back( r );
+    offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( indices_host, indices );
+    TEST_EQUALITY( offset_host( 0 ), 0 );
+    TEST_EQUALITY( offset_host( 1 ), 0 );
+    TEST_EQUALITY( offset_host( 2 ), (int)ranks_ref.size() );
+    std::vector<int> ranks( indices_host.data(),
+                            indices_host.data() + indices_host.extent( 0 ) );
+    std::sort( ranks.begin(), ranks.end() );
+    TEST_COMPARE_ARRAYS( ranks, ranks_ref );
+
+    // The forwarded queries are bounded by the distance to the farthest
+    // neighbor found so far.
+    TEST_EQUALITY( bounded_queries.extent( 0 ), 2 );
+    queries_host = Kokkos::create_mirror_view( bounded_queries );
+    Kokkos::deep_copy( queries_host, bounded_queries );
+    TEST_EQUALITY( queries_host( 0 )._k, 1 );
+    TEST_EQUALITY( queries_host( 0 )._radius, 0. );
+    TEST_EQUALITY( queries_host( 1 )._k, 1 );
+    TEST_EQUALITY( queries_host( 1 )._radius, 1.5 );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsDistributedSearchTreeImpl,
+                                   query_top_tree, DeviceType )
+{
+    using DataTransferKit::Box;
+    using DataTransferKit::Point;
+    using DataTransferKit::Within;
+
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = comm->getRank();
+    int const comm_size = comm->getSize();
+
+    // The local domain of each process is made of two clusters of points far
+    // apart from each other.
+    int const n = 10;
+    Kokkos::View<Box *, DeviceType> boxes( "boxes", 2 * n );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n; ++i )
+        for ( double x : {0., 100.} )
+        {
+            Point const p = {{x + .1 * i, (double)comm_rank, 0.}};
+            boxes_host( x > 0. ? n + i : i ) = {p, p};
+        }
+    Kokkos::deep_copy( boxes, boxes_host );
+
+    // One query in the gap between the clusters and one that meets all the
+    // points.
+    Kokkos::View<Within *, DeviceType> queries( "queries", 2 );
+    auto queries_host = Kokkos::create_mirror_view( queries );
+    queries_host( 0 ) = DataTransferKit::within(
+        {{50., (double)comm_rank, 0.}}, 1. );
+    queries_host( 1 ) = DataTransferKit::within(
+        {{50., .5 * comm_size, 0.}}, 1000. );
+    Kokkos::deep_copy( queries, queries_host );
+
+    std::vector<int> all_ranks( comm_size );
+    std::iota( all_ranks.begin(), all_ranks.end(), 0 );
+
+    for ( int depth : {0, 1, 3} )
+    {
+        DataTransferKit::DistributedSearchTree<DeviceType> tree( comm, boxes,
+                                                                 depth );
+        TEST_EQUALITY( tree.size(), 2 * n * comm_size );
+
+        Kokkos::View<int *, DeviceType> indices( "indices" );
+        Kokkos::View<int *, DeviceType> offset( "offset" );
+        DataTransferKit::Details::DistributedSearchTreeImpl<
+            DeviceType>::queryTopTree( tree, queries, indices, offset );
+        auto indices_host = Kokkos::create_mirror_view( indices );
+        Kokkos::deep_copy( indices_host, indices );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+
+        // A single box around the local domain contains the gap.  Several
+        // boxes do not.
+        TEST_EQUALITY( offset_host( 1 ) - offset_host( 0 ),
+                       depth == 0 ? 1 : 0 );
+        if ( depth == 0 )
+            TEST_EQUALITY( indices_host( 0 ), comm_rank );
+
+        // Every rank is listed once even though several of its boxes meet
+        // the query.
+        std::vector<int> ranks( indices_host.data() + offset_host( 1 ),
+                                indices_host.data() + offset_host( 2 ) );
+        std::sort( ranks.begin(), ranks.end() );
+        TEST_COMPARE_ARRAYS( ranks, all_ranks );
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsDistributedSearchTreeImpl,
+                                   forward_queries_locally, DeviceType )
+{
+    using DataTransferKit::Point;
+    using DataTransferKit::Within;
+
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = comm->getRank();
+    DataTransferKit::Details::DistributorCache distributor_cache( comm );
+
+    // The first and the last queries are destined to the local process, the
+    // second one to no process.
+    Kokkos::View<Within *, DeviceType> queries( "queries", 3 );
+    auto queries_host = Kokkos::create_mirror_view( queries );
+    for ( int q = 0; q < 3; ++q )
+        queries_host( q ) =
+            DataTransferKit::within( {{(double)q, 0., 0.}}, 1. );
+    Kokkos::deep_copy( queries, queries_host );
+    Kokkos::View<int *, DeviceType> indices( "indices", 2 );
+    Kokkos::deep_copy( indices, comm_rank );
+    Kokkos::View<int *, DeviceType> offset( "offset", 4 );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    offset_host( 0 ) = 0;
+    offset_host( 1 ) = 1;
+    offset_host( 2 ) = 1;
+    offset_host( 3 ) = 2;
+    Kokkos::deep_copy( offset, offset_host );
+
+    Kokkos::View<Within *, DeviceType> fwd_queries( "fwd_queries" );
+    Kokkos::View<int *, DeviceType> fwd_ids( "fwd_ids" );
+    Kokkos::View<int *, DeviceType> fwd_ranks( "fwd_ranks" );
+    Kokkos::View<int *, DeviceType> local_ids( "local_ids" );
+    Kokkos::View<Within *, DeviceType> local_queries( "local_queries" );
+    int n_calls = 0;
+    DataTransferKit::Details::DistributedSearchTreeImpl<DeviceType>::
+        forwardQueries( distributor_cache, queries, indices, offset,
+                        fwd_queries, fwd_ids, fwd_ranks, local_ids,
+                        [&]( Kokkos::View<Within *, DeviceType> local ) {
+                            local_queries = local;
+                            ++n_calls;
+                        } );
+
+    // Nothing went through the network.
+    TEST_EQUALITY( n_calls, 1 );
+    TEST_EQUALITY( fwd_queries.extent( 0 ), 0 );
+    TEST_EQUALITY( fwd_ids.extent( 0 ), 0 );
+    TEST_EQUALITY( fwd_ranks.extent( 0 ), 0 );
+
+    auto local_ids_host = Kokkos::create_mirror_view( local_ids );
+    Kokkos::deep_copy( local_ids_host, local_ids );
+    TEST_COMPARE_ARRAYS( local_ids_host, std::vector<int>( {0, 2} ) );
+    TEST_EQUALITY( local_queries.extent( 0 ), 2 );
+    auto local_queries_host = Kokkos::create_mirror_view( local_queries );
+    Kokkos::deep_copy( local_queries_host, local_queries );
+    for ( int j = 0; j < 2; ++j )
+        TEST_ASSERT( DataTransferKit::Details::equals(
+            local_queries_host( j )._geometry,
+            queries_host( local_ids_host( j ) )._geometry ) );
+}
+
 // Include the test macros.
 #include "DataTransferKitSearch_ETIHelperMacros.h"
 
@@ -331,7 +686,16 @@ TEUCHOS_UNIT_TEST( DetailsDistributedSearchTreeImpl,
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsDistributedSearchTreeImpl,    \
                                           sort_results, DeviceType##NODE )     \
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsDistributedSearchTreeImpl,    \
-                                          count_results, DeviceType##NODE )
+                                          count_results, DeviceType##NODE )    \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsDistributedSearchTreeImpl,    \
+                                          send_packed_views, DeviceType##NODE )\
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsDistributedSearchTreeImpl,    \
+                                          reassess_strategy, DeviceType##NODE )\
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsDistributedSearchTreeImpl,    \
+                                          query_top_tree, DeviceType##NODE )   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsDistributedSearchTreeImpl,    \
+                                          forward_queries_locally,             \
+                                          DeviceType##NODE )
 
 // Demangle the types
 DTK_ETI_MANGLING_TYPEDEFS()
@@ -17,8 +17,12 @@
 #include <Teuchos_UnitTestHarness.hpp>
 
 #include <algorithm>
+#include <array>
 #include <bitset>
+#include <cmath> // pow
+#include <cstdlib> // abs
 #include <functional>
+#include <numeric> // iota
 #include <sstream>
 #include <vector>
 
@@ -73,6 +77,77 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsBVH, morton_codes, DeviceType )
     TEST_COMPARE_ARRAYS( morton_codes_host, ref );
 }
 
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsBVH, hilbert_codes, DeviceType )
+{
+    using TreeConstruction = dtk::TreeConstruction<DeviceType>;
+
+    // centers of the cells of a 8x8x8 grid covering the unit cube
+    int const n_1d = 8;
+    int const n = n_1d * n_1d * n_1d;
+    std::vector<std::array<int, 3>> cells( n );
+    std::vector<unsigned int> codes( n );
+    for ( int i = 0; i < n; ++i )
+    {
+        cells[i] = {{i % n_1d, ( i / n_1d ) % n_1d, i / ( n_1d * n_1d )}};
+        codes[i] = TreeConstruction::hilbert3D(
+            ( cells[i][0] + .5 ) / n_1d, ( cells[i][1] + .5 ) / n_1d,
+            ( cells[i][2] + .5 ) / n_1d );
+        TEST_COMPARE( codes[i], <, 1u << 30 );
+    }
+
+    // codes are unique and consecutive cells along the curve share a face
+    std::vector<int> order( n );
+    std::iota( order.begin(), order.end(), 0 );
+    std::sort( order.begin(), order.end(),
+               [&codes]( int i, int j ) { return codes[i] < codes[j]; } );
+    for ( int i = 0; i < n - 1; ++i )
+    {
+        auto const &a = cells[order[i]];
+        auto const &b = cells[order[i + 1]];
+        TEST_COMPARE( codes[order[i]], <, codes[order[i + 1]] );
+        TEST_EQUALITY( std::abs( a[0] - b[0] ) + std::abs( a[1] - b[1] ) +
+                           std::abs( a[2] - b[2] ),
+                       1 );
+    }
+
+    // the curve starts at the origin and the leading three bits identify the
+    // octant just like with the Morton codes
+    TEST_EQUALITY( order[0], 0 );
+    TEST_EQUALITY( TreeConstruction::hilbert3D( 0., 0., 0. ), 0u );
+    for ( int i = 0; i < n; ++i )
+    {
+        int const octant = 4 * ( cells[i][0] / 4 ) + 2 * ( cells[i][1] / 4 ) +
+                           ( cells[i][2] / 4 );
+        int const first = order[( codes[i] >> 27 ) * ( n / 8 )];
+        int const first_octant = 4 * ( cells[first][0] / 4 ) +
+                                 2 * ( cells[first][1] / 4 ) +
+                                 ( cells[first][2] / 4 );
+        TEST_EQUALITY( octant, first_octant );
+    }
+
+    // assignMortonCodes() computes the codes along the requested curve
+    int const m = 4;
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes", m );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    std::vector<DataTransferKit::Point> const points = {
+        {{0., 0., 0.}}, {{.2, .9, .4}}, {{.7, .1, .3}}, {{1., 1., 1.}}};
+    for ( int i = 0; i < m; ++i )
+        boxes_host( i ) = {points[i], points[i]};
+    Kokkos::deep_copy( boxes, boxes_host );
+    DataTransferKit::Box const scene = {{{0., 0., 0.}}, {{1., 1., 1.}}};
+    Kokkos::View<unsigned int *, DeviceType> hilbert_codes( "hilbert_codes",
+                                                            m );
+    TreeConstruction::assignMortonCodes(
+        boxes, hilbert_codes, scene,
+        DataTransferKit::SpaceFillingCurve::Hilbert );
+    auto hilbert_codes_host = Kokkos::create_mirror_view( hilbert_codes );
+    Kokkos::deep_copy( hilbert_codes_host, hilbert_codes );
+    for ( int i = 0; i < m; ++i )
+        TEST_EQUALITY( hilbert_codes_host( i ),
+                       TreeConstruction::hilbert3D( points[i][0], points[i][1],
+                                                    points[i][2] ) );
+}
+
 template <typename DeviceType>
 class FillK
 {
@@ -320,6 +395,90 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsBVH, example_tree_construction,
     std::cout << "sol=" << sol.str() << "\n";
 
     TEST_EQUALITY( sol.str().compare( ref.str() ), 0 );
+
+    // store the internal nodes in the order they are visited
+    dtk::TreeConstruction<DeviceType>::sortInternalNodesDepthFirst(
+        leaf_nodes, internal_nodes );
+    TEST_EQUALITY( internal_nodes.extent_int( 0 ), n - 1 );
+
+    std::ostringstream ref_depth_first;
+    ref_depth_first << "I0"
+                    << "I1"
+                    << "I2"
+                    << "L0"
+                    << "L1"
+                    << "I3"
+                    << "L2"
+                    << "L3"
+                    << "I4"
+                    << "L4"
+                    << "I5"
+                    << "I6"
+                    << "L5"
+                    << "L6"
+                    << "L7";
+
+    root = internal_nodes.data();
+    TEST_ASSERT( root->parent == nullptr );
+
+    std::ostringstream sol_depth_first;
+    traverseRecursive( root, sol_depth_first );
+
+    TEST_EQUALITY( sol_depth_first.str().compare( ref_depth_first.str() ), 0 );
+
+    // the leaves and the children of the internal nodes know their parent
+    for ( int i = 0; i < n - 1; ++i )
+        for ( DataTransferKit::Node *child :
+              {internal_nodes( i ).children.first,
+               internal_nodes( i ).children.second} )
+            TEST_ASSERT( child->parent == &internal_nodes( i ) );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsBVH, binned_sah_depth, DeviceType )
+{
+    // Exponentially spaced points, where every candidate plane of the
+    // surface area heuristic only separates the few farthest points from the
+    // other ones.
+    int const n = 1000;
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes", n );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n; ++i )
+    {
+        double const x = std::pow( 1.05, i );
+        DataTransferKit::Point const p = {{x, x, x}};
+        boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( boxes, boxes_host );
+
+    Kokkos::View<int *, DeviceType> object_ids( "object_ids", n );
+    Kokkos::View<DataTransferKit::Node *, DeviceType> leaf_nodes( "leaf_nodes",
+                                                                  n );
+    Kokkos::View<DataTransferKit::Node *, DeviceType> internal_nodes(
+        "internal_nodes", n - 1 );
+    dtk::TreeConstruction<DeviceType>::generateHierarchyBinnedSAH(
+        boxes, object_ids, leaf_nodes, internal_nodes );
+
+    // The depth must stay within twice that of a balanced tree, i.e. 20.
+    int max_depth = 0;
+    for ( int i = 0; i < n; ++i )
+    {
+        int depth = 0;
+        for ( DataTransferKit::Node const *node = &leaf_nodes( i );
+              node->parent != nullptr; node = node->parent )
+            ++depth;
+        max_depth = std::max( max_depth, depth );
+    }
+    TEST_COMPARE( max_depth, <=, 20 );
+
+    // Every object is in exactly one leaf.
+    auto object_ids_host = Kokkos::create_mirror_view( object_ids );
+    Kokkos::deep_copy( object_ids_host, object_ids );
+    std::vector<int> ids( object_ids_host.data(),
+                          object_ids_host.data() + n );
+    std::sort( ids.begin(), ids.end() );
+    std::vector<int> ids_ref( n );
+    std::iota( ids_ref.begin(), ids_ref.end(), 0 );
+    TEST_COMPARE_ARRAYS( ids, ids_ref );
 }
 
 // Include the test macros.
@@ -330,6 +489,8 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsBVH, example_tree_construction,
     using DeviceType##NODE = typename NODE::device_type;                       \
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsBVH, morton_codes,            \
                                           DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsBVH, hilbert_codes,           \
+                                          DeviceType##NODE )                   \
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT(                                      \
         DetailsBVH, number_of_leading_zero_bits, DeviceType##NODE )            \
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsBVH, indirect_sort,           \
@@ -337,7 +498,9 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsBVH, example_tree_construction,
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsBVH, common_prefix,           \
                                           DeviceType##NODE )                   \
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT(                                      \
-        DetailsBVH, example_tree_construction, DeviceType##NODE )
+        DetailsBVH, example_tree_construction, DeviceType##NODE )              \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DetailsBVH, binned_sah_depth,        \
+                                          DeviceType##NODE )
 // Demangle the types
 DTK_ETI_MANGLING_TYPEDEFS()
 
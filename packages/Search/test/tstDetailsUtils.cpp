@@ -88,6 +88,16 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsUtils, prefix_sum, DeviceType )
     Kokkos::deep_copy( w_host, w );
     std::vector<double> w_ref = {0., 1., 1.};
     TEST_COMPARE_FLOATING_ARRAYS( w_host, w_ref, 1e-14 );
+    // sums that overflow the input type are accumulated in the output type
+    int const big = 1 << 30;
+    Kokkos::View<int *, DeviceType> counts( "counts", 4 );
+    Kokkos::deep_copy( counts, big );
+    Kokkos::View<long long *, DeviceType> offset( "offset", 4 );
+    DataTransferKit::exclusivePrefixSum( counts, offset );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    std::vector<long long> offset_ref = {0, big, 2ll * big, 3ll * big};
+    TEST_COMPARE_ARRAYS( offset_host, offset_ref );
 }
 
 TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DetailsUtils, last_element, DeviceType )
@@ -114,6 +114,16 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree, hello_world,
         TEST_EQUALITY( ranks_host( n ), comm_size - comm_rank );
     }
 
+    // same results with 64-bit offsets
+    Kokkos::View<long long *, DeviceType> long_offset( "offset" );
+    tree.query( queries, indices, long_offset, ranks );
+    auto long_offset_host = Kokkos::create_mirror_view( long_offset );
+    Kokkos::deep_copy( long_offset_host, long_offset );
+    TEST_COMPARE_ARRAYS( long_offset_host, offset_host );
+    auto long_indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( long_indices_host, indices );
+    TEST_COMPARE_ARRAYS( long_indices_host, indices_host );
+
     tree.query( nearest_queries, indices, offset, ranks );
 
     indices_host = Kokkos::create_mirror_view( indices );
@@ -535,6 +545,900 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree, boost_comparison,
     }
 }
 
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree,
+                                   approximate_nearest_neighbors, DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // Same random cloud on all processes, the i-th point lives on rank
+    // i % comm_size.
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 100 * comm_size;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, n, 0 );
+    DataTransferKit::DistributedSearchTree<DeviceType> const tree(
+        comm, makeStridedBoxes<DeviceType>( comm, cloud ) );
+
+    int const n_queries = 20;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    std::vector<std::vector<double>> distances_ref( n_queries );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        DataTransferKit::Point const p = {
+            {points[q][0], points[q][1], points[q][2]}};
+        nearest_points.emplace_back( p, 1 + q % 10 );
+        for ( int i = 0; i < n; ++i )
+            distances_ref[q].push_back( DataTransferKit::Details::distance(
+                p, {{cloud[i][0], cloud[i][1], cloud[i][2]}} ) );
+        std::sort( distances_ref[q].begin(), distances_ref[q].end() );
+    }
+
+    for ( double epsilon : {0., .5} )
+    {
+        Kokkos::View<int *, DeviceType> indices( "indices" );
+        Kokkos::View<int *, DeviceType> offset( "offset" );
+        Kokkos::View<int *, DeviceType> ranks( "ranks" );
+        Kokkos::View<double *, DeviceType> distances( "distances" );
+        tree.query( makeNearestQueries<DeviceType>( nearest_points, epsilon ),
+                    indices, offset, ranks, distances );
+
+        auto indices_host = Kokkos::create_mirror_view( indices );
+        Kokkos::deep_copy( indices_host, indices );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        auto ranks_host = Kokkos::create_mirror_view( ranks );
+        Kokkos::deep_copy( ranks_host, ranks );
+        auto distances_host = Kokkos::create_mirror_view( distances );
+        Kokkos::deep_copy( distances_host, distances );
+
+        TEST_EQUALITY( distances_host.extent( 0 ), indices_host.extent( 0 ) );
+        for ( int q = 0; q < n_queries; ++q )
+        {
+            TEST_EQUALITY( offset_host( q + 1 ) - offset_host( q ),
+                           nearest_points[q].second );
+            std::vector<double> sorted_distances;
+            for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+            {
+                auto const &point =
+                    cloud[indices_host( j ) * comm_size + ranks_host( j )];
+                TEST_FLOATING_EQUALITY(
+                    distances_host( j ),
+                    DataTransferKit::Details::distance(
+                        nearest_points[q].first,
+                        {{point[0], point[1], point[2]}} ),
+                    1e-14 );
+                sorted_distances.push_back( distances_host( j ) );
+            }
+            std::sort( sorted_distances.begin(), sorted_distances.end() );
+            for ( unsigned int j = 0; j < sorted_distances.size(); ++j )
+                TEST_ASSERT( sorted_distances[j] <=
+                             ( 1. + epsilon ) * distances_ref[q][j] *
+                                 ( 1. + 1e-14 ) );
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree, count_and_any,
+                                   DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // Same random cloud on all processes, the i-th point lives on rank
+    // i % comm_size.
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 100 * comm_size;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, n, 0 );
+    DataTransferKit::DistributedSearchTree<DeviceType> const tree(
+        comm, makeStridedBoxes<DeviceType>( comm, cloud ) );
+
+    // Radii range from small enough to miss every point to large enough to
+    // catch points on several processes.  The last query is away from the
+    // cloud.
+    int const n_queries = 20;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    for ( int q = 0; q < n_queries - 1; ++q )
+        within_points.emplace_back(
+            DataTransferKit::Point{{points[q][0], points[q][1], points[q][2]}},
+            q * .1 );
+    within_points.emplace_back( DataTransferKit::Point{{2 * Lx, 0., 0.}}, 1. );
+    std::vector<int> counts_ref( n_queries, 0 );
+    for ( int q = 0; q < n_queries; ++q )
+        for ( int i = 0; i < n; ++i )
+            if ( DataTransferKit::Details::distance(
+                     within_points[q].first,
+                     {{cloud[i][0], cloud[i][1], cloud[i][2]}} ) <=
+                 within_points[q].second )
+                ++counts_ref[q];
+    TEST_EQUALITY( counts_ref[n_queries - 1], 0 );
+
+    auto const queries = makeWithinQueries<DeviceType>( within_points );
+
+    Kokkos::View<int *, DeviceType> counts( "counts" );
+    tree.count( queries, counts );
+    auto counts_host = Kokkos::create_mirror_view( counts );
+    Kokkos::deep_copy( counts_host, counts );
+    TEST_COMPARE_ARRAYS( counts_host, counts_ref );
+
+    Kokkos::View<bool *, DeviceType> hits( "hits" );
+    tree.any( queries, hits );
+    auto hits_host = Kokkos::create_mirror_view( hits );
+    Kokkos::deep_copy( hits_host, hits );
+    TEST_EQUALITY( hits_host.extent_int( 0 ), n_queries );
+    for ( int q = 0; q < n_queries; ++q )
+        TEST_EQUALITY( hits_host( q ), counts_ref[q] > 0 );
+
+    // no query at all
+    tree.count( makeWithinQueries<DeviceType>( {} ), counts );
+    TEST_EQUALITY( counts.extent( 0 ), 0 );
+    tree.any( makeWithinQueries<DeviceType>( {} ), hits );
+    TEST_EQUALITY( hits.extent( 0 ), 0 );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree, nearest_within_radius,
+                                   DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // Same random cloud on all processes, the i-th point lives on rank
+    // i % comm_size.
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 100 * comm_size;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, n, 0 );
+    DataTransferKit::DistributedSearchTree<DeviceType> const tree(
+        comm, makeStridedBoxes<DeviceType>( comm, cloud ) );
+
+    // some radii are small enough that fewer than k neighbors are found
+    int const n_queries = 20;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::tuple<DataTransferKit::Point, int, double>>
+        nearest_within_points;
+    std::vector<std::vector<double>> distances_ref( n_queries );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        DataTransferKit::Point const p = {
+            {points[q][0], points[q][1], points[q][2]}};
+        int const k = 1 + q % 10;
+        double const r = 0.2 * q;
+        nearest_within_points.emplace_back( p, k, r );
+        for ( int i = 0; i < n; ++i )
+        {
+            double const d = DataTransferKit::Details::distance(
+                p, {{cloud[i][0], cloud[i][1], cloud[i][2]}} );
+            if ( d <= r )
+                distances_ref[q].push_back( d );
+        }
+        std::sort( distances_ref[q].begin(), distances_ref[q].end() );
+        if ( (int)distances_ref[q].size() > k )
+            distances_ref[q].resize( k );
+    }
+
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> ranks( "ranks" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    tree.query( makeNearestWithinQueries<DeviceType>( nearest_within_points ),
+                indices, offset, ranks, distances );
+
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        TEST_EQUALITY( offset_host( q + 1 ) - offset_host( q ),
+                       (int)distances_ref[q].size() );
+        TEST_COMPARE_FLOATING_ARRAYS(
+            extractAndSort( distances_host, offset_host( q ),
+                            offset_host( q + 1 ) ),
+            distances_ref[q], 1e-14 );
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree,
+                                   spatial_query_with_distances, DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // Same random cloud on all processes, the i-th point lives on rank
+    // i % comm_size.
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 100 * comm_size;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, n, 0 );
+    DataTransferKit::DistributedSearchTree<DeviceType> const tree(
+        comm, makeStridedBoxes<DeviceType>( comm, cloud ) );
+
+    int const n_queries = 20;
+    int const m = 3;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::vector<double>> distances_ref( n_queries );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        DataTransferKit::Point const p = {
+            {points[q][0], points[q][1], points[q][2]}};
+        double const r = 0.2 * q;
+        within_points.emplace_back( p, r );
+        for ( int i = 0; i < n; ++i )
+        {
+            double const d = DataTransferKit::Details::distance(
+                p, {{cloud[i][0], cloud[i][1], cloud[i][2]}} );
+            if ( d <= r )
+                distances_ref[q].push_back( d );
+        }
+        std::sort( distances_ref[q].begin(), distances_ref[q].end() );
+    }
+    auto const queries = makeWithinQueries<DeviceType>( within_points );
+
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> ranks( "ranks" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+
+    // sorted by ascending distance
+    tree.query( queries, indices, offset, ranks, distances, true );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+    TEST_EQUALITY( ranks.extent( 0 ), distances.extent( 0 ) );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        std::vector<double> d( distances_host.data() + offset_host( q ),
+                               distances_host.data() + offset_host( q + 1 ) );
+        TEST_COMPARE_FLOATING_ARRAYS( d, distances_ref[q], 1e-14 );
+    }
+
+    // only the m closest objects across all processes are kept
+    tree.query( queries, indices, offset, ranks, distances, false, m );
+    Kokkos::deep_copy( offset_host, offset );
+    auto indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( indices_host, indices );
+    auto ranks_host = Kokkos::create_mirror_view( ranks );
+    Kokkos::deep_copy( ranks_host, ranks );
+    distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        if ( (int)distances_ref[q].size() > m )
+            distances_ref[q].resize( m );
+        std::vector<double> d( distances_host.data() + offset_host( q ),
+                               distances_host.data() + offset_host( q + 1 ) );
+        TEST_COMPARE_FLOATING_ARRAYS( d, distances_ref[q], 1e-14 );
+        for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+        {
+            auto const &p =
+                cloud[indices_host( j ) * comm_size + ranks_host( j )];
+            TEST_FLOATING_EQUALITY(
+                DataTransferKit::Details::distance(
+                    within_points[q].first, {{p[0], p[1], p[2]}} ),
+                distances_host( j ), 1e-14 );
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree, all_nearest,
+                                   DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // Same random cloud on all processes, the i-th point lives on rank
+    // i % comm_size.
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 100 * comm_size;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, n, 0 );
+    auto const boxes = makeStridedBoxes<DeviceType>( comm, cloud );
+    DataTransferKit::DistributedSearchTree<DeviceType> const tree( comm,
+                                                                  boxes );
+
+    int const k = 5;
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> ranks( "ranks" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    tree.allNearest( k, indices, offset, ranks, distances );
+
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    auto indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( indices_host, indices );
+    auto ranks_host = Kokkos::create_mirror_view( ranks );
+    Kokkos::deep_copy( ranks_host, ranks );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+
+    int const n_local = boxes.extent_int( 0 );
+    TEST_EQUALITY( offset.extent_int( 0 ), n_local + 1 );
+    for ( int i = 0; i < n_local; ++i )
+    {
+        int const self = i * comm_size + comm_rank;
+        DataTransferKit::Point const p = {
+            {cloud[self][0], cloud[self][1], cloud[self][2]}};
+        std::vector<double> distances_ref;
+        for ( int j = 0; j < n; ++j )
+            if ( j != self )
+                distances_ref.push_back( DataTransferKit::Details::distance(
+                    p, {{cloud[j][0], cloud[j][1], cloud[j][2]}} ) );
+        std::sort( distances_ref.begin(), distances_ref.end() );
+        distances_ref.resize( k );
+
+        std::vector<double> d( distances_host.data() + offset_host( i ),
+                               distances_host.data() + offset_host( i + 1 ) );
+        TEST_COMPARE_FLOATING_ARRAYS( d, distances_ref, 1e-14 );
+        for ( int j = offset_host( i ); j < offset_host( i + 1 ); ++j )
+        {
+            int const other = indices_host( j ) * comm_size + ranks_host( j );
+            TEST_INEQUALITY( other, self );
+            TEST_FLOATING_EQUALITY(
+                DataTransferKit::Details::distance(
+                    p, {{cloud[other][0], cloud[other][1], cloud[other][2]}} ),
+                distances_host( j ), 1e-14 );
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree, repartitioned_tree,
+                                   DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // All the points are passed in on rank 0.  The results must refer to
+    // them by their index on that rank after they were redistributed.
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 100 * comm_size;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, n, 0 );
+    int const n_local = ( comm_rank == 0 ) ? n : 0;
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes",
+                                                            n_local );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n_local; ++i )
+    {
+        DataTransferKit::Point const p = {
+            {cloud[i][0], cloud[i][1], cloud[i][2]}};
+        boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( boxes, boxes_host );
+
+    int const n_queries = 20;
+    int const k = 4;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        DataTransferKit::Point const p = {
+            {points[q][0], points[q][1], points[q][2]}};
+        within_points.emplace_back( p, 0.2 * q );
+        nearest_points.emplace_back( p, k );
+    }
+
+    for ( auto curve : {DataTransferKit::SpaceFillingCurve::Morton,
+                        DataTransferKit::SpaceFillingCurve::Hilbert} )
+    {
+        DataTransferKit::DistributedSearchTree<DeviceType> tree( comm, boxes,
+                                                                 curve );
+        TEST_EQUALITY( tree.size(), n );
+
+        Kokkos::View<int *, DeviceType> indices( "indices" );
+        Kokkos::View<int *, DeviceType> offset( "offset" );
+        Kokkos::View<int *, DeviceType> ranks( "ranks" );
+        Kokkos::View<double *, DeviceType> distances( "distances" );
+        for ( bool nearest : {false, true} )
+        {
+            if ( nearest )
+                tree.query( makeNearestQueries<DeviceType>( nearest_points ),
+                            indices, offset, ranks, distances );
+            else
+                tree.query( makeWithinQueries<DeviceType>( within_points ),
+                            indices, offset, ranks, distances, true );
+            auto offset_host = Kokkos::create_mirror_view( offset );
+            Kokkos::deep_copy( offset_host, offset );
+            auto indices_host = Kokkos::create_mirror_view( indices );
+            Kokkos::deep_copy( indices_host, indices );
+            auto ranks_host = Kokkos::create_mirror_view( ranks );
+            Kokkos::deep_copy( ranks_host, ranks );
+            auto distances_host = Kokkos::create_mirror_view( distances );
+            Kokkos::deep_copy( distances_host, distances );
+            for ( int q = 0; q < n_queries; ++q )
+            {
+                DataTransferKit::Point const &p = within_points[q].first;
+                std::vector<double> distances_ref;
+                for ( int i = 0; i < n; ++i )
+                {
+                    double const d = DataTransferKit::Details::distance(
+                        p, {{cloud[i][0], cloud[i][1], cloud[i][2]}} );
+                    if ( nearest || d <= within_points[q].second )
+                        distances_ref.push_back( d );
+                }
+                std::sort( distances_ref.begin(), distances_ref.end() );
+                if ( nearest )
+                    distances_ref.resize( k );
+                TEST_COMPARE_FLOATING_ARRAYS(
+                    extractAndSort( distances_host, offset_host( q ),
+                                    offset_host( q + 1 ) ),
+                    distances_ref, 1e-14 );
+                for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+                {
+                    TEST_EQUALITY( ranks_host( j ), 0 );
+                    auto const &c = cloud[indices_host( j )];
+                    TEST_FLOATING_EQUALITY(
+                        DataTransferKit::Details::distance(
+                            p, {{c[0], c[1], c[2]}} ),
+                        distances_host( j ), 1e-14 );
+                }
+            }
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree,
+                                   processes_grouped_in_nodes, DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // Same random cloud on all processes, the i-th point lives on rank
+    // i % comm_size.
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 100 * comm_size;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, n, 0 );
+    auto const boxes = makeStridedBoxes<DeviceType>( comm, cloud );
+    int const n_local = boxes.extent_int( 0 );
+    auto const distanceTo = [&]( DataTransferKit::Point const &p, int i ) {
+        return DataTransferKit::Details::distance(
+            p, {{cloud[i][0], cloud[i][1], cloud[i][2]}} );
+    };
+
+    int const n_queries = 20;
+    int const k = 5;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    std::vector<std::vector<double>> within_ref( n_queries );
+    std::vector<std::vector<double>> nearest_ref( n_queries );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        DataTransferKit::Point const p = {
+            {points[q][0], points[q][1], points[q][2]}};
+        within_points.emplace_back( p, 0.2 * q );
+        nearest_points.emplace_back( p, k );
+        for ( int i = 0; i < n; ++i )
+        {
+            double const d = distanceTo( p, i );
+            if ( d <= 0.2 * q )
+                within_ref[q].push_back( d );
+            nearest_ref[q].push_back( d );
+        }
+        std::sort( within_ref[q].begin(), within_ref[q].end() );
+        std::sort( nearest_ref[q].begin(), nearest_ref[q].end() );
+        nearest_ref[q].resize( k );
+    }
+    auto const within_queries = makeWithinQueries<DeviceType>( within_points );
+    auto const nearest_queries =
+        makeNearestQueries<DeviceType>( nearest_points );
+
+    // The nodes are the processes sharing memory with 0.  Otherwise, the last
+    // node may have fewer processes than the others.
+    for ( int ranks_per_node : {0, 2, 3, comm_size + 1} )
+    {
+        DataTransferKit::DistributedSearchTree<DeviceType> tree(
+            comm, boxes, 2, ranks_per_node );
+        TEST_EQUALITY( tree.size(), n );
+
+        Kokkos::View<int *, DeviceType> indices( "indices" );
+        Kokkos::View<int *, DeviceType> offset( "offset" );
+        Kokkos::View<int *, DeviceType> ranks( "ranks" );
+        Kokkos::View<double *, DeviceType> distances( "distances" );
+        for ( bool nearest : {false, true} )
+        {
+            if ( nearest )
+                tree.query( nearest_queries, indices, offset, ranks,
+                            distances );
+            else
+                tree.query( within_queries, indices, offset, ranks, distances,
+                            true );
+            auto offset_host = Kokkos::create_mirror_view( offset );
+            Kokkos::deep_copy( offset_host, offset );
+            auto indices_host = Kokkos::create_mirror_view( indices );
+            Kokkos::deep_copy( indices_host, indices );
+            auto ranks_host = Kokkos::create_mirror_view( ranks );
+            Kokkos::deep_copy( ranks_host, ranks );
+            auto distances_host = Kokkos::create_mirror_view( distances );
+            Kokkos::deep_copy( distances_host, distances );
+            for ( int q = 0; q < n_queries; ++q )
+            {
+                TEST_COMPARE_FLOATING_ARRAYS(
+                    extractAndSort( distances_host, offset_host( q ),
+                                    offset_host( q + 1 ) ),
+                    nearest ? nearest_ref[q] : within_ref[q], 1e-14 );
+                for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+                    TEST_FLOATING_EQUALITY(
+                        distanceTo( within_points[q].first,
+                                    indices_host( j ) * comm_size +
+                                        ranks_host( j ) ),
+                        distances_host( j ), 1e-14 );
+            }
+        }
+
+        Kokkos::View<int *, DeviceType> counts( "counts" );
+        tree.count( within_queries, counts );
+        auto counts_host = Kokkos::create_mirror_view( counts );
+        Kokkos::deep_copy( counts_host, counts );
+        for ( int q = 0; q < n_queries; ++q )
+            TEST_EQUALITY( counts_host( q ), (int)within_ref[q].size() );
+
+        tree.allNearest( k, indices, offset, ranks, distances );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        auto distances_host = Kokkos::create_mirror_view( distances );
+        Kokkos::deep_copy( distances_host, distances );
+        TEST_EQUALITY( offset.extent_int( 0 ), n_local + 1 );
+        for ( int i = 0; i < n_local; ++i )
+        {
+            int const self = i * comm_size + comm_rank;
+            DataTransferKit::Point const p = {
+                {cloud[self][0], cloud[self][1], cloud[self][2]}};
+            std::vector<double> distances_ref;
+            for ( int j = 0; j < n; ++j )
+                if ( j != self )
+                    distances_ref.push_back( distanceTo( p, j ) );
+            std::sort( distances_ref.begin(), distances_ref.end() );
+            distances_ref.resize( k );
+            std::vector<double> d(
+                distances_host.data() + offset_host( i ),
+                distances_host.data() + offset_host( i + 1 ) );
+            TEST_COMPARE_FLOATING_ARRAYS( d, distances_ref, 1e-14 );
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree,
+                                   single_precision_distances, DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // Every process holds a random cloud of points spanning the same region
+    // so that the queries find objects on all of them.
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 50;
+    std::vector<std::vector<std::array<double, 3>>> clouds;
+    for ( int r = 0; r < comm_size; ++r )
+        clouds.push_back( make_random_cloud( Lx, Ly, Lz, n, r ) );
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes", n );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n; ++i )
+    {
+        auto const &c = clouds[comm_rank][i];
+        DataTransferKit::Point const p = {{c[0], c[1], c[2]}};
+        boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( boxes, boxes_host );
+
+    int const n_queries = 20;
+    int const k = 5;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        DataTransferKit::Point const p = {
+            {points[q][0], points[q][1], points[q][2]}};
+        within_points.emplace_back( p, 0.2 * q );
+        nearest_points.emplace_back( p, k );
+    }
+
+    DataTransferKit::DistributedSearchTree<DeviceType> tree( comm, boxes );
+    tree.allowSinglePrecisionDistances();
+
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> ranks( "ranks" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    for ( bool nearest : {false, true} )
+    {
+        if ( nearest )
+            tree.query( makeNearestQueries<DeviceType>( nearest_points ),
+                        indices, offset, ranks, distances );
+        else
+            tree.query( makeWithinQueries<DeviceType>( within_points ),
+                        indices, offset, ranks, distances );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        auto indices_host = Kokkos::create_mirror_view( indices );
+        Kokkos::deep_copy( indices_host, indices );
+        auto ranks_host = Kokkos::create_mirror_view( ranks );
+        Kokkos::deep_copy( ranks_host, ranks );
+        auto distances_host = Kokkos::create_mirror_view( distances );
+        Kokkos::deep_copy( distances_host, distances );
+        for ( int q = 0; q < n_queries; ++q )
+        {
+            DataTransferKit::Point const &p = within_points[q].first;
+            std::vector<double> distances_ref;
+            for ( auto const &cloud : clouds )
+                for ( auto const &c : cloud )
+                {
+                    double const d = DataTransferKit::Details::distance(
+                        p, {{c[0], c[1], c[2]}} );
+                    if ( nearest || d <= within_points[q].second )
+                        distances_ref.push_back( d );
+                }
+            std::sort( distances_ref.begin(), distances_ref.end() );
+            if ( nearest )
+                distances_ref.resize( k );
+            TEST_COMPARE_FLOATING_ARRAYS(
+                extractAndSort( distances_host, offset_host( q ),
+                                offset_host( q + 1 ) ),
+                distances_ref, 1e-6 );
+            // The ranks are not sent but must still be reported.
+            for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+            {
+                int const r = ranks_host( j );
+                TEST_ASSERT( 0 <= r && r < comm_size );
+                auto const &c = clouds[r][indices_host( j )];
+                TEST_FLOATING_EQUALITY(
+                    DataTransferKit::Details::distance(
+                        p, {{c[0], c[1], c[2]}} ),
+                    distances_host( j ), 1e-6 );
+            }
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree, chunked_query,
+                                   DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 100;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, n, comm_rank );
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes", n );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n; ++i )
+    {
+        DataTransferKit::Point const p = {
+            {cloud[i][0], cloud[i][1], cloud[i][2]}};
+        boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( boxes, boxes_host );
+    DataTransferKit::DistributedSearchTree<DeviceType> tree( comm, boxes );
+
+    // Some processes have more queries than others, so that they go
+    // through empty chunks.
+    int const n_queries = 10 + 7 * comm_rank;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    for ( int q = 0; q < n_queries; ++q )
+        within_points.emplace_back(
+            DataTransferKit::Point{{points[q][0], points[q][1], points[q][2]}},
+            0.3 * ( q % 7 ) );
+    auto const queries = makeWithinQueries<DeviceType>( within_points );
+
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> ranks( "ranks" );
+    tree.query( queries, indices, offset, ranks );
+    auto indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( indices_host, indices );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    auto ranks_host = Kokkos::create_mirror_view( ranks );
+    Kokkos::deep_copy( ranks_host, ranks );
+    std::vector<std::vector<std::pair<int, int>>> results_ref( n_queries );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+            results_ref[q].emplace_back( ranks_host( j ), indices_host( j ) );
+        std::sort( results_ref[q].begin(), results_ref[q].end() );
+    }
+
+    // Pairs of maximum numbers of results per chunk and of queries per window
+    std::vector<std::pair<std::size_t, std::size_t>> const sizes = {
+        {0, 1}, {1, 1000000}, {20, 7}, {20, 1000000}, {1000000, 3}};
+    for ( auto const &size : sizes )
+    {
+        std::size_t const max_chunk_size = size.first;
+        std::size_t const max_window_size = size.second;
+        std::vector<std::vector<std::pair<int, int>>> results( n_queries );
+        int next = 0;
+        tree.chunkedQuery(
+            queries, max_chunk_size, max_window_size,
+            [&]( int first, Kokkos::View<int *, DeviceType> chunk_indices,
+                 Kokkos::View<int *, DeviceType> chunk_offset,
+                 Kokkos::View<int *, DeviceType> chunk_ranks ) {
+                TEST_EQUALITY( first, next );
+                auto indices_host = Kokkos::create_mirror_view( chunk_indices );
+                Kokkos::deep_copy( indices_host, chunk_indices );
+                auto offset_host = Kokkos::create_mirror_view( chunk_offset );
+                Kokkos::deep_copy( offset_host, chunk_offset );
+                auto ranks_host = Kokkos::create_mirror_view( chunk_ranks );
+                Kokkos::deep_copy( ranks_host, chunk_ranks );
+                int const n_chunk_queries = chunk_offset.extent_int( 0 ) - 1;
+                TEST_ASSERT( n_chunk_queries == 1 ||
+                             static_cast<std::size_t>( offset_host(
+                                 n_chunk_queries ) ) <= max_chunk_size );
+                for ( int q = 0; q < n_chunk_queries; ++q )
+                    for ( int j = offset_host( q ); j < offset_host( q + 1 );
+                          ++j )
+                        results[first + q].emplace_back( ranks_host( j ),
+                                                         indices_host( j ) );
+                next = first + n_chunk_queries;
+            } );
+        TEST_EQUALITY( next, n_queries );
+        for ( int q = 0; q < n_queries; ++q )
+        {
+            std::sort( results[q].begin(), results[q].end() );
+            TEST_ASSERT( results[q] == results_ref[q] );
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree,
+                                   source_and_target_groups, DeviceType )
+{
+    Teuchos::RCP<const Teuchos::Comm<int>> comm =
+        Teuchos::DefaultComm<int>::getComm();
+    int const comm_rank = Teuchos::rank( *comm );
+    int const comm_size = Teuchos::size( *comm );
+
+    // The roles alternate between both, source only, and target only.
+    using DataTransferKit::ProcessRole;
+    auto const role = []( int rank ) {
+        return std::array<ProcessRole, 3>{{ProcessRole::SourceAndTarget,
+                                           ProcessRole::Source,
+                                           ProcessRole::Target}}[rank % 3];
+    };
+    bool const is_target = ( role( comm_rank ) != ProcessRole::Source );
+
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    int const n = 50;
+    std::vector<std::vector<std::array<double, 3>>> clouds( comm_size );
+    for ( int r = 0; r < comm_size; ++r )
+        if ( role( r ) != ProcessRole::Target )
+            clouds[r] = make_random_cloud( Lx, Ly, Lz, n, r );
+    int const n_local = clouds[comm_rank].size();
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes",
+                                                            n_local );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n_local; ++i )
+    {
+        auto const &c = clouds[comm_rank][i];
+        DataTransferKit::Point const p = {{c[0], c[1], c[2]}};
+        boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( boxes, boxes_host );
+
+    DataTransferKit::DistributedSearchTree<DeviceType> tree(
+        comm, boxes, role( comm_rank ) );
+    int n_sources = 0;
+    for ( int r = 0; r < comm_size; ++r )
+        if ( role( r ) != ProcessRole::Target )
+            ++n_sources;
+    TEST_EQUALITY( tree.size(), n * n_sources );
+
+    // Only the targets issue queries.
+    int const n_queries = is_target ? 20 : 0;
+    int const k = 3;
+    auto const points =
+        make_random_cloud( Lx, Ly, Lz, n_queries, 1234 + comm_rank );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        DataTransferKit::Point const p = {
+            {points[q][0], points[q][1], points[q][2]}};
+        within_points.emplace_back( p, 0.2 * q );
+        nearest_points.emplace_back( p, k );
+    }
+
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> ranks( "ranks" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    for ( bool nearest : {false, true} )
+    {
+        if ( nearest )
+            tree.query( makeNearestQueries<DeviceType>( nearest_points ),
+                        indices, offset, ranks, distances );
+        else
+            tree.query( makeWithinQueries<DeviceType>( within_points ),
+                        indices, offset, ranks, distances );
+        TEST_EQUALITY( offset.extent_int( 0 ), n_queries + 1 );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        auto indices_host = Kokkos::create_mirror_view( indices );
+        Kokkos::deep_copy( indices_host, indices );
+        auto ranks_host = Kokkos::create_mirror_view( ranks );
+        Kokkos::deep_copy( ranks_host, ranks );
+        auto distances_host = Kokkos::create_mirror_view( distances );
+        Kokkos::deep_copy( distances_host, distances );
+        for ( int q = 0; q < n_queries; ++q )
+        {
+            DataTransferKit::Point const &p = within_points[q].first;
+            std::vector<double> distances_ref;
+            for ( auto const &cloud : clouds )
+                for ( auto const &c : cloud )
+                {
+                    double const d = DataTransferKit::Details::distance(
+                        p, {{c[0], c[1], c[2]}} );
+                    if ( nearest || d <= within_points[q].second )
+                        distances_ref.push_back( d );
+                }
+            std::sort( distances_ref.begin(), distances_ref.end() );
+            if ( nearest && (int)distances_ref.size() > k )
+                distances_ref.resize( k );
+            TEST_COMPARE_FLOATING_ARRAYS(
+                extractAndSort( distances_host, offset_host( q ),
+                                offset_host( q + 1 ) ),
+                distances_ref, 1e-14 );
+            for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+            {
+                int const r = ranks_host( j );
+                TEST_ASSERT( role( r ) != ProcessRole::Target );
+                auto const &c = clouds[r][indices_host( j )];
+                TEST_FLOATING_EQUALITY(
+                    DataTransferKit::Details::distance(
+                        p, {{c[0], c[1], c[2]}} ),
+                    distances_host( j ), 1e-14 );
+            }
+        }
+    }
+}
+
 // Include the test macros.
 #include "DataTransferKitSearch_ETIHelperMacros.h"
 
@@ -553,7 +1457,34 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( DistributedSearchTree, boost_comparison,
                                           non_approximate_nearest_neighbors,   \
                                           DeviceType##NODE )                   \
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
-                                          boost_comparison, DeviceType##NODE )
+                                          boost_comparison, DeviceType##NODE ) \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          approximate_nearest_neighbors,       \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          count_and_any, DeviceType##NODE )    \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          nearest_within_radius,               \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          spatial_query_with_distances,        \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree, all_nearest,  \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          repartitioned_tree,                  \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          processes_grouped_in_nodes,          \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          single_precision_distances,          \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          chunked_query, DeviceType##NODE )    \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( DistributedSearchTree,               \
+                                          source_and_target_groups,            \
+                                          DeviceType##NODE )
 
 // Demangle the types
 DTK_ETI_MANGLING_TYPEDEFS()
@@ -676,6 +676,896 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, rtree, DeviceType )
     validateResults( rtree_results, bvh_results, success, out );
 }
 
+template <typename BoundingVolume>
+BoundingVolume makeBoundingVolume( DataTransferKit::Point const &point )
+{
+    BoundingVolume bounding_volume;
+    DataTransferKit::Details::expand( bounding_volume, point );
+    return bounding_volume;
+}
+
+// a default-constructed sphere is centered at the origin and expanding it
+// would enclose the origin as well
+template <>
+DataTransferKit::Sphere makeBoundingVolume<DataTransferKit::Sphere>(
+    DataTransferKit::Point const &point )
+{
+    return DataTransferKit::Sphere( point, 0. );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+DataTransferKit::BVH<DeviceType, BoundingVolume>
+makeBvhOfPoints( std::vector<std::array<double, 3>> const &cloud )
+{
+    int const n = cloud.size();
+    Kokkos::View<BoundingVolume *, DeviceType> bounding_volumes(
+        "bounding_volumes", n );
+    auto bounding_volumes_host = Kokkos::create_mirror_view( bounding_volumes );
+    for ( int i = 0; i < n; ++i )
+        bounding_volumes_host( i ) = makeBoundingVolume<BoundingVolume>(
+            {{cloud[i][0], cloud[i][1], cloud[i][2]}} );
+    Kokkos::deep_copy( bounding_volumes, bounding_volumes_host );
+    return DataTransferKit::BVH<DeviceType, BoundingVolume>(
+        bounding_volumes );
+}
+
+template <typename DeviceType, typename BoundingVolume>
+void checkBoundingVolume(
+    std::vector<std::array<double, 3>> const &cloud,
+    Kokkos::View<DataTransferKit::Within *, DeviceType> within_queries,
+    Kokkos::View<DataTransferKit::Nearest<DataTransferKit::Point> *,
+                 DeviceType>
+        nearest_queries,
+    bool &success, Teuchos::FancyOStream &out )
+{
+    auto const reference_bvh =
+        makeBvhOfPoints<DeviceType, DataTransferKit::Box>( cloud );
+    auto const bvh = makeBvhOfPoints<DeviceType, BoundingVolume>( cloud );
+
+    Kokkos::View<int *, DeviceType> offset_ref( "offset_ref" );
+    Kokkos::View<int *, DeviceType> indices_ref( "indices_ref" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+
+    reference_bvh.query( within_queries, indices_ref, offset_ref );
+    bvh.query( within_queries, indices, offset );
+    validateResults( std::make_tuple( offset_ref, indices_ref ),
+                     std::make_tuple( offset, indices ), success, out );
+
+    // points are randomly distributed so there should not be any tie and the
+    // nearest neighbors must match exactly
+    Kokkos::View<double *, DeviceType> distances_ref( "distances_ref" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    reference_bvh.query( nearest_queries, indices_ref, offset_ref,
+                         distances_ref );
+    bvh.query( nearest_queries, indices, offset, distances );
+    auto indices_ref_host = Kokkos::create_mirror_view( indices_ref );
+    Kokkos::deep_copy( indices_ref_host, indices_ref );
+    auto indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( indices_host, indices );
+    TEST_COMPARE_ARRAYS( indices_host, indices_ref_host );
+    auto distances_ref_host = Kokkos::create_mirror_view( distances_ref );
+    Kokkos::deep_copy( distances_ref_host, distances_ref );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+    TEST_COMPARE_FLOATING_ARRAYS( distances_host, distances_ref_host, 1e-14 );
+
+    // the root bounding volume must enclose every object
+    auto const root = bvh.bounds();
+    for ( auto const &point : cloud )
+        TEST_COMPARE( DataTransferKit::Details::distance(
+                          {{point[0], point[1], point[2]}}, root ),
+                      <, 1e-12 );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, bounding_volumes, DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+
+    int const n_queries = 100;
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    for ( int i = 0; i < n_queries; ++i )
+    {
+        DataTransferKit::Point const p = {
+            {points[i][0], points[i][1], points[i][2]}};
+        within_points.emplace_back( p, 0.5 + 0.02 * i );
+        nearest_points.emplace_back( p, 1 + i % 10 );
+    }
+    auto const within_queries = makeWithinQueries<DeviceType>( within_points );
+    auto const nearest_queries =
+        makeNearestQueries<DeviceType>( nearest_points );
+
+    checkBoundingVolume<DeviceType, DataTransferKit::Sphere>(
+        cloud, within_queries, nearest_queries, success, out );
+    checkBoundingVolume<DeviceType, DataTransferKit::KDOP<14>>(
+        cloud, within_queries, nearest_queries, success, out );
+    checkBoundingVolume<DeviceType, DataTransferKit::KDOP<18>>(
+        cloud, within_queries, nearest_queries, success, out );
+    checkBoundingVolume<DeviceType, DataTransferKit::KDOP<26>>(
+        cloud, within_queries, nearest_queries, success, out );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, asynchronous, DeviceType )
+{
+    using ExecutionSpace = typename DeviceType::execution_space;
+
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    int const n = cloud.size();
+    Kokkos::View<DataTransferKit::Box *, DeviceType> bounding_boxes(
+        "bounding_boxes", n );
+    auto bounding_boxes_host = Kokkos::create_mirror_view( bounding_boxes );
+    for ( int i = 0; i < n; ++i )
+    {
+        DataTransferKit::Point const p = {{cloud[i][0], cloud[i][1],
+                                           cloud[i][2]}};
+        bounding_boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( bounding_boxes, bounding_boxes_host );
+
+    int const n_queries = 100;
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    for ( int i = 0; i < n_queries; ++i )
+    {
+        DataTransferKit::Point const p = {
+            {points[i][0], points[i][1], points[i][2]}};
+        within_points.emplace_back( p, 1. );
+        // ask for more neighbors than there are leaves for some queries
+        nearest_points.emplace_back( p, i % 2 == 0 ? 5 : n + 1 );
+    }
+    auto const within_queries = makeWithinQueries<DeviceType>( within_points );
+    auto const nearest_queries =
+        makeNearestQueries<DeviceType>( nearest_points );
+
+    // reference results with the blocking interface
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+    Kokkos::View<int *, DeviceType> offset_ref( "offset_ref" );
+    Kokkos::View<int *, DeviceType> indices_ref( "indices_ref" );
+    bvh.query( within_queries, indices_ref, offset_ref );
+
+    // construction and query enqueued on the same execution space instance
+    ExecutionSpace space;
+    DataTransferKit::BVH<DeviceType> const async_bvh( space, bounding_boxes );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    async_bvh.query( space, within_queries, indices, offset ).wait();
+    validateResults( std::make_tuple( offset_ref, indices_ref ),
+                     std::make_tuple( offset, indices ), success, out );
+
+    Kokkos::View<double *, DeviceType> distances_ref( "distances_ref" );
+    bvh.query( nearest_queries, indices_ref, offset_ref, distances_ref );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    auto future =
+        async_bvh.query( space, nearest_queries, indices, offset, distances );
+    future.wait();
+    validateResults( std::make_tuple( offset_ref, indices_ref ),
+                     std::make_tuple( offset, indices ), success, out );
+    auto distances_ref_host = Kokkos::create_mirror_view( distances_ref );
+    Kokkos::deep_copy( distances_ref_host, distances_ref );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+    TEST_COMPARE_FLOATING_ARRAYS( distances_host, distances_ref_host, 1e-14 );
+}
+
+template <typename DeviceType>
+Kokkos::View<DataTransferKit::Box *, DeviceType>
+makeBoundingBoxesOfPoints( std::vector<std::array<double, 3>> const &cloud )
+{
+    int const n = cloud.size();
+    Kokkos::View<DataTransferKit::Box *, DeviceType> bounding_boxes(
+        "bounding_boxes", n );
+    auto bounding_boxes_host = Kokkos::create_mirror_view( bounding_boxes );
+    for ( int i = 0; i < n; ++i )
+    {
+        DataTransferKit::Point const p = {{cloud[i][0], cloud[i][1],
+                                           cloud[i][2]}};
+        bounding_boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( bounding_boxes, bounding_boxes_host );
+    return bounding_boxes;
+}
+
+template <typename DeviceType>
+std::tuple<
+    Kokkos::View<DataTransferKit::Within *, DeviceType>,
+    Kokkos::View<DataTransferKit::Nearest<DataTransferKit::Point> *,
+                 DeviceType>>
+makeRandomQueries( double Lx, double Ly, double Lz, int n_queries )
+{
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    for ( int i = 0; i < n_queries; ++i )
+    {
+        DataTransferKit::Point const p = {
+            {points[i][0], points[i][1], points[i][2]}};
+        within_points.emplace_back( p, 0.5 + 0.02 * i );
+        nearest_points.emplace_back( p, 1 + i % 10 );
+    }
+    return std::make_tuple( makeWithinQueries<DeviceType>( within_points ),
+                            makeNearestQueries<DeviceType>( nearest_points ) );
+}
+
+// Checks that two trees built over the same objects return the same results.
+template <typename DeviceType>
+void checkSameResults(
+    DataTransferKit::BVH<DeviceType> const &bvh_ref,
+    DataTransferKit::BVH<DeviceType> const &bvh,
+    Kokkos::View<DataTransferKit::Within *, DeviceType> within_queries,
+    Kokkos::View<DataTransferKit::Nearest<DataTransferKit::Point> *,
+                 DeviceType>
+        nearest_queries,
+    bool &success, Teuchos::FancyOStream &out )
+{
+    TEST_EQUALITY( bvh.size(), bvh_ref.size() );
+    TEST_ASSERT(
+        DataTransferKit::Details::equals( bvh.bounds(), bvh_ref.bounds() ) );
+
+    Kokkos::View<int *, DeviceType> offset_ref( "offset_ref" );
+    Kokkos::View<int *, DeviceType> indices_ref( "indices_ref" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    bvh_ref.query( within_queries, indices_ref, offset_ref );
+    bvh.query( within_queries, indices, offset );
+    validateResults( std::make_tuple( offset_ref, indices_ref ),
+                     std::make_tuple( offset, indices ), success, out );
+
+    // Compare distances rather than indices since ties between duplicated
+    // points may be broken differently.
+    Kokkos::View<double *, DeviceType> distances_ref( "distances_ref" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    bvh_ref.query( nearest_queries, indices_ref, offset_ref, distances_ref );
+    bvh.query( nearest_queries, indices, offset, distances );
+    auto offset_ref_host = Kokkos::create_mirror_view( offset_ref );
+    Kokkos::deep_copy( offset_ref_host, offset_ref );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    TEST_COMPARE_ARRAYS( offset_host, offset_ref_host );
+    auto distances_ref_host = Kokkos::create_mirror_view( distances_ref );
+    Kokkos::deep_copy( distances_ref_host, distances_ref );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+    TEST_COMPARE_FLOATING_ARRAYS( distances_host, distances_ref_host, 1e-14 );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, binned_sah, DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    // Mix a clustered cloud with a coarse uniform one and duplicate some of
+    // the points to exercise the fallback when centroids coincide.
+    auto cloud = make_random_cloud( .1 * Lx, .1 * Ly, .1 * Lz, 800 );
+    auto const coarse_cloud = make_random_cloud( Lx, Ly, Lz, 200 );
+    cloud.insert( cloud.end(), coarse_cloud.begin(), coarse_cloud.end() );
+    cloud.insert( cloud.end(), 50, coarse_cloud[0] );
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+    DataTransferKit::BVH<DeviceType> const sah_bvh(
+        bounding_boxes, DataTransferKit::BVHConstruction::BinnedSAH );
+
+    auto const queries = makeRandomQueries<DeviceType>( Lx, Ly, Lz, 100 );
+    checkSameResults( bvh, sah_bvh, std::get<0>( queries ),
+                      std::get<1>( queries ), success, out );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, hilbert_curve, DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    cloud.insert( cloud.end(), 50, cloud[0] );
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+    DataTransferKit::BVH<DeviceType> const hilbert_bvh(
+        bounding_boxes, DataTransferKit::BVHConstruction::Karras,
+        DataTransferKit::SpaceFillingCurve::Hilbert );
+
+    auto const queries = makeRandomQueries<DeviceType>( Lx, Ly, Lz, 100 );
+    checkSameResults( bvh, hilbert_bvh, std::get<0>( queries ),
+                      std::get<1>( queries ), success, out );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, approximate_nearest_neighbors,
+                                   DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    int const n = cloud.size();
+    Kokkos::View<DataTransferKit::Box *, DeviceType> bounding_boxes(
+        "bounding_boxes", n );
+    auto bounding_boxes_host = Kokkos::create_mirror_view( bounding_boxes );
+    for ( int i = 0; i < n; ++i )
+    {
+        DataTransferKit::Point const p = {{cloud[i][0], cloud[i][1],
+                                           cloud[i][2]}};
+        bounding_boxes_host( i ) = {p, p};
+    }
+    Kokkos::deep_copy( bounding_boxes, bounding_boxes_host );
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+
+    int const n_queries = 100;
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    for ( int i = 0; i < n_queries; ++i )
+        nearest_points.emplace_back(
+            DataTransferKit::Point{{points[i][0], points[i][1], points[i][2]}},
+            1 + i % 10 );
+    auto const exact_queries = makeNearestQueries<DeviceType>( nearest_points );
+
+    Kokkos::View<int *, DeviceType> offset_ref( "offset_ref" );
+    Kokkos::View<int *, DeviceType> indices_ref( "indices_ref" );
+    Kokkos::View<double *, DeviceType> distances_ref( "distances_ref" );
+    bvh.query( exact_queries, indices_ref, offset_ref, distances_ref );
+    auto offset_ref_host = Kokkos::create_mirror_view( offset_ref );
+    Kokkos::deep_copy( offset_ref_host, offset_ref );
+    auto distances_ref_host = Kokkos::create_mirror_view( distances_ref );
+    Kokkos::deep_copy( distances_ref_host, distances_ref );
+
+    for ( double epsilon : {0., .1, 1.} )
+    {
+        auto const queries =
+            makeNearestQueries<DeviceType>( nearest_points, epsilon );
+
+        Kokkos::View<int *, DeviceType> offset( "offset" );
+        Kokkos::View<int *, DeviceType> indices( "indices" );
+        Kokkos::View<double *, DeviceType> distances( "distances" );
+        bvh.query( queries, indices, offset, distances );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        auto distances_host = Kokkos::create_mirror_view( distances );
+        Kokkos::deep_copy( distances_host, distances );
+
+        // same number of neighbors and each of them is within a factor
+        // (1+epsilon) of the exact neighbor of same rank
+        TEST_COMPARE_ARRAYS( offset_host, offset_ref_host );
+        for ( int q = 0; q < n_queries; ++q )
+        {
+            std::vector<double> sorted_distances(
+                distances_host.data() + offset_host( q ),
+                distances_host.data() + offset_host( q + 1 ) );
+            std::sort( sorted_distances.begin(), sorted_distances.end() );
+            for ( int j = 0; j < offset_host( q + 1 ) - offset_host( q ); ++j )
+                TEST_ASSERT( sorted_distances[j] <=
+                             ( 1. + epsilon ) *
+                                 distances_ref_host( offset_host( q ) + j ) );
+        }
+        if ( epsilon == 0. )
+            TEST_COMPARE_ARRAYS( distances_host, distances_ref_host );
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, count_and_any, DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+
+    // add a few queries that do not find anything
+    int const n_queries = 100;
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    for ( int i = 0; i < n_queries; ++i )
+        within_points.emplace_back(
+            DataTransferKit::Point{{points[i][0], points[i][1], points[i][2]}},
+            i % 10 == 0 ? 0. : 0.02 * i );
+    within_points.emplace_back( DataTransferKit::Point{{-Lx, -Ly, -Lz}}, 1. );
+    auto const queries = makeWithinQueries<DeviceType>( within_points );
+
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    bvh.query( queries, indices, offset );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+
+    Kokkos::View<int *, DeviceType> counts( "counts" );
+    bvh.count( queries, counts );
+    auto counts_host = Kokkos::create_mirror_view( counts );
+    Kokkos::deep_copy( counts_host, counts );
+
+    Kokkos::View<bool *, DeviceType> hits( "hits" );
+    bvh.any( queries, hits );
+    auto hits_host = Kokkos::create_mirror_view( hits );
+    Kokkos::deep_copy( hits_host, hits );
+
+    TEST_EQUALITY( counts_host.extent_int( 0 ), n_queries + 1 );
+    TEST_EQUALITY( hits_host.extent_int( 0 ), n_queries + 1 );
+    for ( int i = 0; i < n_queries + 1; ++i )
+    {
+        TEST_EQUALITY( counts_host( i ),
+                       offset_host( i + 1 ) - offset_host( i ) );
+        TEST_EQUALITY( hits_host( i ), counts_host( i ) > 0 );
+    }
+    TEST_ASSERT( !hits_host( n_queries ) );
+
+    // empty tree
+    DataTransferKit::BVH<DeviceType> const empty_bvh{};
+    empty_bvh.count( queries, counts );
+    Kokkos::deep_copy( counts_host, counts );
+    empty_bvh.any( queries, hits );
+    Kokkos::deep_copy( hits_host, hits );
+    for ( int i = 0; i < n_queries + 1; ++i )
+    {
+        TEST_EQUALITY( counts_host( i ), 0 );
+        TEST_ASSERT( !hits_host( i ) );
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, nearest_within_radius,
+                                   DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    int const n = cloud.size();
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+
+    // some radii are small enough that fewer than k neighbors are found
+    int const n_queries = 100;
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::tuple<DataTransferKit::Point, int, double>>
+        nearest_within_points;
+    for ( int i = 0; i < n_queries; ++i )
+        nearest_within_points.emplace_back(
+            DataTransferKit::Point{{points[i][0], points[i][1], points[i][2]}},
+            1 + i % 10, 0.1 * ( i % 20 ) );
+    auto const queries =
+        makeNearestWithinQueries<DeviceType>( nearest_within_points );
+
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    bvh.query( queries, indices, offset, distances );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        auto const &p = std::get<0>( nearest_within_points[q] );
+        int const k = std::get<1>( nearest_within_points[q] );
+        double const r = std::get<2>( nearest_within_points[q] );
+        std::vector<double> distances_ref;
+        for ( int i = 0; i < n; ++i )
+        {
+            double const d = DataTransferKit::Details::distance(
+                p, {{cloud[i][0], cloud[i][1], cloud[i][2]}} );
+            if ( d <= r )
+                distances_ref.push_back( d );
+        }
+        std::sort( distances_ref.begin(), distances_ref.end() );
+        if ( (int)distances_ref.size() > k )
+            distances_ref.resize( k );
+
+        TEST_EQUALITY( offset_host( q + 1 ) - offset_host( q ),
+                       (int)distances_ref.size() );
+        TEST_COMPARE_FLOATING_ARRAYS(
+            extractAndSort( distances_host, offset_host( q ),
+                            offset_host( q + 1 ) ),
+            distances_ref, 1e-14 );
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, spatial_query_with_distances,
+                                   DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    int const n = cloud.size();
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+
+    int const n_queries = 100;
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    for ( int i = 0; i < n_queries; ++i )
+        within_points.emplace_back(
+            DataTransferKit::Point{{points[i][0], points[i][1], points[i][2]}},
+            0.2 * ( i % 10 ) );
+    auto const queries = makeWithinQueries<DeviceType>( within_points );
+
+    std::vector<std::vector<double>> distances_ref( n_queries );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        for ( int i = 0; i < n; ++i )
+        {
+            double const d = DataTransferKit::Details::distance(
+                within_points[q].first,
+                {{cloud[i][0], cloud[i][1], cloud[i][2]}} );
+            if ( d <= within_points[q].second )
+                distances_ref[q].push_back( d );
+        }
+        std::sort( distances_ref[q].begin(), distances_ref[q].end() );
+    }
+
+    // unsorted, the distances match the objects that were found
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    bvh.query( queries, indices, offset, distances );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    auto indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( indices_host, indices );
+    auto distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+    TEST_EQUALITY( indices.extent( 0 ), distances.extent( 0 ) );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        TEST_COMPARE_FLOATING_ARRAYS(
+            extractAndSort( distances_host, offset_host( q ),
+                            offset_host( q + 1 ) ),
+            distances_ref[q], 1e-14 );
+        for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+        {
+            auto const &p = cloud[indices_host( j )];
+            TEST_FLOATING_EQUALITY(
+                DataTransferKit::Details::distance(
+                    within_points[q].first, {{p[0], p[1], p[2]}} ),
+                distances_host( j ), 1e-14 );
+        }
+    }
+
+    // sorted by ascending distance
+    bvh.query( queries, indices, offset, distances, true );
+    Kokkos::deep_copy( offset_host, offset );
+    distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        std::vector<double> d( distances_host.data() + offset_host( q ),
+                               distances_host.data() + offset_host( q + 1 ) );
+        TEST_COMPARE_FLOATING_ARRAYS( d, distances_ref[q], 1e-14 );
+    }
+
+    // only the 3 closest objects are kept
+    int const m = 3;
+    bvh.query( queries, indices, offset, distances, false, m );
+    Kokkos::deep_copy( offset_host, offset );
+    indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( indices_host, indices );
+    distances_host = Kokkos::create_mirror_view( distances );
+    Kokkos::deep_copy( distances_host, distances );
+    TEST_EQUALITY( indices.extent( 0 ), distances.extent( 0 ) );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        if ( (int)distances_ref[q].size() > m )
+            distances_ref[q].resize( m );
+        std::vector<double> d( distances_host.data() + offset_host( q ),
+                               distances_host.data() + offset_host( q + 1 ) );
+        TEST_COMPARE_FLOATING_ARRAYS( d, distances_ref[q], 1e-14 );
+        for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+        {
+            auto const &p = cloud[indices_host( j )];
+            TEST_FLOATING_EQUALITY(
+                DataTransferKit::Details::distance(
+                    within_points[q].first, {{p[0], p[1], p[2]}} ),
+                distances_host( j ), 1e-14 );
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, packet_traversal, DeviceType )
+{
+    using DataTransferKit::QueryTraversal;
+
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+
+    // the last packet is incomplete
+    int const n_queries = 101;
+    auto const queries = makeRandomQueries<DeviceType>( Lx, Ly, Lz, n_queries );
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::tuple<DataTransferKit::Point, int, double>>
+        nearest_within_points;
+    for ( int i = 0; i < n_queries; ++i )
+        nearest_within_points.emplace_back(
+            DataTransferKit::Point{{points[i][0], points[i][1], points[i][2]}},
+            i % 10, 0.1 * ( i % 20 ) );
+    auto const nearest_within_queries =
+        makeNearestWithinQueries<DeviceType>( nearest_within_points );
+
+    Kokkos::View<int *, DeviceType> offset_ref( "offset_ref" );
+    Kokkos::View<int *, DeviceType> indices_ref( "indices_ref" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+
+    bvh.query( std::get<0>( queries ), indices_ref, offset_ref );
+    bvh.query( std::get<0>( queries ), indices, offset,
+               QueryTraversal::Packet );
+    validateResults( std::make_tuple( offset_ref, indices_ref ),
+                     std::make_tuple( offset, indices ), success, out );
+
+    bvh.query( std::get<1>( queries ), indices_ref, offset_ref );
+    bvh.query( std::get<1>( queries ), indices, offset,
+               QueryTraversal::Packet );
+    validateResults( std::make_tuple( offset_ref, indices_ref ),
+                     std::make_tuple( offset, indices ), success, out );
+
+    bvh.query( nearest_within_queries, indices_ref, offset_ref );
+    bvh.query( nearest_within_queries, indices, offset,
+               QueryTraversal::Packet );
+    validateResults( std::make_tuple( offset_ref, indices_ref ),
+                     std::make_tuple( offset, indices ), success, out );
+
+    // the neighbors are sorted by ascending distance
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    auto indices_host = Kokkos::create_mirror_view( indices );
+    Kokkos::deep_copy( indices_host, indices );
+    for ( int q = 0; q < n_queries; ++q )
+    {
+        auto const &p = std::get<0>( nearest_within_points[q] );
+        std::vector<double> d;
+        for ( int j = offset_host( q ); j < offset_host( q + 1 ); ++j )
+        {
+            auto const &c = cloud[indices_host( j )];
+            d.push_back(
+                DataTransferKit::Details::distance( p, {{c[0], c[1], c[2]}} ) );
+        }
+        TEST_ASSERT( std::is_sorted( d.begin(), d.end() ) );
+    }
+
+    // trees with a single leaf or none
+    for ( int n : {0, 1} )
+    {
+        DataTransferKit::BVH<DeviceType> const small_bvh(
+            Kokkos::subview( bounding_boxes, std::make_pair( 0, n ) ) );
+        small_bvh.query( std::get<0>( queries ), indices_ref, offset_ref );
+        small_bvh.query( std::get<0>( queries ), indices, offset,
+                         QueryTraversal::Packet );
+        validateResults( std::make_tuple( offset_ref, indices_ref ),
+                         std::make_tuple( offset, indices ), success, out );
+        small_bvh.query( nearest_within_queries, indices_ref, offset_ref );
+        small_bvh.query( nearest_within_queries, indices, offset,
+                         QueryTraversal::Packet );
+        validateResults( std::make_tuple( offset_ref, indices_ref ),
+                         std::make_tuple( offset, indices ), success, out );
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, team_traversal, DeviceType )
+{
+    using DataTransferKit::QueryTraversal;
+
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+
+    // a few queries find most of the objects while the others find a handful
+    int const n_queries = 100;
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    for ( int i = 0; i < n_queries; ++i )
+        within_points.emplace_back(
+            DataTransferKit::Point{{points[i][0], points[i][1], points[i][2]}},
+            i % 10 == 0 ? 10. : 0.5 );
+    auto const within_queries = makeWithinQueries<DeviceType>( within_points );
+    auto const nearest_queries =
+        std::get<1>( makeRandomQueries<DeviceType>( Lx, Ly, Lz, n_queries ) );
+
+    Kokkos::View<int *, DeviceType> offset_ref( "offset_ref" );
+    Kokkos::View<int *, DeviceType> indices_ref( "indices_ref" );
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+
+    // trees with no leaf, a single one, and with leaves both above and below
+    // the depth at which the traversal is split
+    for ( int n : {0, 1, 5, 1000} )
+    {
+        DataTransferKit::BVH<DeviceType> const small_bvh(
+            Kokkos::subview( bounding_boxes, std::make_pair( 0, n ) ) );
+        small_bvh.query( within_queries, indices_ref, offset_ref );
+        small_bvh.query( within_queries, indices, offset,
+                         QueryTraversal::Team );
+        validateResults( std::make_tuple( offset_ref, indices_ref ),
+                         std::make_tuple( offset, indices ), success, out );
+    }
+
+    bvh.query( nearest_queries, indices_ref, offset_ref );
+    bvh.query( nearest_queries, indices, offset, QueryTraversal::Team );
+    validateResults( std::make_tuple( offset_ref, indices_ref ),
+                     std::make_tuple( offset, indices ), success, out );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, all_nearest, DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    int const n = cloud.size();
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+
+    int const k = 10;
+    Kokkos::View<int *, DeviceType> offset( "offset" );
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    for ( bool exclude_self : {true, false} )
+    {
+        bvh.allNearest( k, indices, offset, distances, exclude_self );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        auto indices_host = Kokkos::create_mirror_view( indices );
+        Kokkos::deep_copy( indices_host, indices );
+        auto distances_host = Kokkos::create_mirror_view( distances );
+        Kokkos::deep_copy( distances_host, distances );
+        TEST_EQUALITY( offset_host.extent_int( 0 ), n + 1 );
+        TEST_EQUALITY( offset_host( n ), n * k );
+        for ( int i = 0; i < n; ++i )
+        {
+            DataTransferKit::Point const p = {
+                {cloud[i][0], cloud[i][1], cloud[i][2]}};
+            std::vector<double> distances_ref;
+            for ( int j = 0; j < n; ++j )
+                if ( j != i || !exclude_self )
+                    distances_ref.push_back(
+                        DataTransferKit::Details::distance(
+                            p, {{cloud[j][0], cloud[j][1], cloud[j][2]}} ) );
+            std::sort( distances_ref.begin(), distances_ref.end() );
+            distances_ref.resize( k );
+            std::vector<double> d( distances_host.data() + offset_host( i ),
+                                   distances_host.data() +
+                                       offset_host( i + 1 ) );
+            TEST_COMPARE_FLOATING_ARRAYS( d, distances_ref, 1e-14 );
+            // the point itself comes first when it is not excluded
+            TEST_EQUALITY( indices_host( offset_host( i ) ) == i,
+                           !exclude_self );
+        }
+    }
+
+    // fewer objects than neighbors requested
+    for ( int m : {0, 1, 2, 5} )
+    {
+        DataTransferKit::BVH<DeviceType> const small_bvh(
+            Kokkos::subview( bounding_boxes, std::make_pair( 0, m ) ) );
+        small_bvh.allNearest( k, indices, offset, distances );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        auto indices_host = Kokkos::create_mirror_view( indices );
+        Kokkos::deep_copy( indices_host, indices );
+        TEST_EQUALITY( offset_host( m ), m * std::max( m - 1, 0 ) );
+        for ( int i = 0; i < m; ++i )
+        {
+            std::vector<int> neighbors;
+            for ( int j = 0; j < m; ++j )
+                if ( j != i )
+                    neighbors.push_back( j );
+            TEST_COMPARE_ARRAYS( extractAndSort( indices_host, offset_host( i ),
+                                                 offset_host( i + 1 ) ),
+                                 neighbors );
+        }
+    }
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, large_offsets, DeviceType )
+{
+    double const Lx = 10.0;
+    double const Ly = 10.0;
+    double const Lz = 10.0;
+    auto const cloud = make_random_cloud( Lx, Ly, Lz, 1000 );
+    auto const bounding_boxes = makeBoundingBoxesOfPoints<DeviceType>( cloud );
+    DataTransferKit::BVH<DeviceType> const bvh( bounding_boxes );
+
+    int const n_queries = 100;
+    auto const points = make_random_cloud( Lx, Ly, Lz, n_queries );
+    std::vector<std::pair<DataTransferKit::Point, double>> within_points;
+    std::vector<std::pair<DataTransferKit::Point, int>> nearest_points;
+    for ( int i = 0; i < n_queries; ++i )
+    {
+        DataTransferKit::Point const p = {
+            {points[i][0], points[i][1], points[i][2]}};
+        within_points.emplace_back( p, i % 10 == 0 ? 0. : 0.03 * i );
+        nearest_points.emplace_back( p, i % 7 );
+    }
+    auto const within_queries = makeWithinQueries<DeviceType>( within_points );
+    auto const nearest_queries =
+        makeNearestQueries<DeviceType>( nearest_points );
+
+    Kokkos::View<int *, DeviceType> indices_ref( "indices_ref" );
+    Kokkos::View<int *, DeviceType> offset_ref( "offset_ref" );
+    bvh.query( within_queries, indices_ref, offset_ref );
+    auto indices_ref_host = Kokkos::create_mirror_view( indices_ref );
+    Kokkos::deep_copy( indices_ref_host, indices_ref );
+    auto offset_ref_host = Kokkos::create_mirror_view( offset_ref );
+    Kokkos::deep_copy( offset_ref_host, offset_ref );
+
+    // same results with 64-bit offsets, for all traversals
+    Kokkos::View<int *, DeviceType> indices( "indices" );
+    Kokkos::View<long long *, DeviceType> offset( "offset" );
+    for ( auto traversal : {DataTransferKit::QueryTraversal::PerQuery,
+                            DataTransferKit::QueryTraversal::Packet,
+                            DataTransferKit::QueryTraversal::Team} )
+    {
+        bvh.query( within_queries, indices, offset, traversal );
+        auto indices_host = Kokkos::create_mirror_view( indices );
+        Kokkos::deep_copy( indices_host, indices );
+        auto offset_host = Kokkos::create_mirror_view( offset );
+        Kokkos::deep_copy( offset_host, offset );
+        TEST_COMPARE_ARRAYS( offset_host, offset_ref_host );
+        TEST_COMPARE_ARRAYS( indices_host, indices_ref_host );
+    }
+    Kokkos::View<double *, DeviceType> distances( "distances" );
+    bvh.query( within_queries, indices, offset, distances, true, 3 );
+    auto offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    for ( int i = 0; i < n_queries; ++i )
+        TEST_EQUALITY( offset_host( i + 1 ) - offset_host( i ),
+                       std::min( offset_ref_host( i + 1 ) -
+                                     offset_ref_host( i ),
+                                 3 ) );
+    Kokkos::View<int *, DeviceType> nearest_offset_ref( "offset_ref" );
+    bvh.query( nearest_queries, indices_ref, nearest_offset_ref );
+    auto nearest_offset_ref_host =
+        Kokkos::create_mirror_view( nearest_offset_ref );
+    Kokkos::deep_copy( nearest_offset_ref_host, nearest_offset_ref );
+    bvh.query( nearest_queries, indices, offset, distances );
+    offset_host = Kokkos::create_mirror_view( offset );
+    Kokkos::deep_copy( offset_host, offset );
+    TEST_COMPARE_ARRAYS( offset_host, nearest_offset_ref_host );
+
+    // chunks hold consecutive queries with at most max_chunk_size results
+    // unless a query has more by itself
+    for ( std::size_t max_chunk_size : {0, 1, 50, 1000, 1000000} )
+    {
+        int n_processed_queries = 0;
+        bvh.chunkedQuery(
+            within_queries, max_chunk_size,
+            [&]( int first, Kokkos::View<int *, DeviceType> chunk_indices,
+                 Kokkos::View<int *, DeviceType> chunk_offset ) {
+                TEST_EQUALITY( first, n_processed_queries );
+                auto indices_host = Kokkos::create_mirror_view( chunk_indices );
+                Kokkos::deep_copy( indices_host, chunk_indices );
+                auto offset_host = Kokkos::create_mirror_view( chunk_offset );
+                Kokkos::deep_copy( offset_host, chunk_offset );
+                int const n = offset_host.extent_int( 0 ) - 1;
+                TEST_ASSERT( n > 0 );
+                TEST_ASSERT( n == 1 || static_cast<std::size_t>(
+                                           offset_host( n ) ) <=
+                                           max_chunk_size );
+                for ( int q = 0; q < n; ++q )
+                    TEST_COMPARE_ARRAYS(
+                        extractAndSort( indices_host, offset_host( q ),
+                                        offset_host( q + 1 ) ),
+                        extractAndSort( indices_ref_host,
+                                        offset_ref_host( first + q ),
+                                        offset_ref_host( first + q + 1 ) ) );
+                n_processed_queries += n;
+            } );
+        TEST_EQUALITY( n_processed_queries, n_queries );
+    }
+}
+
 // Include the test macros.
 #include "DataTransferKitSearch_ETIHelperMacros.h"
 
@@ -694,7 +1584,31 @@ TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( LinearBVH, rtree, DeviceType )
                                           DeviceType##NODE )                   \
     TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, structured_grid,          \
                                           DeviceType##NODE )                   \
-    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, rtree, DeviceType##NODE )
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, rtree, DeviceType##NODE ) \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, bounding_volumes,         \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, asynchronous,             \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, binned_sah,               \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, hilbert_curve,            \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT(                                      \
+        LinearBVH, approximate_nearest_neighbors, DeviceType##NODE )           \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, count_and_any,            \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, nearest_within_radius,    \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT(                                      \
+        LinearBVH, spatial_query_with_distances, DeviceType##NODE )            \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, packet_traversal,         \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, team_traversal,           \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, all_nearest,              \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( LinearBVH, large_offsets,            \
+                                          DeviceType##NODE )
 
 // Demangle the types
 DTK_ETI_MANGLING_TYPEDEFS()
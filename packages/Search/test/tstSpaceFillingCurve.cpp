@@ -0,0 +1,180 @@
+/****************************************************************************
+ * Copyright (c) 2012-2018 by the DataTransferKit authors                   *
+ * All rights reserved.                                                     *
+ *                                                                          *
+ * This file is part of the DataTransferKit library. DataTransferKit is     *
+ * distributed under a BSD 3-clause license. For the licensing terms see    *
+ * the LICENSE file in the top-level directory.                             *
+ *                                                                          *
+ * SPDX-License-Identifier: BSD-3-Clause                                    *
+ ****************************************************************************/
+
+#include <DTK_DetailsTreeConstruction.hpp>
+#include <DTK_SpaceFillingCurve.hpp>
+
+#include <Kokkos_Core.hpp>
+
+#include <Teuchos_UnitTestHarness.hpp>
+
+#include <algorithm>
+#include <cmath> // abs
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace dtk = DataTransferKit::Details;
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( SpaceFillingCurve, permutation, DeviceType )
+{
+    // points of a 8x8x8 structured grid stored in random order
+    int const n_1d = 8;
+    int const n = n_1d * n_1d * n_1d;
+    std::vector<int> order( n );
+    std::iota( order.begin(), order.end(), 0 );
+    std::shuffle( order.begin(), order.end(), std::mt19937( 0 ) );
+
+    Kokkos::View<DataTransferKit::Point *, DeviceType> points( "points", n );
+    auto points_host = Kokkos::create_mirror_view( points );
+    for ( int i = 0; i < n; ++i )
+    {
+        int const l = order[i];
+        points_host( i ) = {{(double)( l % n_1d ),
+                             (double)( ( l / n_1d ) % n_1d ),
+                             (double)( l / ( n_1d * n_1d ) )}};
+    }
+    Kokkos::deep_copy( points, points_host );
+
+    auto const permutation =
+        DataTransferKit::computeSpaceFillingCurvePermutation( points );
+    TEST_EQUALITY( permutation.extent_int( 0 ), n );
+    auto permutation_host = Kokkos::create_mirror_view( permutation );
+    Kokkos::deep_copy( permutation_host, permutation );
+
+    // every point appears exactly once
+    std::vector<int> sorted_permutation( permutation_host.data(),
+                                         permutation_host.data() + n );
+    std::sort( sorted_permutation.begin(), sorted_permutation.end() );
+    std::vector<int> iota_ref( n );
+    std::iota( iota_ref.begin(), iota_ref.end(), 0 );
+    TEST_COMPARE_ARRAYS( sorted_permutation, iota_ref );
+
+    // the Morton codes of the reordered points are non-decreasing
+    using TreeConstruction = dtk::TreeConstruction<DeviceType>;
+    double const h = 1. / ( n_1d - 1 );
+    std::vector<unsigned int> morton_codes( n );
+    for ( int i = 0; i < n; ++i )
+    {
+        auto const &p = points_host( permutation_host( i ) );
+        morton_codes[i] =
+            TreeConstruction::morton3D( p[0] * h, p[1] * h, p[2] * h );
+    }
+    TEST_ASSERT( std::is_sorted( morton_codes.begin(), morton_codes.end() ) );
+
+    // boxes around the points yield the same codes hence the same ordering
+    // up to the ties (there are none here)
+    Kokkos::View<DataTransferKit::Box *, DeviceType> boxes( "boxes", n );
+    auto boxes_host = Kokkos::create_mirror_view( boxes );
+    for ( int i = 0; i < n; ++i )
+        boxes_host( i ) = {points_host( i ), points_host( i )};
+    Kokkos::deep_copy( boxes, boxes_host );
+    auto const box_permutation =
+        DataTransferKit::computeSpaceFillingCurvePermutation( boxes );
+    auto box_permutation_host = Kokkos::create_mirror_view( box_permutation );
+    Kokkos::deep_copy( box_permutation_host, box_permutation );
+    TEST_COMPARE_ARRAYS( box_permutation_host, permutation_host );
+
+    // consecutive points along the Hilbert curve are neighbors on the grid
+    auto const hilbert_permutation =
+        DataTransferKit::computeSpaceFillingCurvePermutation(
+            points, DataTransferKit::SpaceFillingCurve::Hilbert );
+    auto hilbert_permutation_host =
+        Kokkos::create_mirror_view( hilbert_permutation );
+    Kokkos::deep_copy( hilbert_permutation_host, hilbert_permutation );
+    for ( int i = 0; i < n - 1; ++i )
+    {
+        auto const &p = points_host( hilbert_permutation_host( i ) );
+        auto const &q = points_host( hilbert_permutation_host( i + 1 ) );
+        TEST_FLOATING_EQUALITY( std::abs( p[0] - q[0] ) +
+                                    std::abs( p[1] - q[1] ) +
+                                    std::abs( p[2] - q[2] ),
+                                1., 1e-14 );
+    }
+
+    // empty and single object
+    Kokkos::View<DataTransferKit::Point *, DeviceType> empty( "empty", 0 );
+    auto const empty_permutation =
+        DataTransferKit::computeSpaceFillingCurvePermutation( empty );
+    TEST_EQUALITY( empty_permutation.extent_int( 0 ), 0 );
+    Kokkos::View<DataTransferKit::Box *, DeviceType> one( "one", 1 );
+    auto const one_permutation =
+        DataTransferKit::computeSpaceFillingCurvePermutation( one );
+    auto one_permutation_host = Kokkos::create_mirror_view( one_permutation );
+    Kokkos::deep_copy( one_permutation_host, one_permutation );
+    TEST_EQUALITY( one_permutation_host( 0 ), 0 );
+}
+
+TEUCHOS_UNIT_TEST_TEMPLATE_1_DECL( SpaceFillingCurve, apply_permutation,
+                                   DeviceType )
+{
+    int const n = 5;
+    std::vector<int> const permutation_ref = {3, 0, 4, 1, 2};
+    Kokkos::View<int *, DeviceType> permutation( "permutation", n );
+    auto permutation_host = Kokkos::create_mirror_view( permutation );
+    for ( int i = 0; i < n; ++i )
+        permutation_host( i ) = permutation_ref[i];
+    Kokkos::deep_copy( permutation, permutation_host );
+
+    // rank-1
+    Kokkos::View<double *, DeviceType> v( "v", n );
+    DataTransferKit::iota( v, 10. );
+    DataTransferKit::applyPermutation( permutation, v );
+    auto v_host = Kokkos::create_mirror_view( v );
+    Kokkos::deep_copy( v_host, v );
+    std::vector<double> v_ref = {13., 10., 14., 11., 12.};
+    TEST_COMPARE_FLOATING_ARRAYS( v_host, v_ref, 1e-14 );
+    DataTransferKit::applyInversePermutation( permutation, v );
+    Kokkos::deep_copy( v_host, v );
+    v_ref = {10., 11., 12., 13., 14.};
+    TEST_COMPARE_FLOATING_ARRAYS( v_host, v_ref, 1e-14 );
+
+    // rank-2, rows are moved as a whole
+    int const m = 3;
+    Kokkos::View<int **, DeviceType> w( "w", n, m );
+    auto w_host = Kokkos::create_mirror_view( w );
+    for ( int i = 0; i < n; ++i )
+        for ( int j = 0; j < m; ++j )
+            w_host( i, j ) = m * i + j;
+    Kokkos::deep_copy( w, w_host );
+    DataTransferKit::applyPermutation( permutation, w );
+    Kokkos::deep_copy( w_host, w );
+    for ( int i = 0; i < n; ++i )
+        for ( int j = 0; j < m; ++j )
+            TEST_EQUALITY( w_host( i, j ), m * permutation_ref[i] + j );
+    DataTransferKit::applyInversePermutation( permutation, w );
+    Kokkos::deep_copy( w_host, w );
+    for ( int i = 0; i < n; ++i )
+        for ( int j = 0; j < m; ++j )
+            TEST_EQUALITY( w_host( i, j ), m * i + j );
+
+    // extents must match
+    Kokkos::View<double *, DeviceType> u( "u", n + 1 );
+    TEST_THROW( DataTransferKit::applyPermutation( permutation, u ),
+                DataTransferKit::DataTransferKitException );
+}
+
+// Include the test macros.
+#include "DataTransferKitSearch_ETIHelperMacros.h"
+
+// Create the test group
+#define UNIT_TEST_GROUP( NODE )                                                \
+    using DeviceType##NODE = typename NODE::device_type;                       \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( SpaceFillingCurve, permutation,      \
+                                          DeviceType##NODE )                   \
+    TEUCHOS_UNIT_TEST_TEMPLATE_1_INSTANT( SpaceFillingCurve,                   \
+                                          apply_permutation, DeviceType##NODE )
+
+// Demangle the types
+DTK_ETI_MANGLING_TYPEDEFS()
+
+// Instantiate the tests
+DTK_INSTANTIATE_N( UNIT_TEST_GROUP )